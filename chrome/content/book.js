@@ -26,6 +26,10 @@ const Cu = Components.utils;
 
 Cu.import("chrome://chmsee/content/utils.js");
 Cu.import("chrome://chmsee/content/rdfUtils.js");
+Cu.import("resource://gre/modules/XPCOMUtils.jsm");
+
+const OpenCancelled = -3; // EXTRACT_CANCELLED in csChmfile.h
+const SearchLimit = 200;
 
 var Book = {
     getBookFromUrl: function(url) {
@@ -42,23 +46,32 @@ var Book = {
             } else if (uri.path === "config") {
                 book.title = "about:config";
             }
-        } else if (uri.scheme === "file") {
-            d("Book::getBookFromUrl", "path = " + uri.path);
-            d("Book::getBookFromUrl", "bookshelf = " + Prefs.bookshelf.path);
-            var bookshelf = Prefs.bookshelf.path;
-
-            if (uri.path.indexOf(bookshelf) !== -1) {
-                var pos = uri.path.substring(bookshelf.length + 1).indexOf("/");
-                book.folder = uri.path.substring(0, bookshelf.length + pos + 1);
+        } else if (uri.scheme === "file" || uri.scheme === "chmsee") {
+            var path = Book.getBookPath(url);
+            d("Book::getBookFromUrl", "path = " + path);
+
+            var chmfile = null;
+
+            if (path !== "" && !isShelfFolder(path)) { // page inside a chm archive
+                var file = Cc["@mozilla.org/file/local;1"].createInstance(Ci.nsILocalFile);
+                file.initWithPath(path);
+                book.folder = bookFolder(file);
+                chmfile = path;
+            } else {
+                book.folder = path;
+            }
 
-                if (RDF.loadBookinfo(book) === false) {
-                    d("Book::getBookFromUrl", "load book info failed, url = " + url);
+            if (book.folder !== "") {
+                var chmobj = createChmObject();
+                if (chmobj.loadNavCache(book.folder, chmfile) === false) {
+                    d("Book::getBookFromUrl", "load navigation cache failed, url = " + url);
                     return null;
                 }
 
-                if (book.hhkDS !== null) {
-                    book.hhkData = RDF.convertDSToArray(book.hhkDS);
-                }
+                loadChmInfo(book, chmobj);
+                RDF.loadBookinfo(book);
+                finishBook(book);
+                book.url = url;
             } else { // normal page
             }
         } else { // XXX HTTP?
@@ -67,75 +80,242 @@ var Book = {
         return book;
     },
 
+    /*
+     * The chm file a chmsee:// url reads from, or the bookshelf folder of
+     * the book a bookshelf url is in, "" for any other page.
+     */
+    getBookPath: function (url) {
+        var uri = Cc["@mozilla.org/network/io-service;1"].getService(Ci.nsIIOService).newURI(url, null, null);
+        if (uri.scheme !== "file" && uri.scheme !== "chmsee")
+            return "";
+
+        var path = (uri.scheme === "file") ? uri.path : url.substring(CsScheme.length);
+        var bookshelf = Prefs.bookshelf.path;
+        var sep = path.indexOf("::");
+
+        if (sep !== -1)
+            return decodeURI(path.substring(0, sep));
+
+        if (path.indexOf(bookshelf) !== -1) {
+            var pos = path.substring(bookshelf.length + 1).indexOf("/");
+            return path.substring(0, bookshelf.length + pos + 1);
+        }
+
+        return "";
+    },
+
     getBookFromFile: function(file) {
         var book = newBook();
+        book.folder = bookFolder(file);
 
-        var dirService = Cc["@mozilla.org/file/directory_service;1"].getService(Ci.nsIProperties);
-        var bookshelf = dirService.get("Home", Ci.nsIFile).path + "/.chmsee/bookshelf";
-
-        book.folder = bookshelf + "/" + md5Hash(file);
+        try {
+            var chmobj = createChmObject();
+            var mode = openMode();
 
-        if (RDF.loadBookinfo(book) === false) {
-            try {
-                var chmobj = Cc["@chmsee/cschm;1"].createInstance();
-                chmobj.QueryInterface(Ci.csIChm);
+            if (chmobj.loadNavCache(book.folder, file.path) === false || cachedMode(chmobj) !== mode) {
+                chmobj = createChmObject();
                 chmobj.openChm(file, book.folder);
 
-                book.homepage = book.folder + "/" + chmobj.homepage;
-                d("Book::getBookFromFile", "chm homepage = " + book.homepage);
+                if (mode === Ci.csIChm.OPEN_EXTRACT)
+                    chmobj.extractChm(book.folder);
+                else if (mode === Ci.csIChm.OPEN_PACK)
+                    chmobj.packChm(book.folder);
+                else if (mode === Ci.csIChm.OPEN_LAZY)
+                    chmobj.extractLazy(book.folder);
 
-                d("Book::getBookFromFile", "lcid = " + chmobj.lcid);
-                book.charset = getCharset(chmobj.lcid);
+                saveNavCache(chmobj, book.folder, mode !== Ci.csIChm.OPEN_INFO);
+            }
 
-                book.title = convertToUTF8(chmobj.bookname, book.charset);
-                d("Book::getBookFromFile", "book title = " + book.title);
+            loadChmInfo(book, chmobj);
+        } catch (e) {
+            d("Book::getBookFromFile", "Loading @chmsee/cschm component fail: " + e.name + " -> " + e.message);
+            return null;
+        }
 
-                book.type = "book";
-                if (chmobj.hhc !== null) {
-                    d("Book::getBookFromFile", "hhc = " + chmobj.hhc);
-                    book.hhc = book.folder + "/" + chmobj.hhc;
-                    book.hhcDS = RDF.getRdfDatasource("hhc", book);
-                }
+        RDF.loadBookinfo(book);
+        return finishBook(book);
+    },
 
-                if (chmobj.hhk !== null) {
-                    d("Book::getBookFromFile", "hhk = " + chmobj.hhk);
-                    book.hhk = book.folder + "/" +  chmobj.hhk;
-                    book.hhkDS = RDF.getRdfDatasource("hhk", book);
-                }
-            } catch (e) {
-                d("Book::getBookFromFile", "Loading @chmsee/cschm component fail: " + e.name + " -> " + e.message);
+    /*
+     * Like getBookFromFile, but the chm file is opened on a background
+     * thread. listener.onBook(book) is called when done, with null if the
+     * book failed to open; listener.onProgress(bytes, totalBytes) is called
+     * while extracting. Returns the csIChm object whose cancel() aborts
+     * opening without calling the listener, or null if the book was cached.
+     */
+    openBookFromFile: function(file, listener) {
+        var book = newBook();
+        book.folder = bookFolder(file);
+
+        try {
+            var chmobj = createChmObject();
+            var mode = openMode();
+
+            if (chmobj.loadNavCache(book.folder, file.path) === true && cachedMode(chmobj) === mode) {
+                loadChmInfo(book, chmobj);
+                RDF.loadBookinfo(book);
+                listener.onBook(finishBook(book));
                 return null;
             }
 
-            RDF.saveBookinfo(book);
+            chmobj = createChmObject();
+            chmobj.asyncOpenChm(file, book.folder, mode, {
+                QueryInterface: XPCOMUtils.generateQI([Ci.csIChmOpenListener]),
+
+                onProgress: function (chm, bytes, totalBytes, objects, totalObjects) {
+                    if (listener.onProgress)
+                        listener.onProgress(bytes, totalBytes);
+                },
+
+                onOpened: function (chm, status) {
+                    d("Book::openBookFromFile", "status = " + status + ", stats = " + chm.stats);
+                    if (status === OpenCancelled)
+                        return;
+
+                    if (status !== 0) {
+                        listener.onBook(null);
+                        return;
+                    }
+
+                    try {
+                        saveNavCache(chm, book.folder, mode !== Ci.csIChm.OPEN_INFO);
+                        loadChmInfo(book, chm);
+                    } catch (e) {
+                        d("Book::openBookFromFile", "Loading book info fail: " + e.name + " -> " + e.message);
+                        listener.onBook(null);
+                        return;
+                    }
+
+                    listener.onBook(finishBook(book));
+                },
+            });
+
+            return chmobj;
+        } catch (e) {
+            d("Book::openBookFromFile", "Loading @chmsee/cschm component fail: " + e.name + " -> " + e.message);
+            listener.onBook(null);
+            return null;
         }
+    },
 
-        if (book.hhkDS !== null) {
-            book.hhkData = RDF.convertDSToArray(book.hhkDS);
+    /*
+     * Open the books at paths, chm files or bookshelf folders as
+     * getBookPath gives, all at once on native threads, paths[first]
+     * first. listener.onBook(i, book) is called for each of them as soon
+     * as it is ready, with null if it failed to open.
+     */
+    openBooks: function (paths, first, listener) {
+        try {
+            var chmobj = createChmObject();
+            chmobj.openBooks(paths.length, paths, Prefs.bookshelf.path, openMode(), first, {
+                QueryInterface: XPCOMUtils.generateQI([Ci.csIChmBatchListener]),
+
+                onBookOpened: function (i, chm, folder, status) {
+                    d("Book::openBooks", "path = " + paths[i] + ", folder = " + folder + ", status = " + status);
+                    if (status !== 0) {
+                        listener.onBook(i, null);
+                        return;
+                    }
+
+                    var book = newBook();
+                    book.folder = folder;
+                    try {
+                        loadChmInfo(book, chm);
+                    } catch (e) {
+                        d("Book::openBooks", "Loading book info fail: " + e.name + " -> " + e.message);
+                        listener.onBook(i, null);
+                        return;
+                    }
+
+                    RDF.loadBookinfo(book);
+                    listener.onBook(i, finishBook(book));
+                },
+            });
+        } catch (e) {
+            d("Book::openBooks", "Loading @chmsee/cschm component fail: " + e.name + " -> " + e.message);
+            for (var i = 0; i < paths.length; i++)
+                listener.onBook(i, null);
         }
+    },
 
-        book.url = CsScheme + book.homepage;
-        return book;
+    /*
+     * Full-text search of a book. listener.onResults(sitemap) gets the
+     * matching pages, or null if the search failed. Books compiled with a
+     * search index are answered from it, for the others the first search
+     * builds an index in the background, calling
+     * listener.onProgress(docs, totalDocs) meanwhile.
+     */
+    search: function (book, text, listener) {
+        var query = convertFromUTF8(text, book.charset);
+        var results = book.chm.search(book.folder, query, SearchLimit);
+
+        if (results === null)
+            results = book.chm.searchBuiltin(query, true, SearchLimit);
+
+        if (results !== null) {
+            listener.onResults(results);
+            return;
+        }
+
+        d("Book::search", "building search index of " + book.folder);
+        book.chm.buildSearchIndex(book.folder, {
+            QueryInterface: XPCOMUtils.generateQI([Ci.csIChmSearchListener]),
+
+            onProgress: function (chm, docs, totalDocs) {
+                if (listener.onProgress)
+                    listener.onProgress(docs, totalDocs);
+            },
+
+            onIndexed: function (chm, status) {
+                d("Book::search", "index status = " + status);
+                if (status === OpenCancelled)
+                    return;
+
+                listener.onResults(status === 0 ? chm.search(book.folder, query, SearchLimit) : null);
+            },
+        });
     },
 
     saveBookInfo: function (book) {
         RDF.saveBookinfo(book);
     },
+
+    /*
+     * Trim the bookshelf to Prefs.bookshelfMaxSize in the background,
+     * least recently used books first, never touching openBooks.
+     */
+    collectBookshelf: function (openBooks) {
+        var budget = Prefs.bookshelfMaxSize;
+        if (budget <= 0)
+            return;
+
+        var keep = [];
+        for (var i = 0; i < openBooks.length; i++) {
+            if (openBooks[i].type === "book" && openBooks[i].folder)
+                keep.push(openBooks[i].folder);
+        }
+
+        try {
+            var chmobj = createChmObject();
+            chmobj.collectBookshelf(Prefs.bookshelf.path, budget * 1024 * 1024, keep.length, keep);
+        } catch (e) {
+            d("Book::collectBookshelf", e.name + ": " + e.message);
+        }
+    },
 };
 
 var EmptyBook = {
     type: "page",
     folder: "",
+    root: "",
     homepage: "",
     lastpage: "",
     url: "",
     title: "",
     zoom: 1.0,
-    hhc: null,
-    hhcDS: null,
-    hhk: null,
-    hhkDS: null,
-    hhkData: null,
+    chm: null,
+    toc: null,
+    index: null,
     charset: "ISO-8859-1",
 };
 
@@ -145,170 +325,94 @@ var newBook = function () {
     return new NewBook();
 };
 
-var convertToUTF8 = function (string, charset) {
-    d("convertToUTF8", "string = " + string + ", charset = " + charset);
+var bookFolder = function (file) {
+    var bookshelf = Prefs.bookshelf.path;
+    var chmobj = Cc["@chmsee/cschm;1"].createInstance(Ci.csIChm);
+
+    return bookshelf + "/" + chmobj.fingerprint(file, bookshelf + "/fingerprints");
+};
+
+var isShelfFolder = function (path) {
+    return path.indexOf(Prefs.bookshelf.path + "/") === 0;
+};
 
-    var UTF8Service = Cc["@mozilla.org/intl/utf8converterservice;1"].getService(Ci.nsIUTF8ConverterService);
-    return UTF8Service.convertStringToUTF8(string, charset, false);
+// Full extraction to files or a pack, lazy extraction or pages read from the archive
+var openMode = function () {
+    if (Prefs.extractBook)
+        return Prefs.packBook ? Ci.csIChm.OPEN_PACK : Ci.csIChm.OPEN_EXTRACT;
+    else if (Prefs.lazyExtract)
+        return Ci.csIChm.OPEN_LAZY;
+    else
+        return Ci.csIChm.OPEN_INFO;
 };
 
-var md5Hash = function (file) {
-    var istream = Cc["@mozilla.org/network/file-input-stream;1"].createInstance(Ci.nsIFileInputStream);
+// The mode a cached book was opened in, reopened when it is not openMode() any more
+var cachedMode = function (chmobj) {
+    if (!chmobj.extracted)
+        return Ci.csIChm.OPEN_INFO;
+    else if (chmobj.packed)
+        return Ci.csIChm.OPEN_PACK;
+    else if (chmobj.lazy)
+        return Ci.csIChm.OPEN_LAZY;
+    else
+        return Ci.csIChm.OPEN_EXTRACT;
+};
 
-    istream.init(file, 0x01, 0444, 0);
+var createChmObject = function () {
+    var chmobj = Cc["@chmsee/cschm;1"].createInstance();
+    chmobj.QueryInterface(Ci.csIChm);
+    chmobj.poolCapacity = Prefs.poolCapacity;
+    return chmobj;
+};
 
-    var ch = Cc["@mozilla.org/security/hash;1"].createInstance(Ci.nsICryptoHash);
-    ch.init(ch.MD5);
-    ch.updateFromStream(istream, 0xffffffff);
-    var hash = ch.finish(false);
+/*
+ * The nav cache only saves parsing on the next open, a book that cannot
+ * write it still opens.
+ */
+var saveNavCache = function (chmobj, folder, extracted) {
+    try {
+        chmobj.saveNavCache(folder, extracted);
+    } catch (e) {
+        d("saveNavCache", "Writing nav cache to " + folder + " fail: " + e.name + " -> " + e.message);
+    }
+};
 
-    // return the two-digit hexadecimal code for a byte
-    var toHexString = function (charCode) {
-        return ("0" + charCode.toString(16)).slice(-2);
+// Fill book with the information of an opened or cached csIChm object
+var loadChmInfo = function (book, chmobj) {
+    if (chmobj.extracted) {
+        book.root = book.folder;
+    } else { // pages are read from the archive by chmsee:// handler
+        book.root = chmobj.chmfile + "::";
     }
 
-    var s = [];
-    for (var i = 0; i < hash.length; i++)
-        s.push(toHexString(hash.charCodeAt(i)));
-    return s.join("");
+    book.homepage = book.root + "/" + chmobj.homepage;
+    d("loadChmInfo", "chm homepage = " + book.homepage);
+
+    d("loadChmInfo", "lcid = " + chmobj.lcid);
+    book.charset = chmobj.charset;
+
+    book.title = chmobj.title;
+    d("loadChmInfo", "book title = " + book.title);
+
+    book.type = "book";
+    book.chm = chmobj;
+    book.toc = chmobj.toc;
+    book.index = chmobj.index;
+    d("loadChmInfo", "toc = " + (book.toc ? book.toc.length : 0) + ", index = " + (book.index ? book.index.length : 0));
+};
+
+var finishBook = function (book) {
+    book.url = CsScheme + book.homepage;
+    return book;
 };
 
-var getCharset = function (lcid) {
-    switch(lcid) {
-    case 0x0436:
-    case 0x042d:
-    case 0x0403:
-    case 0x0406:
-    case 0x0413:
-    case 0x0813:
-    case 0x0409:
-    case 0x0809:
-    case 0x0c09:
-    case 0x1009:
-    case 0x1409:
-    case 0x1809:
-    case 0x1c09:
-    case 0x2009:
-    case 0x2409:
-    case 0x2809:
-    case 0x2c09:
-    case 0x3009:
-    case 0x3409:
-    case 0x0438:
-    case 0x040b:
-    case 0x040c:
-    case 0x080c:
-    case 0x0c0c:
-    case 0x100c:
-    case 0x140c:
-    case 0x180c:
-    case 0x0407:
-    case 0x0807:
-    case 0x0c07:
-    case 0x1007:
-    case 0x1407:
-    case 0x040f:
-    case 0x0421:
-    case 0x0410:
-    case 0x0810:
-    case 0x043e:
-    case 0x0414:
-    case 0x0814:
-    case 0x0416:
-    case 0x0816:
-    case 0x040a:
-    case 0x080a:
-    case 0x0c0a:
-    case 0x100a:
-    case 0x140a:
-    case 0x180a:
-    case 0x1c0a:
-    case 0x200a:
-    case 0x240a:
-    case 0x280a:
-    case 0x2c0a:
-    case 0x300a:
-    case 0x340a:
-    case 0x380a:
-    case 0x3c0a:
-    case 0x400a:
-    case 0x440a:
-    case 0x480a:
-    case 0x4c0a:
-    case 0x500a:
-    case 0x0441:
-    case 0x041d:
-    case 0x081d:
-        return "ISO-8859-1";
-    case 0x041c:
-    case 0x041a:
-    case 0x0405:
-    case 0x040e:
-    case 0x0418:
-    case 0x041b:
-    case 0x0424:
-    case 0x081a:
-        return "ISO-8859-2";
-    case 0x0415:
-        return "WINDOWS-1250";
-    case 0x0419:
-        return "WINDOWS-1251";
-    case 0x0c01:
-        return "WINDOWS-1256";
-    case 0x0401:
-    case 0x0801:
-    case 0x1001:
-    case 0x1401:
-    case 0x1801:
-    case 0x1c01:
-    case 0x2001:
-    case 0x2401:
-    case 0x2801:
-    case 0x2c01:
-    case 0x3001:
-    case 0x3401:
-    case 0x3801:
-    case 0x3c01:
-    case 0x4001:
-    case 0x0429:
-    case 0x0420:
-        return "ISO-8859-6";
-    case 0x0408:
-        return "ISO-8859-7";
-    case 0x040d:
-        return "ISO-8859-8";
-    case 0x042c:
-    case 0x041f:
-    case 0x0443:
-        return "ISO-8859-9";
-    case 0x041e:
-        return "ISO-8859-11";
-    case 0x0425:
-    case 0x0426:
-    case 0x0427:
-        return "ISO-8859-13";
-    case 0x0411:
-        return "cp932";
-    case 0x0804:
-    case 0x1004:
-        return "gbk";
-    case 0x0412:
-        return "cp949";
-    case 0x0404:
-    case 0x0c04:
-    case 0x1404:
-        return "cp950";
-    case 0x082c:
-    case 0x0423:
-    case 0x0402:
-    case 0x043f:
-    case 0x042f:
-    case 0x0c1a:
-    case 0x0444:
-    case 0x0422:
-    case 0x0843:
-        return "cp1251";
-    default:
-        return "UTF-8";
+var convertFromUTF8 = function (string, charset) {
+    try {
+        var converter = Cc["@mozilla.org/intl/scriptableunicodeconverter"].createInstance(Ci.nsIScriptableUnicodeConverter);
+        converter.charset = charset;
+        return converter.ConvertFromUnicode(string) + converter.Finish();
+    } catch (e) {
+        d("convertFromUTF8", "cannot convert " + string + " to " + charset);
+        return string;
     }
 };
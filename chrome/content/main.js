@@ -26,6 +26,7 @@ Cu.import("chrome://chmsee/content/utils.js");
 Cu.import("chrome://chmsee/content/book.js");
 
 var contentTabbox = null;
+var openingChm = null;
 
 /*** Event handlers ***/
 
@@ -72,6 +73,7 @@ var onQuit = function (aForceQuit)  {
 
     var quitSeverity = aForceQuit ? Ci.nsIAppStartup.eForceQuit : Ci.nsIAppStartup.eAttemptQuit;
 
+    cancelOpening();
     saveCurrentTabs();
     appStartup.quit(quitSeverity);
 };
@@ -89,6 +91,15 @@ var onTocSelected = function (event) {
     var url = CsScheme + cellText;
     d("onTocSelected", "index = " + tree.view.selection.currentIndex + ", url = " + url);
     browser.setAttribute("src", url);
+
+    // warm the topics around it for goNext and goPrevious, search results
+    // are not in toc order
+    var panel = contentTabbox.selectedPanel;
+    var book = panel.book;
+    if (panel.treebox.toc && tree === panel.treebox.toc.tree && book.chm && Prefs.prefetchPages > 0)
+        book.chm.prefetch(book.chm.extracted ? book.folder : null,
+                          tree.view.QueryInterface(Ci.csIChmTreeView).getEntry(tree.currentIndex),
+                          Prefs.prefetchPages);
 };
 
 var onTabSelect = function () {
@@ -104,10 +115,41 @@ var onInputFilter = function (event) {
     var tree = currentPanel.treebox.index.tree;
 
     var filterText = event.target.value;
-    rebuildIndexTree(tree, book.hhkData, filterText);
+    rebuildIndexTree(tree, book, filterText);
     d("onInputFilter", "filter text = " + filterText);
 };
 
+var onSearch = function (event) {
+    var currentPanel = contentTabbox.selectedPanel;
+    var book = currentPanel.book;
+    var tree = currentPanel.treebox.search.tree;
+    var text = event.target.value;
+    var progress = document.getElementById("open-progress");
+
+    d("onSearch", "text = " + text);
+    if (text === "")
+        return;
+
+    Book.search(book, text, {
+        onProgress: function (docs, totalDocs) {
+            progress.hidden = false;
+            progress.value = totalDocs > 0 ? Math.round(docs * 100 / totalDocs) : 0;
+        },
+
+        onResults: function (results) {
+            progress.hidden = true;
+
+            if (results === null) {
+                notice(window, "Cannot search this book.");
+                return;
+            }
+
+            tree.view = results.createTreeView(book.root);
+            tree.browser = currentPanel.browser;
+        },
+    });
+};
+
 /*** Commands ***/
 
 var onPrint = function () {
@@ -139,15 +181,39 @@ var openFile = function () {
     if (res == Ci.nsIFilePicker.returnOK) {
         Prefs.lastDir = fp.file.parent;
 
-        var book = Book.getBookFromFile(fp.file);
-        if (book == null) {
-            notice(window, "Open book failed!\nYou may need to rebuild the chmsee XPCOM component.");
-            return;
-        }
-        var newTab = createBookTab(book);
+        cancelOpening();
 
-        replaceTab(newTab, getCurrentTab());
-        refreshBookTab(newTab);
+        var progress = document.getElementById("open-progress");
+
+        openingChm = Book.openBookFromFile(fp.file, {
+            onProgress: function (bytes, totalBytes) {
+                progress.hidden = false;
+                progress.value = totalBytes > 0 ? Math.round(bytes * 100 / totalBytes) : 0;
+            },
+
+            onBook: function (book) {
+                openingChm = null;
+                progress.hidden = true;
+
+                if (book == null) {
+                    notice(window, "Open book failed!\nYou may need to rebuild the chmsee XPCOM component.");
+                    return;
+                }
+                var newTab = createBookTab(book);
+
+                replaceTab(newTab, getCurrentTab());
+                refreshBookTab(newTab);
+                collectBookshelf();
+            },
+        });
+    }
+};
+
+var cancelOpening = function () {
+    if (openingChm) {
+        openingChm.cancel();
+        openingChm = null;
+        document.getElementById("open-progress").hidden = true;
     }
 };
 
@@ -348,7 +414,8 @@ var aboutConfig = function () {
 /*** Other functions ***/
 
 var openCmdLineFiles = function(cmdLine) {
-    var count = 0;
+    var paths = [];
+    var tabs = [];
 
     for (var i = 0; i < cmdLine.length; i += 1) {
         var argu = cmdLine.getArgument(i);
@@ -356,44 +423,88 @@ var openCmdLineFiles = function(cmdLine) {
         try {
             var file = cmdLine.resolveFile(argu);
             d("openCmdLineFiles", "resolved file = " + file.path);
-            var book = Book.getBookFromFile(file);
-
-            if (book) {
-                newTab = createBookTab(book);
-                appendTab(newTab);
-                refreshBookTab(newTab);
-                count++;
-            }
+            paths.push(file.path);
+            tabs.push(appendPendingTab());
         } catch (e) {
             d("openCmdLineFiles", "Cannot open specified file " + argu + ", " + e.message);
         }
     }
 
-    if (count == 0)
-        appendTab(createPageTab(Book.getBookFromUrl("about:mozilla")));
+    openBookTabs(paths, tabs, null);
 };
 
 var loadSavedTabs = function () {
     try {
         var data = LastUrls.read();
         var urls = JSON.parse(data);
-        var book = null;
-        var newTab = null;
+        var paths = [];
+        var tabs = [];
+        var bookUrls = [];
 
         for (var i = 0; i < urls.length; i += 1) {
-            book = Book.getBookFromUrl(urls[i]);
-            if (book.type === "book") {
-                newTab = createBookTab(book);
-                appendTab(newTab);
-                refreshBookTab(newTab);
+            var path = Book.getBookPath(urls[i]);
+            if (path !== "") {
+                paths.push(path);
+                tabs.push(appendPendingTab());
+                bookUrls.push(urls[i]);
             } else {
-                appendTab(createPageTab(book));
+                appendTab(createPageTab(Book.getBookFromUrl(urls[i])));
             }
         }
+
+        openBookTabs(paths, tabs, bookUrls);
     } catch (e) {
         d("loadSavedTabs", e.name + ": " + e.message);
         appendTab(createPageTab(Book.getBookFromUrl("about:mozilla")));
+        collectBookshelf();
+    }
+};
+
+// Empty tab holding the place of a book being opened
+var appendPendingTab = function () {
+    var tab = createPageTab(Book.getBookFromUrl("about:blank"));
+    appendTab(tab);
+    return tab;
+};
+
+/*
+ * Open the books at paths all at once, each replacing its pending tab in
+ * tabs as soon as it is ready, so that tabs keep their order. The first
+ * one is opened first, initTabbox selects it. urls are the pages to show,
+ * null for the homepages. Failed books lose their tab.
+ */
+var openBookTabs = function (paths, tabs, urls) {
+    var remaining = paths.length;
+
+    var done = function () {
+        if (contentTabbox.tabs.itemCount === 0)
+            appendTab(createPageTab(Book.getBookFromUrl("about:mozilla")));
+        collectBookshelf();
+    };
+
+    if (remaining === 0) {
+        done();
+        return;
     }
+
+    Book.openBooks(paths, 0, {
+        onBook: function (i, book) {
+            if (book === null) {
+                d("openBookTabs", "Cannot open " + paths[i]);
+                removeTab(tabs[i]);
+            } else {
+                if (urls)
+                    book.url = urls[i];
+                var newTab = createBookTab(book);
+                replaceTab(newTab, tabs[i]);
+                refreshBookTab(newTab);
+            }
+
+            remaining--;
+            if (remaining === 0)
+                done();
+        },
+    });
 };
 
 var saveCurrentTabs = function () {
@@ -427,10 +538,22 @@ var initTabbox = function () {
         loadSavedTabs();
     } else {
         appendTab(createPageTab(Book.getBookFromUrl("about:mozilla")));
+        collectBookshelf();
     }
     contentTabbox.selectedIndex = 0;
 };
 
+// Evict unused books from the bookshelf, keeping those open in tabs
+var collectBookshelf = function () {
+    var panels = contentTabbox.tabpanels;
+    var books = [];
+
+    for (var i = 0; i < panels.childNodes.length; i++)
+        books.push(panels.childNodes[i].book);
+
+    Book.collectBookshelf(books);
+};
+
 var setCommandStatus = function(type) {
     if (type === "page") {
         document.getElementById("panel-btn").setAttribute("hidden", "true");
@@ -493,20 +616,27 @@ var createBookTab = function (book) {
     treePanels.setAttribute("flex", "1");
     treeTabbox.appendChild(treePanels);
 
-    if (book.hhcDS !== null) {
+    if (book.toc !== null) {
         var toc = createTreeTab("toc");
         treeTabs.appendChild(toc.tab);
         treePanels.appendChild(toc.panel);
         treeTabbox.toc = toc.treeBox;
     }
 
-    if (book.hhkDS !== null) {
+    if (book.index !== null) {
         var index = createTreeTab("index");
         treeTabs.appendChild(index.tab);
         treePanels.appendChild(index.panel);
         treeTabbox.index = index.treeBox;
     }
 
+    if (book.chm !== null) {
+        var search = createTreeTab("search");
+        treeTabs.appendChild(search.tab);
+        treePanels.appendChild(search.panel);
+        treeTabbox.search = search.treeBox;
+    }
+
     bookContentBox.appendChild(treeTabbox);
 
     var splitter = document.createElement("splitter");
@@ -536,6 +666,9 @@ var createTreeTab = function (type) {
     if (type === "index") {
         title = "index";
         boxClass = "index-treebox";
+    } else if (type === "search") {
+        title = "search";
+        boxClass = "search-treebox";
     }
 
     var tab = document.createElement("tab");
@@ -603,14 +736,13 @@ var refreshBookTab = function (tab) {
     if (treebox.index)
         var indexTree = treebox.index.tree;
 
-    if (book.hhcDS !== null && tocTree) {
-        tocTree.database.AddDataSource(book.hhcDS);
-        tocTree.builder.rebuild();
+    if (book.toc !== null && tocTree) {
+        tocTree.view = book.toc.createTreeView(book.root);
         tocTree.browser = panel.browser;
     }
 
-    if (book.hhkDS !== null && indexTree) {
-        rebuildIndexTree(indexTree, book.hhkData, "");
+    if (book.index !== null && indexTree) {
+        rebuildIndexTree(indexTree, book, "");
         indexTree.browser = panel.browser;
     }
 
@@ -636,38 +768,49 @@ var refreshBookTab = function (tab) {
 
 };
 
-var rebuildIndexTree = function (tree, data, filterText) {
-    var table = null;
-
-    if (filterText === "") {
-        table = data;
-    } else {
-        table = [];
-
-        for (var i = 0; i < data.length; i++) {
-            if ((data[i].name.toLowerCase()).indexOf(filterText) !== -1)
-                table.push({name:data[i].name, local:data[i].local});
-        }
-    }
-
-    table.sort(function (a, b) { return a.name > b.name; });
-    tree.view = new TreeView(table);
+var rebuildIndexTree = function (tree, book, filterText) {
+    tree.view = new IndexTreeView(book.index, book.root, filterText);
 };
 
-var TreeView = function (table) {
-    this.rowCount = table.length;
+/*
+ * Tree view over the entries of an index whose name contains text. Rows
+ * are fetched from csIChmSitemap.filter a window at a time, so only the
+ * visible part of a large index is ever copied.
+ */
+var IndexTreeView = function (sitemap, root, text) {
+    const windowSize = 256;
+    var windowStart = -1;
+    var rows = [];
+
+    var fetch = function (row) {
+        var total = {}, count = {};
+        var start = row - row % windowSize;
+        var entries = sitemap.filter(text, start, windowSize, total, count);
+
+        rows = [];
+        for (var i = 0; i < entries.length; i++)
+            rows.push({name: sitemap.getName(entries[i]), local: root + "/" + sitemap.getLocal(entries[i])});
+
+        windowStart = start;
+        return total.value;
+    };
+
+    this.rowCount = fetch(0);
     this.getCellText = function(row, col) {
+        if (row < windowStart || row >= windowStart + windowSize)
+            fetch(row);
+
         if (col.index === 0)
-            return table[row].name;
+            return rows[row - windowStart].name;
         else
-            return table[row].local;
+            return rows[row - windowStart].local;
     };
     this.setTree = function(treebox) {
         this.treebox = treebox;
     };
     this.isContainer = function(row){ return false; };
     this.isSeparator = function(row){ return false; };
-    this.isSorted = function(){ return false; };
+    this.isSorted = function(){ return true; };
     this.getLevel = function(row){ return 0; };
     this.getImageSrc = function(row,col){ return null; };
     this.getRowProperties = function(row,props){};
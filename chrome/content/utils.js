@@ -24,7 +24,7 @@ const Ci = Components.interfaces;
 const Cr = Components.results;
 const Cu = Components.utils;
 
-const CsScheme = "file://";
+const CsScheme = "chmsee://";
 
 /*** Read/Save preference ***/
 
@@ -70,6 +70,50 @@ var Prefs = {
     set bookshelf(dir) {
         application.prefs.setValue("chmsee.bookshelf.dir", dir.path);
     },
+
+    get extractBook() {
+        if (application.prefs.has("chmsee.bookshelf.extract"))
+            return application.prefs.get("chmsee.bookshelf.extract").value;
+        else
+            return false;
+    },
+
+    get packBook() {
+        if (application.prefs.has("chmsee.bookshelf.pack"))
+            return application.prefs.get("chmsee.bookshelf.pack").value;
+        else
+            return false;
+    },
+
+    get lazyExtract() {
+        if (application.prefs.has("chmsee.bookshelf.lazy"))
+            return application.prefs.get("chmsee.bookshelf.lazy").value;
+        else
+            return false;
+    },
+
+    // megabytes, 0 for no limit
+    get bookshelfMaxSize() {
+        if (application.prefs.has("chmsee.bookshelf.maxsize"))
+            return application.prefs.get("chmsee.bookshelf.maxsize").value;
+        else
+            return 0;
+    },
+
+    // toc entries read ahead on each side of the selected one, 0 for none
+    get prefetchPages() {
+        if (application.prefs.has("chmsee.prefetch.pages"))
+            return application.prefs.get("chmsee.prefetch.pages").value;
+        else
+            return 3;
+    },
+
+    get poolCapacity() {
+        if (application.prefs.has("chmsee.pool.capacity"))
+            return application.prefs.get("chmsee.pool.capacity").value;
+        else
+            return 16;
+    },
 };
 
 var LastUrls = {
@@ -31,6 +31,7 @@ const nsIChannel            = Ci.nsIChannel;
 const nsIContentPolicy      = Ci.nsIContentPolicy;
 
 const SCHEME = "chmsee";
+const NavCacheFile = "chmsee_nav.bin"; // NAV_CACHE_FILE in csChmnav.h
 const PROTOCOL_CID = Components.ID("e75fd986-51d4-11e0-938b-00241d8cf371");
 
 Cu.import("chrome://chmsee/content/utils.js");
@@ -52,12 +53,16 @@ ChmseeProtocolHandler.prototype = {
     },
 
     newURI: function(aSpec, aCharset, aBaseURI) {
-        d("newURI", "aSpec = " + aSpec + ", aCharset = " + aCharset + ", aBaseURI = " + aBaseURI.spec);
+        d("newURI", "aSpec = " + aSpec + ", aCharset = " + aCharset + ", aBaseURI = " + (aBaseURI ? aBaseURI.spec : null));
 
         var uri = Cc["@mozilla.org/network/simple-uri;1"].createInstance(nsIURI);
 
         if (aSpec.indexOf("chmsee://") == 0) {
             uri.spec = aSpec;
+        } else if (aSpec.charAt(0) == "/" && aBaseURI.spec.indexOf("::") !== -1) {
+            // absolute path inside the chm archive
+            var base = aBaseURI.spec;
+            uri.spec = base.substring(0, base.indexOf("::") + 2) + aSpec;
         } else {
             var base = aBaseURI.spec;
             var pos = base.lastIndexOf("/");
@@ -75,15 +80,173 @@ ChmseeProtocolHandler.prototype = {
     newChannel: function(aURI) {
         d("newChannel", "aURI.spec = " + aURI.spec);
 
-        var filepath = "file://" + aURI.spec.substring(9);
-        d("newChannel", "filepath = " + filepath);
+        var spec = aURI.spec.substring(9);
+        var sep = spec.indexOf("::");
+
+        if (sep === -1) { // page extracted to bookshelf
+            var path = decodeURI(spec.replace(/[?#].*$/, ""));
+            var shelfBook = getShelfBook(path);
+
+            if (shelfBook && shelfBook.chm.packed) {
+                try {
+                    var packStream = Cc["@chmsee/cschminputstream;1"].createInstance(Ci.csIChmInputStream);
+                    packStream.initPack(shelfBook.folder, shelfBook.path);
+                    return newStreamChannel(aURI, packStream, shelfBook.path);
+                } catch (e) {
+                    d("newChannel", "pack of " + shelfBook.folder + " fail: " + e.name + " -> " + e.message);
+                    delete shelfBooks[shelfBook.folder];
+                }
+            }
+
+            // a lazy object not extracted yet is read from the archive, and extracted for the next time
+            if (shelfBook && shelfBook.chm.lazy) {
+                try {
+                    if (!shelfBook.chm.hasObject(shelfBook.folder, shelfBook.path)) {
+                        fetchObject(shelfBook);
+
+                        var chmFile = Cc["@mozilla.org/file/local;1"].createInstance(Ci.nsILocalFile);
+                        chmFile.initWithPath(shelfBook.chm.chmfile);
+
+                        var lazyStream = Cc["@chmsee/cschminputstream;1"].createInstance(Ci.csIChmInputStream);
+                        lazyStream.init(chmFile, shelfBook.path);
+                        return newStreamChannel(aURI, lazyStream, shelfBook.path);
+                    }
+                } catch (e) {
+                    d("newChannel", "lazy object " + shelfBook.path + " fail: " + e.name + " -> " + e.message);
+                    delete shelfBooks[shelfBook.folder];
+                }
+            }
+
+            var filepath = "file://" + spec;
+            d("newChannel", "filepath = " + filepath);
+
+            var iOService = Cc["@mozilla.org/network/io-service;1"].getService(nsIIOService);
+            return iOService.newChannel(filepath, null, null);
+        }
 
-        var iOService = Cc["@mozilla.org/network/io-service;1"].getService(nsIIOService);
-        var channel = iOService.newChannel(filepath, null, null);
-        return channel;
+        // chmsee:///path/to/book.chm::/path/in/archive
+        var chmpath = decodeURI(spec.substring(0, sep));
+        var objpath = decodeURI(spec.substring(sep + 2).replace(/[?#].*$/, ""));
+        d("newChannel", "chmpath = " + chmpath + ", objpath = " + objpath);
+
+        var file = Cc["@mozilla.org/file/local;1"].createInstance(Ci.nsILocalFile);
+        file.initWithPath(chmpath);
+
+        var stream = Cc["@chmsee/cschminputstream;1"].createInstance(Ci.csIChmInputStream);
+        stream.init(file, objpath);
+
+        return newStreamChannel(aURI, stream, objpath);
     },
 };
 
+// Channel reading a csIChmInputStream, typed after the object name
+var newStreamChannel = function (aURI, stream, objpath) {
+    var channel = Cc["@mozilla.org/network/input-stream-channel;1"].createInstance(Ci.nsIInputStreamChannel);
+    channel.setURI(aURI);
+    channel.contentStream = stream;
+    channel.QueryInterface(nsIChannel);
+
+    var contentType = getContentType(objpath);
+    if (contentType)
+        channel.contentType = contentType;
+
+    return channel;
+};
+
+/*
+ * {chm, modified} of the books of the bookshelf folders by folder, with
+ * the time their nav cache was written.  A book is loaded again when
+ * that changes, after it was opened in another mode or was collected.
+ */
+var shelfBooks = {};
+
+// Objects of lazily extracted books being extracted, by folder and path
+var fetching = {};
+
+/*
+ * The book a bookshelf path belongs to if it is lazily extracted or
+ * packed, as {chm, folder, path} with path inside the book, else null.
+ */
+var getShelfBook = function (path) {
+    var bookshelf = Prefs.bookshelf.path;
+    if (path.indexOf(bookshelf + "/") !== 0)
+        return null;
+
+    var rest = path.substring(bookshelf.length + 1);
+    var pos = rest.indexOf("/");
+    if (pos === -1)
+        return null;
+
+    var folder = bookshelf + "/" + rest.substring(0, pos);
+    var navFile = Cc["@mozilla.org/file/local;1"].createInstance(Ci.nsILocalFile);
+    navFile.initWithPath(folder + "/" + NavCacheFile);
+
+    if (!navFile.exists()) {
+        delete shelfBooks[folder];
+        return null;
+    }
+
+    var modified = navFile.lastModifiedTime;
+    if (!(folder in shelfBooks) || shelfBooks[folder].modified !== modified) {
+        var chmobj = Cc["@chmsee/cschm;1"].createInstance(Ci.csIChm);
+
+        delete shelfBooks[folder];
+        if (!chmobj.loadNavCache(folder, null))
+            return null;
+
+        shelfBooks[folder] = {chm: chmobj, modified: modified};
+    }
+
+    var chm = shelfBooks[folder].chm;
+    if (!chm.lazy && !chm.packed)
+        return null;
+
+    return {chm: chm, folder: folder, path: rest.substring(pos)};
+};
+
+// Extract an object of a lazily extracted book on a background thread
+var fetchObject = function (shelfBook) {
+    var key = shelfBook.folder + shelfBook.path;
+    if (key in fetching)
+        return;
+
+    var dropBook = function (chm) {
+        if (shelfBooks[shelfBook.folder] && shelfBooks[shelfBook.folder].chm === chm)
+            delete shelfBooks[shelfBook.folder];
+    };
+
+    fetching[key] = true;
+    try {
+        shelfBook.chm.asyncFetchObject(shelfBook.folder, shelfBook.path, {
+            QueryInterface: XPCOMUtils.generateQI([Ci.csIChmFetchListener]),
+
+            onFetched: function (chm, path, found) {
+                d("fetchObject", "lazy object = " + path + ", found = " + found);
+                delete fetching[key];
+                if (!found)
+                    dropBook(chm);
+            },
+        });
+    } catch (e) {
+        d("fetchObject", "lazy object " + shelfBook.path + " fail: " + e.name + " -> " + e.message);
+        delete fetching[key];
+        dropBook(shelfBook.chm);
+    }
+};
+
+var getContentType = function (path) {
+    var pos = path.lastIndexOf(".");
+    if (pos === -1)
+        return null;
+
+    try {
+        var mimeService = Cc["@mozilla.org/mime;1"].getService(Ci.nsIMIMEService);
+        return mimeService.getTypeFromExtension(path.substring(pos + 1));
+    } catch (e) { // let the content sniffer decide
+        return null;
+    }
+};
+
 var ChmseeProtocolHandlerFactory = function (scheme) {
     this.scheme = scheme;
 };
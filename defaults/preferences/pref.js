@@ -27,3 +27,12 @@ pref("extensions.getMoreThemesURL", "chrome://mozapps/locale/extensions/extensio
 
 /* chmsee preference */
 pref("chmsee.open.lasturls", true);
+pref("chmsee.bookshelf.extract", false);
+/* extracted books go to one compressed file instead of a tree of files */
+pref("chmsee.bookshelf.pack", false);
+pref("chmsee.bookshelf.lazy", false);
+/* megabytes the bookshelf may take, least recently used books go first, 0 for no limit */
+pref("chmsee.bookshelf.maxsize", 2048);
+pref("chmsee.pool.capacity", 16);
+/* toc entries read ahead on each side of the selected one, 0 for none */
+pref("chmsee.prefetch.pages", 3);
@@ -0,0 +1,340 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Benchmark of the native CHM layer on one book.
+ *
+ *   bench/chm-bench [-n runs] [-r reads] book.chm workdir
+ *
+ * Prints a JSON object with
+ *
+ *   fileinfo   open, chm_fileinfo and close, p50 and p99 over 10 * runs
+ *   sitemaps   best parse time and entry count of the hhc and hhk
+ *   retrieve   reads random objects whole through the pooled handle as
+ *              csChmInputStream does, p50 and p99 over reads
+ *   extract    extract_chm to workdir/extract, best and median of runs
+ *
+ * and the peak resident size after each of them, then the counters of
+ * csChmstats.c, so that runs before and after a change can be compared.  Drop the page cache first for cold
+ * numbers.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ftw.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include <chm_lib.h>
+
+#include "csChmfile.h"
+#include "csChmarena.h"
+#include "csChmpool.h"
+#include "csChmaccess.h"
+#include "csChmparser.h"
+#include "csChmstats.h"
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static long peak_rss_kb(void)
+{
+        struct rusage usage;
+
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+}
+
+static int _compare_double(const void *a, const void *b)
+{
+        double x = *(const double *)a, y = *(const double *)b;
+
+        return x < y ? -1 : x > y;
+}
+
+/* q-th quantile of the n samples, sorted in place */
+static double quantile(double *samples, int n, double q)
+{
+        if (n == 0)
+                return 0;
+
+        qsort(samples, n, sizeof(double), _compare_double);
+        return samples[(int)(q * (n - 1) + 0.5)];
+}
+
+static void print_string(const char *s)
+{
+        putchar('"');
+        for (; s && *s; s++) {
+                if (*s == '"' || *s == '\\')
+                        printf("\\%c", *s);
+                else if ((unsigned char)*s < 0x20)
+                        printf("\\u%04x", *s);
+                else
+                        putchar(*s);
+        }
+        putchar('"');
+}
+
+static int _remove_callback(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+        return remove(path);
+}
+
+static void remove_tree(const char *path)
+{
+        nftw(path, _remove_callback, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+struct object_list
+{
+        struct chmUnitInfo *units;
+        int count;
+        int capacity;
+        unsigned long long bytes;
+};
+
+static int _list_callback(struct chmFile *h, struct chmUnitInfo *ui, void *context)
+{
+        struct object_list *list = (struct object_list *)context;
+        size_t len = strlen(ui->path);
+
+        if (ui->path[0] != '/' || ui->path[len - 1] == '/' || ui->length == 0)
+                return CHM_ENUMERATOR_CONTINUE;
+
+        if (list->count == list->capacity) {
+                list->capacity = list->capacity ? list->capacity * 2 : 1024;
+                list->units = (struct chmUnitInfo *)realloc(list->units, list->capacity * sizeof(struct chmUnitInfo));
+        }
+        list->units[list->count++] = *ui;
+        list->bytes += ui->length;
+
+        return CHM_ENUMERATOR_CONTINUE;
+}
+
+static void bench_fileinfo(const char *filename, int runs, struct fileinfo *result)
+{
+        double *samples = (double *)malloc(runs * sizeof(double));
+        int i;
+
+        for (i = 0; i < runs; i++) {
+                struct fileinfo info;
+                double t = now();
+
+                memset(&info, 0, sizeof(info));
+                info.lcid = 0x0409;
+                info.chmfile = chm_open(filename);
+                if (info.chmfile) {
+                        chm_fileinfo(&info);
+                        chm_close(info.chmfile);
+                }
+                samples[i] = (now() - t) * 1000;
+
+                if (i == 0)
+                        *result = info;
+                else
+                        chm_arena_free(info.arena);
+        }
+
+        printf("  \"fileinfo\": {\"runs\": %d, \"p50_ms\": %.4f, \"p99_ms\": %.4f, \"rss_kb\": %ld},\n",
+               runs, quantile(samples, runs, 0.5), quantile(samples, runs, 0.99), peak_rss_kb());
+
+        free(samples);
+}
+
+static void bench_sitemap(struct chmFile *h, const char *key, const char *path, int runs)
+{
+        double best = 0;
+        u_int32_t entries = 0;
+        int i;
+
+        for (i = 0; path && i < runs; i++) {
+                double t = now();
+                struct sitemap *map = sitemap_parse_object(h, path);
+
+                t = now() - t;
+                if (!map)
+                        break;
+                if (i == 0 || t < best)
+                        best = t;
+                entries = map->count;
+                sitemap_free(map);
+        }
+
+        printf("\"%s\": {\"entries\": %u, \"best_ms\": %.3f}", key, entries, best * 1000);
+}
+
+static void bench_retrieve(const char *filename, struct object_list *list, int reads)
+{
+        struct chmFile *h = chm_pool_open(filename);
+        struct chm_access *access = h ? chm_pool_access(h) : NULL;
+        double *samples = (double *)malloc(reads * sizeof(double));
+        unsigned long long bytes = 0;
+        unsigned char *buf = (unsigned char *)malloc(1 << 16);
+        unsigned int seed = 1;
+        int i, n = 0;
+
+        for (i = 0; h && list->count && i < reads; i++) {
+                struct chmUnitInfo ui;
+                LONGUINT64 offset = 0;
+                LONGINT64 len;
+                double t;
+
+                seed = seed * 1103515245 + 12345;
+
+                /* by name, as a page load does */
+                t = now();
+                if (chm_resolve_object(h, list->units[(seed >> 8) % list->count].path, &ui) != CHM_RESOLVE_SUCCESS)
+                        continue;
+                while (offset < ui.length) {
+                        if (access)
+                                len = chm_access_read(access, &ui, buf, offset, 1 << 16);
+                        else
+                                len = chm_retrieve_object(h, &ui, buf, offset, 1 << 16);
+                        if (len <= 0)
+                                break;
+                        offset += len;
+                }
+                samples[n++] = (now() - t) * 1000000;
+                bytes += offset;
+        }
+
+        printf("  \"retrieve\": {\"reads\": %d, \"bytes\": %llu, \"p50_us\": %.2f, \"p99_us\": %.2f, \"rss_kb\": %ld},\n",
+               n, bytes, quantile(samples, n, 0.5), quantile(samples, n, 0.99), peak_rss_kb());
+
+        if (h)
+                chm_pool_close(h);
+        free(samples);
+        free(buf);
+}
+
+static void bench_extract(const char *filename, const char *folder, int runs)
+{
+        struct extract_stats stats, best_stats;
+        double *samples = (double *)malloc(runs * sizeof(double));
+        double best = 0;
+        int i, failed = 0;
+
+        memset(&best_stats, 0, sizeof(best_stats));
+
+        for (i = 0; i < runs; i++) {
+                double t;
+
+                remove_tree(folder);
+                mkdir(folder, 0777);
+
+                memset(&stats, 0, sizeof(stats));
+                t = now();
+                if (extract_chm(filename, folder, NULL, &stats) != 0)
+                        failed++;
+                samples[i] = now() - t;
+
+                if (i == 0 || samples[i] < best) {
+                        best = samples[i];
+                        best_stats = stats;
+                }
+        }
+
+        remove_tree(folder);
+
+        printf("  \"extract\": {\"runs\": %d, \"failed\": %d, \"threads\": %d, \"objects\": %lu, \"bytes\": %llu,\n"
+               "              \"best_s\": %.4f, \"median_s\": %.4f, \"mb_per_s\": %.1f, \"objects_per_s\": %.0f,\n"
+               "              \"enumerate_s\": %.4f, \"mkdir_s\": %.4f, \"write_s\": %.4f, \"rss_kb\": %ld},\n",
+               runs, failed, best_stats.threads, best_stats.objects, best_stats.bytes,
+               best, quantile(samples, runs, 0.5),
+               best > 0 ? best_stats.bytes / best / (1 << 20) : 0.0,
+               best > 0 ? best_stats.objects / best : 0.0,
+               best_stats.enumerate_time, best_stats.mkdir_time, best_stats.extract_time,
+               peak_rss_kb());
+
+        free(samples);
+}
+
+int main(int argc, char **argv)
+{
+        struct object_list list;
+        struct fileinfo info;
+        struct chmFile *h;
+        struct stat st;
+        char folder[4096], *counters;
+        int runs = 5, reads = 10000, arg = 1;
+
+        while (arg + 1 < argc && argv[arg][0] == '-') {
+                if (strcmp(argv[arg], "-n") == 0)
+                        runs = atoi(argv[arg + 1]);
+                else if (strcmp(argv[arg], "-r") == 0)
+                        reads = atoi(argv[arg + 1]);
+                else
+                        break;
+                arg += 2;
+        }
+
+        if (arg + 2 != argc || runs < 1 || reads < 1) {
+                fprintf(stderr, "usage: %s [-n runs] [-r reads] book.chm workdir\n", argv[0]);
+                return 1;
+        }
+
+        if (stat(argv[arg], &st) == -1 || (h = chm_open(argv[arg])) == NULL) {
+                fprintf(stderr, "cannot open %s\n", argv[arg]);
+                return 1;
+        }
+
+        memset(&info, 0, sizeof(info));
+        memset(&list, 0, sizeof(list));
+        chm_enumerate(h, CHM_ENUMERATE_NORMAL | CHM_ENUMERATE_FILES, _list_callback, &list);
+
+        mkdir(argv[arg + 1], 0777);
+        snprintf(folder, sizeof(folder), "%s/extract", argv[arg + 1]);
+
+        printf("{\n  \"book\": ");
+        print_string(argv[arg]);
+        printf(", \"size\": %llu, \"objects\": %d, \"object_bytes\": %llu,\n",
+               (unsigned long long)st.st_size, list.count, list.bytes);
+
+        bench_fileinfo(argv[arg], 10 * runs, &info);
+
+        printf("  \"sitemaps\": {");
+        bench_sitemap(h, "hhc", info.hhc, runs);
+        printf(", ");
+        bench_sitemap(h, "hhk", info.hhk, runs);
+        printf(", \"rss_kb\": %ld},\n", peak_rss_kb());
+        chm_close(h);
+
+        bench_retrieve(argv[arg], &list, reads);
+        bench_extract(argv[arg], folder, runs);
+
+        counters = chm_stats_json();
+        printf("  \"counters\": %s,\n", counters);
+        printf("  \"peak_rss_kb\": %ld\n}\n", peak_rss_kb());
+        free(counters);
+
+        chm_arena_free(info.arena);
+        free(list.units);
+
+        return 0;
+}
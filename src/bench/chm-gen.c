@@ -0,0 +1,779 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Synthetic CHM files for the benchmarks.
+ *
+ *   bench/chm-gen [-p small|huge|deep|hhk] [-n count] [-s size] [-S seed] out.chm
+ *
+ *   small  count pages (20000) of size / 4 to size bytes (4k), in 100 folders
+ *   huge   count objects (4) of size bytes (64m) and a few pages
+ *   deep   count pages (10000) of size bytes (2k), 12 folders deep
+ *   hhk    an index of count keywords (100000) over 2000 pages
+ *
+ * Every book has #SYSTEM, #WINDOWS and #STRINGS, a toc and an index, and
+ * a directory of 4k listing chunks with index chunks above them, as hhc
+ * compiled books do.  The content is stored in the uncompressed section:
+ * LZX costs are not covered, bench real books for those.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <sys/types.h>
+
+#define BLOCK_LEN 4096
+#define PMGL_LEN 0x14
+#define PMGI_LEN 0x08
+#define ITSF_LEN 0x60
+#define ITSP_LEN 0x54
+#define SECTION0_LEN 0x18
+
+/* longest path generated, deep ones included */
+#define CHM_GEN_PATHLEN 512
+
+struct object
+{
+        char *path;
+        u_int64_t start;
+        u_int64_t length;
+        unsigned char *data;    /* NULL for generated pages and blobs */
+        int blob;
+        unsigned int seed;
+};
+
+struct book
+{
+        struct object *objects;
+        int count;
+        int capacity;
+        u_int64_t content_length;
+};
+
+/* grows by doubling */
+struct buffer
+{
+        unsigned char *data;
+        size_t length;
+        size_t capacity;
+};
+
+static const char *words[] = {
+        "archive", "buffer", "chunk", "directory", "entry", "file", "guide",
+        "header", "index", "jump", "keyword", "listing", "manual", "node",
+        "object", "page", "query", "reference", "section", "table", "topic",
+        "unit", "value", "window", "example", "yield", "zone", "the", "of",
+        "and", "to", "in", "is", "for", "with", "on", "this", "that",
+};
+
+#define WORD_COUNT (sizeof(words) / sizeof(words[0]))
+
+static unsigned int next_random(unsigned int *state)
+{
+        unsigned int x = *state;
+
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        *state = x ? x : 0x9e3779b9;
+
+        return *state;
+}
+
+static void buffer_append(struct buffer *buf, const void *data, size_t len)
+{
+        if (buf->length + len > buf->capacity) {
+                while (buf->length + len > buf->capacity)
+                        buf->capacity = buf->capacity ? buf->capacity * 2 : 4096;
+                buf->data = (unsigned char *)realloc(buf->data, buf->capacity);
+        }
+
+        memcpy(buf->data + buf->length, data, len);
+        buf->length += len;
+}
+
+static void buffer_printf(struct buffer *buf, const char *format, ...)
+{
+        char line[1024];
+        va_list args;
+        int len;
+
+        va_start(args, format);
+        len = vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+
+        buffer_append(buf, line, len < (int)sizeof(line) ? len : (int)sizeof(line) - 1);
+}
+
+static void put_u16(unsigned char *p, u_int16_t v)
+{
+        p[0] = v & 0xff;
+        p[1] = v >> 8;
+}
+
+static void put_u32(unsigned char *p, u_int32_t v)
+{
+        put_u16(p, v & 0xffff);
+        put_u16(p + 2, v >> 16);
+}
+
+static void put_u64(unsigned char *p, u_int64_t v)
+{
+        put_u32(p, (u_int32_t)v);
+        put_u32(p + 4, (u_int32_t)(v >> 32));
+}
+
+/* 7 bits a byte, most significant first, high bit set on all but the last */
+static int put_encint(unsigned char *p, u_int64_t v)
+{
+        unsigned char tmp[10];
+        int n = 0, i;
+
+        do {
+                tmp[n++] = v & 0x7f;
+                v >>= 7;
+        } while (v);
+
+        for (i = 0; i < n; i++)
+                p[i] = tmp[n - 1 - i] | (i < n - 1 ? 0x80 : 0);
+
+        return n;
+}
+
+static u_int64_t get_encint(const unsigned char **p)
+{
+        u_int64_t v = 0;
+
+        while (**p & 0x80)
+                v = (v << 7) | (*(*p)++ & 0x7f);
+        v = (v << 7) | *(*p)++;
+
+        return v;
+}
+
+static struct object *add_object(struct book *book, const char *path)
+{
+        struct object *obj;
+
+        if (book->count == book->capacity) {
+                book->capacity = book->capacity ? book->capacity * 2 : 1024;
+                book->objects = (struct object *)realloc(book->objects, book->capacity * sizeof(struct object));
+        }
+
+        obj = &book->objects[book->count++];
+        memset(obj, 0, sizeof(*obj));
+        obj->path = strdup(path);
+
+        return obj;
+}
+
+/* object holding what buf has, buf is emptied */
+static void add_data(struct book *book, const char *path, struct buffer *buf)
+{
+        struct object *obj = add_object(book, path);
+
+        obj->data = buf->data;
+        obj->length = buf->length;
+        obj->start = book->content_length;
+        book->content_length += obj->length;
+
+        memset(buf, 0, sizeof(*buf));
+}
+
+static void add_generated(struct book *book, const char *path, u_int64_t length, int blob, unsigned int seed)
+{
+        struct object *obj = add_object(book, path);
+
+        obj->length = length;
+        obj->blob = blob;
+        obj->seed = seed ? seed : 1;
+        obj->start = book->content_length;
+        book->content_length += length;
+}
+
+/* the folders on the way to path, write_book drops the repeated ones */
+static void add_folders(struct book *book, const char *path)
+{
+        char folder[CHM_GEN_PATHLEN];
+        const char *p;
+
+        for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+                size_t len = p - path + 1;
+
+                if (len >= sizeof(folder))
+                        break;
+                memcpy(folder, path, len);
+                folder[len] = '\0';
+                add_object(book, folder);
+        }
+}
+
+/* html page of exactly length bytes, words picked by seed */
+static void fill_page(unsigned char *out, u_int64_t length, unsigned int seed, const char *path)
+{
+        static const char tail[] = "\n</body></html>\n";
+        const u_int64_t tail_len = sizeof(tail) - 1;
+        char head[2 * CHM_GEN_PATHLEN + 64];
+        u_int64_t pos;
+        int len;
+
+        len = snprintf(head, sizeof(head), "<html><head><title>%s</title></head><body>\n<h1>%s</h1>\n", path, path);
+        if ((u_int64_t)len > length)
+                len = (int)length;
+        memcpy(out, head, len);
+        pos = len;
+
+        for (;;) {
+                const char *word = words[next_random(&seed) % WORD_COUNT];
+                size_t wlen = strlen(word);
+
+                if (pos + wlen + 1 + tail_len > length)
+                        break;
+                memcpy(out + pos, word, wlen);
+                pos += wlen;
+                out[pos++] = next_random(&seed) % 12 ? ' ' : '\n';
+        }
+
+        while (pos + tail_len < length)
+                out[pos++] = ' ';
+
+        memcpy(out + pos, tail, length - pos);
+}
+
+/* text and noise in turns of 64k, as images and archives inside books are */
+static void fill_blob(unsigned char *out, u_int64_t length, unsigned int seed)
+{
+        u_int64_t pos;
+
+        for (pos = 0; pos < length; pos += 4) {
+                u_int32_t v = next_random(&seed);
+                u_int64_t n = length - pos < 4 ? length - pos : 4;
+
+                if ((pos >> 16) & 1)
+                        memcpy(out + pos, &v, n);
+                else
+                        memcpy(out + pos, words[v % WORD_COUNT], n);
+        }
+}
+
+static void add_system(struct book *book, const char *title)
+{
+        static const char *strings[] = { "", "toc.hhc", "index.hhk", "index.html" };
+        struct buffer buf;
+        unsigned char entry[8 + 0x196];
+        u_int32_t offsets[5];
+        int i;
+
+        memset(&buf, 0, sizeof(buf));
+
+        /* #STRINGS: a NUL first, then the strings #WINDOWS points at */
+        for (i = 0; i < 4; i++) {
+                offsets[i] = buf.length;
+                buffer_append(&buf, strings[i], strlen(strings[i]) + 1);
+        }
+        offsets[4] = buf.length;
+        buffer_append(&buf, title, strlen(title) + 1);
+        add_data(book, "/#STRINGS", &buf);
+
+        /* #WINDOWS: count and size of the entries, then one entry */
+        memset(entry, 0, sizeof(entry));
+        put_u32(entry, 1);
+        put_u32(entry + 4, 0x196);
+        put_u32(entry + 8, 0x196);
+        put_u32(entry + 8 + 0x14, offsets[4]);
+        put_u32(entry + 8 + 0x60, offsets[1]);
+        put_u32(entry + 8 + 0x64, offsets[2]);
+        put_u32(entry + 8 + 0x68, offsets[3]);
+        buffer_append(&buf, entry, sizeof(entry));
+        add_data(book, "/#WINDOWS", &buf);
+
+        /* #SYSTEM: version, then code, length and data entries */
+        put_u32(entry, 3);
+        buffer_append(&buf, entry, 4);
+        for (i = 0; i < 4; i++) {
+                const char *value = i == 3 ? title : strings[i + 1];
+
+                put_u16(entry, i);
+                put_u16(entry + 2, strlen(value) + 1);
+                buffer_append(&buf, entry, 4);
+                buffer_append(&buf, value, strlen(value) + 1);
+        }
+        put_u16(entry, 4);
+        put_u16(entry + 2, 4);
+        put_u32(entry + 4, 0x0409);
+        buffer_append(&buf, entry, 8);
+        add_data(book, "/#SYSTEM", &buf);
+}
+
+static void add_sitemap_entry(struct buffer *buf, const char *name, const char *local)
+{
+        buffer_printf(buf, "<LI> <OBJECT type=\"text/sitemap\">\n"
+                      "\t<param name=\"Name\" value=\"%s\">\n"
+                      "\t<param name=\"Local\" value=\"%s\">\n"
+                      "\t</OBJECT>\n", name, local);
+}
+
+static void generate(struct book *book, const char *profile, long count, u_int64_t size, unsigned int seed)
+{
+        struct buffer toc, hhk;
+        char path[CHM_GEN_PATHLEN], name[64];
+        long pages, i;
+
+        memset(&toc, 0, sizeof(toc));
+        memset(&hhk, 0, sizeof(hhk));
+
+        buffer_printf(&toc, "<HTML><BODY>\n<UL>\n");
+        buffer_printf(&hhk, "<HTML><BODY>\n<UL>\n");
+
+        add_system(book, profile);
+        add_generated(book, "/index.html", 2048, 0, seed);
+
+        if (strcmp(profile, "hhk") == 0)
+                pages = 2000;
+        else if (strcmp(profile, "huge") == 0)
+                pages = 16;
+        else
+                pages = count;
+
+        for (i = 0; i < pages; i++) {
+                u_int64_t length;
+
+                if (strcmp(profile, "deep") == 0) {
+                        int len = 0, level;
+
+                        /* a folder for each base 4 digit of i */
+                        for (level = 0; level < 12; level++)
+                                len += snprintf(path + len, sizeof(path) - len, "/level%d_%ld",
+                                                level, (i >> (2 * (11 - level))) & 3);
+                        snprintf(path + len, sizeof(path) - len, "/page%ld.html", i);
+                } else {
+                        snprintf(path, sizeof(path), "/html/%02ld/page%ld.html", i % 100, i);
+                }
+
+                if (strcmp(profile, "small") == 0)
+                        length = size / 4 + next_random(&seed) % (size - size / 4 + 1);
+                else if (strcmp(profile, "deep") == 0)
+                        length = size;
+                else
+                        length = 4096;
+
+                add_folders(book, path);
+                add_generated(book, path, length, 0, next_random(&seed));
+
+                snprintf(name, sizeof(name), "Page %ld", i);
+                add_sitemap_entry(&toc, name, path + 1);
+        }
+
+        if (strcmp(profile, "huge") == 0) {
+                for (i = 0; i < count; i++) {
+                        snprintf(path, sizeof(path), "/data/blob%ld.bin", i);
+                        add_folders(book, path);
+                        add_generated(book, path, size, 1, next_random(&seed));
+                }
+        }
+
+        if (strcmp(profile, "hhk") == 0) {
+                for (i = 0; i < count; i++) {
+                        snprintf(name, sizeof(name), "keyword %ld", i);
+                        snprintf(path, sizeof(path), "html/%02ld/page%ld.html#k%ld",
+                                 (i % pages) % 100, i % pages, i);
+                        add_sitemap_entry(&hhk, name, path);
+                }
+        } else {
+                add_sitemap_entry(&hhk, "home", "index.html");
+        }
+
+        buffer_printf(&toc, "</UL>\n</BODY></HTML>\n");
+        buffer_printf(&hhk, "</UL>\n</BODY></HTML>\n");
+        add_data(book, "/toc.hhc", &toc);
+        add_data(book, "/index.hhk", &hhk);
+}
+
+static int _compare_path(const void *a, const void *b)
+{
+        return strcasecmp(((const struct object *)a)->path, ((const struct object *)b)->path);
+}
+
+static int _compare_start(const void *a, const void *b)
+{
+        const struct object *x = *(const struct object * const *)a;
+        const struct object *y = *(const struct object * const *)b;
+
+        return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/* Sort by name, as chmlib looks them up, and drop repeated folders */
+static void sort_objects(struct book *book)
+{
+        int i, n = 0;
+
+        qsort(book->objects, book->count, sizeof(struct object), _compare_path);
+
+        for (i = 0; i < book->count; i++) {
+                if (n > 0 && strcasecmp(book->objects[n - 1].path, book->objects[i].path) == 0) {
+                        free(book->objects[i].path);
+                        free(book->objects[i].data);
+                        continue;
+                }
+                book->objects[n++] = book->objects[i];
+        }
+
+        book->count = n;
+}
+
+/*
+ * Start a chunk of type ("PMGL" or "PMGI") in dir.  The previous one,
+ * started at *chunk with *used bytes filled, is padded and its free
+ * space set.
+ */
+static void start_chunk(struct buffer *dir, size_t *chunk, size_t *used, const char *type, int header_len)
+{
+        unsigned char header[PMGL_LEN];
+
+        if (*used) {
+                memset(header, 0, sizeof(header));
+                while (*used < BLOCK_LEN) {
+                        size_t n = BLOCK_LEN - *used < sizeof(header) ? BLOCK_LEN - *used : sizeof(header);
+
+                        buffer_append(dir, header, n);
+                        *used += n;
+                }
+        }
+
+        if (!type)
+                return;
+
+        *chunk = dir->length;
+        memset(header, 0, sizeof(header));
+        memcpy(header, type, 4);
+        buffer_append(dir, header, header_len);
+        *used = header_len;
+}
+
+static void end_chunk(struct buffer *dir, size_t chunk, size_t used)
+{
+        put_u32(dir->data + chunk + 4, BLOCK_LEN - used);
+        start_chunk(dir, &chunk, &used, NULL, 0);
+}
+
+/*
+ * The listing chunks hold the entries in name order and are linked both
+ * ways, the index chunks above them the first name of each chunk of the
+ * level below, up to a single root.  Returns the chunk count; *root is
+ * -1 when one listing chunk is enough, *depth counts the levels.
+ */
+static int build_directory(struct book *book, struct buffer *dir, int *root, int *last_listing, int *depth)
+{
+        struct buffer keys, next_keys;
+        unsigned char entry[CHM_GEN_PATHLEN + 40];
+        size_t chunk = 0, used = 0;
+        int chunks = 0, level_first, level_count, i;
+
+        memset(&keys, 0, sizeof(keys));
+        memset(&next_keys, 0, sizeof(next_keys));
+
+        for (i = 0; i < book->count; i++) {
+                struct object *obj = &book->objects[i];
+                size_t name_len = strlen(obj->path);
+                int len = 0;
+
+                len += put_encint(entry + len, name_len);
+                memcpy(entry + len, obj->path, name_len);
+                len += name_len;
+                len += put_encint(entry + len, 0);
+                len += put_encint(entry + len, obj->start);
+                len += put_encint(entry + len, obj->length);
+
+                if (used == 0 || used + len > BLOCK_LEN) {
+                        unsigned char key[CHM_GEN_PATHLEN + 20];
+                        int key_len;
+
+                        if (used) {
+                                put_u32(dir->data + chunk + 4, BLOCK_LEN - used);
+                                put_u32(dir->data + chunk + 16, chunks);
+                        }
+                        start_chunk(dir, &chunk, &used, "PMGL", PMGL_LEN);
+                        put_u32(dir->data + chunk + 12, chunks - 1);
+                        put_u32(dir->data + chunk + 16, (u_int32_t)-1);
+
+                        /* first name and number of the chunk, for the index */
+                        key_len = put_encint(key, name_len);
+                        memcpy(key + key_len, obj->path, name_len);
+                        key_len += name_len;
+                        key_len += put_encint(key + key_len, chunks);
+                        buffer_append(&keys, key, key_len);
+
+                        chunks++;
+                }
+
+                buffer_append(dir, entry, len);
+                used += len;
+        }
+        end_chunk(dir, chunk, used);
+
+        *last_listing = chunks - 1;
+        *root = -1;
+        *depth = 1;
+
+        /* index levels until one chunk holds a whole level */
+        level_count = chunks;
+        while (level_count > 1) {
+                const unsigned char *p = keys.data, *end = keys.data + keys.length;
+
+                level_first = chunks;
+                used = 0;
+                next_keys.length = 0;
+
+                while (p < end) {
+                        const unsigned char *key = p;
+                        u_int64_t name_len = get_encint(&p);
+                        int len;
+
+                        p += name_len;
+                        get_encint(&p);
+                        len = p - key;
+
+                        if (used == 0 || used + len > BLOCK_LEN) {
+                                const unsigned char *name = key;
+                                unsigned char next[CHM_GEN_PATHLEN + 20];
+                                int n;
+
+                                if (used)
+                                        put_u32(dir->data + chunk + 4, BLOCK_LEN - used);
+                                start_chunk(dir, &chunk, &used, "PMGI", PMGI_LEN);
+
+                                get_encint(&name);
+                                n = put_encint(next, name_len);
+                                memcpy(next + n, name, name_len);
+                                n += name_len;
+                                n += put_encint(next + n, chunks);
+                                buffer_append(&next_keys, next, n);
+
+                                chunks++;
+                        }
+
+                        buffer_append(dir, key, len);
+                        used += len;
+                }
+                end_chunk(dir, chunk, used);
+
+                level_count = chunks - level_first;
+                *root = chunks - 1;
+                (*depth)++;
+
+                keys.length = 0;
+                buffer_append(&keys, next_keys.data, next_keys.length);
+        }
+
+        free(keys.data);
+        free(next_keys.data);
+
+        return chunks;
+}
+
+static int write_book(struct book *book, FILE *fp)
+{
+        static const unsigned char guid[16] = {
+                0x6a, 0x92, 0x02, 0x5d, 0x2e, 0x21, 0xd0, 0x11,
+                0x9d, 0xf9, 0x00, 0xa0, 0xc9, 0x22, 0xe6, 0xec,
+        };
+        struct object **order;
+        struct buffer dir;
+        unsigned char itsf[ITSF_LEN], itsp[ITSP_LEN], section0[SECTION0_LEN];
+        unsigned char *page = NULL;
+        u_int64_t page_size = 0, dir_offset, data_offset;
+        int chunks, root, last_listing, depth, i;
+
+        sort_objects(book);
+
+        memset(&dir, 0, sizeof(dir));
+        chunks = build_directory(book, &dir, &root, &last_listing, &depth);
+
+        memset(itsp, 0, sizeof(itsp));
+        memcpy(itsp, "ITSP", 4);
+        put_u32(itsp + 0x04, 1);
+        put_u32(itsp + 0x08, ITSP_LEN);
+        put_u32(itsp + 0x0c, 0x0a);
+        put_u32(itsp + 0x10, BLOCK_LEN);
+        put_u32(itsp + 0x14, 2);
+        put_u32(itsp + 0x18, depth);
+        put_u32(itsp + 0x1c, (u_int32_t)root);
+        put_u32(itsp + 0x20, 0);
+        put_u32(itsp + 0x24, last_listing);
+        put_u32(itsp + 0x28, chunks);
+        put_u32(itsp + 0x2c, (u_int32_t)-1);
+        put_u32(itsp + 0x30, 0x0409);
+        memcpy(itsp + 0x34, guid, 16);
+        put_u32(itsp + 0x44, ITSP_LEN);
+        put_u32(itsp + 0x48, (u_int32_t)-1);
+        put_u32(itsp + 0x4c, (u_int32_t)-1);
+        put_u32(itsp + 0x50, (u_int32_t)-1);
+
+        dir_offset = ITSF_LEN + SECTION0_LEN;
+        data_offset = dir_offset + ITSP_LEN + dir.length;
+
+        memset(itsf, 0, sizeof(itsf));
+        memcpy(itsf, "ITSF", 4);
+        put_u32(itsf + 0x04, 3);
+        put_u32(itsf + 0x08, ITSF_LEN);
+        put_u32(itsf + 0x0c, 1);
+        put_u32(itsf + 0x14, 0x0409);
+        memcpy(itsf + 0x18, guid, 16);
+        memcpy(itsf + 0x28, guid, 16);
+        itsf[0x28] = 0x6b;
+        put_u64(itsf + 0x38, ITSF_LEN);
+        put_u64(itsf + 0x40, SECTION0_LEN);
+        put_u64(itsf + 0x48, dir_offset);
+        put_u64(itsf + 0x50, ITSP_LEN + dir.length);
+        put_u64(itsf + 0x58, data_offset);
+
+        memset(section0, 0, sizeof(section0));
+        put_u32(section0, 0x01fe);
+        put_u64(section0 + 8, data_offset + book->content_length);
+
+        if (fwrite(itsf, ITSF_LEN, 1, fp) != 1 || fwrite(section0, SECTION0_LEN, 1, fp) != 1
+            || fwrite(itsp, ITSP_LEN, 1, fp) != 1 || fwrite(dir.data, dir.length, 1, fp) != 1) {
+                free(dir.data);
+                return -1;
+        }
+        free(dir.data);
+
+        /* content in the order it was added, not in name order */
+        order = (struct object **)malloc(book->count * sizeof(struct object *));
+        for (i = 0; i < book->count; i++)
+                order[i] = &book->objects[i];
+        qsort(order, book->count, sizeof(struct object *), _compare_start);
+
+        for (i = 0; i < book->count; i++) {
+                struct object *obj = order[i];
+
+                if (obj->length == 0)
+                        continue;
+
+                if (!obj->data) {
+                        if (obj->length > page_size) {
+                                page_size = obj->length;
+                                page = (unsigned char *)realloc(page, page_size);
+                        }
+                        if (obj->blob)
+                                fill_blob(page, obj->length, obj->seed);
+                        else
+                                fill_page(page, obj->length, obj->seed, obj->path);
+                }
+
+                if (fwrite(obj->data ? obj->data : page, obj->length, 1, fp) != 1)
+                        break;
+        }
+
+        free(order);
+        free(page);
+
+        return i == book->count ? 0 : -1;
+}
+
+static u_int64_t parse_size(const char *arg)
+{
+        char *end;
+        u_int64_t size = strtoull(arg, &end, 10);
+
+        if (*end == 'k' || *end == 'K')
+                size <<= 10;
+        else if (*end == 'm' || *end == 'M')
+                size <<= 20;
+        else if (*end == 'g' || *end == 'G')
+                size <<= 30;
+
+        return size;
+}
+
+static void usage(const char *name)
+{
+        fprintf(stderr, "usage: %s [-p small|huge|deep|hhk] [-n count] [-s size] [-S seed] out.chm\n", name);
+}
+
+int main(int argc, char **argv)
+{
+        struct book book;
+        const char *profile = "small";
+        long count = -1;
+        u_int64_t size = 0;
+        unsigned int seed = 1;
+        FILE *fp;
+        int arg, i, ret;
+
+        for (arg = 1; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+                if (strcmp(argv[arg], "-p") == 0)
+                        profile = argv[arg + 1];
+                else if (strcmp(argv[arg], "-n") == 0)
+                        count = atol(argv[arg + 1]);
+                else if (strcmp(argv[arg], "-s") == 0)
+                        size = parse_size(argv[arg + 1]);
+                else if (strcmp(argv[arg], "-S") == 0)
+                        seed = (unsigned int)atol(argv[arg + 1]);
+                else
+                        break;
+        }
+
+        if (arg + 1 != argc) {
+                usage(argv[0]);
+                return 1;
+        }
+
+        if (strcmp(profile, "small") == 0) {
+                count = count < 0 ? 20000 : count;
+                size = size ? size : 4096;
+        } else if (strcmp(profile, "huge") == 0) {
+                count = count < 0 ? 4 : count;
+                size = size ? size : 64 << 20;
+        } else if (strcmp(profile, "deep") == 0) {
+                count = count < 0 ? 10000 : count;
+                size = size ? size : 2048;
+        } else if (strcmp(profile, "hhk") == 0) {
+                count = count < 0 ? 100000 : count;
+        } else {
+                usage(argv[0]);
+                return 1;
+        }
+
+        memset(&book, 0, sizeof(book));
+        generate(&book, profile, count, size, seed ? seed : 1);
+
+        fp = fopen(argv[arg], "wb");
+        if (!fp) {
+                fprintf(stderr, "cannot create %s\n", argv[arg]);
+                return 1;
+        }
+
+        ret = write_book(&book, fp);
+        if (fclose(fp) != 0)
+                ret = -1;
+
+        if (ret == -1)
+                fprintf(stderr, "writing %s failed\n", argv[arg]);
+
+        for (i = 0; i < book.count; i++) {
+                free(book.objects[i].path);
+                free(book.objects[i].data);
+        }
+        free(book.objects);
+
+        return ret == -1 ? 1 : 0;
+}
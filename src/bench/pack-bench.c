@@ -0,0 +1,244 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Raw files against pack storage.
+ *
+ *   bench/pack-bench [-n runs] book.chm workdir
+ *
+ * Extracts the book to workdir/raw and packs it to workdir/pack, then
+ * prints for both the time taken, the disk usage, the time to read the
+ * homepage as a first page would (open, look up, read) and the average
+ * time to read any object.  Drop the page cache between runs for cold
+ * numbers.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <chm_lib.h>
+
+#include "csChmfile.h"
+#include "csChmpool.h"
+#include "csChmpack.h"
+
+static double now(void)
+{
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static unsigned long long disk_usage(const char *path)
+{
+        unsigned long long size;
+        struct dirent *dent;
+        struct stat st;
+        char child[4096];
+        DIR *dir;
+
+        if (lstat(path, &st) == -1)
+                return 0;
+
+        size = (unsigned long long)st.st_blocks * 512;
+        if (!S_ISDIR(st.st_mode) || (dir = opendir(path)) == NULL)
+                return size;
+
+        while ((dent = readdir(dir)) != NULL) {
+                if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+                        continue;
+                snprintf(child, sizeof(child), "%s/%s", path, dent->d_name);
+                size += disk_usage(child);
+        }
+
+        closedir(dir);
+        return size;
+}
+
+struct object_list
+{
+        char **paths;
+        int count;
+        int capacity;
+};
+
+static int _list_callback(struct chmFile *h, struct chmUnitInfo *ui, void *context)
+{
+        struct object_list *list = (struct object_list *)context;
+        size_t len = strlen(ui->path);
+
+        if (ui->path[0] != '/' || ui->path[len - 1] == '/' || strstr(ui->path, "/../"))
+                return CHM_ENUMERATOR_CONTINUE;
+
+        if (list->count == list->capacity) {
+                list->capacity = list->capacity ? list->capacity * 2 : 1024;
+                list->paths = (char **)realloc(list->paths, list->capacity * sizeof(char *));
+        }
+        list->paths[list->count++] = strdup(ui->path);
+
+        return CHM_ENUMERATOR_CONTINUE;
+}
+
+static long read_raw(const char *folder, const char *path, char *buf, size_t size)
+{
+        char filename[4096];
+        long total = 0, n;
+        int fd;
+
+        snprintf(filename, sizeof(filename), "%s%s", folder, path);
+        fd = open(filename, O_RDONLY);
+        if (fd == -1)
+                return -1;
+
+        while ((n = read(fd, buf, size)) > 0)
+                total += n;
+
+        close(fd);
+        return total;
+}
+
+static long read_packed(const char *packfile, const char *path, char *buf, size_t size)
+{
+        struct pack_cursor cursor = { -1, 0, NULL };
+        struct pack *pack;
+        u_int64_t offset = 0;
+        long object, n;
+
+        pack = pack_open(packfile);
+        if (!pack)
+                return -1;
+
+        object = pack_lookup(pack, path);
+        if (object != -1) {
+                while ((n = pack_read(pack, object, &cursor, (unsigned char *)buf, offset, size)) > 0)
+                        offset += n;
+        }
+
+        pack_cursor_free(&cursor);
+        pack_close(pack);
+
+        return object == -1 ? -1 : (long)offset;
+}
+
+int main(int argc, char **argv)
+{
+        struct extract_options options;
+        struct object_list list;
+        struct fileinfo info;
+        char raw[4096], packed[4096], packfile[4096], homepage[CHM_MAX_PATHLEN + 1];
+        char *buf;
+        int runs = 5, arg = 1, i, j;
+        double t, raw_extract, pack_extract, raw_first = 0, pack_first = 0, raw_all = 0, pack_all = 0;
+
+        if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+                runs = atoi(argv[2]);
+                arg = 3;
+        }
+
+        if (arg + 2 != argc || runs < 1) {
+                fprintf(stderr, "usage: %s [-n runs] book.chm workdir\n", argv[0]);
+                return 1;
+        }
+
+        if (snprintf(raw, sizeof(raw), "%s/raw", argv[arg + 1]) >= (int)sizeof(raw)
+            || snprintf(packed, sizeof(packed), "%s/pack", argv[arg + 1]) >= (int)sizeof(packed)
+            || snprintf(packfile, sizeof(packfile), "%s/" PACK_FILE, packed) >= (int)sizeof(packfile)) {
+                fprintf(stderr, "workdir too long: %s\n", argv[arg + 1]);
+                return 1;
+        }
+        mkdir(argv[arg + 1], 0777);
+        mkdir(raw, 0777);
+        mkdir(packed, 0777);
+
+        memset(&info, 0, sizeof(info));
+        info.lcid = 0x0409;
+        info.chmfile = chm_pool_open(argv[arg]);
+        if (!info.chmfile) {
+                fprintf(stderr, "cannot open %s\n", argv[arg]);
+                return 1;
+        }
+        chm_fileinfo(&info);
+
+        memset(&list, 0, sizeof(list));
+        chm_enumerate(info.chmfile, CHM_ENUMERATE_ALL, _list_callback, &list);
+        chm_pool_close(info.chmfile);
+
+        snprintf(homepage, sizeof(homepage), "%s%s", info.homepage && info.homepage[0] == '/' ? "" : "/",
+                 info.homepage ? info.homepage : "");
+        homepage[1 + strcspn(homepage + 1, "?#")] = '\0';
+        chm_normalize_path(homepage);
+
+        t = now();
+        if (extract_chm(argv[arg], raw, NULL, NULL) != 0)
+                fprintf(stderr, "extracting %s failed\n", argv[arg]);
+        raw_extract = now() - t;
+
+        memset(&options, 0, sizeof(options));
+        options.pack = 1;
+        t = now();
+        if (extract_chm(argv[arg], packed, &options, NULL) != 0)
+                fprintf(stderr, "packing %s failed\n", argv[arg]);
+        pack_extract = now() - t;
+
+        buf = (char *)malloc(1 << 20);
+
+        for (i = 0; i < runs; i++) {
+                t = now();
+                read_raw(raw, homepage, buf, 1 << 20);
+                raw_first += now() - t;
+
+                t = now();
+                read_packed(packfile, homepage, buf, 1 << 20);
+                pack_first += now() - t;
+
+                t = now();
+                for (j = 0; j < list.count; j++)
+                        read_raw(raw, list.paths[j], buf, 1 << 20);
+                raw_all += now() - t;
+
+                t = now();
+                for (j = 0; j < list.count; j++)
+                        read_packed(packfile, list.paths[j], buf, 1 << 20);
+                pack_all += now() - t;
+        }
+
+        printf("%s: %d objects, homepage %s\n", argv[arg], list.count, homepage);
+        printf("raw:  extract %.3fs, %llu bytes on disk, first page %.3fms, avg object %.3fms\n",
+               raw_extract, disk_usage(raw), raw_first * 1000 / runs,
+               list.count ? raw_all * 1000 / runs / list.count : 0.0);
+        printf("pack: extract %.3fs, %llu bytes on disk, first page %.3fms, avg object %.3fms\n",
+               pack_extract, disk_usage(packed), pack_first * 1000 / runs,
+               list.count ? pack_all * 1000 / runs / list.count : 0.0);
+
+        for (j = 0; j < list.count; j++)
+                free(list.paths[j]);
+        free(list.paths);
+        free(buf);
+
+        return 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# Generate the synthetic books into workdir, once, and bench each of
+# them.  Prints one JSON document keyed by profile, keep it to compare
+# against the next run:
+#
+#   bench/run-bench.sh workdir [runs] > results.json
+
+set -e
+
+BENCH_DIR=$(dirname "$0")
+WORKDIR=${1:?usage: $0 workdir [runs]}
+RUNS=${2:-5}
+PROFILES="small huge deep hhk"
+
+mkdir -p "$WORKDIR"
+
+for profile in $PROFILES; do
+        if [ ! -f "$WORKDIR/$profile.chm" ]; then
+                echo "generating $profile.chm" >&2
+                "$BENCH_DIR/chm-gen" -p $profile "$WORKDIR/$profile.chm"
+        fi
+done
+
+echo "{"
+sep=""
+for profile in $PROFILES; do
+        echo "benching $profile.chm" >&2
+        printf '%s"%s": ' "$sep" $profile
+        "$BENCH_DIR/chm-bench" -n $RUNS "$WORKDIR/$profile.chm" "$WORKDIR/$profile"
+        sep=","
+done
+echo "}"
@@ -0,0 +1,110 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Micro-benchmark of the native sitemap parser.
+ *
+ *   bench/sitemap-bench [-n runs] file.hhk ...
+ *
+ * Parses each extracted hhc/hhk file from disk and prints the best and
+ * average parse time, the entry count and the memory held by the result.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "csChmparser.h"
+
+static double now(void)
+{
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static char *read_file(const char *filename, size_t *size)
+{
+        struct stat statbuf;
+        FILE *fp;
+        char *data;
+
+        if (stat(filename, &statbuf) == -1 || (fp = fopen(filename, "rb")) == NULL)
+                return NULL;
+
+        data = (char *)malloc(statbuf.st_size);
+        *size = fread(data, 1, statbuf.st_size, fp);
+        fclose(fp);
+
+        return data;
+}
+
+int main(int argc, char **argv)
+{
+        int runs = 10, i, arg = 1;
+
+        if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+                runs = atoi(argv[2]);
+                arg = 3;
+        }
+
+        if (arg >= argc || runs < 1) {
+                fprintf(stderr, "usage: %s [-n runs] file.hhk ...\n", argv[0]);
+                return 1;
+        }
+
+        for (; arg < argc; arg++) {
+                double best = 0, total = 0;
+                struct sitemap *map = NULL;
+                size_t size = 0;
+                char *data = read_file(argv[arg], &size);
+
+                if (data == NULL) {
+                        fprintf(stderr, "cannot read %s\n", argv[arg]);
+                        continue;
+                }
+
+                for (i = 0; i < runs; i++) {
+                        double t = now();
+
+                        sitemap_free(map);
+                        map = sitemap_parse(data, size);
+
+                        t = now() - t;
+                        total += t;
+                        if (i == 0 || t < best)
+                                best = t;
+                }
+
+                printf("%s: %lu bytes, %u entries, best %.2fms, avg %.2fms, "
+                       "%.1f MB/s, %lu bytes held\n",
+                       argv[arg], (unsigned long)size, map->count,
+                       best * 1000, total * 1000 / runs,
+                       size / best / (1024 * 1024),
+                       (unsigned long)(map->capacity * sizeof(struct sitemap_entry) + map->strings_cap));
+
+                sitemap_free(map);
+                free(data);
+        }
+
+        return 0;
+}
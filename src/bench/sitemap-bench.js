@@ -0,0 +1,136 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * The JS side of bench/sitemap-bench, for comparison.
+ *
+ *   node bench/sitemap-bench.js [-n runs] file.hhk ...
+ *
+ * Parses each file with simpleparser.js, the regex parser chmsee used
+ * before csChmparser.c, into the same flat (depth, name, local) entries
+ * and prints the best and average parse time in the format of
+ * bench/sitemap-bench.  The RDF datasource that was built on top of it
+ * is left out, so this is the lower bound of the old path.
+ */
+
+var fs = require("fs");
+var path = require("path");
+var vm = require("vm");
+
+vm.runInThisContext(fs.readFileSync(path.join(__dirname, "simpleparser.js"), "latin1"));
+
+var lower = function (s) {
+    return s ? s.toLowerCase() : "";
+};
+
+// what the old ContentHandler kept, without the RDF
+var SitemapHandler = function () {
+    this.depth = 0;
+    this.isItem = false;
+    this.name = null;
+    this.local = null;
+    this.entries = [];
+};
+
+SitemapHandler.prototype = {
+    startElement: function (tag, attrs) {
+        tag = lower(tag);
+
+        if (tag == "ul") {
+            this.depth++;
+        } else if (tag == "object") {
+            if (attrs.length > 0 && lower(attrs[0].name) == "type" && lower(attrs[0].value) == "text/sitemap") {
+                this.isItem = true;
+                this.name = null;
+                this.local = null;
+            }
+        } else if (tag == "param" && this.isItem && attrs.length > 1) {
+            var name = lower(attrs[0].value);
+
+            if (name == "name" && this.name === null)
+                this.name = attrs[1].value;
+            else if (name == "local")
+                this.local = attrs[1].value;
+        }
+    },
+
+    endElement: function (tag) {
+        tag = lower(tag);
+
+        if (tag == "ul") {
+            if (this.depth > 0)
+                this.depth--;
+        } else if (tag == "object" && this.isItem) {
+            this.entries.push({depth: this.depth, name: this.name || "", local: this.local || ""});
+            this.isItem = false;
+        }
+    },
+
+    characters: function (s) {},
+    comment: function (s) {}
+};
+
+var main = function (argv) {
+    var runs = 10, arg = 0;
+
+    if (argv.length > 1 && argv[0] == "-n") {
+        runs = parseInt(argv[1], 10);
+        arg = 2;
+    }
+
+    if (arg >= argv.length || !(runs >= 1)) {
+        process.stderr.write("usage: sitemap-bench.js [-n runs] file.hhk ...\n");
+        return 1;
+    }
+
+    for (; arg < argv.length; arg++) {
+        var data;
+
+        try {
+            data = fs.readFileSync(argv[arg], "latin1");
+        } catch (e) {
+            process.stderr.write("cannot read " + argv[arg] + "\n");
+            continue;
+        }
+
+        var best = 0, total = 0, handler = null;
+
+        for (var i = 0; i < runs; i++) {
+            var t = process.hrtime();
+
+            handler = new SitemapHandler();
+            new SimpleHtmlParser().parse(data, handler);
+
+            t = process.hrtime(t);
+            t = t[0] + t[1] / 1e9;
+            total += t;
+            if (i == 0 || t < best)
+                best = t;
+        }
+
+        console.log(argv[arg] + ": " + data.length + " bytes, " + handler.entries.length + " entries, "
+                    + "best " + (best * 1000).toFixed(2) + "ms, avg " + (total * 1000 / runs).toFixed(2) + "ms, "
+                    + (data.length / best / (1024 * 1024)).toFixed(1) + " MB/s, "
+                    + process.memoryUsage().heapUsed + " bytes heap");
+    }
+
+    return 0;
+};
+
+process.exitCode = main(process.argv.slice(2));
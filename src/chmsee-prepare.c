@@ -0,0 +1,402 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Prepare books for ChmSee without starting it.
+ *
+ *   chmsee-prepare [-d bookshelf] [-m info|extract|lazy|pack] [-j jobs]
+ *                  [-S] [-f] book.chm ...
+ *
+ * Every book gets its bookshelf folder, named by its fingerprint, with
+ * what the application would write on first open: the sitemap files,
+ * the navigation cache with the parsed toc and index, the extracted
+ * objects as the mode says, and the full-text search index unless -S.
+ * Book.getBookFromFile then finds the book already loaded.  Books whose
+ * folder is complete are skipped unless -f.  The books are prepared by
+ * jobs threads, as many as there are cores by default.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include <chm_lib.h>
+
+#include "csChmfile.h"
+#include "csChmarena.h"
+#include "csChmcharset.h"
+#include "csChmpool.h"
+#include "csChmhash.h"
+#include "csChmparser.h"
+#include "csChmnav.h"
+#include "csChmsearch.h"
+
+/* the modes of csIChm.asyncOpenChm */
+enum { MODE_INFO, MODE_EXTRACT, MODE_LAZY, MODE_PACK };
+
+static const char *mode_names[] = { "info", "extract", "lazy", "pack" };
+
+struct prepare_job
+{
+        char **files;
+        int count;
+        const char *bookshelf;
+        int mode;
+        int search;
+        int force;
+
+        pthread_mutex_t mutex;
+        int next;
+        int failed;
+};
+
+static double now(void)
+{
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int make_dirs(const char *path)
+{
+        char buffer[PATH_MAX];
+        char *p;
+
+        if (snprintf(buffer, sizeof(buffer), "%s", path) >= (int)sizeof(buffer))
+                return -1;
+
+        for (p = buffer + 1; *p; p++) {
+                if (*p == '/') {
+                        *p = '\0';
+                        mkdir(buffer, 0777);
+                        *p = '/';
+                }
+        }
+
+        return mkdir(buffer, 0777) == 0 || access(buffer, W_OK) == 0 ? 0 : -1;
+}
+
+/* path of name inside folder, -1 when it does not fit */
+static int folder_file(char *path, size_t size, const char *folder, const char *name)
+{
+        return snprintf(path, size, "%s/%s", folder, name) < (int)size ? 0 : -1;
+}
+
+/* The folder was prepared in mode already */
+static int is_prepared(const char *folder, int mode)
+{
+        struct navinfo info;
+        struct sitemap *toc, *index;
+        char path[PATH_MAX];
+        int flags;
+
+        info.arena = NULL;
+        if (folder_file(path, sizeof(path), folder, NAV_CACHE_FILE) == -1
+            || nav_load(path, &info, &toc, &index) == -1)
+                return 0;
+
+        chm_arena_free(info.arena);
+        sitemap_free(toc);
+        sitemap_free(index);
+
+        switch (mode) {
+        case MODE_EXTRACT: flags = NAV_EXTRACTED; break;
+        case MODE_LAZY:    flags = NAV_EXTRACTED | NAV_LAZY; break;
+        case MODE_PACK:    flags = NAV_EXTRACTED | NAV_PACKED; break;
+        default:           flags = 0; break;
+        }
+
+        return (int)info.flags == flags;
+}
+
+/* Same as opening the book in the application, then saving its cache */
+static int prepare_nav(const char *filename, const char *folder, int mode)
+{
+        struct fileinfo info;
+        struct navinfo nav;
+        struct sitemap *toc = NULL, *index = NULL;
+        char path[PATH_MAX];
+        long ret = 0;
+
+        memset(&info, 0, sizeof(info));
+        info.lcid = 0x0409;
+        info.chmfile = chm_pool_open(filename);
+        if (!info.chmfile)
+                return -1;
+
+        chm_fileinfo(&info);
+
+        if (info.hhc) {
+                extract_object(info.chmfile, info.hhc, folder);
+                toc = sitemap_parse_object(info.chmfile, info.hhc);
+                if (toc)
+                        sitemap_to_utf8(toc, chm_lcid_charset(info.lcid));
+        }
+        if (info.hhk) {
+                extract_object(info.chmfile, info.hhk, folder);
+                index = sitemap_parse_object(info.chmfile, info.hhk);
+                if (index)
+                        sitemap_to_utf8(index, chm_lcid_charset(info.lcid));
+        }
+
+        if (mode == MODE_LAZY) {
+                const char *paths[4];
+                int n = 0;
+
+                if (info.homepage)
+                        paths[n++] = info.homepage;
+                if (info.hhc)
+                        paths[n++] = info.hhc;
+                if (info.hhk)
+                        paths[n++] = info.hhk;
+                paths[n] = NULL;
+
+                ret = extract_chm_lazy(info.chmfile, folder, paths);
+        }
+
+        chm_pool_close(info.chmfile);
+
+        if (ret == 0 && (mode == MODE_EXTRACT || mode == MODE_PACK)) {
+                struct extract_options options;
+
+                memset(&options, 0, sizeof(options));
+                options.pack = mode == MODE_PACK;
+                ret = extract_chm(filename, folder, &options, NULL);
+        }
+
+        if (ret == 0) {
+                nav.arena = info.arena;
+                nav.chmfile = filename;
+                nav.homepage = info.homepage ? info.homepage : "/";
+                nav.bookname = info.bookname ? info.bookname : "";
+                nav.hhc = info.hhc;
+                nav.hhk = info.hhk;
+                nav.lcid = info.lcid;
+                nav.flags = mode == MODE_INFO ? 0 : NAV_EXTRACTED;
+                if (mode == MODE_LAZY)
+                        nav.flags |= NAV_LAZY;
+                if (mode == MODE_PACK)
+                        nav.flags |= NAV_PACKED;
+
+                ret = folder_file(path, sizeof(path), folder, NAV_CACHE_FILE);
+                if (ret == 0)
+                        ret = nav_save(path, &nav, toc, index);
+        }
+
+        sitemap_free(toc);
+        sitemap_free(index);
+        chm_arena_free(info.arena);
+
+        return ret == 0 ? 0 : -1;
+}
+
+static int prepare_search(const char *filename, const char *folder, int force)
+{
+        struct search_index *index;
+        struct navinfo info;
+        struct sitemap *toc, *sitemap_index;
+        char path[PATH_MAX];
+
+        if (folder_file(path, sizeof(path), folder, SEARCH_INDEX_FILE) == -1)
+                return -1;
+        if (!force && (index = search_open(path)) != NULL) {
+                search_close(index);
+                return 0;
+        }
+
+        /* the lcid picks the tokenizer, the navigation cache has it */
+        info.arena = NULL;
+        if (folder_file(path, sizeof(path), folder, NAV_CACHE_FILE) == -1
+            || nav_load(path, &info, &toc, &sitemap_index) == -1)
+                return -1;
+        chm_arena_free(info.arena);
+        sitemap_free(toc);
+        sitemap_free(sitemap_index);
+
+        if (folder_file(path, sizeof(path), folder, SEARCH_INDEX_FILE) == -1)
+                return -1;
+        return search_build(filename, path, info.lcid, NULL) == 0 ? 0 : -1;
+}
+
+static int prepare_book(struct prepare_job *job, const char *argument)
+{
+        char filename[PATH_MAX], cache[PATH_MAX], folder[PATH_MAX];
+        char fingerprint[CHM_FINGERPRINT_LEN + 1];
+        double begin = now();
+        int skipped = 0;
+
+        /* the application keys the fingerprint cache by absolute path */
+        if (realpath(argument, filename) == NULL) {
+                fprintf(stderr, "%s: cannot resolve path\n", argument);
+                return -1;
+        }
+
+        snprintf(cache, sizeof(cache), "%s/fingerprints", job->bookshelf);
+
+        if (chm_fingerprint(filename, cache, fingerprint) == -1) {
+                fprintf(stderr, "%s: cannot fingerprint\n", filename);
+                return -1;
+        }
+
+        snprintf(folder, sizeof(folder), "%s/%s", job->bookshelf, fingerprint);
+        if (make_dirs(folder) == -1) {
+                fprintf(stderr, "%s: cannot create %s\n", filename, folder);
+                return -1;
+        }
+
+        if (!job->force && is_prepared(folder, job->mode)) {
+                skipped = 1;
+        } else if (prepare_nav(filename, folder, job->mode) == -1) {
+                fprintf(stderr, "%s: cannot open or extract\n", filename);
+                return -1;
+        }
+
+        if (job->search && prepare_search(filename, folder, job->force) == -1) {
+                fprintf(stderr, "%s: cannot build search index\n", filename);
+                return -1;
+        }
+
+        printf("%s %s: %s%s in %.3fs\n", fingerprint, filename,
+               skipped ? "cached" : mode_names[job->mode],
+               job->search ? " + search" : "", now() - begin);
+
+        return 0;
+}
+
+static void *prepare_worker(void *data)
+{
+        struct prepare_job *job = (struct prepare_job *)data;
+
+        for (;;) {
+                int i;
+
+                pthread_mutex_lock(&job->mutex);
+                i = job->next++;
+                pthread_mutex_unlock(&job->mutex);
+
+                if (i >= job->count)
+                        break;
+
+                if (prepare_book(job, job->files[i]) == -1) {
+                        pthread_mutex_lock(&job->mutex);
+                        job->failed++;
+                        pthread_mutex_unlock(&job->mutex);
+                }
+        }
+
+        return NULL;
+}
+
+static void usage(const char *name)
+{
+        fprintf(stderr, "usage: %s [-d bookshelf] [-m info|extract|lazy|pack] [-j jobs] [-S] [-f] book.chm ...\n", name);
+}
+
+int main(int argc, char **argv)
+{
+        struct prepare_job job;
+        pthread_t workers[64];
+        char bookshelf[PATH_MAX];
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int jobs = cpus > 0 ? (int)cpus : 1;
+        int opt, i, threads;
+
+        memset(&job, 0, sizeof(job));
+        job.mode = MODE_INFO;
+        job.search = 1;
+
+        if (getenv("HOME"))
+                snprintf(bookshelf, sizeof(bookshelf), "%s/.chmsee/bookshelf", getenv("HOME"));
+        else
+                bookshelf[0] = '\0';
+
+        while ((opt = getopt(argc, argv, "d:m:j:Sf")) != -1) {
+                switch (opt) {
+                case 'd':
+                        snprintf(bookshelf, sizeof(bookshelf), "%s", optarg);
+                        break;
+                case 'm':
+                        for (i = 0; i < 4 && strcmp(optarg, mode_names[i]) != 0; i++)
+                                ;
+                        if (i == 4) {
+                                usage(argv[0]);
+                                return 1;
+                        }
+                        job.mode = i;
+                        break;
+                case 'j':
+                        jobs = atoi(optarg);
+                        break;
+                case 'S':
+                        job.search = 0;
+                        break;
+                case 'f':
+                        job.force = 1;
+                        break;
+                default:
+                        usage(argv[0]);
+                        return 1;
+                }
+        }
+
+        if (optind >= argc || jobs < 1 || !bookshelf[0]) {
+                usage(argv[0]);
+                return 1;
+        }
+
+        if (make_dirs(bookshelf) == -1) {
+                fprintf(stderr, "cannot create bookshelf %s\n", bookshelf);
+                return 1;
+        }
+
+        job.files = argv + optind;
+        job.count = argc - optind;
+        job.bookshelf = bookshelf;
+        pthread_mutex_init(&job.mutex, NULL);
+
+        /* extract_chm runs its own threads per book as well */
+        if (jobs > job.count)
+                jobs = job.count;
+        if (jobs > (int)(sizeof(workers) / sizeof(workers[0])))
+                jobs = sizeof(workers) / sizeof(workers[0]);
+
+        for (threads = 0; threads < jobs; threads++)
+                if (pthread_create(&workers[threads], NULL, prepare_worker, &job) != 0)
+                        break;
+
+        if (threads == 0)
+                prepare_worker(&job);
+
+        for (i = 0; i < threads; i++)
+                pthread_join(workers[i], NULL);
+
+        pthread_mutex_destroy(&job.mutex);
+
+        if (job.failed)
+                fprintf(stderr, "%d of %d books failed\n", job.failed, job.count);
+
+        return job.failed ? 1 : 0;
+}
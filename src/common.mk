@@ -3,8 +3,18 @@ COMPONENTSDIR = ${CHMSEE_ROOTDIR}/components
 
 TARGET = ${COMPONENTSDIR}/libxpcomchm.so
 
-SRCS = csChm.cpp csChmModule.cpp csChmfile.c
-OBJS = csChm.o csChmModule.o csChmfile.o
+SRCS = csChm.cpp csChmStream.cpp csChmSitemap.cpp csChmModule.cpp \
+       csChmfile.c csChmpool.c csChmhash.c csChmparser.c \
+       csChmnav.c csChmindex.c csChmsearch.c csChmfts.c csChmaccess.c \
+       csChmmanifest.c csChmshelf.c csChmpack.c csChmstats.c \
+       csChmprefetch.c csChmarena.c csChmcharset.c \
+       csChmTreeView.cpp csChmtree.c
+OBJS = csChm.o csChmStream.o csChmSitemap.o csChmModule.o \
+       csChmfile.o csChmpool.o csChmhash.o csChmparser.o \
+       csChmnav.o csChmindex.o csChmsearch.o csChmfts.o csChmaccess.o \
+       csChmmanifest.o csChmshelf.o csChmpack.o csChmstats.o \
+       csChmprefetch.o csChmarena.o csChmcharset.o \
+       csChmTreeView.o csChmtree.o
 
 INTERFACE = csIChm
 IDL = ${INTERFACE}.idl
@@ -35,7 +45,7 @@ XPCOM_FROZEN_LDOPTS = -Wl,-R${LIBXUL_SDK}/bin -L${LIBXUL_SDK}/bin -lxpcom -lmoza
 LDFLAGS            += ${DEFINES} \
 	              ${INCLUDES} \
 		      ${MOZ_DEBUG_DISABLE_DEFS} \
-		      -shared -Wl,-soname,${TARGET} -lpthread \
+		      -shared -Wl,-soname,${TARGET} -lpthread -lm -lz \
 		      ${LIBXUL_SDK}/lib/libxpcomglue_s.a \
 		      ${XPCOM_FROZEN_LDOPTS} \
 		      ${NSPR_LIBS} \
@@ -58,5 +68,58 @@ ${TARGET}: ${XPT} ${OBJS}
 %.o: %.c++
 	${CXX} ${CXXFLAGS} -c $<
 
+# bench/sitemap-bench.js times the old JS sitemap parser, run it with node
+BENCH = bench/sitemap-bench bench/pack-bench bench/chm-gen bench/chm-bench
+
+# synthetic books and results of bench-run go there
+BENCH_WORKDIR = /tmp/chmsee-bench
+
+BENCH_OBJS = csChmfile.o csChmpool.o csChmaccess.o csChmmanifest.o csChmpack.o csChmstats.o \
+             csChmarena.o
+
+bench: ${BENCH}
+
+bench/sitemap-bench: bench/sitemap-bench.c csChmparser.o ${BENCH_OBJS}
+	${CC} ${CFLAGS} $^ -o $@ -lpthread -lz ${CHMLIB_LIBS}
+
+bench/pack-bench: bench/pack-bench.c ${BENCH_OBJS}
+	${CC} ${CFLAGS} $^ -o $@ -lpthread -lz ${CHMLIB_LIBS}
+
+bench/chm-gen: bench/chm-gen.c
+	${CC} ${CFLAGS} $^ -o $@
+
+bench/chm-bench: bench/chm-bench.c csChmparser.o ${BENCH_OBJS}
+	${CC} ${CFLAGS} $^ -o $@ -lpthread -lz ${CHMLIB_LIBS}
+
+bench-run: bench/chm-gen bench/chm-bench
+	sh bench/run-bench.sh ${BENCH_WORKDIR} > ${BENCH_WORKDIR}.json
+	@echo results in ${BENCH_WORKDIR}.json
+
+# headless book preparation, no XPCOM needed
+CLI = chmsee-prepare
+
+cli: ${CLI}
+
+chmsee-prepare: chmsee-prepare.c csChmparser.o csChmhash.o csChmnav.o csChmsearch.o csChmcharset.o ${BENCH_OBJS}
+	${CC} ${CFLAGS} $^ -o $@ -lpthread -lm -lz ${CHMLIB_LIBS}
+
+# tests of the native layer over synthetic books, no XPCOM needed
+TESTS = test/lazy-test test/tree-test
+
+TEST_WORKDIR = /tmp/chmsee-test
+
+test/lazy-test: test/lazy-test.c ${BENCH_OBJS}
+	${CC} ${CFLAGS} $^ -o $@ -lpthread -lz ${CHMLIB_LIBS}
+
+test/tree-test: test/tree-test.c csChmtree.o csChmparser.o ${BENCH_OBJS}
+	${CC} ${CFLAGS} $^ -o $@ -lpthread -lz ${CHMLIB_LIBS}
+
+check: bench/chm-gen ${TESTS}
+	mkdir -p ${TEST_WORKDIR}
+	bench/chm-gen -p small -n 200 ${TEST_WORKDIR}/small.chm
+	test/lazy-test ${TEST_WORKDIR}/small.chm ${TEST_WORKDIR}
+	test/tree-test
+
 clean:
 	rm ${TARGET} ${OBJS} ${XPT}
+	rm -f ${BENCH} ${CLI} ${TESTS}
@@ -18,6 +18,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <chm_lib.h>
@@ -26,120 +28,1411 @@
 #include "nsEmbedString.h"
 #include "nsMemory.h"
 #include "nsIClassInfoImpl.h"
+#include "nsThreadUtils.h"
+#include "prinrval.h"
+#include "pratom.h"
 
 #include "csChm.h"
 #include "csChmfile.h"
+#include "csChmpool.h"
+#include "csChmaccess.h"
+#include "csChmhash.h"
+#include "csChmparser.h"
+#include "csChmnav.h"
+#include "csChmarena.h"
+#include "csChmcharset.h"
+#include "csChmmanifest.h"
+#include "csChmshelf.h"
+#include "csChmsearch.h"
+#include "csChmfts.h"
+#include "csChmstats.h"
+#include "csChmprefetch.h"
+#include "csChmSitemap.h"
 
 csChm::csChm()
 {
         /* member initializers and constructor code */
-        mHomepage = (char*)nsMemory::Clone("/", 2);
-        mBookname = (char*)nsMemory::Clone("", 1);
+        mArena = chm_arena_new();
+        mHomepage = chm_arena_string(mArena, "/");
+        mBookname = chm_arena_string(mArena, "");
         mHhc = NULL;
         mHhk = NULL;
+        mFilename = NULL;
         mLcid = 0x0409; // default: iso-8859-1
+        mExtracted = PR_FALSE;
+        mLazy = PR_FALSE;
+        mPacked = PR_FALSE;
+        mManifest = NULL;
+        mBatchDone = 0;
 }
 
 csChm::~csChm()
 {
         /* destructor code */
-        if (mHomepage)
-                nsMemory::Free(mHomepage);
+        manifest_close(mManifest);
+        chm_arena_free(mArena);
+}
+
+// A string already in mArena is only looked up, not copied
+void csChm::copyinfo(const char **mTarget, const char *iSource)
+{
+        if (iSource)
+                *mTarget = chm_arena_string(mArena, iSource);
+}
+
+// XPConnect frees what a string getter returns, so this is the one copy
+NS_IMETHODIMP csChm::getAttribute(char **attr, const char *m)
+{
+        NS_PRECONDITION(attr != nsnull, "null ptr");
+        if (!attr)
+                return NS_ERROR_NULL_POINTER;
+
+        if (m) {
+                *attr = (char*) nsMemory::Clone(m, strlen(m) + 1);
+                if (! *attr)
+                        return NS_ERROR_NULL_POINTER;
+        }
+        else {
+                *attr = nsnull;
+        }
+        return NS_OK;
+}
+
+NS_IMPL_CLASSINFO(csChm, NULL, 0, CS_CHM_CID)
+NS_IMPL_ISUPPORTS1_CI(csChm, csIChm)
+
+/*
+ * Open the archive and read the book information from its special
+ * objects.  If folder is given it is created and the sitemap files are
+ * written there, pages are served from the archive by csChmInputStream.
+ */
+static PRInt32 open_book(const char *filename, const char *folder, struct fileinfo *info)
+{
+        if (folder && chm_make_folder(folder) == -1) {
+                fprintf(stderr, "creating book folder failed, folder = %s\n", folder);
+                return -1;
+        }
+
+        struct chmFile* chmfile = chm_pool_open(filename);
+        if (!chmfile)
+                return -2;
+
+        d(printf("open_book >>> Open chmfile %s\n", filename));
+
+        info->chmfile = chmfile;
+        chm_fileinfo(info);
+        info->chmfile = NULL;
+
+        if (folder && info->hhc)
+                extract_object(chmfile, info->hhc, folder);
+        if (folder && info->hhk)
+                extract_object(chmfile, info->hhk, folder);
+
+        chm_pool_close(chmfile);
+
+        return 0;
+}
+
+/* Write what a lazily extracted book needs up front to folder */
+static PRInt32 lazy_book(const char *filename, const char *folder, const struct fileinfo *info)
+{
+        const char *paths[4];
+        int n = 0;
+
+        struct chmFile* chmfile = chm_pool_open(filename);
+        if (!chmfile)
+                return -2;
+
+        if (info->homepage)
+                paths[n++] = info->homepage;
+        if (info->hhc)
+                paths[n++] = info->hhc;
+        if (info->hhk)
+                paths[n++] = info->hhk;
+        paths[n] = NULL;
+
+        long ret = extract_chm_lazy(chmfile, folder, paths);
+        chm_pool_close(chmfile);
+
+        return ret;
+}
+
+/* Parse the sitemap at path with its names converted to UTF-8 */
+static struct sitemap *parse_sitemap(struct chmFile *chmfile, const char *path, u_int32_t lcid)
+{
+        struct sitemap *map = sitemap_parse_object(chmfile, path);
+
+        if (map)
+                sitemap_to_utf8(map, chm_lcid_charset(lcid));
+
+        return map;
+}
+
+static void init_fileinfo(struct fileinfo *info, u_int32_t lcid, struct chm_arena *arena)
+{
+        info->chmfile = NULL;
+        info->arena = arena;
+        info->homepage = NULL;
+        info->bookname = NULL;
+        info->hhc = NULL;
+        info->hhk = NULL;
+        info->lcid = lcid;
+}
+
+/* long openChm (in nsILocalFile file); */
+NS_IMETHODIMP csChm::OpenChm(nsILocalFile *file, const char *folder, PRInt32 *_retval NS_OUTPARAM)
+{
+        if (!file) {
+                *_retval = -1;
+                return NS_ERROR_NULL_POINTER;
+        }
+
+        // Get file native path from nsIFile interface
+        nsEmbedCString path;
+        file->GetNativePath(path);
+
+        // Get filename
+        mFilename = chm_arena_intern(mArena, path.get(), path.Length());
+
+        // read straight into the arena of the book
+        struct fileinfo info;
+        init_fileinfo(&info, mLcid, mArena);
+
+        *_retval = open_book(mFilename, folder, &info);
+
+        if (*_retval == -1)
+                return NS_ERROR_FAILURE;
+        if (*_retval)
+                return NS_OK;
+
+        copyinfo(&mHomepage, info.homepage);
+        copyinfo(&mBookname, info.bookname);
+        copyinfo(&mHhc, info.hhc);
+        copyinfo(&mHhk, info.hhk);
+
+        mLcid = info.lcid;
+        mToc = nsnull;
+        mIndex = nsnull;
+
+        return NS_OK;
+}
+
+/* long extractChm (in string folder); */
+NS_IMETHODIMP csChm::ExtractChm(const char *folder, PRInt32 *_retval NS_OUTPARAM)
+{
+        if (!mFilename) {
+                *_retval = -1;
+                return NS_ERROR_NOT_INITIALIZED;
+        }
+
+        struct extract_stats stats;
+        memset(&stats, 0, sizeof(stats));
+
+        long ret = extract_chm(mFilename, folder, NULL, &stats);
+        d(printf("csChm::ExtractChm >>> extract chmfile to %s, return value = %ld\n", folder, ret));
+
+        d(printf("csChm::ExtractChm >>> %lu objects, %llu bytes in %.3fs "
+                 "(enumerate %.3fs, mkdir %.3fs, extract %.3fs, %d threads)\n",
+                 stats.objects, stats.bytes, stats.total_time,
+                 stats.enumerate_time, stats.mkdir_time, stats.extract_time, stats.threads));
+
+        if (ret) {
+                fprintf(stderr, "extracting chm failed, file = %s\n", mFilename);
+                *_retval = ret;
+                return NS_ERROR_FAILURE;
+        }
+
+        mLazy = PR_FALSE;
+        mPacked = PR_FALSE;
+        *_retval = 0;
+        return NS_OK;
+}
+
+/* long packChm (in string folder); */
+NS_IMETHODIMP csChm::PackChm(const char *folder, PRInt32 *_retval NS_OUTPARAM)
+{
+        NS_ENSURE_ARG_POINTER(folder);
+
+        if (!mFilename) {
+                *_retval = -1;
+                return NS_ERROR_NOT_INITIALIZED;
+        }
+
+        struct extract_options options;
+        memset(&options, 0, sizeof(options));
+        options.pack = 1;
+
+        long ret = extract_chm(mFilename, folder, &options, NULL);
+        d(printf("csChm::PackChm >>> pack chmfile to %s, return value = %ld\n", folder, ret));
+
+        if (ret) {
+                fprintf(stderr, "packing chm failed, file = %s\n", mFilename);
+                *_retval = ret;
+                return NS_ERROR_FAILURE;
+        }
+
+        mPacked = PR_TRUE;
+        mLazy = PR_FALSE;
+        *_retval = 0;
+        return NS_OK;
+}
+
+/* long extractLazy (in string folder); */
+NS_IMETHODIMP csChm::ExtractLazy(const char *folder, PRInt32 *_retval NS_OUTPARAM)
+{
+        NS_ENSURE_ARG_POINTER(folder);
+
+        if (!mFilename) {
+                *_retval = -1;
+                return NS_ERROR_NOT_INITIALIZED;
+        }
+
+        struct fileinfo info;
+        init_fileinfo(&info, mLcid, mArena);
+        info.homepage = mHomepage;
+        info.hhc = mHhc;
+        info.hhk = mHhk;
+
+        *_retval = lazy_book(mFilename, folder, &info);
+        if (*_retval) {
+                fprintf(stderr, "lazy extraction failed, file = %s\n", mFilename);
+                return NS_ERROR_FAILURE;
+        }
+
+        mLazy = PR_TRUE;
+        mPacked = PR_FALSE;
+        manifest_close(mManifest);
+        mManifest = NULL;
+
+        return NS_OK;
+}
+
+/* Normalized archive path of an object path as pages link to it */
+static int object_path(const char *path, char *objpath)
+{
+        if (snprintf(objpath, CHM_MAX_PATHLEN + 1, "%s%s", path[0] == '/' ? "" : "/", path) >= CHM_MAX_PATHLEN + 1)
+                return -1;
+
+        chm_normalize_path(objpath);
+        return 0;
+}
+
+/* boolean hasObject (in string folder, in string path); */
+NS_IMETHODIMP csChm::HasObject(const char *folder, const char *path, PRBool *_retval NS_OUTPARAM)
+{
+        NS_ENSURE_ARG_POINTER(folder);
+        NS_ENSURE_ARG_POINTER(path);
+
+        char objpath[CHM_MAX_PATHLEN + 1];
+        if (object_path(path, objpath) == -1)
+                return NS_ERROR_FILE_NAME_TOO_LONG;
+
+        if (!mManifest)
+                mManifest = manifest_open(folder, 0);
+        if (!mManifest)
+                return NS_ERROR_FILE_ACCESS_DENIED;
+
+        *_retval = manifest_has(mManifest, objpath) ? PR_TRUE : PR_FALSE;
+        return NS_OK;
+}
+
+/*
+ * Lazy fetch
+ *
+ * csChmFetchTask extracts one object on its own thread the way
+ * csChmOpenTask opens a book.  Only the main thread touches the
+ * manifest, csChm::OnFetchDone() adds the object once it is written.
+ */
+
+class csChmFetchTask : public nsRunnable
+{
+public:
+        csChmFetchTask(csChm *chm, const char *filename, const char *folder,
+                       const char *path, csIChmFetchListener *listener);
+        ~csChmFetchTask();
+
+        NS_IMETHOD Run();
+
+        csChm *mChm;
+        char *mFolder;
+        char *mPath;
+        PRBool mFound;
+        nsCOMPtr<nsIThread> mThread;
+        nsCOMPtr<csIChmFetchListener> mListener;
+
+private:
+        char *mFilename;
+};
+
+csChmFetchTask::csChmFetchTask(csChm *chm, const char *filename, const char *folder,
+                               const char *path, csIChmFetchListener *listener)
+{
+        mChm = chm;
+        mFilename = strdup(filename);
+        mFolder = strdup(folder);
+        mPath = strdup(path);
+        mFound = PR_FALSE;
+        mListener = listener;
+}
+
+csChmFetchTask::~csChmFetchTask()
+{
+        free(mFilename);
+        free(mFolder);
+        free(mPath);
+}
+
+NS_IMETHODIMP csChmFetchTask::Run()
+{
+        if (NS_IsMainThread()) {
+                mChm->OnFetchDone(this);
+                return NS_OK;
+        }
+
+        struct chmFile* chmfile = chm_pool_open(mFilename);
+        if (chmfile) {
+                mFound = extract_object(chmfile, mPath, mFolder) == 0 ? PR_TRUE : PR_FALSE;
+                chm_pool_close(chmfile);
+        }
+
+        return NS_DispatchToMainThread(this);
+}
+
+void csChm::OnFetchDone(csChmFetchTask *task)
+{
+        d(printf("csChm::OnFetchDone >>> %s, found = %d\n", task->mPath, task->mFound));
+
+        if (task->mFound) {
+                if (!mManifest)
+                        mManifest = manifest_open(task->mFolder, 0);
+                if (mManifest)
+                        manifest_add(mManifest, task->mPath);
+        }
+
+        nsCOMPtr<csIChmFetchListener> listener;
+        listener.swap(task->mListener);
+
+        task->mThread->Shutdown();
+        task->mThread = nsnull;
+
+        if (listener)
+                listener->OnFetched(this, task->mPath, task->mFound);
+
+        // balances the reference taken by AsyncFetchObject
+        NS_RELEASE_THIS();
+}
+
+/* void asyncFetchObject (in string folder, in string path, in csIChmFetchListener listener); */
+NS_IMETHODIMP csChm::AsyncFetchObject(const char *folder, const char *path, csIChmFetchListener *listener)
+{
+        NS_ENSURE_ARG_POINTER(folder);
+        NS_ENSURE_ARG_POINTER(path);
+
+        if (!mFilename)
+                return NS_ERROR_NOT_INITIALIZED;
+
+        char objpath[CHM_MAX_PATHLEN + 1];
+        if (object_path(path, objpath) == -1)
+                return NS_ERROR_FILE_NAME_TOO_LONG;
+
+        nsRefPtr<csChmFetchTask> task = new csChmFetchTask(this, mFilename, folder, objpath, listener);
+
+        nsresult rv = NS_NewThread(getter_AddRefs(task->mThread), task);
+        if (NS_FAILED(rv))
+                return rv;
+
+        NS_ADDREF_THIS();
+        return NS_OK;
+}
+
+/*
+ * Asynchronous open
+ *
+ * csChmOpenTask runs open_book() and the full or lazy extraction on its
+ * own thread, then dispatches itself back to the main thread where
+ * csChm::OnOpenDone() takes over the book information.  Progress is
+ * posted to the main thread at most every 100ms.
+ */
+
+class csChmOpenTask : public nsRunnable
+{
+public:
+        csChmOpenTask(csChm *chm, const char *filename, const char *folder, PRInt32 mode);
+        ~csChmOpenTask();
+
+        NS_IMETHOD Run();
+
+        csChm *mChm;
+        struct fileinfo mInfo;
+        PRInt32 mMode;
+        PRInt32 mStatus;
+        volatile int mCancel;
+        PRIntervalTime mLastProgress;
+
+private:
+        char *mFilename;
+        char *mFolder;
+};
+
+class csChmProgressEvent : public nsRunnable
+{
+public:
+        csChmProgressEvent(csChm *chm,
+                           PRUint64 bytes, PRUint64 totalBytes,
+                           PRUint32 objects, PRUint32 totalObjects)
+                : mChm(chm), mBytes(bytes), mTotalBytes(totalBytes),
+                  mObjects(objects), mTotalObjects(totalObjects) {}
+
+        NS_IMETHOD Run()
+        {
+                mChm->OnOpenProgress(mBytes, mTotalBytes, mObjects, mTotalObjects);
+                return NS_OK;
+        }
+
+private:
+        csChm *mChm;
+        PRUint64 mBytes;
+        PRUint64 mTotalBytes;
+        PRUint32 mObjects;
+        PRUint32 mTotalObjects;
+};
+
+static void open_progress(unsigned long objects, unsigned long total_objects,
+                          unsigned long long bytes, unsigned long long total_bytes,
+                          void *data)
+{
+        csChmOpenTask *task = (csChmOpenTask *)data;
+        PRIntervalTime now = PR_IntervalNow();
+
+        if (objects < total_objects
+            && PR_IntervalToMilliseconds(now - task->mLastProgress) < 100)
+                return;
+
+        task->mLastProgress = now;
+
+        nsCOMPtr<nsIRunnable> event = new csChmProgressEvent(task->mChm,
+                                                             bytes, total_bytes,
+                                                             objects, total_objects);
+        NS_DispatchToMainThread(event);
+}
+
+csChmOpenTask::csChmOpenTask(csChm *chm, const char *filename, const char *folder, PRInt32 mode)
+{
+        mChm = chm;
+        mFilename = strdup(filename);
+        mFolder = folder ? strdup(folder) : NULL;
+        mMode = mode;
+        mStatus = 0;
+        mCancel = 0;
+        mLastProgress = PR_IntervalNow();
+
+        init_fileinfo(&mInfo, 0x0409, NULL);
+}
+
+csChmOpenTask::~csChmOpenTask()
+{
+        free(mFilename);
+        free(mFolder);
+        chm_arena_free(mInfo.arena);
+}
+
+NS_IMETHODIMP csChmOpenTask::Run()
+{
+        if (NS_IsMainThread()) {
+                mChm->OnOpenDone(this);
+                return NS_OK;
+        }
+
+        // lazy_book() writes the sitemaps itself
+        mStatus = open_book(mFilename, mMode == csIChm::OPEN_LAZY ? NULL : mFolder, &mInfo);
+
+        if (mStatus == 0 && (mMode == csIChm::OPEN_EXTRACT || mMode == csIChm::OPEN_PACK) && !mCancel) {
+                struct extract_options options;
+                options.progress = open_progress;
+                options.progress_data = this;
+                options.cancel = &mCancel;
+                options.pack = mMode == csIChm::OPEN_PACK;
+
+                mStatus = extract_chm(mFilename, mFolder, &options, NULL);
+        } else if (mStatus == 0 && mMode == csIChm::OPEN_LAZY && !mCancel) {
+                mStatus = lazy_book(mFilename, mFolder, &mInfo);
+        }
+
+        if (mCancel)
+                mStatus = EXTRACT_CANCELLED;
+
+        return NS_DispatchToMainThread(this);
+}
+
+void csChm::OnOpenProgress(PRUint64 bytes, PRUint64 totalBytes, PRUint32 objects, PRUint32 totalObjects)
+{
+        if (mListener)
+                mListener->OnProgress(this, bytes, totalBytes, objects, totalObjects);
+}
+
+void csChm::OnOpenDone(csChmOpenTask *task)
+{
+        PRInt32 status = task->mStatus;
+
+        d(printf("csChm::OnOpenDone >>> status = %d\n", status));
+
+        if (status == 0) {
+                copyinfo(&mHomepage, task->mInfo.homepage);
+                copyinfo(&mBookname, task->mInfo.bookname);
+                copyinfo(&mHhc, task->mInfo.hhc);
+                copyinfo(&mHhk, task->mInfo.hhk);
+
+                mLcid = task->mInfo.lcid;
+                mToc = nsnull;
+                mIndex = nsnull;
+
+                mLazy = task->mMode == OPEN_LAZY;
+                mPacked = task->mMode == OPEN_PACK;
+                manifest_close(mManifest);
+                mManifest = NULL;
+        }
+
+        nsCOMPtr<csIChmOpenListener> listener = mListener;
+        mListener = nsnull;
+
+        if (mThread) {
+                mThread->Shutdown();
+                mThread = nsnull;
+        }
+        mTask = nsnull;
+
+        if (listener)
+                listener->OnOpened(this, status);
+
+        // balances the reference taken by AsyncOpenChm
+        NS_RELEASE_THIS();
+}
+
+/* void asyncOpenChm (in nsILocalFile file, in string folder, in long mode, in csIChmOpenListener listener); */
+NS_IMETHODIMP csChm::AsyncOpenChm(nsILocalFile *file, const char *folder, PRInt32 mode, csIChmOpenListener *listener)
+{
+        NS_ENSURE_ARG_POINTER(file);
+        if (mode < OPEN_INFO || mode > OPEN_PACK || (mode != OPEN_INFO && !folder))
+                return NS_ERROR_INVALID_ARG;
+
+        if (mTask)
+                return NS_ERROR_IN_PROGRESS;
+
+        nsEmbedCString path;
+        file->GetNativePath(path);
+
+        mFilename = chm_arena_intern(mArena, path.get(), path.Length());
+
+        mTask = new csChmOpenTask(this, mFilename, folder, mode);
+        mListener = listener;
+
+        nsresult rv = NS_NewThread(getter_AddRefs(mThread), mTask);
+        if (NS_FAILED(rv)) {
+                mTask = nsnull;
+                mListener = nsnull;
+                return rv;
+        }
+
+        NS_ADDREF_THIS();
+        return NS_OK;
+}
+
+/*
+ * Batch open
+ *
+ * csChmBatchTask opens the books of a session on up to
+ * CHM_BATCH_THREADS threads, each taking the next book until none is
+ * left: fingerprint it, map its navigation cache, or open, extract and
+ * cache it as the application does for a single book.  Every finished
+ * book is posted to the main thread, where csChm::OnBatchBook() hands a
+ * new csChm made of it to the listener, so books show up in the order
+ * they finish rather than the order asked.
+ */
+
+struct batch_book
+{
+        char *folder;
+        struct navinfo info;
+        struct sitemap *toc;
+        struct sitemap *index;
+        PRInt32 status;
+};
+
+class csChmBatchTask : public nsRunnable
+{
+public:
+        csChmBatchTask(csChm *chm, PRUint32 count, const char **paths,
+                       const char *bookshelf, PRInt32 mode, PRUint32 first);
+        ~csChmBatchTask();
+
+        NS_IMETHOD Run();
+
+        PRUint32 mCount;
+        struct batch_book *mBooks;
+
+private:
+        csChm *mChm;
+        char **mPaths;
+        char *mBookshelf;
+        PRInt32 mMode;
+        PRUint32 mFirst;
+        PRInt32 mNext;
+};
+
+class csChmBatchEvent : public nsRunnable
+{
+public:
+        csChmBatchEvent(csChm *chm, PRUint32 index) : mChm(chm), mIndex(index) {}
+
+        NS_IMETHOD Run()
+        {
+                mChm->OnBatchBook(mIndex);
+                return NS_OK;
+        }
+
+private:
+        csChm *mChm;
+        PRUint32 mIndex;
+};
+
+/* Navigation cache flags of a book opened in mode */
+static u_int32_t mode_flags(PRInt32 mode)
+{
+        switch (mode) {
+        case csIChm::OPEN_EXTRACT:
+                return NAV_EXTRACTED;
+        case csIChm::OPEN_LAZY:
+                return NAV_EXTRACTED | NAV_LAZY;
+        case csIChm::OPEN_PACK:
+                return NAV_EXTRACTED | NAV_PACKED;
+        default:
+                return 0;
+        }
+}
+
+/*
+ * Fill book with the navigation cache of the chm file or bookshelf
+ * folder at path, creating it first if the book was never opened or,
+ * for a chm file, was opened in another mode.
+ */
+static PRInt32 batch_open(const char *path, const char *bookshelf, PRInt32 mode, struct batch_book *book)
+{
+        char folder[1024], navpath[1024];
+        struct stat statbuf;
+
+        chm_stats_add(CHM_STAT_STATS, 1);
+        if (stat(path, &statbuf) == -1)
+                return -2;
+
+        if (S_ISDIR(statbuf.st_mode)) {
+                if (snprintf(folder, sizeof(folder), "%s", path) >= (int)sizeof(folder))
+                        return -2;
+        } else {
+                char cache[1024], fingerprint[CHM_FINGERPRINT_LEN + 1];
+
+                if (snprintf(cache, sizeof(cache), "%s/fingerprints", bookshelf) >= (int)sizeof(cache)
+                    || chm_fingerprint(path, cache, fingerprint) == -1
+                    || snprintf(folder, sizeof(folder), "%s/%s", bookshelf, fingerprint) >= (int)sizeof(folder))
+                        return -2;
+        }
+
+        book->folder = strdup(folder);
+        if (snprintf(navpath, sizeof(navpath), "%s/" NAV_CACHE_FILE, folder) >= (int)sizeof(navpath))
+                return -2;
+
+        // a folder is only known by its cache, it stays in the mode it was opened in
+        if (nav_load(navpath, &book->info, &book->toc, &book->index) == 0 && book->info.chmfile
+            && (S_ISDIR(statbuf.st_mode) || book->info.flags == mode_flags(mode))) {
+                // the folder is named by content, the book may have moved since
+                if (!S_ISDIR(statbuf.st_mode) && strcmp(book->info.chmfile, path) != 0) {
+                        book->info.chmfile = chm_arena_string(book->info.arena, path);
+                        nav_save(navpath, &book->info, book->toc, book->index);
+                }
+                shelf_touch(folder);
+                return 0;
+        }
+        sitemap_free(book->toc);
+        sitemap_free(book->index);
+        book->toc = book->index = NULL;
+
+        // a folder is only known by its cache
+        if (S_ISDIR(statbuf.st_mode))
+                return -2;
+
+        if (!book->info.arena && !(book->info.arena = chm_arena_new()))
+                return -2;
+
+        struct fileinfo info;
+        init_fileinfo(&info, 0x0409, book->info.arena);
+
+        PRInt32 status = open_book(path, mode == csIChm::OPEN_LAZY ? NULL : folder, &info);
+        if (status == 0 && (mode == csIChm::OPEN_EXTRACT || mode == csIChm::OPEN_PACK)) {
+                struct extract_options options;
+                memset(&options, 0, sizeof(options));
+                options.pack = mode == csIChm::OPEN_PACK;
+
+                status = extract_chm(path, folder, &options, NULL);
+        } else if (status == 0 && mode == csIChm::OPEN_LAZY) {
+                status = lazy_book(path, folder, &info);
+        }
+
+        if (status == 0) {
+                struct chmFile *chmfile = chm_pool_open(path);
+                if (chmfile && info.hhc)
+                        book->toc = parse_sitemap(chmfile, info.hhc, info.lcid);
+                if (chmfile && info.hhk)
+                        book->index = parse_sitemap(chmfile, info.hhk, info.lcid);
+                if (chmfile)
+                        chm_pool_close(chmfile);
+
+                book->info.chmfile = chm_arena_string(book->info.arena, path);
+                book->info.homepage = info.homepage ? info.homepage : "/";
+                book->info.bookname = info.bookname ? info.bookname : "";
+                book->info.hhc = info.hhc;
+                book->info.hhk = info.hhk;
+                book->info.lcid = info.lcid;
+                book->info.flags = mode_flags(mode);
+
+                if (nav_save(navpath, &book->info, book->toc, book->index) == 0)
+                        shelf_touch(folder);
+        }
+
+        return status;
+}
+
+csChmBatchTask::csChmBatchTask(csChm *chm, PRUint32 count, const char **paths,
+                               const char *bookshelf, PRInt32 mode, PRUint32 first)
+{
+        mChm = chm;
+        mCount = count;
+        mBooks = (struct batch_book *)calloc(count ? count : 1, sizeof(struct batch_book));
+        mPaths = (char **)malloc((count ? count : 1) * sizeof(char *));
+        for (PRUint32 i = 0; i < count; i++)
+                mPaths[i] = strdup(paths[i] ? paths[i] : "");
+        mBookshelf = strdup(bookshelf);
+        mMode = mode;
+        mFirst = first < count ? first : 0;
+        mNext = 0;
+}
+
+csChmBatchTask::~csChmBatchTask()
+{
+        for (PRUint32 i = 0; i < mCount; i++) {
+                struct batch_book *book = mBooks + i;
+
+                free(book->folder);
+                chm_arena_free(book->info.arena);
+                sitemap_free(book->toc);
+                sitemap_free(book->index);
+                free(mPaths[i]);
+        }
+        free(mBooks);
+        free(mPaths);
+        free(mBookshelf);
+}
+
+// Run by every batch thread at once
+NS_IMETHODIMP csChmBatchTask::Run()
+{
+        for (;;) {
+                PRUint32 n = (PRUint32)PR_AtomicIncrement(&mNext) - 1;
+                if (n >= mCount)
+                        break;
+
+                // paths[first] before the others
+                PRUint32 i = n == 0 ? mFirst : n <= mFirst ? n - 1 : n;
+
+                u_int64_t begin = chm_stats_clock();
+                mBooks[i].status = batch_open(mPaths[i], mBookshelf, mMode, mBooks + i);
+                chm_trace_event("batch_open", begin, chm_stats_clock(), mPaths[i]);
+
+                nsCOMPtr<nsIRunnable> event = new csChmBatchEvent(mChm, i);
+                NS_DispatchToMainThread(event);
+        }
+
+        return NS_OK;
+}
+
+void csChm::OnBatchBook(PRUint32 index)
+{
+        struct batch_book *book = mBatchTask->mBooks + index;
+        nsRefPtr<csChm> chm;
+
+        d(printf("csChm::OnBatchBook >>> %u: %s, status = %d\n", index, book->folder, book->status));
+
+        if (book->status == 0) {
+                chm = new csChm();
+                chm->TakeNavInfo(&book->info, book->toc, book->index);
+                book->toc = book->index = NULL;
+        }
+
+        if (mBatchListener)
+                mBatchListener->OnBookOpened(index, chm, book->folder, book->status);
+
+        if (++mBatchDone < mBatchTask->mCount)
+                return;
+
+        for (PRUint32 i = 0; i < CHM_BATCH_THREADS; i++) {
+                if (mBatchThreads[i]) {
+                        mBatchThreads[i]->Shutdown();
+                        mBatchThreads[i] = nsnull;
+                }
+        }
+        mBatchTask = nsnull;
+        mBatchListener = nsnull;
+
+        // balances the reference taken by OpenBooks
+        NS_RELEASE_THIS();
+}
 
-        if (mBookname)
-                nsMemory::Free(mBookname);
+/* void openBooks (in unsigned long count, [array, size_is (count)] in string paths, in string bookshelf, in long mode, in unsigned long first, in csIChmBatchListener listener); */
+NS_IMETHODIMP csChm::OpenBooks(PRUint32 count, const char **paths, const char *bookshelf,
+                               PRInt32 mode, PRUint32 first, csIChmBatchListener *listener)
+{
+        NS_ENSURE_ARG_POINTER(bookshelf);
+        if (mode < OPEN_INFO || mode > OPEN_PACK)
+                return NS_ERROR_INVALID_ARG;
+
+        if (mBatchTask)
+                return NS_ERROR_IN_PROGRESS;
+        if (count == 0)
+                return NS_OK;
+
+        mBatchTask = new csChmBatchTask(this, count, paths, bookshelf, mode, first);
+        mBatchListener = listener;
+        mBatchDone = 0;
 
-        if (mHhc)
-                nsMemory::Free(mHhc);
+        PRUint32 threads = count < CHM_BATCH_THREADS ? count : CHM_BATCH_THREADS;
+        for (PRUint32 i = 0; i < threads; i++) {
+                nsresult rv = NS_NewThread(getter_AddRefs(mBatchThreads[i]), mBatchTask);
+                if (NS_FAILED(rv)) {
+                        if (i > 0)
+                                break;
+                        mBatchTask = nsnull;
+                        mBatchListener = nsnull;
+                        return rv;
+                }
+        }
 
-        if (mHhk)
-                nsMemory::Free(mHhk);
+        NS_ADDREF_THIS();
+        return NS_OK;
 }
 
-void csChm::copyinfo(char **mTarget, char *iSource)
+/*
+ * Full-text indexing
+ *
+ * csChmSearchTask runs search_build() on its own thread the same way
+ * csChmOpenTask opens a book, progress is posted at most every 100ms.
+ */
+
+class csChmSearchTask : public nsRunnable
 {
-        if (iSource) {
-                if (*mTarget) {
-                        nsMemory::Free(*mTarget);
-                }
+public:
+        csChmSearchTask(csChm *chm, const char *filename, const char *folder, PRUint32 lcid);
+        ~csChmSearchTask();
+
+        NS_IMETHOD Run();
+
+        csChm *mChm;
+        PRInt32 mStatus;
+        volatile int mCancel;
+        PRIntervalTime mLastProgress;
+
+private:
+        char *mFilename;
+        char *mIndexPath;
+        PRUint32 mLcid;
+};
+
+class csChmSearchProgressEvent : public nsRunnable
+{
+public:
+        csChmSearchProgressEvent(csChm *chm, PRUint32 docs, PRUint32 totalDocs)
+                : mChm(chm), mDocs(docs), mTotalDocs(totalDocs) {}
 
-                *mTarget = (char*) nsMemory::Clone(iSource, strlen(iSource) + 1);
-                free(iSource);
+        NS_IMETHOD Run()
+        {
+                mChm->OnSearchProgress(mDocs, mTotalDocs);
+                return NS_OK;
         }
+
+private:
+        csChm *mChm;
+        PRUint32 mDocs;
+        PRUint32 mTotalDocs;
+};
+
+static void search_progress(unsigned long docs, unsigned long total_docs, void *data)
+{
+        csChmSearchTask *task = (csChmSearchTask *)data;
+        PRIntervalTime now = PR_IntervalNow();
+
+        if (docs < total_docs
+            && PR_IntervalToMilliseconds(now - task->mLastProgress) < 100)
+                return;
+
+        task->mLastProgress = now;
+
+        nsCOMPtr<nsIRunnable> event = new csChmSearchProgressEvent(task->mChm, docs, total_docs);
+        NS_DispatchToMainThread(event);
 }
 
-NS_IMETHODIMP csChm::getAttribute(char **attr, char *m)
+csChmSearchTask::csChmSearchTask(csChm *chm, const char *filename, const char *folder, PRUint32 lcid)
 {
-        NS_PRECONDITION(attr != nsnull, "null ptr");
-        if (!attr)
-                return NS_ERROR_NULL_POINTER;
+        mChm = chm;
+        mFilename = strdup(filename);
+        mIndexPath = (char *)malloc(strlen(folder) + sizeof("/" SEARCH_INDEX_FILE));
+        sprintf(mIndexPath, "%s/" SEARCH_INDEX_FILE, folder);
+        mLcid = lcid;
+        mStatus = 0;
+        mCancel = 0;
+        mLastProgress = PR_IntervalNow();
+}
 
-        if (m) {
-                *attr = (char*) nsMemory::Clone(m, strlen(m) + 1);
-                if (! *attr)
-                        return NS_ERROR_NULL_POINTER;
+csChmSearchTask::~csChmSearchTask()
+{
+        free(mFilename);
+        free(mIndexPath);
+}
+
+NS_IMETHODIMP csChmSearchTask::Run()
+{
+        if (NS_IsMainThread()) {
+                mChm->OnSearchDone(this);
+                return NS_OK;
         }
-        else {
-                *attr = nsnull;
+
+        struct search_options options;
+        memset(&options, 0, sizeof(options));
+        options.progress = search_progress;
+        options.progress_data = this;
+        options.cancel = &mCancel;
+
+        mStatus = search_build(mFilename, mIndexPath, mLcid, &options);
+
+        return NS_DispatchToMainThread(this);
+}
+
+void csChm::OnSearchProgress(PRUint32 docs, PRUint32 totalDocs)
+{
+        if (mSearchListener)
+                mSearchListener->OnProgress(this, docs, totalDocs);
+}
+
+void csChm::OnSearchDone(csChmSearchTask *task)
+{
+        PRInt32 status = task->mStatus;
+
+        d(printf("csChm::OnSearchDone >>> status = %d\n", status));
+
+        nsCOMPtr<csIChmSearchListener> listener = mSearchListener;
+        mSearchListener = nsnull;
+
+        if (mSearchThread) {
+                mSearchThread->Shutdown();
+                mSearchThread = nsnull;
+        }
+        mSearchTask = nsnull;
+
+        if (listener)
+                listener->OnIndexed(this, status);
+
+        // balances the reference taken by BuildSearchIndex
+        NS_RELEASE_THIS();
+}
+
+/* void buildSearchIndex (in string folder, in csIChmSearchListener listener); */
+NS_IMETHODIMP csChm::BuildSearchIndex(const char *folder, csIChmSearchListener *listener)
+{
+        NS_ENSURE_ARG_POINTER(folder);
+
+        if (!mFilename)
+                return NS_ERROR_NOT_INITIALIZED;
+        if (mSearchTask)
+                return NS_ERROR_IN_PROGRESS;
+
+        mSearchTask = new csChmSearchTask(this, mFilename, folder, mLcid);
+        mSearchListener = listener;
+
+        nsresult rv = NS_NewThread(getter_AddRefs(mSearchThread), mSearchTask);
+        if (NS_FAILED(rv)) {
+                mSearchTask = nsnull;
+                mSearchListener = nsnull;
+                return rv;
         }
+
+        NS_ADDREF_THIS();
         return NS_OK;
 }
 
-NS_IMPL_CLASSINFO(csChm, NULL, 0, CS_CHM_CID)
-NS_IMPL_ISUPPORTS1_CI(csChm, csIChm)
+/* csIChmSitemap search (in string folder, in ACString query, in unsigned long limit); */
+NS_IMETHODIMP csChm::Search(const char *folder, const nsACString & query, PRUint32 limit, csIChmSitemap **_retval NS_OUTPARAM)
+{
+        NS_ENSURE_ARG_POINTER(folder);
 
-/* long openChm (in nsILocalFile file); */
-NS_IMETHODIMP csChm::OpenChm(nsILocalFile *file, const char *folder, PRInt32 *_retval NS_OUTPARAM)
+        nsEmbedCString path(folder);
+        path.Append("/" SEARCH_INDEX_FILE);
+
+        struct search_index *index = search_open(path.get());
+        if (!index) {
+                *_retval = nsnull;
+                return NS_OK;
+        }
+
+        struct search_result *results = (struct search_result *)malloc((limit + 1) * sizeof(struct search_result));
+        nsEmbedCString text(query);
+        PRUint32 count = search_query(index, text.get(), results, limit);
+
+        struct sitemap *map = sitemap_new();
+        for (PRUint32 i = 0; i < count; i++) {
+                const char *title = search_doc_title(index, results[i].doc);
+                const char *local = search_doc_path(index, results[i].doc);
+
+                sitemap_append(map, 0, *title ? title : local, local);
+        }
+
+        free(results);
+        search_close(index);
+        sitemap_to_utf8(map, chm_lcid_charset(mLcid));
+
+        NS_ADDREF(*_retval = new csChmSitemap(map));
+        return NS_OK;
+}
+
+/* csIChmSitemap searchBuiltin (in ACString query, in boolean partial, in unsigned long limit); */
+NS_IMETHODIMP csChm::SearchBuiltin(const nsACString & query, PRBool partial, PRUint32 limit, csIChmSitemap **_retval NS_OUTPARAM)
 {
-        if (!file) {
-                *_retval = -1;
-                return NS_ERROR_NULL_POINTER;
+        if (!mFilename)
+                return NS_ERROR_NOT_INITIALIZED;
+
+        struct chmFile *chmfile = chm_pool_open(mFilename);
+        if (!chmfile)
+                return NS_ERROR_FILE_CORRUPTED;
+
+        nsEmbedCString text(query);
+        struct sitemap *map = sitemap_new();
+
+        if (fts_search(chmfile, text.get(), partial, map, limit) == -1) {
+                sitemap_free(map);
+                *_retval = nsnull;
+        } else {
+                sitemap_to_utf8(map, chm_lcid_charset(mLcid));
+                NS_ADDREF(*_retval = new csChmSitemap(map));
         }
 
-        // Get file native path from nsIFile interface
+        chm_pool_close(chmfile);
+        return NS_OK;
+}
+
+/* void cancel (); */
+NS_IMETHODIMP csChm::Cancel()
+{
+        if (mTask)
+                mTask->mCancel = 1;
+        if (mSearchTask)
+                mSearchTask->mCancel = 1;
+
+        return NS_OK;
+}
+
+/* ACString fingerprint (in nsILocalFile file, in string cacheFile); */
+NS_IMETHODIMP csChm::Fingerprint(nsILocalFile *file, const char *cacheFile, nsACString &_retval NS_OUTPARAM)
+{
+        NS_ENSURE_ARG_POINTER(file);
+
         nsEmbedCString path;
         file->GetNativePath(path);
 
-        // Get filename
-        char *filename = NS_CStringCloneData(path);
+        char fingerprint[CHM_FINGERPRINT_LEN + 1];
+        if (chm_fingerprint(path.get(), cacheFile, fingerprint) == -1)
+                return NS_ERROR_FILE_CORRUPTED;
 
-        struct chmFile* chmfile = chm_open(filename);
-        if (!chmfile) {
-                *_retval = -2;
-                return NS_OK;
-        }
+        _retval.Assign(fingerprint);
+        return NS_OK;
+}
 
-        d(printf("csChm::OpenChm >>> Open chmfile %s\n", filename));
+/* csIChmSitemap parseSitemap (in string path); */
+NS_IMETHODIMP csChm::ParseSitemap(const char *path, csIChmSitemap **_retval NS_OUTPARAM)
+{
+        NS_ENSURE_ARG_POINTER(path);
 
-        long ret = extract_chm(filename, folder);
-        d(printf("csChm::OpenChm >>> extract chmfile to %s, return value = %ld\n", folder, ret));
+        if (!mFilename)
+                return NS_ERROR_NOT_INITIALIZED;
 
-        if (ret) {
-                fprintf(stderr, "extracting chm failed, file = %s\n", filename);
-                return NS_ERROR_FAILURE;
-        }
+        struct chmFile *chmfile = chm_pool_open(mFilename);
+        if (!chmfile)
+                return NS_ERROR_FILE_CORRUPTED;
 
-        struct fileinfo *info = (struct fileinfo *)malloc(sizeof(struct fileinfo));
-        info->bookfolder = folder;
-        info->homepage = NULL;
-        info->bookname = NULL;
-        info->hhc = NULL;
-        info->hhk = NULL;
+        struct sitemap *map = parse_sitemap(chmfile, path, mLcid);
+        chm_pool_close(chmfile);
 
-        chm_fileinfo(info);
+        if (!map)
+                return NS_ERROR_FILE_NOT_FOUND;
+
+        NS_ADDREF(*_retval = new csChmSitemap(map));
+        return NS_OK;
+}
 
+/*
+ * Take over book information and sitemaps read from a navigation cache,
+ * the strings are interned in mArena whichever arena info has them in
+ */
+void csChm::TakeNavInfo(struct navinfo *info, struct sitemap *toc, struct sitemap *index)
+{
+        copyinfo(&mFilename, info->chmfile);
         copyinfo(&mHomepage, info->homepage);
         copyinfo(&mBookname, info->bookname);
         copyinfo(&mHhc, info->hhc);
         copyinfo(&mHhk, info->hhk);
 
         mLcid = info->lcid;
+        mExtracted = (info->flags & NAV_EXTRACTED) ? PR_TRUE : PR_FALSE;
+        mLazy = (info->flags & NAV_LAZY) ? PR_TRUE : PR_FALSE;
+        mPacked = (info->flags & NAV_PACKED) ? PR_TRUE : PR_FALSE;
+        manifest_close(mManifest);
+        mManifest = NULL;
+
+        mToc = toc ? new csChmSitemap(toc) : nsnull;
+        mIndex = index ? new csChmSitemap(index) : nsnull;
+}
+
+/* boolean loadNavCache (in string folder, in string chmfile); */
+NS_IMETHODIMP csChm::LoadNavCache(const char *folder, const char *chmfile, PRBool *_retval NS_OUTPARAM)
+{
+        NS_ENSURE_ARG_POINTER(folder);
+
+        nsEmbedCString path(folder);
+        path.Append("/" NAV_CACHE_FILE);
+
+        struct navinfo info;
+        struct sitemap *toc, *index;
+
+        // read straight into the arena of the book
+        info.arena = mArena;
+        *_retval = PR_FALSE;
+        if (nav_load(path.get(), &info, &toc, &index) == -1 || !info.chmfile)
+                return NS_OK;
+
+        // the folder is named by content, the book may have moved since
+        if (chmfile && strcmp(info.chmfile, chmfile) != 0) {
+                d(printf("csChm::LoadNavCache >>> %s moved to %s\n", info.chmfile, chmfile));
+                info.chmfile = chm_arena_string(mArena, chmfile);
+                nav_save(path.get(), &info, toc, index);
+        }
+
+        TakeNavInfo(&info, toc, index);
+
+        shelf_touch(folder);
+
+        *_retval = PR_TRUE;
+        return NS_OK;
+}
+
+/* void saveNavCache (in string folder, in boolean extracted); */
+NS_IMETHODIMP csChm::SaveNavCache(const char *folder, PRBool extracted)
+{
+        NS_ENSURE_ARG_POINTER(folder);
+
+        if (!mFilename)
+                return NS_ERROR_NOT_INITIALIZED;
+
+        nsCOMPtr<csIChmSitemap> toc, index;
+        GetToc(getter_AddRefs(toc));
+        GetIndex(getter_AddRefs(index));
+
+        mExtracted = extracted;
+
+        struct navinfo info;
+        info.arena = mArena;
+        info.chmfile = mFilename;
+        info.homepage = mHomepage;
+        info.bookname = mBookname;
+        info.hhc = mHhc;
+        info.hhk = mHhk;
+        info.lcid = mLcid;
+        info.flags = extracted ? NAV_EXTRACTED : 0;
+        if (extracted && mLazy)
+                info.flags |= NAV_LAZY;
+        if (extracted && mPacked)
+                info.flags |= NAV_PACKED;
+
+        // a book opened without sitemaps may have had nothing written yet
+        if (chm_make_folder(folder) == -1)
+                return NS_ERROR_FILE_ACCESS_DENIED;
+
+        nsEmbedCString path(folder);
+        path.Append("/" NAV_CACHE_FILE);
+
+        if (nav_save(path.get(), &info,
+                     toc ? static_cast<csChmSitemap*>(toc.get())->Sitemap() : NULL,
+                     index ? static_cast<csChmSitemap*>(index.get())->Sitemap() : NULL) == -1)
+                return NS_ERROR_FILE_ACCESS_DENIED;
+
+        shelf_touch(folder);
+
+        return NS_OK;
+}
+
+/*
+ * Bookshelf garbage collection
+ *
+ * csChmShelfTask runs shelf_collect() on its own thread and comes back to
+ * the main thread to have the thread shut down, nobody waits for it.
+ */
+
+class csChmShelfTask : public nsRunnable
+{
+public:
+        csChmShelfTask(csChm *chm, const char *bookshelf, PRUint64 budget,
+                       PRUint32 count, const char **keep);
+        ~csChmShelfTask();
+
+        NS_IMETHOD Run();
+
+private:
+        csChm *mChm;
+        char *mBookshelf;
+        PRUint64 mBudget;
+        char **mKeep;
+        PRUint32 mCount;
+};
+
+csChmShelfTask::csChmShelfTask(csChm *chm, const char *bookshelf, PRUint64 budget,
+                               PRUint32 count, const char **keep)
+{
+        mChm = chm;
+        mBookshelf = strdup(bookshelf);
+        mBudget = budget;
+        mCount = count;
+        mKeep = (char **)malloc((count ? count : 1) * sizeof(char *));
+        for (PRUint32 i = 0; i < count; i++)
+                mKeep[i] = strdup(keep[i] ? keep[i] : "");
+}
+
+csChmShelfTask::~csChmShelfTask()
+{
+        for (PRUint32 i = 0; i < mCount; i++)
+                free(mKeep[i]);
+        free(mKeep);
+        free(mBookshelf);
+}
+
+NS_IMETHODIMP csChmShelfTask::Run()
+{
+        if (NS_IsMainThread()) {
+                mChm->OnShelfDone(this);
+                return NS_OK;
+        }
+
+        struct shelf_stats stats;
+        int ret = shelf_collect(mBookshelf, mBudget, mKeep, mCount, &stats);
+
+        if (ret == 0)
+                d(printf("csChmShelfTask::Run >>> %s: %lu books, %llu bytes, evicted %lu books, %llu bytes\n",
+                         mBookshelf, stats.books, stats.bytes, stats.evicted, stats.evicted_bytes));
+        else if (ret == -1)
+                fprintf(stderr, "collecting bookshelf failed: %s\n", mBookshelf);
+
+        return NS_DispatchToMainThread(this);
+}
+
+void csChm::OnShelfDone(csChmShelfTask *task)
+{
+        if (mShelfThread) {
+                mShelfThread->Shutdown();
+                mShelfThread = nsnull;
+        }
+        mShelfTask = nsnull;
+
+        // balances the reference taken by CollectBookshelf
+        NS_RELEASE_THIS();
+}
+
+/* void collectBookshelf (in string bookshelf, in PRUint64 budget, in PRUint32 count, [array, size_is (count)] in string keep); */
+NS_IMETHODIMP csChm::CollectBookshelf(const char *bookshelf, PRUint64 budget, PRUint32 count, const char **keep)
+{
+        NS_ENSURE_ARG_POINTER(bookshelf);
+
+        if (mShelfTask)
+                return NS_ERROR_IN_PROGRESS;
+
+        mShelfTask = new csChmShelfTask(this, bookshelf, budget, count, keep);
+
+        nsresult rv = NS_NewThread(getter_AddRefs(mShelfThread), mShelfTask);
+        if (NS_FAILED(rv)) {
+                mShelfTask = nsnull;
+                return rv;
+        }
+
+        NS_ADDREF_THIS();
+        return NS_OK;
+}
+
+/* void prefetch (in string folder, in unsigned long entry, in unsigned long pages); */
+NS_IMETHODIMP csChm::Prefetch(const char *folder, PRUint32 entry, PRUint32 pages)
+{
+        if (!mFilename)
+                return NS_ERROR_NOT_INITIALIZED;
+
+        nsCOMPtr<csIChmSitemap> toc;
+        GetToc(getter_AddRefs(toc));
+        if (!toc)
+                return NS_OK;
+
+        enum chm_prefetch_source source = CHM_PREFETCH_ARCHIVE;
+        if (mExtracted && folder)
+                source = mPacked ? CHM_PREFETCH_PACK : CHM_PREFETCH_FOLDER;
+
+        chm_prefetch(mFilename, folder, source,
+                     static_cast<csChmSitemap*>(toc.get())->Sitemap(), entry, pages);
+
+        return NS_OK;
+}
+
+/* readonly attribute csIChmSitemap toc; */
+NS_IMETHODIMP csChm::GetToc(csIChmSitemap **aToc)
+{
+        if (!mToc && mHhc)
+                ParseSitemap(mHhc, getter_AddRefs(mToc));
+
+        NS_IF_ADDREF(*aToc = mToc);
+        return NS_OK;
+}
+
+/* readonly attribute csIChmSitemap index; */
+NS_IMETHODIMP csChm::GetIndex(csIChmSitemap **aIndex)
+{
+        if (!mIndex && mHhk)
+                ParseSitemap(mHhk, getter_AddRefs(mIndex));
+
+        NS_IF_ADDREF(*aIndex = mIndex);
+        return NS_OK;
+}
+
+/* readonly attribute string chmfile; */
+NS_IMETHODIMP csChm::GetChmfile(char **aChmfile)
+{
+        return getAttribute(aChmfile, mFilename);
+}
 
-        free(info);
+/* readonly attribute boolean extracted; */
+NS_IMETHODIMP csChm::GetExtracted(PRBool *aExtracted)
+{
+        *aExtracted = mExtracted;
+        return NS_OK;
+}
 
-        chm_close(chmfile);
-        chmfile = NULL;
+/* readonly attribute boolean lazy; */
+NS_IMETHODIMP csChm::GetLazy(PRBool *aLazy)
+{
+        *aLazy = mLazy;
+        return NS_OK;
+}
 
+/* readonly attribute boolean packed; */
+NS_IMETHODIMP csChm::GetPacked(PRBool *aPacked)
+{
+        *aPacked = mPacked;
         return NS_OK;
 }
 
@@ -155,6 +1448,16 @@ NS_IMETHODIMP csChm::GetBookname(char **aBookname)
         return getAttribute(aBookname, mBookname);
 }
 
+/* readonly attribute AUTF8String title; */
+NS_IMETHODIMP csChm::GetTitle(nsACString &aTitle)
+{
+        char *title = chm_to_utf8(chm_lcid_charset(mLcid), mBookname, strlen(mBookname));
+
+        aTitle.Assign(title ? title : mBookname);
+        free(title);
+        return NS_OK;
+}
+
 /* readonly attribute string hhc; */
 NS_IMETHODIMP csChm::GetHhc(char **aHhc)
 {
@@ -167,9 +1470,85 @@ NS_IMETHODIMP csChm::GetHhk(char **aHhk)
         return getAttribute(aHhk, mHhk);
 }
 
+/* readonly attribute ACString charset; */
+NS_IMETHODIMP csChm::GetCharset(nsACString &aCharset)
+{
+        aCharset.Assign(chm_lcid_charset(mLcid));
+        return NS_OK;
+}
+
 /* readonly attribute PRUint32 lcid; */
 NS_IMETHODIMP csChm::GetLcid(PRUint32 *aLcid)
 {
         *aLcid = mLcid;
         return NS_OK;
 }
+
+/* attribute long poolCapacity; */
+NS_IMETHODIMP csChm::GetPoolCapacity(PRInt32 *aPoolCapacity)
+{
+        *aPoolCapacity = chm_pool_get_capacity();
+        return NS_OK;
+}
+
+NS_IMETHODIMP csChm::SetPoolCapacity(PRInt32 aPoolCapacity)
+{
+        chm_pool_set_capacity(aPoolCapacity);
+        return NS_OK;
+}
+
+/* readonly attribute unsigned long long cacheHits; */
+NS_IMETHODIMP csChm::GetCacheHits(PRUint64 *aCacheHits)
+{
+        struct chm_access_stats stats;
+
+        chm_pool_get_stats(&stats);
+        *aCacheHits = stats.hits;
+        return NS_OK;
+}
+
+/* readonly attribute unsigned long long cacheMisses; */
+NS_IMETHODIMP csChm::GetCacheMisses(PRUint64 *aCacheMisses)
+{
+        struct chm_access_stats stats;
+
+        chm_pool_get_stats(&stats);
+        *aCacheMisses = stats.misses;
+        return NS_OK;
+}
+
+/* readonly attribute ACString stats; */
+NS_IMETHODIMP csChm::GetStats(nsACString &aStats)
+{
+        char *json = chm_stats_json();
+
+        aStats.Assign(json);
+        free(json);
+        return NS_OK;
+}
+
+/* attribute boolean tracing; */
+NS_IMETHODIMP csChm::GetTracing(PRBool *aTracing)
+{
+        *aTracing = chm_trace_enabled() ? PR_TRUE : PR_FALSE;
+        return NS_OK;
+}
+
+NS_IMETHODIMP csChm::SetTracing(PRBool aTracing)
+{
+        chm_trace_enable(aTracing);
+        return NS_OK;
+}
+
+/* void writeTrace (in string path); */
+NS_IMETHODIMP csChm::WriteTrace(const char *path)
+{
+        NS_ENSURE_ARG_POINTER(path);
+
+        if (chm_trace_write(path) == -1) {
+                fprintf(stderr, "writing trace failed, file = %s\n", path);
+                return NS_ERROR_FAILURE;
+        }
+
+        return NS_OK;
+}
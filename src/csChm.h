@@ -21,12 +21,29 @@
 #ifndef __CS_CHM_H__
 #define __CS_CHM_H__
 
+#include "nsCOMPtr.h"
+#include "nsAutoPtr.h"
+#include "nsIThread.h"
+
 #include "csIChm.h"
 
 #define CS_CHM_CID                                                      \
         { 0x9c9192c2, 0x4aa5, 0x11e0, { 0xa9, 0x34, 0x00, 0x24, 0x1d, 0x8c, 0xf3, 0x71 }}
 #define CS_CHM_CONTRACTID "@chmsee/cschm;1"
 
+/* books openBooks works on at once */
+#define CHM_BATCH_THREADS 4
+
+class csChmOpenTask;
+class csChmFetchTask;
+class csChmSearchTask;
+class csChmShelfTask;
+class csChmBatchTask;
+struct manifest;
+struct chm_arena;
+struct navinfo;
+struct sitemap;
+
 class csChm : public csIChm
 {
 public:
@@ -35,16 +52,51 @@ public:
 
         csChm();
 
+        void OnOpenProgress(PRUint64, PRUint64, PRUint32, PRUint32);
+        void OnOpenDone(csChmOpenTask *);
+        void OnFetchDone(csChmFetchTask *);
+        void OnSearchProgress(PRUint32, PRUint32);
+        void OnSearchDone(csChmSearchTask *);
+        void OnShelfDone(csChmShelfTask *);
+        void OnBatchBook(PRUint32);
+        void TakeNavInfo(struct navinfo *, struct sitemap *, struct sitemap *);
+
 private:
         ~csChm();
-        void copyinfo(char **, char *);
-        NS_IMETHODIMP getAttribute(char **, char *);
+        void copyinfo(const char **, const char *);
+        NS_IMETHODIMP getAttribute(char **, const char *);
 
-        char *mHomepage;
-        char *mBookname;
-        char *mHhc;
-        char *mHhk;
+        // interned in mArena, which lives as long as the book
+        struct chm_arena *mArena;
+        const char *mHomepage;
+        const char *mBookname;
+        const char *mHhc;
+        const char *mHhk;
+        const char *mFilename;
         int   mLcid;
+        PRBool mExtracted;
+        PRBool mLazy;
+        PRBool mPacked;
+        struct manifest *mManifest;
+
+        nsCOMPtr<csIChmSitemap> mToc;
+        nsCOMPtr<csIChmSitemap> mIndex;
+
+        nsCOMPtr<nsIThread> mThread;
+        nsRefPtr<csChmOpenTask> mTask;
+        nsCOMPtr<csIChmOpenListener> mListener;
+
+        nsCOMPtr<nsIThread> mSearchThread;
+        nsRefPtr<csChmSearchTask> mSearchTask;
+        nsCOMPtr<csIChmSearchListener> mSearchListener;
+
+        nsCOMPtr<nsIThread> mShelfThread;
+        nsRefPtr<csChmShelfTask> mShelfTask;
+
+        nsCOMPtr<nsIThread> mBatchThreads[CHM_BATCH_THREADS];
+        nsRefPtr<csChmBatchTask> mBatchTask;
+        nsCOMPtr<csIChmBatchListener> mBatchListener;
+        PRUint32 mBatchDone;
 
 protected:
         /* additional members */
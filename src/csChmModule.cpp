@@ -21,18 +21,23 @@
 #include "nsIClassInfoImpl.h"
 
 #include "csChm.h"
+#include "csChmStream.h"
 
 NS_GENERIC_FACTORY_CONSTRUCTOR(csChm)
+NS_GENERIC_FACTORY_CONSTRUCTOR(csChmInputStream)
 
 NS_DEFINE_NAMED_CID(CS_CHM_CID);
+NS_DEFINE_NAMED_CID(CS_CHM_INPUT_STREAM_CID);
 
 static const mozilla::Module::CIDEntry kcsChmCIDs[] = {
         { &kCS_CHM_CID, false, NULL, csChmConstructor },
+        { &kCS_CHM_INPUT_STREAM_CID, false, NULL, csChmInputStreamConstructor },
         { NULL }
 };
 
 static const mozilla::Module::ContractIDEntry kcsChmContracts[] = {
         { CS_CHM_CONTRACTID, &kCS_CHM_CID },
+        { CS_CHM_INPUT_STREAM_CONTRACTID, &kCS_CHM_INPUT_STREAM_CID },
         { NULL }
 };
 
@@ -0,0 +1,114 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#include "nsStringAPI.h"
+#include "nsMemory.h"
+
+#include "csChmSitemap.h"
+#include "csChmTreeView.h"
+#include "csChmparser.h"
+#include "csChmindex.h"
+
+csChmSitemap::csChmSitemap(struct sitemap *map)
+{
+        mSitemap = map;
+        mNameIndex = NULL;
+}
+
+csChmSitemap::~csChmSitemap()
+{
+        name_index_free(mNameIndex);
+        sitemap_free(mSitemap);
+}
+
+NS_IMPL_ISUPPORTS1(csChmSitemap, csIChmSitemap)
+
+/* a sitemap mapped from the navigation cache is only checked as it is read */
+#define CHECK_OFFSET(offset) \
+        NS_ENSURE_TRUE((offset) < mSitemap->strings_len, NS_ERROR_FILE_CORRUPTED)
+
+/* readonly attribute unsigned long length; */
+NS_IMETHODIMP csChmSitemap::GetLength(PRUint32 *aLength)
+{
+        *aLength = mSitemap->count;
+        return NS_OK;
+}
+
+/* unsigned long getDepth (in unsigned long index); */
+NS_IMETHODIMP csChmSitemap::GetDepth(PRUint32 index, PRUint32 *_retval NS_OUTPARAM)
+{
+        NS_ENSURE_TRUE(index < mSitemap->count, NS_ERROR_ILLEGAL_VALUE);
+
+        *_retval = mSitemap->entries[index].depth;
+        return NS_OK;
+}
+
+/* AUTF8String getName (in unsigned long index); */
+NS_IMETHODIMP csChmSitemap::GetName(PRUint32 index, nsACString &_retval NS_OUTPARAM)
+{
+        NS_ENSURE_TRUE(index < mSitemap->count, NS_ERROR_ILLEGAL_VALUE);
+
+        CHECK_OFFSET(mSitemap->entries[index].name);
+
+        _retval.Assign(SITEMAP_NAME(mSitemap, index));
+        return NS_OK;
+}
+
+/* ACString getLocal (in unsigned long index); */
+NS_IMETHODIMP csChmSitemap::GetLocal(PRUint32 index, nsACString &_retval NS_OUTPARAM)
+{
+        NS_ENSURE_TRUE(index < mSitemap->count, NS_ERROR_ILLEGAL_VALUE);
+
+        CHECK_OFFSET(mSitemap->entries[index].local);
+
+        _retval.Assign(SITEMAP_LOCAL(mSitemap, index));
+        return NS_OK;
+}
+
+/* void filter (in AUTF8String text, in unsigned long offset, in unsigned long limit, out unsigned long total, out unsigned long count, [array, size_is (count), retval] out unsigned long entries); */
+NS_IMETHODIMP csChmSitemap::Filter(const nsACString & text, PRUint32 offset, PRUint32 limit,
+                                   PRUint32 *total NS_OUTPARAM, PRUint32 *count NS_OUTPARAM,
+                                   PRUint32 **entries NS_OUTPARAM)
+{
+        if (!mNameIndex)
+                mNameIndex = name_index_build(mSitemap);
+
+        *total = mSitemap->count;
+        if (offset >= *total)
+                limit = 0;
+        else if (limit > *total - offset)
+                limit = *total - offset;
+
+        *entries = (PRUint32 *) nsMemory::Alloc((limit ? limit : 1) * sizeof(PRUint32));
+        if (!*entries)
+                return NS_ERROR_OUT_OF_MEMORY;
+
+        nsCString query(text);
+        *total = name_index_filter(mNameIndex, query.get(), offset, limit, *entries);
+        *count = offset < *total ? PR_MIN(limit, *total - offset) : 0;
+
+        return NS_OK;
+}
+
+/* csIChmTreeView createTreeView (in AString root); */
+NS_IMETHODIMP csChmSitemap::CreateTreeView(const nsAString & root, csIChmTreeView **_retval NS_OUTPARAM)
+{
+        NS_ADDREF(*_retval = new csChmTreeView(this, mSitemap, root));
+        return NS_OK;
+}
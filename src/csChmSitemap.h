@@ -0,0 +1,46 @@
+/* -*- Mode: C++; -*- */
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHM_SITEMAP_H__
+#define __CS_CHM_SITEMAP_H__
+
+#include "csIChm.h"
+
+struct sitemap;
+struct name_index;
+
+class csChmSitemap : public csIChmSitemap
+{
+public:
+        NS_DECL_ISUPPORTS
+        NS_DECL_CSICHMSITEMAP
+
+        csChmSitemap(struct sitemap *);
+
+        struct sitemap *Sitemap() { return mSitemap; }
+
+private:
+        ~csChmSitemap();
+
+        struct sitemap *mSitemap;
+        struct name_index *mNameIndex;
+};
+
+#endif //__CS_CHM_SITEMAP_H__
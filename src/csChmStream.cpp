@@ -0,0 +1,269 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <chm_lib.h>
+
+#include "nsStringAPI.h"
+#include "nsEmbedString.h"
+#include "nsMemory.h"
+
+#include "csChmStream.h"
+#include "csChmfile.h"
+#include "csChmpool.h"
+#include "csChmaccess.h"
+
+csChmInputStream::csChmInputStream()
+{
+        mChmfile = NULL;
+        mAccess = NULL;
+        mOffset = 0;
+        memset(&mUnit, 0, sizeof(mUnit));
+
+        mPack = NULL;
+        mPackObject = -1;
+        mCursor.frame = -1;
+        mCursor.length = 0;
+        mCursor.data = NULL;
+}
+
+csChmInputStream::~csChmInputStream()
+{
+        Close();
+}
+
+NS_IMPL_THREADSAFE_ISUPPORTS2(csChmInputStream, csIChmInputStream, nsIInputStream)
+
+/* void init (in nsILocalFile file, in string path); */
+NS_IMETHODIMP csChmInputStream::Init(nsILocalFile *file, const char *path)
+{
+        NS_ENSURE_ARG_POINTER(file);
+        NS_ENSURE_ARG_POINTER(path);
+
+        if (mChmfile || mPack)
+                return NS_ERROR_ALREADY_INITIALIZED;
+
+        char objpath[CHM_MAX_PATHLEN + 1];
+        if (snprintf(objpath, sizeof(objpath), "%s%s", path[0] == '/' ? "" : "/", path) >= (int)sizeof(objpath))
+                return NS_ERROR_FILE_NAME_TOO_LONG;
+
+        chm_normalize_path(objpath);
+
+        nsEmbedCString filename;
+        file->GetNativePath(filename);
+
+        mChmfile = chm_pool_open(filename.get());
+        if (!mChmfile)
+                return NS_ERROR_FILE_CORRUPTED;
+        mAccess = chm_pool_access(mChmfile);
+
+        if (chm_resolve_object(mChmfile, objpath, &mUnit) != CHM_RESOLVE_SUCCESS
+            || objpath[strlen(objpath) - 1] == '/') {
+                d(printf("csChmInputStream::Init >>> %s not found in %s\n", objpath, filename.get()));
+                Close();
+                return NS_ERROR_FILE_NOT_FOUND;
+        }
+
+        d(printf("csChmInputStream::Init >>> %s, length = %llu\n", objpath, mUnit.length));
+        mOffset = 0;
+
+        return NS_OK;
+}
+
+/* void initPack (in string folder, in string path); */
+NS_IMETHODIMP csChmInputStream::InitPack(const char *folder, const char *path)
+{
+        NS_ENSURE_ARG_POINTER(folder);
+        NS_ENSURE_ARG_POINTER(path);
+
+        if (mChmfile || mPack)
+                return NS_ERROR_ALREADY_INITIALIZED;
+
+        char objpath[CHM_MAX_PATHLEN + 1];
+        if (snprintf(objpath, sizeof(objpath), "%s%s", path[0] == '/' ? "" : "/", path) >= (int)sizeof(objpath))
+                return NS_ERROR_FILE_NAME_TOO_LONG;
+
+        chm_normalize_path(objpath);
+
+        nsEmbedCString packpath(folder);
+        packpath.Append("/" PACK_FILE);
+
+        mPack = pack_open(packpath.get());
+        if (!mPack)
+                return NS_ERROR_FILE_CORRUPTED;
+
+        mPackObject = pack_lookup(mPack, objpath);
+        if (mPackObject == -1) {
+                d(printf("csChmInputStream::InitPack >>> %s not found in %s\n", objpath, packpath.get()));
+                Close();
+                return NS_ERROR_FILE_NOT_FOUND;
+        }
+
+        // mUnit only carries the length and the name for the messages
+        strcpy(mUnit.path, objpath);
+        mUnit.length = pack_length(mPack, mPackObject);
+        mOffset = 0;
+
+        d(printf("csChmInputStream::InitPack >>> %s, length = %llu\n", objpath, mUnit.length));
+
+        return NS_OK;
+}
+
+/* readonly attribute PRUint64 contentLength; */
+NS_IMETHODIMP csChmInputStream::GetContentLength(PRUint64 *aContentLength)
+{
+        NS_ENSURE_ARG_POINTER(aContentLength);
+
+        *aContentLength = mUnit.length;
+        return NS_OK;
+}
+
+/* void close (); */
+NS_IMETHODIMP csChmInputStream::Close()
+{
+        if (mChmfile) {
+                chm_pool_close(mChmfile);
+                mChmfile = NULL;
+                mAccess = NULL;
+        }
+
+        if (mPack) {
+                pack_cursor_free(&mCursor);
+                pack_close(mPack);
+                mPack = NULL;
+                mPackObject = -1;
+        }
+
+        return NS_OK;
+}
+
+/* unsigned long available (); */
+NS_IMETHODIMP csChmInputStream::Available(PRUint32 *_retval NS_OUTPARAM)
+{
+        if (!mChmfile && !mPack)
+                return NS_BASE_STREAM_CLOSED;
+
+        PRUint64 remain = mUnit.length - mOffset;
+        *_retval = remain > PR_UINT32_MAX ? PR_UINT32_MAX : (PRUint32)remain;
+
+        return NS_OK;
+}
+
+/* [noscript] unsigned long read (in charPtr aBuf, in unsigned long aCount); */
+NS_IMETHODIMP csChmInputStream::Read(char *aBuf, PRUint32 aCount, PRUint32 *_retval NS_OUTPARAM)
+{
+        *_retval = 0;
+
+        if (!mChmfile && !mPack)
+                return NS_OK;
+
+        PRUint64 remain = mUnit.length - mOffset;
+        if (remain == 0)
+                return NS_OK;
+
+        if (aCount > remain)
+                aCount = (PRUint32)remain;
+
+        LONGINT64 len;
+        if (mPack)
+                len = pack_read(mPack, mPackObject, &mCursor, (unsigned char *)aBuf, mOffset, aCount);
+        else if (mAccess)
+                len = chm_access_read(mAccess, &mUnit, (unsigned char *)aBuf, mOffset, aCount);
+        else
+                len = chm_retrieve_object(mChmfile, &mUnit, (unsigned char *)aBuf, mOffset, aCount);
+        if (len <= 0) {
+                fprintf(stderr, "incomplete object: %s\n", mUnit.path);
+                return NS_ERROR_FILE_CORRUPTED;
+        }
+
+        mOffset += len;
+        *_retval = (PRUint32)len;
+
+        return NS_OK;
+}
+
+/* [noscript] unsigned long readSegments (in nsWriteSegmentFun aWriter, in voidPtr aClosure, in unsigned long aCount); */
+NS_IMETHODIMP csChmInputStream::ReadSegments(nsWriteSegmentFun aWriter, void *aClosure, PRUint32 aCount, PRUint32 *_retval NS_OUTPARAM)
+{
+        char buffer[32768];
+        const unsigned char *slice;
+        LONGINT64 avail = 0;
+        nsresult rv;
+
+        *_retval = 0;
+
+        // Uncompressed objects, and the stored frames of packed ones, go
+        // to the writer straight from the mapping, without a copy of our own.
+        if (mPack) {
+                long frame_avail = 0;
+
+                slice = pack_slice(mPack, mPackObject, mOffset, &frame_avail);
+                avail = frame_avail;
+        } else {
+                slice = mAccess ? chm_access_slice(mAccess, &mUnit, mOffset, &avail) : NULL;
+        }
+        if (slice) {
+                PRUint32 len = avail < aCount ? (PRUint32)avail : aCount;
+
+                while (len > 0) {
+                        PRUint32 written = 0;
+
+                        rv = aWriter(this, aClosure, (const char *)slice + *_retval, *_retval, len, &written);
+                        if (NS_FAILED(rv) || written == 0)
+                                break;
+
+                        mOffset += written;
+                        *_retval += written;
+                        len -= written;
+                }
+
+                return NS_OK;
+        }
+
+        while (aCount > 0) {
+                PRUint32 len = 0, written = 0;
+
+                rv = Read(buffer, aCount < sizeof(buffer) ? aCount : sizeof(buffer), &len);
+                if (NS_FAILED(rv))
+                        return *_retval ? NS_OK : rv;
+                if (len == 0)
+                        break;
+
+                rv = aWriter(this, aClosure, buffer, *_retval, len, &written);
+
+                // Rewind whatever the writer did not consume, it is read
+                // again from the archive on the next call.
+                mOffset -= len - written;
+                *_retval += written;
+                aCount -= written;
+
+                if (NS_FAILED(rv) || written < len)
+                        break;
+        }
+
+        return NS_OK;
+}
+
+/* boolean isNonBlocking (); */
+NS_IMETHODIMP csChmInputStream::IsNonBlocking(PRBool *_retval NS_OUTPARAM)
+{
+        *_retval = PR_FALSE;
+        return NS_OK;
+}
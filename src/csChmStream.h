@@ -0,0 +1,62 @@
+/* -*- Mode: C++; -*- */
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHM_STREAM_H__
+#define __CS_CHM_STREAM_H__
+
+#include <chm_lib.h>
+
+#include "csIChm.h"
+#include "csChmpack.h"
+
+struct chm_access;
+
+#define CS_CHM_INPUT_STREAM_CID                                         \
+        { 0x3f6b0a8e, 0x6c1d, 0x11e0, { 0x8b, 0x7a, 0x00, 0x24, 0x1d, 0x8c, 0xf3, 0x71 }}
+#define CS_CHM_INPUT_STREAM_CONTRACTID "@chmsee/cschminputstream;1"
+
+/*
+ * Reads one object of a chm archive, or of the pack of an extracted book,
+ * on demand, the chmsee:// protocol handler wraps it in an input stream
+ * channel.
+ */
+class csChmInputStream : public csIChmInputStream
+{
+public:
+        NS_DECL_ISUPPORTS
+        NS_DECL_NSIINPUTSTREAM
+        NS_DECL_CSICHMINPUTSTREAM
+
+        csChmInputStream();
+
+private:
+        ~csChmInputStream();
+
+        struct chmFile *mChmfile;
+        struct chm_access *mAccess;
+        struct chmUnitInfo mUnit;
+        PRUint64 mOffset;
+
+        struct pack *mPack;
+        long mPackObject;
+        struct pack_cursor mCursor;
+};
+
+#endif //__CS_CHM_STREAM_H__
@@ -0,0 +1,307 @@
+/* -*- Mode: C++; -*- */
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Native tree view of a sitemap, the visible rows are kept by the
+ * tree_rows of csChmtree.c.
+ */
+
+#include "nsMemory.h"
+#include "nsITreeColumns.h"
+
+#include "csChmTreeView.h"
+#include "csChmparser.h"
+
+csChmTreeView::csChmTreeView(csIChmSitemap *owner, struct sitemap *map, const nsAString &root)
+        : mOwner(owner), mSitemap(map), mRoot(root)
+{
+        // out of memory leaves the tree empty
+        tree_rows_init(&mRows, mSitemap);
+}
+
+csChmTreeView::~csChmTreeView()
+{
+        tree_rows_free(&mRows);
+}
+
+NS_IMPL_ISUPPORTS2(csChmTreeView, csIChmTreeView, nsITreeView)
+
+#define CHECK_ROW(row) \
+        NS_ENSURE_TRUE((row) >= 0 && (PRUint32)(row) < mRows.count, NS_ERROR_ILLEGAL_VALUE)
+
+/* unsigned long getEntry (in long row); */
+NS_IMETHODIMP csChmTreeView::GetEntry(PRInt32 row, PRUint32 *_retval NS_OUTPARAM)
+{
+        CHECK_ROW(row);
+
+        *_retval = mRows.rows[row].entry;
+        return NS_OK;
+}
+
+/* readonly attribute long rowCount; */
+NS_IMETHODIMP csChmTreeView::GetRowCount(PRInt32 *aRowCount)
+{
+        *aRowCount = mRows.count;
+        return NS_OK;
+}
+
+/* attribute nsITreeSelection selection; */
+NS_IMETHODIMP csChmTreeView::GetSelection(nsITreeSelection **aSelection)
+{
+        NS_IF_ADDREF(*aSelection = mSelection);
+        return NS_OK;
+}
+
+NS_IMETHODIMP csChmTreeView::SetSelection(nsITreeSelection *aSelection)
+{
+        mSelection = aSelection;
+        return NS_OK;
+}
+
+/* void getRowProperties (in long index, in nsISupportsArray properties); */
+NS_IMETHODIMP csChmTreeView::GetRowProperties(PRInt32 index, nsISupportsArray *properties)
+{
+        return NS_OK;
+}
+
+/* void getCellProperties (in long row, in nsITreeColumn col, in nsISupportsArray properties); */
+NS_IMETHODIMP csChmTreeView::GetCellProperties(PRInt32 row, nsITreeColumn *col, nsISupportsArray *properties)
+{
+        return NS_OK;
+}
+
+/* void getColumnProperties (in nsITreeColumn col, in nsISupportsArray properties); */
+NS_IMETHODIMP csChmTreeView::GetColumnProperties(nsITreeColumn *col, nsISupportsArray *properties)
+{
+        return NS_OK;
+}
+
+/* boolean isContainer (in long index); */
+NS_IMETHODIMP csChmTreeView::IsContainer(PRInt32 index, PRBool *_retval NS_OUTPARAM)
+{
+        CHECK_ROW(index);
+
+        *_retval = tree_rows_is_container(&mRows, index);
+        return NS_OK;
+}
+
+/* boolean isContainerOpen (in long index); */
+NS_IMETHODIMP csChmTreeView::IsContainerOpen(PRInt32 index, PRBool *_retval NS_OUTPARAM)
+{
+        CHECK_ROW(index);
+
+        *_retval = tree_rows_is_open(&mRows, index);
+        return NS_OK;
+}
+
+/* boolean isContainerEmpty (in long index); */
+NS_IMETHODIMP csChmTreeView::IsContainerEmpty(PRInt32 index, PRBool *_retval NS_OUTPARAM)
+{
+        *_retval = PR_FALSE;
+        return NS_OK;
+}
+
+/* boolean isSeparator (in long index); */
+NS_IMETHODIMP csChmTreeView::IsSeparator(PRInt32 index, PRBool *_retval NS_OUTPARAM)
+{
+        *_retval = PR_FALSE;
+        return NS_OK;
+}
+
+/* boolean isSorted (); */
+NS_IMETHODIMP csChmTreeView::IsSorted(PRBool *_retval NS_OUTPARAM)
+{
+        *_retval = PR_FALSE;
+        return NS_OK;
+}
+
+/* boolean canDrop (in long index, in long orientation, in nsIDOMDataTransfer dataTransfer); */
+NS_IMETHODIMP csChmTreeView::CanDrop(PRInt32 index, PRInt32 orientation, nsIDOMDataTransfer *dataTransfer, PRBool *_retval NS_OUTPARAM)
+{
+        *_retval = PR_FALSE;
+        return NS_OK;
+}
+
+/* void drop (in long row, in long orientation, in nsIDOMDataTransfer dataTransfer); */
+NS_IMETHODIMP csChmTreeView::Drop(PRInt32 row, PRInt32 orientation, nsIDOMDataTransfer *dataTransfer)
+{
+        return NS_OK;
+}
+
+/* long getParentIndex (in long rowIndex); */
+NS_IMETHODIMP csChmTreeView::GetParentIndex(PRInt32 rowIndex, PRInt32 *_retval NS_OUTPARAM)
+{
+        CHECK_ROW(rowIndex);
+
+        *_retval = tree_rows_parent(&mRows, rowIndex);
+        return NS_OK;
+}
+
+/* boolean hasNextSibling (in long rowIndex, in long afterIndex); */
+NS_IMETHODIMP csChmTreeView::HasNextSibling(PRInt32 rowIndex, PRInt32 afterIndex, PRBool *_retval NS_OUTPARAM)
+{
+        CHECK_ROW(rowIndex);
+
+        *_retval = tree_rows_has_next_sibling(&mRows, rowIndex, PR_MAX(afterIndex, 0));
+        return NS_OK;
+}
+
+/* long getLevel (in long index); */
+NS_IMETHODIMP csChmTreeView::GetLevel(PRInt32 index, PRInt32 *_retval NS_OUTPARAM)
+{
+        CHECK_ROW(index);
+
+        *_retval = mRows.rows[index].level;
+        return NS_OK;
+}
+
+/* AString getImageSrc (in long row, in nsITreeColumn col); */
+NS_IMETHODIMP csChmTreeView::GetImageSrc(PRInt32 row, nsITreeColumn *col, nsAString & _retval NS_OUTPARAM)
+{
+        _retval.Truncate();
+        return NS_OK;
+}
+
+/* long getProgressMode (in long row, in nsITreeColumn col); */
+NS_IMETHODIMP csChmTreeView::GetProgressMode(PRInt32 row, nsITreeColumn *col, PRInt32 *_retval NS_OUTPARAM)
+{
+        *_retval = nsITreeView::PROGRESS_NONE;
+        return NS_OK;
+}
+
+/* AString getCellValue (in long row, in nsITreeColumn col); */
+NS_IMETHODIMP csChmTreeView::GetCellValue(PRInt32 row, nsITreeColumn *col, nsAString & _retval NS_OUTPARAM)
+{
+        _retval.Truncate();
+        return NS_OK;
+}
+
+/* AString getCellText (in long row, in nsITreeColumn col); */
+NS_IMETHODIMP csChmTreeView::GetCellText(PRInt32 row, nsITreeColumn *col, nsAString & _retval NS_OUTPARAM)
+{
+        CHECK_ROW(row);
+        NS_ENSURE_ARG_POINTER(col);
+
+        PRUint32 entry = mRows.rows[row].entry;
+        PRInt32 index;
+        col->GetIndex(&index);
+
+        // a sitemap mapped from the navigation cache is only checked as it is read
+        if (index == 0) {
+                NS_ENSURE_TRUE(mSitemap->entries[entry].name < mSitemap->strings_len, NS_ERROR_FILE_CORRUPTED);
+
+                // names are UTF-8, locals are bytes the way ACString gives them to JS
+                _retval.Assign(NS_ConvertUTF8toUTF16(SITEMAP_NAME(mSitemap, entry)));
+        } else {
+                NS_ENSURE_TRUE(mSitemap->entries[entry].local < mSitemap->strings_len, NS_ERROR_FILE_CORRUPTED);
+
+                _retval.Assign(mRoot);
+                _retval.Append(PRUnichar('/'));
+                _retval.Append(NS_ConvertASCIItoUTF16(SITEMAP_LOCAL(mSitemap, entry)));
+        }
+
+        return NS_OK;
+}
+
+/* void setTree (in nsITreeBoxObject tree); */
+NS_IMETHODIMP csChmTreeView::SetTree(nsITreeBoxObject *tree)
+{
+        mTree = tree;
+        return NS_OK;
+}
+
+/* void toggleOpenState (in long index); */
+NS_IMETHODIMP csChmTreeView::ToggleOpenState(PRInt32 index)
+{
+        CHECK_ROW(index);
+
+        PRInt32 changed;
+        if (tree_rows_toggle(&mRows, index, &changed) == -1)
+                return NS_ERROR_OUT_OF_MEMORY;
+
+        if (mTree && changed) {
+                mTree->RowCountChanged(index + 1, changed);
+                mTree->InvalidateRow(index);
+        }
+
+        return NS_OK;
+}
+
+/* void cycleHeader (in nsITreeColumn col); */
+NS_IMETHODIMP csChmTreeView::CycleHeader(nsITreeColumn *col)
+{
+        return NS_OK;
+}
+
+/* void selectionChanged (); */
+NS_IMETHODIMP csChmTreeView::SelectionChanged()
+{
+        return NS_OK;
+}
+
+/* void cycleCell (in long row, in nsITreeColumn col); */
+NS_IMETHODIMP csChmTreeView::CycleCell(PRInt32 row, nsITreeColumn *col)
+{
+        return NS_OK;
+}
+
+/* boolean isEditable (in long row, in nsITreeColumn col); */
+NS_IMETHODIMP csChmTreeView::IsEditable(PRInt32 row, nsITreeColumn *col, PRBool *_retval NS_OUTPARAM)
+{
+        *_retval = PR_FALSE;
+        return NS_OK;
+}
+
+/* boolean isSelectable (in long row, in nsITreeColumn col); */
+NS_IMETHODIMP csChmTreeView::IsSelectable(PRInt32 row, nsITreeColumn *col, PRBool *_retval NS_OUTPARAM)
+{
+        *_retval = PR_TRUE;
+        return NS_OK;
+}
+
+/* void setCellValue (in long row, in nsITreeColumn col, in AString value); */
+NS_IMETHODIMP csChmTreeView::SetCellValue(PRInt32 row, nsITreeColumn *col, const nsAString & value)
+{
+        return NS_ERROR_NOT_IMPLEMENTED;
+}
+
+/* void setCellText (in long row, in nsITreeColumn col, in AString value); */
+NS_IMETHODIMP csChmTreeView::SetCellText(PRInt32 row, nsITreeColumn *col, const nsAString & value)
+{
+        return NS_ERROR_NOT_IMPLEMENTED;
+}
+
+/* void performAction (in wstring action); */
+NS_IMETHODIMP csChmTreeView::PerformAction(const PRUnichar *action)
+{
+        return NS_OK;
+}
+
+/* void performActionOnRow (in wstring action, in long row); */
+NS_IMETHODIMP csChmTreeView::PerformActionOnRow(const PRUnichar *action, PRInt32 row)
+{
+        return NS_OK;
+}
+
+/* void performActionOnCell (in wstring action, in long row, in nsITreeColumn col); */
+NS_IMETHODIMP csChmTreeView::PerformActionOnCell(const PRUnichar *action, PRInt32 row, nsITreeColumn *col)
+{
+        return NS_OK;
+}
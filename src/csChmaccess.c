@@ -0,0 +1,500 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Archive access layer
+ *
+ * The archive is mapped once.  Objects of the uncompressed section are
+ * copied straight from the mapping.  The compressed section is read a
+ * whole LZX block at a time, block n being the n-th entry of the reset
+ * table, and the decompressed blocks are kept in a LRU cache, so pages
+ * and the stylesheets and images they share are decompressed once rather
+ * than on every request.  chmlib still does the decompression, a miss
+ * asks it for the block as if it were an object of its own.
+ *
+ * Uncompressed objects can also be handed out as slices of the mapping,
+ * or copied file to file by the kernel, so embedded images and PDFs
+ * never pass through a userspace buffer.  Archives on network
+ * filesystems are not mapped, see map_archive.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <sys/vfs.h>
+#else
+#include <sys/statvfs.h>
+#endif
+
+#include "csChmfile.h"
+#include "csChmaccess.h"
+#include "csChmstats.h"
+
+#define RESET_TABLE "::DataSpace/Storage/MSCompressed/Transform/" \
+        "{7FC28940-9D31-11D0-9B27-00A0C91E9C7C}/InstanceData/ResetTable"
+#define RESET_TABLE_HEADER_LEN 0x28
+#define ITSF_HEADER_LEN        0x60
+
+struct block
+{
+        u_int32_t index;
+        u_int32_t length;
+        unsigned char *data;
+        struct block *prev;
+        struct block *next;
+};
+
+struct chm_access
+{
+        struct chmFile *h;
+
+        unsigned char *map;
+        size_t map_len;
+        u_int64_t data_offset;
+
+        u_int64_t block_len;
+        u_int64_t uncompressed_len;
+        u_int32_t block_count;
+
+        pthread_mutex_t mutex;
+        struct block **blocks;          /* by block index */
+        struct block *head;             /* most recently used */
+        struct block *tail;
+        u_int32_t cached;
+        u_int32_t capacity;
+
+        struct chm_access_stats stats;
+};
+
+static u_int32_t get_dword(const unsigned char *buf)
+{
+        return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((u_int32_t)buf[3] << 24);
+}
+
+static u_int64_t get_qword(const unsigned char *buf)
+{
+        return get_dword(buf) | ((u_int64_t)get_dword(buf + 4) << 32);
+}
+
+/* version 3 headers carry the data offset, version 2 ones imply it */
+static u_int64_t header_data_offset(const unsigned char *header)
+{
+        if (get_dword(header + 4) >= 3)
+                return get_qword(header + 0x58);
+
+        return get_qword(header + 0x48) + get_qword(header + 0x50);
+}
+
+/* Whether the file open at fd is on a filesystem of this machine */
+static int local_file(int fd)
+{
+#ifdef __linux__
+        struct statfs buf;
+
+        if (fstatfs(fd, &buf) == -1)
+                return 0;
+
+        switch ((u_int32_t)buf.f_type) {
+        case 0x6969:            /* NFS */
+        case 0x517b:            /* SMB */
+        case 0xff534d42:        /* CIFS */
+        case 0xfe534d42:        /* SMB2 */
+        case 0x65735546:        /* FUSE */
+        case 0x01021997:        /* 9P */
+        case 0x5346414f:        /* AFS */
+        case 0x73757245:        /* Coda */
+        case 0x00c36400:        /* Ceph */
+                return 0;
+        default:
+                return 1;
+        }
+#elif defined(ST_LOCAL)
+        struct statvfs buf;
+
+        return fstatvfs(fd, &buf) == 0 && (buf.f_flag & ST_LOCAL);
+#else
+        return 1;
+#endif
+}
+
+/*
+ * Reading the mapping of a file that has been truncated since raises
+ * SIGBUS and takes the whole process down.  Files on network and FUSE
+ * filesystems, where anything may rewrite them, are not mapped and go
+ * through chmlib's preads.  The pool keys handles by size and mtime as
+ * well and closes a handle once its file has changed, which leaves the
+ * reads already under way on a local file rewritten in place.
+ */
+static void map_archive(struct chm_access *access, const char *filename)
+{
+        struct stat statbuf;
+        void *map;
+        int fd;
+
+        fd = open(filename, O_RDONLY);
+        if (fd == -1)
+                return;
+
+        if (fstat(fd, &statbuf) == 0 && statbuf.st_size >= ITSF_HEADER_LEN && local_file(fd)) {
+                map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map != MAP_FAILED) {
+                        access->map = (unsigned char *)map;
+                        access->map_len = statbuf.st_size;
+                }
+        }
+        close(fd);
+
+        if (!access->map)
+                return;
+
+        if (memcmp(access->map, "ITSF", 4) != 0) {
+                munmap(access->map, access->map_len);
+                access->map = NULL;
+                return;
+        }
+
+        access->data_offset = header_data_offset(access->map);
+}
+
+static void read_reset_table(struct chm_access *access)
+{
+        unsigned char header[RESET_TABLE_HEADER_LEN];
+        struct chmUnitInfo ui;
+
+        if (chm_resolve_object(access->h, RESET_TABLE, &ui) != CHM_RESOLVE_SUCCESS
+            || chm_retrieve_object(access->h, &ui, header, 0, sizeof(header)) != sizeof(header))
+                return;
+
+        access->uncompressed_len = get_qword(header + 0x10);
+        access->block_len = get_qword(header + 0x20);
+
+        if (access->block_len == 0 || access->block_len > (1 << 20))
+                return;
+
+        access->block_count = (access->uncompressed_len + access->block_len - 1) / access->block_len;
+        access->blocks = (struct block **)calloc(access->block_count ? access->block_count : 1,
+                                                 sizeof(struct block *));
+        access->capacity = CHM_BLOCK_CACHE_SIZE / access->block_len;
+        if (access->capacity < 2)
+                access->capacity = 2;
+}
+
+struct chm_access *
+chm_access_open(struct chmFile *h, const char *filename)
+{
+        struct chm_access *access;
+
+        access = (struct chm_access *)calloc(1, sizeof(struct chm_access));
+        access->h = h;
+        pthread_mutex_init(&access->mutex, NULL);
+
+        map_archive(access, filename);
+        read_reset_table(access);
+
+        d(printf("chm_access_open >>> %s, mapped = %lu, blocks = %u of %llu bytes\n",
+                 filename, (unsigned long)access->map_len, access->block_count,
+                 (unsigned long long)access->block_len));
+
+        return access;
+}
+
+static void lru_unlink(struct chm_access *access, struct block *b)
+{
+        if (b->prev)
+                b->prev->next = b->next;
+        else
+                access->head = b->next;
+
+        if (b->next)
+                b->next->prev = b->prev;
+        else
+                access->tail = b->prev;
+}
+
+static void lru_push(struct chm_access *access, struct block *b)
+{
+        b->prev = NULL;
+        b->next = access->head;
+        if (access->head)
+                access->head->prev = b;
+        access->head = b;
+        if (!access->tail)
+                access->tail = b;
+}
+
+/* Called with the mutex held */
+static void cache_insert(struct chm_access *access, struct block *b)
+{
+        lru_push(access, b);
+        access->blocks[b->index] = b;
+        access->cached++;
+
+        while (access->cached > access->capacity) {
+                struct block *lru = access->tail;
+
+                lru_unlink(access, lru);
+                access->blocks[lru->index] = NULL;
+                access->cached--;
+                free(lru->data);
+                free(lru);
+        }
+}
+
+static struct block *load_block(struct chm_access *access, u_int32_t index)
+{
+        struct chmUnitInfo ui;
+        struct block *b;
+        LONGINT64 len;
+
+        memset(&ui, 0, sizeof(ui));
+        ui.space = CHM_COMPRESSED;
+        ui.start = (u_int64_t)index * access->block_len;
+        ui.length = access->uncompressed_len - ui.start;
+        if (ui.length > access->block_len)
+                ui.length = access->block_len;
+
+        b = (struct block *)malloc(sizeof(struct block));
+        b->index = index;
+        b->data = (unsigned char *)malloc(ui.length ? ui.length : 1);
+
+        len = chm_retrieve_object(access->h, &ui, b->data, 0, ui.length);
+        if (len != (LONGINT64)ui.length) {
+                free(b->data);
+                free(b);
+                return NULL;
+        }
+        b->length = ui.length;
+
+        return b;
+}
+
+/* Copy from the compressed section through the block cache */
+static LONGINT64 read_compressed(struct chm_access *access, u_int64_t start,
+                                 unsigned char *buf, LONGINT64 len)
+{
+        LONGINT64 done = 0;
+
+        while (done < len) {
+                u_int64_t pos = start + done;
+                u_int32_t index = pos / access->block_len;
+                u_int32_t offset = pos % access->block_len;
+                struct block *b;
+                LONGINT64 n;
+
+                if (index >= access->block_count)
+                        break;
+
+                pthread_mutex_lock(&access->mutex);
+                b = access->blocks[index];
+                if (b) {
+                        access->stats.hits++;
+                        chm_stats_add(CHM_STAT_CACHE_HITS, 1);
+                        lru_unlink(access, b);
+                        lru_push(access, b);
+                } else {
+                        access->stats.misses++;
+                        chm_stats_add(CHM_STAT_CACHE_MISSES, 1);
+                        pthread_mutex_unlock(&access->mutex);
+
+                        /* decompress without holding the cache */
+                        b = load_block(access, index);
+                        if (!b)
+                                break;
+
+                        pthread_mutex_lock(&access->mutex);
+                        if (access->blocks[index]) {
+                                free(b->data);
+                                free(b);
+                                b = access->blocks[index];
+                        } else {
+                                cache_insert(access, b);
+                        }
+                }
+
+                n = b->length - offset;
+                if (n > len - done)
+                        n = len - done;
+                if (n > 0)
+                        memcpy(buf + done, b->data + offset, n);
+                pthread_mutex_unlock(&access->mutex);
+
+                if (n <= 0)
+                        break;
+                done += n;
+        }
+
+        return done;
+}
+
+/*
+ * Same as chm_retrieve_object, which it falls back to when the archive
+ * could not be mapped or has an unusual reset table.
+ */
+LONGINT64
+chm_access_read(struct chm_access *access, struct chmUnitInfo *ui,
+                unsigned char *buf, LONGUINT64 addr, LONGINT64 len)
+{
+        if (addr >= ui->length)
+                return 0;
+        if (addr + len > ui->length)
+                len = ui->length - addr;
+
+        if (ui->space == CHM_UNCOMPRESSED && access->map) {
+                u_int64_t start = access->data_offset + ui->start + addr;
+
+                if (start + len <= access->map_len) {
+                        memcpy(buf, access->map + start, len);
+                        __sync_fetch_and_add(&access->stats.mapped_reads, 1);
+                        return len;
+                }
+        }
+
+        if (ui->space == CHM_COMPRESSED && access->block_count)
+                return read_compressed(access, ui->start + addr, buf, len);
+
+        return chm_retrieve_object(access->h, ui, buf, addr, len);
+}
+
+/*
+ * Point into the mapping at addr of an uncompressed object, len gets how
+ * many bytes of it follow.  NULL when the object has to be read instead.
+ * The slice stays valid as long as the access does.
+ */
+const unsigned char *
+chm_access_slice(struct chm_access *access, struct chmUnitInfo *ui,
+                 LONGUINT64 addr, LONGINT64 *len)
+{
+        u_int64_t start;
+
+        if (ui->space != CHM_UNCOMPRESSED || !access->map || addr >= ui->length)
+                return NULL;
+
+        start = access->data_offset + ui->start + addr;
+        if (start + (ui->length - addr) > access->map_len)
+                return NULL;
+
+        *len = ui->length - addr;
+        __sync_fetch_and_add(&access->stats.mapped_reads, 1);
+
+        return access->map + start;
+}
+
+/* Offset of the content sections in the archive open at fd, -1 if not a chm */
+int
+chm_data_offset(int fd, u_int64_t *offset)
+{
+        unsigned char header[ITSF_HEADER_LEN];
+
+        if (pread(fd, header, sizeof(header), 0) != sizeof(header)
+            || memcmp(header, "ITSF", 4) != 0)
+                return -1;
+
+        *offset = header_data_offset(header);
+        return 0;
+}
+
+/*
+ * Copy len bytes at offset of in_fd to the current position of out_fd
+ * inside the kernel, copy_file_range first, which can share extents,
+ * then sendfile.  Returns how much got copied, the caller does the rest
+ * by hand.
+ */
+LONGINT64
+chm_copy_range(int in_fd, u_int64_t offset, int out_fd, LONGINT64 len)
+{
+        LONGINT64 done = 0;
+
+#ifdef __NR_copy_file_range
+        while (done < len) {
+                loff_t in_off = offset + done;
+                ssize_t n = syscall(__NR_copy_file_range, in_fd, &in_off, out_fd, NULL,
+                                    (size_t)(len - done), 0);
+
+                if (n <= 0)
+                        break;
+                done += n;
+        }
+#endif
+
+#ifdef __linux__
+        while (done < len) {
+                off_t in_off = offset + done;
+                ssize_t n = sendfile(out_fd, in_fd, &in_off, (size_t)(len - done));
+
+                if (n <= 0)
+                        break;
+                done += n;
+        }
+#endif
+
+        return done;
+}
+
+/* Length of the blocks the cache holds, 0 when compressed objects bypass it */
+u_int64_t
+chm_access_block_len(struct chm_access *access)
+{
+        return access->block_count ? access->block_len : 0;
+}
+
+void
+chm_access_get_stats(struct chm_access *access, struct chm_access_stats *stats)
+{
+        pthread_mutex_lock(&access->mutex);
+        *stats = access->stats;
+        pthread_mutex_unlock(&access->mutex);
+}
+
+void
+chm_access_close(struct chm_access *access)
+{
+        struct block *b, *next;
+
+        if (!access)
+                return;
+
+        d(printf("chm_access_close >>> hits = %llu, misses = %llu, mapped reads = %llu\n",
+                 (unsigned long long)access->stats.hits,
+                 (unsigned long long)access->stats.misses,
+                 (unsigned long long)access->stats.mapped_reads));
+
+        for (b = access->head; b; b = next) {
+                next = b->next;
+                free(b->data);
+                free(b);
+        }
+
+        free(access->blocks);
+        if (access->map)
+                munmap(access->map, access->map_len);
+        pthread_mutex_destroy(&access->mutex);
+        free(access);
+}
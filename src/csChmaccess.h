@@ -0,0 +1,55 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHMACCESS_H__
+#define __CS_CHMACCESS_H__
+
+#include <sys/types.h>
+#include <chm_lib.h>
+
+/* decompressed LZX blocks kept per archive */
+#define CHM_BLOCK_CACHE_SIZE (8 << 20)
+
+struct chm_access;
+
+struct chm_access_stats
+{
+        u_int64_t hits;
+        u_int64_t misses;
+        u_int64_t mapped_reads;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct chm_access *chm_access_open(struct chmFile *, const char *);
+LONGINT64 chm_access_read(struct chm_access *, struct chmUnitInfo *, unsigned char *, LONGUINT64, LONGINT64);
+const unsigned char *chm_access_slice(struct chm_access *, struct chmUnitInfo *, LONGUINT64, LONGINT64 *);
+int chm_data_offset(int, u_int64_t *);
+LONGINT64 chm_copy_range(int, u_int64_t, int, LONGINT64);
+u_int64_t chm_access_block_len(struct chm_access *);
+void chm_access_get_stats(struct chm_access *, struct chm_access_stats *);
+void chm_access_close(struct chm_access *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * String arena
+ *
+ * Book information used to be one malloc per string, cloned again by
+ * csChm.  Strings are now interned: each one is stored once, after its
+ * hash and length, in chunks owned by the arena, and the same string
+ * interned again returns the same pointer.  The first chunk and hash
+ * table are allocated with the arena, so the few strings of a book cost
+ * a single malloc.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "csChmarena.h"
+#include "csChmstats.h"
+
+#define ARENA_FIRST_CHUNK 1024
+#define ARENA_CHUNK 8192
+#define ARENA_FIRST_SLOTS 16
+
+#define ARENA_ALIGN(n) (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+struct arena_chunk
+{
+        struct arena_chunk *next;
+        size_t size;
+        size_t used;
+};
+
+struct arena_string
+{
+        u_int32_t hash;
+        u_int32_t len;
+        char str[1];
+};
+
+struct chm_arena
+{
+        struct arena_chunk *chunks;
+        struct arena_string **slots;
+        u_int32_t mask;
+        u_int32_t count;
+        struct arena_string *first_slots[ARENA_FIRST_SLOTS];
+};
+
+static u_int32_t
+string_hash(const char *str, size_t len)
+{
+        u_int32_t hash = 2166136261u;
+
+        while (len--)
+                hash = (hash ^ (unsigned char)*str++) * 16777619u;
+
+        return hash;
+}
+
+static struct arena_chunk *
+chunk_new(size_t size)
+{
+        struct arena_chunk *chunk = (struct arena_chunk *)malloc(sizeof(struct arena_chunk) + size);
+
+        if (chunk == NULL)
+                return NULL;
+
+        chunk->next = NULL;
+        chunk->size = size;
+        chunk->used = 0;
+        chm_stats_add(CHM_STAT_ARENA_CHUNKS, 1);
+
+        return chunk;
+}
+
+static void *
+arena_alloc(struct chm_arena *arena, size_t size)
+{
+        struct arena_chunk *chunk = arena->chunks;
+
+        size = ARENA_ALIGN(size);
+
+        if (chunk->used + size > chunk->size) {
+                /* large strings get a chunk of their own behind the current one */
+                if (size > ARENA_CHUNK / 4) {
+                        chunk = chunk_new(size);
+                        if (chunk == NULL)
+                                return NULL;
+                        chunk->next = arena->chunks->next;
+                        arena->chunks->next = chunk;
+                } else {
+                        chunk = chunk_new(ARENA_CHUNK);
+                        if (chunk == NULL)
+                                return NULL;
+                        chunk->next = arena->chunks;
+                        arena->chunks = chunk;
+                }
+        }
+
+        chunk->used += size;
+        chm_stats_add(CHM_STAT_ARENA_BYTES, size);
+
+        return (char *)(chunk + 1) + chunk->used - size;
+}
+
+static int
+arena_grow(struct chm_arena *arena)
+{
+        u_int32_t size = (arena->mask + 1) * 2, i, j;
+        struct arena_string **slots;
+
+        slots = (struct arena_string **)calloc(size, sizeof(struct arena_string *));
+        if (slots == NULL)
+                return -1;
+
+        for (i = 0; i <= arena->mask; i++) {
+                if (arena->slots[i] == NULL)
+                        continue;
+                for (j = arena->slots[i]->hash & (size - 1); slots[j]; j = (j + 1) & (size - 1))
+                        ;
+                slots[j] = arena->slots[i];
+        }
+
+        if (arena->slots != arena->first_slots)
+                free(arena->slots);
+        arena->slots = slots;
+        arena->mask = size - 1;
+
+        return 0;
+}
+
+struct chm_arena *
+chm_arena_new(void)
+{
+        struct chm_arena *arena;
+
+        arena = (struct chm_arena *)malloc(sizeof(struct chm_arena)
+                                           + sizeof(struct arena_chunk) + ARENA_FIRST_CHUNK);
+        if (arena == NULL)
+                return NULL;
+        chm_stats_add(CHM_STAT_ARENA_CHUNKS, 1);
+
+        arena->chunks = (struct arena_chunk *)(arena + 1);
+        arena->chunks->next = NULL;
+        arena->chunks->size = ARENA_FIRST_CHUNK;
+        arena->chunks->used = 0;
+
+        memset(arena->first_slots, 0, sizeof(arena->first_slots));
+        arena->slots = arena->first_slots;
+        arena->mask = ARENA_FIRST_SLOTS - 1;
+        arena->count = 0;
+
+        return arena;
+}
+
+/*
+ * The copy of the len bytes at str kept by arena, NUL terminated.  The
+ * pointer stays valid until the arena is freed.
+ */
+const char *
+chm_arena_intern(struct chm_arena *arena, const char *str, size_t len)
+{
+        u_int32_t hash = string_hash(str, len), i;
+        struct arena_string *s;
+
+        for (i = hash & arena->mask; (s = arena->slots[i]) != NULL; i = (i + 1) & arena->mask) {
+                if (s->hash == hash && s->len == len && memcmp(s->str, str, len) == 0) {
+                        chm_stats_add(CHM_STAT_INTERN_HITS, 1);
+                        return s->str;
+                }
+        }
+
+        /* at most three quarters full */
+        if ((arena->count + 1) * 4 > (arena->mask + 1) * 3) {
+                if (arena_grow(arena) == -1)
+                        return NULL;
+                for (i = hash & arena->mask; arena->slots[i]; i = (i + 1) & arena->mask)
+                        ;
+        }
+
+        s = (struct arena_string *)arena_alloc(arena, offsetof(struct arena_string, str) + len + 1);
+        if (s == NULL)
+                return NULL;
+
+        s->hash = hash;
+        s->len = len;
+        memcpy(s->str, str, len);
+        s->str[len] = '\0';
+
+        arena->slots[i] = s;
+        arena->count++;
+
+        return s->str;
+}
+
+/* chm_arena_intern() of a C string, NULL stays NULL */
+const char *
+chm_arena_string(struct chm_arena *arena, const char *str)
+{
+        return str ? chm_arena_intern(arena, str, strlen(str)) : NULL;
+}
+
+void
+chm_arena_free(struct chm_arena *arena)
+{
+        struct arena_chunk *chunk, *next;
+
+        if (arena == NULL)
+                return;
+
+        /* except the first chunk, allocated with the arena */
+        for (chunk = arena->chunks; chunk; chunk = next) {
+                next = chunk->next;
+                if (chunk != (struct arena_chunk *)(arena + 1))
+                        free(chunk);
+        }
+
+        if (arena->slots != arena->first_slots)
+                free(arena->slots);
+        free(arena);
+}
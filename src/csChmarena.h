@@ -0,0 +1,44 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHMARENA_H__
+#define __CS_CHMARENA_H__
+
+#include <stddef.h>
+
+/*
+ * Interned strings of a book, freed all at once with their arena.
+ * An arena is not locked, it belongs to one thread at a time.
+ */
+struct chm_arena;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct chm_arena *chm_arena_new(void);
+const char *chm_arena_intern(struct chm_arena *, const char *, size_t);
+const char *chm_arena_string(struct chm_arena *, const char *);
+void chm_arena_free(struct chm_arena *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,333 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Book charset
+ *
+ * The strings of a book are in the legacy charset its #SYSTEM lcid names.
+ * Sitemap names are converted to UTF-8 once, right after parsing, in one
+ * pass over the strings of the sitemap, so the navigation cache and the
+ * trees get UTF-8 and nothing is converted per row.  Runs of ASCII, most
+ * of the text of most books, are found 16 bytes at a time and copied
+ * as they are; only the rest goes through iconv(3).  Locals are archive
+ * paths and are never converted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <iconv.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "csChmfile.h"
+#include "csChmparser.h"
+#include "csChmcharset.h"
+#include "csChmstats.h"
+
+/* what an invalid or truncated sequence becomes, U+FFFD */
+#define REPLACEMENT "\xef\xbf\xbd"
+
+struct utf8_buffer
+{
+        char *data;
+        size_t len;
+        size_t cap;
+};
+
+/* Charset of the strings of a book in the language lcid */
+const char *
+chm_lcid_charset(u_int32_t lcid)
+{
+        switch (lcid) {
+        case 0x0436: case 0x042d: case 0x0403: case 0x0406: case 0x0413:
+        case 0x0813: case 0x0409: case 0x0809: case 0x0c09: case 0x1009:
+        case 0x1409: case 0x1809: case 0x1c09: case 0x2009: case 0x2409:
+        case 0x2809: case 0x2c09: case 0x3009: case 0x3409: case 0x0438:
+        case 0x040b: case 0x040c: case 0x080c: case 0x0c0c: case 0x100c:
+        case 0x140c: case 0x180c: case 0x0407: case 0x0807: case 0x0c07:
+        case 0x1007: case 0x1407: case 0x040f: case 0x0421: case 0x0410:
+        case 0x0810: case 0x043e: case 0x0414: case 0x0814: case 0x0416:
+        case 0x0816: case 0x040a: case 0x080a: case 0x0c0a: case 0x100a:
+        case 0x140a: case 0x180a: case 0x1c0a: case 0x200a: case 0x240a:
+        case 0x280a: case 0x2c0a: case 0x300a: case 0x340a: case 0x380a:
+        case 0x3c0a: case 0x400a: case 0x440a: case 0x480a: case 0x4c0a:
+        case 0x500a: case 0x0441: case 0x041d: case 0x081d:
+                return "ISO-8859-1";
+        case 0x041c: case 0x041a: case 0x0405: case 0x040e: case 0x0418:
+        case 0x041b: case 0x0424: case 0x081a:
+                return "ISO-8859-2";
+        case 0x0415:
+                return "WINDOWS-1250";
+        case 0x0419:
+                return "WINDOWS-1251";
+        case 0x0c01:
+                return "WINDOWS-1256";
+        case 0x0401: case 0x0801: case 0x1001: case 0x1401: case 0x1801:
+        case 0x1c01: case 0x2001: case 0x2401: case 0x2801: case 0x2c01:
+        case 0x3001: case 0x3401: case 0x3801: case 0x3c01: case 0x4001:
+        case 0x0429: case 0x0420:
+                return "ISO-8859-6";
+        case 0x0408:
+                return "ISO-8859-7";
+        case 0x040d:
+                return "ISO-8859-8";
+        case 0x042c: case 0x041f: case 0x0443:
+                return "ISO-8859-9";
+        case 0x041e:
+                return "ISO-8859-11";
+        case 0x0425: case 0x0426: case 0x0427:
+                return "ISO-8859-13";
+        case 0x0411:
+                return "cp932";
+        case 0x0804: case 0x1004:
+                return "gbk";
+        case 0x0412:
+                return "cp949";
+        case 0x0404: case 0x0c04: case 0x1404:
+                return "cp950";
+        case 0x082c: case 0x0423: case 0x0402: case 0x043f: case 0x042f:
+        case 0x0c1a: case 0x0444: case 0x0422: case 0x0843:
+                return "cp1251";
+        default:
+                return "UTF-8";
+        }
+}
+
+/* Length of the run of ASCII bytes str starts with */
+static size_t
+ascii_length(const char *str, size_t len)
+{
+        const unsigned char *s = (const unsigned char *)str;
+        size_t i = 0;
+        u_int64_t word;
+
+#ifdef __SSE2__
+        for (; i + 16 <= len; i += 16) {
+                if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i))))
+                        break;
+        }
+#endif
+        for (; i + 8 <= len; i += 8) {
+                memcpy(&word, s + i, 8);
+                if (word & 0x8080808080808080ULL)
+                        break;
+        }
+        while (i < len && s[i] < 0x80)
+                i++;
+
+        return i;
+}
+
+static int
+reserve(struct utf8_buffer *buf, size_t size)
+{
+        char *data;
+        size_t cap = buf->cap ? buf->cap : 4096;
+
+        if (buf->len + size <= buf->cap)
+                return 0;
+
+        while (buf->len + size > cap)
+                cap *= 2;
+
+        data = (char *)realloc(buf->data, cap);
+        if (data == NULL)
+                return -1;
+
+        buf->data = data;
+        buf->cap = cap;
+
+        return 0;
+}
+
+/* Append str to buf as UTF-8 and NUL terminate it */
+static int
+append_utf8(struct utf8_buffer *buf, iconv_t cd, const char *str, size_t len)
+{
+        size_t ascii = ascii_length(str, len);
+        char *in, *out;
+        size_t in_left, out_left;
+
+        /* one byte of a legacy charset makes at most three of UTF-8 */
+        if (reserve(buf, ascii + (len - ascii) * 3 + 1) == -1)
+                return -1;
+
+        memcpy(buf->data + buf->len, str, ascii);
+        buf->len += ascii;
+
+        in = (char *)str + ascii;
+        in_left = len - ascii;
+
+        iconv(cd, NULL, NULL, NULL, NULL);
+        while (in_left > 0) {
+                out = buf->data + buf->len;
+                out_left = buf->cap - buf->len - 1;
+
+                if (iconv(cd, &in, &in_left, &out, &out_left) != (size_t)-1) {
+                        buf->len = out - buf->data;
+                        break;
+                }
+                buf->len = out - buf->data;
+
+                if (errno == E2BIG) {
+                        if (reserve(buf, in_left * 3 + 4) == -1)
+                                return -1;
+                        continue;
+                }
+
+                /* EILSEQ or EINVAL: replace the byte and go on after it */
+                if (reserve(buf, sizeof(REPLACEMENT) + in_left * 3) == -1)
+                        return -1;
+                memcpy(buf->data + buf->len, REPLACEMENT, sizeof(REPLACEMENT) - 1);
+                buf->len += sizeof(REPLACEMENT) - 1;
+                in++;
+                in_left--;
+                iconv(cd, NULL, NULL, NULL, NULL);
+        }
+
+        buf->data[buf->len++] = '\0';
+
+        return 0;
+}
+
+static int
+is_utf8(const char *charset)
+{
+        return strcasecmp(charset, "UTF-8") == 0;
+}
+
+/*
+ * malloc'ed UTF-8 copy of the len bytes at str in charset, NULL when
+ * iconv does not know the charset
+ */
+char *
+chm_to_utf8(const char *charset, const char *str, size_t len)
+{
+        struct utf8_buffer buf;
+        iconv_t cd;
+
+        if (is_utf8(charset) || ascii_length(str, len) == len)
+                return strndup(str, len);
+
+        cd = iconv_open("UTF-8", charset);
+        if (cd == (iconv_t)-1)
+                return NULL;
+
+        memset(&buf, 0, sizeof(buf));
+        if (append_utf8(&buf, cd, str, len) == -1) {
+                free(buf.data);
+                buf.data = NULL;
+        }
+        iconv_close(cd);
+
+        return buf.data;
+}
+
+/*
+ * Convert the names of map from charset to UTF-8, into a new strings
+ * buffer.  A map of ASCII strings only is left as it is.  Returns -1
+ * when the charset is unknown or map is mapped from the navigation
+ * cache, which is UTF-8 already.
+ */
+int
+sitemap_to_utf8(struct sitemap *map, const char *charset)
+{
+        u_int64_t begin = chm_stats_clock();
+        struct utf8_buffer buf;
+        iconv_t cd;
+        u_int32_t i, *offsets;
+
+        if (map->mapping)
+                return -1;
+        if (is_utf8(charset) || ascii_length(map->strings, map->strings_len) == map->strings_len)
+                return 0;
+
+        cd = iconv_open("UTF-8", charset);
+        if (cd == (iconv_t)-1) {
+                fprintf(stderr, "Unknown charset: %s\n", charset);
+                return -1;
+        }
+
+        /* new name and local of every entry, the map is only changed once all fit */
+        offsets = (u_int32_t *)malloc((map->count + 1) * 2 * sizeof(u_int32_t));
+        memset(&buf, 0, sizeof(buf));
+        if (offsets == NULL || reserve(&buf, map->strings_len + map->strings_len / 2 + 1) == -1) {
+                free(offsets);
+                free(buf.data);
+                iconv_close(cd);
+                return -1;
+        }
+
+        /* offset 0 stays the empty string */
+        buf.data[buf.len++] = '\0';
+
+        for (i = 0; i < map->count; i++) {
+                const struct sitemap_entry *entry = map->entries + i;
+                const char *str;
+
+                offsets[2 * i] = 0;
+                if (entry->name) {
+                        str = map->strings + entry->name;
+                        offsets[2 * i] = buf.len;
+                        if (append_utf8(&buf, cd, str, strlen(str)) == -1)
+                                break;
+                }
+
+                offsets[2 * i + 1] = 0;
+                if (entry->local) {
+                        size_t len;
+
+                        str = map->strings + entry->local;
+                        len = strlen(str) + 1;
+                        if (reserve(&buf, len) == -1)
+                                break;
+                        offsets[2 * i + 1] = buf.len;
+                        memcpy(buf.data + buf.len, str, len);
+                        buf.len += len;
+                }
+        }
+        iconv_close(cd);
+
+        if (i < map->count) {
+                fprintf(stderr, "Out of memory converting sitemap to UTF-8\n");
+                free(offsets);
+                free(buf.data);
+                return -1;
+        }
+
+        for (i = 0; i < map->count; i++) {
+                map->entries[i].name = offsets[2 * i];
+                map->entries[i].local = offsets[2 * i + 1];
+        }
+        free(offsets);
+
+        free(map->strings);
+        map->strings = buf.data;
+        map->strings_len = buf.len;
+        map->strings_cap = buf.cap;
+
+        chm_trace_event("sitemap_to_utf8", begin, chm_stats_clock(), charset);
+
+        return 0;
+}
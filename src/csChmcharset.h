@@ -0,0 +1,40 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHMCHARSET_H__
+#define __CS_CHMCHARSET_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct sitemap;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const char *chm_lcid_charset(u_int32_t);
+char *chm_to_utf8(const char *, const char *, size_t);
+int sitemap_to_utf8(struct sitemap *, const char *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -20,100 +20,297 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 
 #include <chm_lib.h>
 
 #include "csChmfile.h"
-
-struct extract_context
-{
-        const char *base_path;
-};
+#include "csChmarena.h"
+#include "csChmpool.h"
+#include "csChmaccess.h"
+#include "csChmmanifest.h"
+#include "csChmpack.h"
+#include "csChmstats.h"
 
 #define UINT16ARRAY(x) ((unsigned char)(x)[0] | ((u_int16_t)(x)[1] << 8))
 #define UINT32ARRAY(x) (UINT16ARRAY(x) | ((u_int32_t)(x)[2] << 16)      \
                         | ((u_int32_t)(x)[3] << 24))
 
-static int file_exists(const char *path)
+/* mkdir -p, the parents are only looked at when path cannot be made */
+static int rmkdir(char *path)
 {
-        struct stat statbuf;
-        if (stat(path, &statbuf) != -1)
-                return 1;
-        else
+        char *slash;
+        int ret;
+
+        if (path[0] == '\0')
+                return 0;
+
+        chm_stats_add(CHM_STAT_MKDIRS, 1);
+        if (mkdir(path, 0777) == 0 || errno == EEXIST)
                 return 0;
+
+        slash = strrchr(path, '/');
+        if (errno != ENOENT || slash == NULL || slash == path)
+                return -1;
+
+        *slash = '\0';
+        ret = rmkdir(path);
+        *slash = '/';
+        if (ret == -1)
+                return -1;
+
+        chm_stats_add(CHM_STAT_MKDIRS, 1);
+        return mkdir(path, 0777) == 0 || errno == EEXIST ? 0 : -1;
 }
 
-static int rmkdir(char *path)
+/* Create the folder a book is written to and its parents, -1 on failure */
+int
+chm_make_folder(const char *path)
 {
-        char *i = strrchr(path, '/');
+        char buffer[1024];
 
-        if(path[0] == '\0'  ||  file_exists(path))
-                return 0;
+        if (snprintf(buffer, sizeof(buffer), "%s", path) >= (int)sizeof(buffer))
+                return -1;
+
+        return rmkdir(buffer);
+}
 
-        if (i != NULL) {
-                *i = '\0';
-                rmkdir(path);
-                *i = '/';
-                mkdir(path, 0777);
+/*
+ * Directories of an extraction
+ *
+ * The folder the book goes to is opened once and objects are created
+ * relative to it with openat.  Every directory made, or found there, is
+ * remembered in a hash set of paths relative to the folder, so each one
+ * costs a single mkdirat and none a stat.
+ */
+struct dir_cache
+{
+        int root;
+        pthread_mutex_t mutex;
+        char **slots;
+        u_int32_t mask;
+        u_int32_t count;
+};
+
+static u_int32_t hash_dir(const char *path, size_t len)
+{
+        u_int32_t h = 2166136261u;
+
+        while (len--)
+                h = (h ^ (unsigned char)*path++) * 16777619u;
+
+        return h;
+}
+
+static char **dir_cache_slot(struct dir_cache *cache, const char *path, size_t len)
+{
+        u_int32_t i = hash_dir(path, len) & cache->mask;
+
+        while (cache->slots[i]
+               && (strncmp(cache->slots[i], path, len) != 0 || cache->slots[i][len] != '\0'))
+                i = (i + 1) & cache->mask;
+
+        return cache->slots + i;
+}
+
+static void dir_cache_insert(struct dir_cache *cache, const char *path, size_t len)
+{
+        char **slot;
+
+        /* kept at most half full */
+        if ((cache->count + 1) * 2 > cache->mask + 1) {
+                char **old = cache->slots;
+                u_int32_t i, size = cache->mask + 1;
+
+                cache->mask = size * 2 - 1;
+                cache->slots = (char **)calloc(size * 2, sizeof(char *));
+                for (i = 0; i < size; i++)
+                        if (old[i])
+                                *dir_cache_slot(cache, old[i], strlen(old[i])) = old[i];
+                free(old);
         }
 
-        if (file_exists(path))
+        slot = dir_cache_slot(cache, path, len);
+        *slot = (char *)malloc(len + 1);
+        memcpy(*slot, path, len);
+        (*slot)[len] = '\0';
+        cache->count++;
+}
+
+static struct dir_cache *dir_cache_open(const char *base_path)
+{
+        struct dir_cache *cache;
+        int root = open(base_path, O_RDONLY | O_DIRECTORY);
+
+        /* the folder is only there already if the sitemaps were written to it */
+        if (root == -1 && errno == ENOENT && chm_make_folder(base_path) == 0)
+                root = open(base_path, O_RDONLY | O_DIRECTORY);
+        if (root == -1)
+                return NULL;
+
+        cache = (struct dir_cache *)malloc(sizeof(struct dir_cache));
+        cache->root = root;
+        pthread_mutex_init(&cache->mutex, NULL);
+        cache->mask = 1023;
+        cache->slots = (char **)calloc(cache->mask + 1, sizeof(char *));
+        cache->count = 0;
+
+        return cache;
+}
+
+static void dir_cache_close(struct dir_cache *cache)
+{
+        u_int32_t i;
+
+        if (!cache)
+                return;
+
+        for (i = 0; i <= cache->mask; i++)
+                free(cache->slots[i]);
+        free(cache->slots);
+        pthread_mutex_destroy(&cache->mutex);
+        close(cache->root);
+        free(cache);
+}
+
+/* The first len bytes of path, relative to the root, made with their parents */
+static int dir_cache_make_locked(struct dir_cache *cache, const char *path, size_t len)
+{
+        char dir[CHM_MAX_PATHLEN + 1];
+        size_t parent = len;
+
+        if (len == 0 || *dir_cache_slot(cache, path, len))
                 return 0;
-        else
+        if (len > CHM_MAX_PATHLEN)
+                return -1;
+
+        while (parent > 0 && path[parent - 1] != '/')
+                parent--;
+        if (parent > 1 && dir_cache_make_locked(cache, path, parent - 1) == -1)
                 return -1;
+
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+
+        chm_stats_add(CHM_STAT_MKDIRS, 1);
+        if (mkdirat(cache->root, dir, 0777) == -1 && errno != EEXIST)
+                return -1;
+
+        dir_cache_insert(cache, path, len);
+        return 0;
+}
+
+static int dir_cache_make(struct dir_cache *cache, const char *path, size_t len)
+{
+        int ret;
+
+        pthread_mutex_lock(&cache->mutex);
+        ret = dir_cache_make_locked(cache, path, len);
+        pthread_mutex_unlock(&cache->mutex);
+
+        return ret;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+        while (len > 0) {
+                ssize_t n = write(fd, buf, len);
+
+                if (n <= 0)
+                        return -1;
+                buf += n;
+                len -= n;
+        }
+
+        return 0;
+}
+
+/* Create the file of path, its directory if missing, -1 on failure */
+static int create_file(const char *base_path, struct dir_cache *dirs, const char *path)
+{
+        const char *slash = strrchr(path, '/');
+        char buffer[1024];
+        int fd;
+
+        if (dirs) {
+                fd = openat(dirs->root, path + 1, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+                if (fd == -1 && errno == ENOENT && slash > path
+                    && dir_cache_make(dirs, path + 1, slash - path - 1) == 0)
+                        fd = openat(dirs->root, path + 1, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+                return fd;
+        }
+
+        if (snprintf(buffer, sizeof(buffer), "%s%s", base_path, path) >= (int)sizeof(buffer))
+                return -1;
+
+        fd = open(buffer, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd == -1 && errno == ENOENT) {
+                /* make sure that it isn't just a missing directory before we abort */
+                buffer[strlen(base_path) + (slash - path)] = '\0';
+                rmkdir(buffer);
+                buffer[strlen(base_path) + (slash - path)] = '/';
+                fd = open(buffer, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        }
+
+        return fd;
 }
 
 /*
- * Callback function for enumerate API
+ * Write one archive object to base_path, creating its directory on demand,
+ * through dirs when given.  With archive_fd open on the chm file,
+ * uncompressed objects are copied by the kernel from data_offset on.
  */
-static int _extract_callback(struct chmFile *h,
-                             struct chmUnitInfo *ui,
-                             void *context)
+static int extract_unit(struct chmFile *h,
+                        struct chmUnitInfo *ui,
+                        const char *base_path,
+                        struct dir_cache *dirs,
+                        int archive_fd,
+                        u_int64_t data_offset)
 {
-        LONGUINT64 ui_path_len;
-        char buffer[32768];
-        struct extract_context *ctx = (struct extract_context *)context;
-        char *i;
+        size_t ui_path_len;
 
         if (ui->path[0] != '/')
-                return CHM_ENUMERATOR_CONTINUE;
+                return 0;
 
         /* quick hack for security hole mentioned by Sven Tantau */
         if (strstr(ui->path, "/../") != NULL) {
                 /* fprintf(stderr, "Not extracting %s (dangerous path)\n", ui->path); */
-                return CHM_ENUMERATOR_CONTINUE;
+                return 0;
         }
 
-        if (snprintf(buffer, sizeof(buffer), "%s/%s", ctx->base_path, ui->path) > 1024)
-                return CHM_ENUMERATOR_FAILURE;
-
         /* Get the length of the path */
-        ui_path_len = strlen(ui->path)-1;
+        ui_path_len = strlen(ui->path) - 1;
 
         /* Distinguish between files and dirs */
         if (ui->path[ui_path_len] != '/' ) {
-                FILE *fout;
+                char buffer[32768];
                 LONGINT64 len, remain=ui->length;
                 LONGUINT64 offset = 0;
-
-                d(printf("_extract_callback >>> ui->path = %s\n", ui->path));
-                if ((fout = fopen(buffer, "wb")) == NULL) {
-                        /* make sure that it isn't just a missing directory before we abort */
-                        char newbuf[32768];
-                        strcpy(newbuf, buffer);
-                        i = strrchr(newbuf, '/');
-                        *i = '\0';
-                        rmkdir(newbuf);
-                        if ((fout = fopen(buffer, "wb")) == NULL)
-                                return CHM_ENUMERATOR_FAILURE;
+                u_int64_t begin = chm_stats_clock(), decompress = 0, t;
+                int fd;
+
+                d(printf("extract_unit >>> ui->path = %s\n", ui->path));
+                fd = create_file(base_path, dirs, ui->path);
+                if (fd == -1)
+                        return -1;
+
+                if (archive_fd != -1 && ui->space == CHM_UNCOMPRESSED && remain > 0) {
+                        offset = chm_copy_range(archive_fd, data_offset + ui->start, fd, remain);
+                        remain -= offset;
+                        chm_stats_add(CHM_STAT_KERNEL_BYTES, offset);
                 }
 
                 while (remain != 0) {
-                        len = chm_retrieve_object(h, ui, (unsigned char *)buffer, offset, 32768);
-                        if (len > 0) {
-                                fwrite(buffer, 1, (size_t)len, fout);
+                        t = chm_stats_clock();
+                        len = chm_retrieve_object(h, ui, (unsigned char *)buffer, offset, sizeof(buffer));
+                        decompress += chm_stats_clock() - t;
+                        if (len > 0 && write_all(fd, buffer, (size_t)len) == 0) {
                                 offset += len;
                                 remain -= len;
                         } else {
@@ -122,13 +319,24 @@ static int _extract_callback(struct chmFile *h,
                         }
                 }
 
-                fclose(fout);
+                close(fd);
+
+                chm_stats_add(CHM_STAT_DECOMPRESS_NS, decompress);
+                chm_stats_add(CHM_STAT_WRITE_NS, chm_stats_clock() - begin - decompress);
+                chm_stats_add(CHM_STAT_OBJECTS, 1);
+                chm_stats_add(CHM_STAT_BYTES, offset);
+        } else if (dirs) {
+                if (dir_cache_make(dirs, ui->path + 1, ui_path_len - 1) == -1)
+                        return -1;
         } else {
-                if (rmkdir(buffer) == -1)
-                        return CHM_ENUMERATOR_FAILURE;
+                char buffer[1024];
+
+                if (snprintf(buffer, sizeof(buffer), "%s%s", base_path, ui->path) >= (int)sizeof(buffer)
+                    || rmkdir(buffer) == -1)
+                        return -1;
         }
 
-        return CHM_ENUMERATOR_CONTINUE;
+        return 0;
 }
 
 static u_int32_t
@@ -144,218 +352,658 @@ get_dword(const unsigned char *buf)
         return result;
 }
 
+/*
+ * Read a whole archive object into a NUL terminated heap buffer
+ */
+static unsigned char *
+retrieve_object(struct chmFile *h, const char *path, size_t *length)
+{
+        struct chmUnitInfo ui;
+        unsigned char *buffer;
+        LONGINT64 len;
+
+        if (chm_resolve_object(h, path, &ui) != CHM_RESOLVE_SUCCESS) {
+                d(printf("retrieve_object >>> %s not found\n", path));
+                return NULL;
+        }
+
+        buffer = (unsigned char *)malloc((size_t)ui.length + 1);
+        if (buffer == NULL)
+                return NULL;
+
+        len = ui.length ? chm_retrieve_object(h, &ui, buffer, 0, ui.length) : 0;
+        if (len < (LONGINT64)ui.length) {
+                fprintf(stderr, "incomplete file: %s\n", path);
+                free(buffer);
+                return NULL;
+        }
+
+        buffer[ui.length] = '\0';
+        *length = (size_t)ui.length;
+
+        return buffer;
+}
+
+static const char *
+intern_string(struct fileinfo *info, const unsigned char *str, size_t max)
+{
+        return chm_arena_intern(info->arena, (const char *)str, strnlen((const char *)str, max));
+}
+
 static void
 chm_system_info(struct fileinfo *info)
 {
-        FILE *fp;
-        unsigned char buffer[4096];
-        char system_file[1024];
-        size_t size = 0, len = 0;
-        int index = 0;
-        unsigned char* cursor = NULL;
-        u_int16_t value = 0;
-
-        sprintf(system_file, "%s/#SYSTEM", info->bookfolder);
-        d(printf("chm_system_info >>> system info file = %s\n", system_file));
+        unsigned char *buffer, *cursor, *end;
+        size_t size = 0;
 
-        fp = fopen(system_file, "r");
-        if (fp == NULL) {
+        buffer = retrieve_object(info->chmfile, "/#SYSTEM", &size);
+        if (buffer == NULL) {
                 fprintf(stderr, "#SYSTEM file open failed.\n");
                 return;
         }
 
-        fread(buffer, sizeof(char), 4, fp); // Skip 4 bytes
-        size = fread(buffer, sizeof(char), 4096, fp);
+        /* 4 bytes version, then entries of code, length and data */
+        cursor = buffer + 4;
+        end = buffer + size;
 
-        if (!size)
-                return;
-
-        buffer[size - 1] = 0;
+        while (cursor + 4 <= end) {
+                u_int16_t code = UINT16ARRAY(cursor);
+                u_int16_t len = UINT16ARRAY(cursor + 2);
+                unsigned char *data = cursor + 4;
 
-        for(;;) {
-                if (index > size - 1 - (long)sizeof(u_int16_t))
+                if (data + len > end)
                         break;
 
-                cursor = buffer + index;
-                value = UINT16ARRAY(cursor);
-                d(printf("chm_system_info >>> value = %d\n", value));
+                d(printf("chm_system_info >>> code = %d, length = %d\n", code, len));
 
-                switch(value) {
+                switch(code) {
                 case 0:
-                        index += 2;
-                        cursor = buffer + index;
-
-                        len = strlen((const char*)(buffer + index + 2));
-                        info->hhc = (char *)malloc(len + 1);
-                        strcpy(info->hhc, (const char*)(buffer + index + 2));
+                        info->hhc = intern_string(info, data, len);
                         d(printf("chm_system_info >>> hhc = %s\n", info->hhc));
-
                         break;
                 case 1:
-                        index += 2;
-                        cursor = buffer + index;
-
-                        len = strlen((const char*)(buffer + index + 2));
-                        info->hhk = (char *)malloc(len + 1);
-                        strcpy(info->hhk, (const char*)(buffer + index + 2));
+                        info->hhk = intern_string(info, data, len);
                         d(printf("chm_system_info >>> hhk = %s\n", info->hhk));
-
                         break;
                 case 2:
-                        index += 2;
-                        cursor = buffer + index;
-
-                        len = strlen((const char*)(buffer + index + 2));
-                        info->homepage = (char *)malloc(len + 1);
-                        strcpy(info->homepage, (const char*)(buffer + index + 2));
+                        info->homepage = intern_string(info, data, len);
                         d(printf("chm_system_info >>> homepage = %s\n", info->homepage));
-
                         break;
                 case 3:
-                        index += 2;
-                        cursor = buffer + index;
-
-                        len = strlen((const char*)(buffer + index + 2));
-                        info->bookname = (char *)malloc(len + 1);
-                        strcpy(info->bookname, (const char*)(buffer + index + 2));
+                        info->bookname = intern_string(info, data, len);
                         d(printf("chm_system_info >>> bookname = %s\n", info->bookname));
-
                         break;
                 case 4:
-                        index += 2;
-                        cursor = buffer + index;
-
-                        info->lcid = UINT32ARRAY(buffer + index + 2);
-
+                        if (len >= 4)
+                                info->lcid = UINT32ARRAY(data);
                         break;
                 default:
-                        index += 2;
-                        cursor = buffer + index;
+                        break;
                 }
 
-                value = UINT16ARRAY(cursor);
-                index += value + 2;
+                cursor = data + len;
         }
+
+        free(buffer);
 }
 
 static void
 chm_windows_info(struct fileinfo *info)
 {
-        FILE *fp;
-        unsigned char buffer[4096];
-        char windows_file[1024], strings_file[1024];
-        size_t size = 0, len = 0;
+        unsigned char *windows, *strings;
+        size_t windows_size = 0, strings_size = 0;
         u_int32_t entries, entry_size;
         u_int32_t hhc, hhk, bookname, homepage;
 
-        sprintf(windows_file, "%s/#WINDOWS", info->bookfolder);
-        d(printf("chm_windows_info >>> windows info file = %s\n", windows_file));
-
-        fp = fopen(windows_file, "r");
+        windows = retrieve_object(info->chmfile, "/#WINDOWS", &windows_size);
 
-        if (fp == NULL) {
+        if (windows == NULL) {
                 fprintf(stderr, "Open windows info file failed.\n");
                 return;
         }
 
-        size = fread(buffer, sizeof(char), 8, fp);
-
-        if (size < 8)
-                return;
-
-        entries = get_dword(buffer);
-        if (entries < 1)
+        if (windows_size < 8) {
+                free(windows);
                 return;
+        }
 
-        entry_size = get_dword(buffer + 4);
+        entries = get_dword(windows);
+        entry_size = get_dword(windows + 4);
 
-        size = fread(buffer, sizeof(char), entry_size, fp);
-        if (size < entry_size)
+        if (entries < 1 || entry_size < 0x6c || windows_size < 8 + (size_t)entry_size) {
+                free(windows);
                 return;
+        }
 
-        hhc = get_dword(buffer + 0x60);
-        hhk = get_dword(buffer + 0x64);
-        homepage = get_dword(buffer + 0x68);
-        bookname = get_dword(buffer + 0x14);
+        hhc = get_dword(windows + 8 + 0x60);
+        hhk = get_dword(windows + 8 + 0x64);
+        homepage = get_dword(windows + 8 + 0x68);
+        bookname = get_dword(windows + 8 + 0x14);
+
+        free(windows);
 
         d(printf("chm_windows_info >>> hhc = %x\n", hhc));
         d(printf("chm_windows_info >>> hhk = %x\n", hhk));
         d(printf("chm_windows_info >>> homepage = %x\n", homepage));
         d(printf("chm_windows_info >>> bookname = %x\n", bookname));
 
-        fclose(fp);
-
-        sprintf(strings_file, "%s/#STRINGS", info->bookfolder);
-        d(printf("chm_windows_info >>> strings info file = %s\n", strings_file));
+        strings = retrieve_object(info->chmfile, "/#STRINGS", &strings_size);
 
-        fp = fopen(strings_file, "r");
-
-        if (fp == NULL) {
+        if (strings == NULL) {
                 fprintf(stderr, "Open strings info file failed.\n");
                 return;
         }
 
-        size = fread(buffer, sizeof(char), 4096, fp);
+        if (!info->hhc && hhc && hhc < strings_size)
+                info->hhc = intern_string(info, strings + hhc, strings_size - hhc);
+        if (!info->hhk && hhk && hhk < strings_size)
+                info->hhk = intern_string(info, strings + hhk, strings_size - hhk);
+        if (!info->homepage && homepage && homepage < strings_size)
+                info->homepage = intern_string(info, strings + homepage, strings_size - homepage);
+        if (!info->bookname && bookname && bookname < strings_size)
+                info->bookname = intern_string(info, strings + bookname, strings_size - bookname);
 
-        if (size == 0)
-                return;
+        free(strings);
+}
+
+/*
+ * Parallel extraction
+ *
+ * The enumeration collects every object first, the directory tree is
+ * created in one pass, then worker threads each holding their own chm
+ * handle retrieve and write the objects.  Objects are sorted by their
+ * offset in the content section and handed out in consecutive chunks, so
+ * every worker decompresses its own run of LZX blocks instead of all of
+ * them fighting over the same reset interval.
+ */
+
+#define EXTRACT_CHUNK 64
+#define EXTRACT_MAX_THREADS 16
+
+struct extract_item
+{
+        LONGUINT64 start;
+        LONGUINT64 length;
+        int space;
+        char *path;
+};
+
+struct extract_job
+{
+        const char *filename;
+        const char *base_path;
+        const struct extract_options *options;
+
+        /* shared by the workers for kernel copies, -1 when unavailable */
+        int archive_fd;
+        u_int64_t data_offset;
+
+        /* set when the objects go to a pack */
+        struct pack_writer *pack;
+        /* else directories made below base_path */
+        struct dir_cache *dirs;
+
+        struct extract_item *items;
+        int count;
+        int capacity;
+        LONGUINT64 total_bytes;
+
+        pthread_mutex_t mutex;
+        int next;
+        int failed;
+        unsigned long objects;
+        LONGUINT64 bytes;
+};
+
+static double now(void)
+{
+        struct timeval tv;
 
-        if (!info->hhc && hhc) {
-                len = strlen((const char*)(buffer + hhc));
-                info->hhc = (char *)malloc(len + 1);
-                strcpy(info->hhc, (const char*)(buffer + hhc));
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int extract_cancelled(struct extract_job *job)
+{
+        return job->options && job->options->cancel && *job->options->cancel;
+}
+
+static int _collect_callback(struct chmFile *h,
+                             struct chmUnitInfo *ui,
+                             void *context)
+{
+        struct extract_job *job = (struct extract_job *)context;
+        struct extract_item *item;
+
+        if (extract_cancelled(job))
+                return CHM_ENUMERATOR_SUCCESS;
+
+        if (ui->path[0] != '/' || strstr(ui->path, "/../") != NULL)
+                return CHM_ENUMERATOR_CONTINUE;
+
+        if (job->count == job->capacity) {
+                job->capacity = job->capacity ? job->capacity * 2 : 1024;
+                job->items = (struct extract_item *)realloc(job->items, job->capacity * sizeof(struct extract_item));
+        }
+
+        item = job->items + job->count++;
+        item->start = ui->start;
+        item->length = ui->length;
+        item->space = ui->space;
+        item->path = strdup(ui->path);
+        job->total_bytes += ui->length;
+
+        return CHM_ENUMERATOR_CONTINUE;
+}
+
+static int compare_item_offset(const void *a, const void *b)
+{
+        const struct extract_item *x = (const struct extract_item *)a;
+        const struct extract_item *y = (const struct extract_item *)b;
+
+        if (x->space != y->space)
+                return x->space - y->space;
+
+        return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/* Create every directory the objects live in, each one exactly once */
+static void make_directories(struct extract_job *job)
+{
+        int i;
+
+        for (i = 0; i < job->count; i++) {
+                const char *path = job->items[i].path;
+                const char *slash = strrchr(path, '/');
+
+                if (slash > path)
+                        dir_cache_make(job->dirs, path + 1, slash - path - 1);
         }
-        if (!info->hhk && hhk) {
-                len = strlen((const char*)(buffer + hhk));
-                info->hhk = (char *)malloc(len + 1);
-                strcpy(info->hhk, (const char*)(buffer + hhk));
+}
+
+struct pack_source
+{
+        struct chmFile *h;
+        struct chmUnitInfo *ui;
+        u_int64_t decompress;
+};
+
+static long read_unit(void *data, unsigned char *buf, u_int64_t offset, long len)
+{
+        struct pack_source *source = (struct pack_source *)data;
+        u_int64_t t = chm_stats_clock();
+        long n = (long)chm_retrieve_object(source->h, source->ui, buf, offset, len);
+
+        source->decompress += chm_stats_clock() - t;
+
+        return n;
+}
+
+/* Store one archive object in the pack, directories have no entry */
+static int pack_unit(struct chmFile *h, struct chmUnitInfo *ui, struct pack_writer *pack)
+{
+        struct pack_source source;
+        u_int64_t begin = chm_stats_clock();
+        int ret;
+
+        if (ui->path[strlen(ui->path) - 1] == '/')
+                return 0;
+
+        source.h = h;
+        source.ui = ui;
+        source.decompress = 0;
+
+        ret = pack_add(pack, ui->path, ui->length, read_unit, &source);
+
+        /* compressing counts as writing */
+        chm_stats_add(CHM_STAT_DECOMPRESS_NS, source.decompress);
+        chm_stats_add(CHM_STAT_WRITE_NS, chm_stats_clock() - begin - source.decompress);
+        if (ret == 0) {
+                chm_stats_add(CHM_STAT_OBJECTS, 1);
+                chm_stats_add(CHM_STAT_BYTES, ui->length);
         }
-        if (!info->homepage && homepage) {
-                len = strlen((const char*)(buffer + homepage));
-                info->homepage = (char *)malloc(len + 1);
-                strcpy(info->homepage, (const char*)(buffer + homepage));
+
+        return ret;
+}
+
+static void *extract_worker(void *data)
+{
+        struct extract_job *job = (struct extract_job *)data;
+        struct chmFile *handle;
+        struct chmUnitInfo ui;
+
+        handle = chm_stats_open(job->filename);
+        if (handle == NULL) {
+                pthread_mutex_lock(&job->mutex);
+                job->failed = 1;
+                pthread_mutex_unlock(&job->mutex);
+                return NULL;
         }
-        if (!info->bookname && bookname) {
-                len = strlen((const char*)(buffer + bookname));
-                info->bookname = (char *)malloc(len + 1);
-                strcpy(info->bookname, (const char*)(buffer + bookname));
+
+        for (;;) {
+                int first, last, i;
+                unsigned long objects = 0;
+                LONGUINT64 bytes = 0;
+                u_int64_t begin;
+
+                pthread_mutex_lock(&job->mutex);
+                first = job->next;
+                job->next += EXTRACT_CHUNK;
+                pthread_mutex_unlock(&job->mutex);
+
+                if (first >= job->count)
+                        break;
+
+                last = first + EXTRACT_CHUNK;
+                if (last > job->count)
+                        last = job->count;
+
+                begin = chm_stats_clock();
+
+                for (i = first; i < last && !extract_cancelled(job); i++) {
+                        struct extract_item *item = job->items + i;
+
+                        ui.start = item->start;
+                        ui.length = item->length;
+                        ui.space = item->space;
+                        ui.flags = 0;
+                        strncpy(ui.path, item->path, CHM_MAX_PATHLEN);
+                        ui.path[CHM_MAX_PATHLEN] = '\0';
+
+                        if ((job->pack ? pack_unit(handle, &ui, job->pack)
+                             : extract_unit(handle, &ui, job->base_path, job->dirs,
+                                            job->archive_fd, job->data_offset)) == -1) {
+                                fprintf(stderr, "Extract object failed: %s\n", ui.path);
+                                continue;
+                        }
+
+                        objects++;
+                        bytes += item->length;
+                }
+
+                chm_trace_event("extract chunk", begin, chm_stats_clock(), job->items[first].path);
+
+                pthread_mutex_lock(&job->mutex);
+                job->objects += objects;
+                job->bytes += bytes;
+                if (job->options && job->options->progress)
+                        job->options->progress(job->objects, job->count,
+                                               job->bytes, job->total_bytes,
+                                               job->options->progress_data);
+                pthread_mutex_unlock(&job->mutex);
         }
 
-        fclose(fp);
+        chm_close(handle);
+        return NULL;
+}
+
+static int extract_threads(int count)
+{
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int threads = cpus > 0 ? (int)cpus : 1;
+
+        if (threads > EXTRACT_MAX_THREADS)
+                threads = EXTRACT_MAX_THREADS;
+        if (threads > count / EXTRACT_CHUNK + 1)
+                threads = count / EXTRACT_CHUNK + 1;
+
+        return threads;
 }
 
 long
-extract_chm(const char *filename, const char *base_path)
+extract_chm(const char *filename, const char *base_path,
+            const struct extract_options *options, struct extract_stats *stats)
 {
         struct chmFile *handle;
-        struct extract_context ec;
+        struct extract_job job;
+        pthread_t workers[EXTRACT_MAX_THREADS];
+        double begin, t;
+        u_int64_t mark = chm_stats_clock(), phase;
+        int i, threads;
+
+        begin = now();
 
-        handle = chm_open(filename);
+        handle = chm_pool_open(filename);
 
         if (handle == NULL) {
                 fprintf(stderr, "Cannot open chmfile: %s", filename);
                 return -1;
         }
 
-        ec.base_path = base_path;
+        memset(&job, 0, sizeof(job));
+        job.filename = filename;
+        job.base_path = base_path;
+        job.options = options;
+        pthread_mutex_init(&job.mutex, NULL);
+
+        job.archive_fd = open(filename, O_RDONLY);
+        if (job.archive_fd != -1 && chm_data_offset(job.archive_fd, &job.data_offset) == -1) {
+                close(job.archive_fd);
+                job.archive_fd = -1;
+        }
 
+        phase = chm_stats_clock();
         if (!chm_enumerate(handle,
                            CHM_ENUMERATE_NORMAL | CHM_ENUMERATE_SPECIAL,
-                           _extract_callback,
-                           (void *)&ec)) {
+                           _collect_callback,
+                           (void *)&job)) {
                 fprintf(stderr, "Extract chmfile failed: %s", filename);
         }
+        chm_stats_add(CHM_STAT_ENUMERATE_NS, chm_stats_clock() - phase);
+        chm_trace_event("enumerate", phase, chm_stats_clock(), filename);
+
+        chm_pool_close(handle);
+
+        t = now();
+        if (stats)
+                stats->enumerate_time = t - begin;
+
+        phase = chm_stats_clock();
+        qsort(job.items, job.count, sizeof(struct extract_item), compare_item_offset);
+        if (options && options->pack) {
+                char path[1024];
+
+                if (snprintf(path, sizeof(path), "%s/" PACK_FILE, base_path) < (int)sizeof(path))
+                        job.pack = pack_create(path);
+                if (!job.pack)
+                        job.failed = 1;
+        } else if (!extract_cancelled(&job)) {
+                job.dirs = dir_cache_open(base_path);
+                if (job.dirs)
+                        make_directories(&job);
+                else
+                        job.failed = 1;
+        }
 
-        chm_close(handle);
+        chm_trace_event("make directories", phase, chm_stats_clock(), base_path);
+
+        if (stats)
+                stats->mkdir_time = now() - t;
+        t = now();
+
+        threads = job.failed ? 0 : extract_threads(job.count);
+        for (i = 0; i < threads; i++) {
+                if (pthread_create(&workers[i], NULL, extract_worker, &job) != 0) {
+                        threads = i;
+                        break;
+                }
+        }
+
+        /* no thread could be started, do the work here */
+        if (threads == 0 && !job.failed)
+                extract_worker(&job);
+
+        for (i = 0; i < threads; i++)
+                pthread_join(workers[i], NULL);
+
+        if (job.pack && pack_finish(job.pack, !extract_cancelled(&job)) == -1
+            && !extract_cancelled(&job)) {
+                fprintf(stderr, "Writing pack failed: %s\n", base_path);
+                job.failed = 1;
+        }
+
+        if (stats) {
+                stats->extract_time = now() - t;
+                stats->total_time = now() - begin;
+                stats->threads = threads ? threads : 1;
+                stats->objects = job.objects;
+                stats->bytes = job.bytes;
+        }
+
+        chm_trace_event("extract_chm", mark, chm_stats_clock(), filename);
+
+        d(printf("extract_chm >>> %lu objects, %llu bytes, %d threads\n", job.objects, job.bytes, threads));
+
+        for (i = 0; i < job.count; i++)
+                free(job.items[i].path);
+        free(job.items);
+        dir_cache_close(job.dirs);
+        if (job.archive_fd != -1)
+                close(job.archive_fd);
+        pthread_mutex_destroy(&job.mutex);
+
+        if (extract_cancelled(&job))
+                return EXTRACT_CANCELLED;
+
+        return job.failed ? -1 : 0;
+}
+
+struct lazy_context
+{
+        const char *base_path;
+        struct manifest *manifest;
+};
+
+static int _lazy_callback(struct chmFile *h,
+                          struct chmUnitInfo *ui,
+                          void *context)
+{
+        struct lazy_context *ctx = (struct lazy_context *)context;
+
+        /* the # files only, $ ones like the search index can be huge */
+        if (strncmp(ui->path, "/#", 2) != 0)
+                return CHM_ENUMERATOR_CONTINUE;
+
+        if (extract_unit(h, ui, ctx->base_path, NULL, -1, 0) == 0)
+                manifest_add(ctx->manifest, ui->path);
+
+        return CHM_ENUMERATOR_CONTINUE;
+}
+
+/*
+ * Lazy extraction: write the special # objects and the NULL terminated
+ * paths (homepage, hhc, hhk) to base_path and start its manifest.  The
+ * other objects are extracted one by one as the pages ask for them.
+ */
+long
+extract_chm_lazy(struct chmFile *handle, const char *base_path, const char **paths)
+{
+        struct lazy_context ctx;
+        char objpath[CHM_MAX_PATHLEN + 1];
+        u_int64_t begin;
+
+        /* open_book leaves the folder to lazy extraction */
+        if (chm_make_folder(base_path) == -1)
+                return -1;
+
+        ctx.base_path = base_path;
+        ctx.manifest = manifest_open(base_path, 1);
+        if (!ctx.manifest)
+                return -1;
+
+        begin = chm_stats_clock();
+        if (!chm_enumerate(handle,
+                           CHM_ENUMERATE_SPECIAL,
+                           _lazy_callback,
+                           (void *)&ctx))
+                fprintf(stderr, "Extract special objects failed: %s\n", base_path);
+        chm_stats_add(CHM_STAT_ENUMERATE_NS, chm_stats_clock() - begin);
+
+        for (; *paths; paths++) {
+                if (snprintf(objpath, sizeof(objpath), "%s%s", (*paths)[0] == '/' ? "" : "/", *paths) >= (int)sizeof(objpath))
+                        continue;
+
+                /* the homepage may carry an anchor or a query */
+                objpath[1 + strcspn(objpath + 1, "?#")] = '\0';
+                chm_normalize_path(objpath);
+
+                if (extract_object(handle, objpath, base_path) == 0)
+                        manifest_add(ctx.manifest, objpath);
+        }
+
+        manifest_close(ctx.manifest);
 
         return 0;
 }
 
+long
+extract_object(struct chmFile *handle, const char *path, const char *base_path)
+{
+        struct chmUnitInfo ui;
+        char objpath[CHM_MAX_PATHLEN + 1];
+        u_int64_t begin = chm_stats_clock();
+        int ret;
+
+        if (snprintf(objpath, sizeof(objpath), "%s%s", path[0] == '/' ? "" : "/", path) >= (int)sizeof(objpath))
+                return -1;
+
+        chm_normalize_path(objpath);
+
+        if (chm_resolve_object(handle, objpath, &ui) != CHM_RESOLVE_SUCCESS) {
+                d(printf("extract_object >>> %s not found\n", objpath));
+                return -1;
+        }
+
+        ret = extract_unit(handle, &ui, base_path, NULL, -1, 0);
+        chm_trace_event("extract_object", begin, chm_stats_clock(), objpath);
+
+        return ret;
+}
+
+/*
+ * Collapse "//", "/./" and "/../" segments of an archive path in place,
+ * so relative links resolve to the object name stored in the directory.
+ */
+void
+chm_normalize_path(char *path)
+{
+        char *src = path, *dst = path;
+
+        if (*src != '/')
+                return;
+
+        while (*src) {
+                if (src[0] == '/' && src[1] == '/') {
+                        src++;
+                } else if (src[0] == '/' && src[1] == '.' && (src[2] == '/' || src[2] == '\0')) {
+                        src += 2;
+                } else if (src[0] == '/' && src[1] == '.' && src[2] == '.' && (src[3] == '/' || src[3] == '\0')) {
+                        src += 3;
+                        while (dst > path && *--dst != '/')
+                                ;
+                } else {
+                        *dst++ = *src++;
+                }
+        }
+
+        if (dst == path)
+                *dst++ = '/';
+        *dst = '\0';
+}
+
 void
 chm_fileinfo(struct fileinfo *info)
 {
+        u_int64_t begin = chm_stats_clock();
+
+        if (info->arena == NULL)
+                info->arena = chm_arena_new();
+        if (info->arena == NULL)
+                return;
+
         chm_system_info(info);
         chm_windows_info(info);
+        chm_trace_event("chm_fileinfo", begin, chm_stats_clock(), info->bookname);
 
         d(printf("chm_fileinfo >>> hhc = %s\n", info->hhc));
         d(printf("chm_fileinfo >>> hhk = %s\n", info->hhk));
@@ -26,21 +26,57 @@
 #define d(x)
 #endif
 
+struct chmFile;
+struct chm_arena;
+
+/* the strings are interned in arena, created by chm_fileinfo() if NULL */
 struct fileinfo
 {
-        const char *bookfolder;
-        char *homepage;
-        char *bookname;
-        char *hhc;
-        char *hhk;
+        struct chmFile *chmfile;
+        struct chm_arena *arena;
+        const char *homepage;
+        const char *bookname;
+        const char *hhc;
+        const char *hhk;
         u_int32_t lcid;
 };
 
+struct extract_stats
+{
+        double enumerate_time;
+        double mkdir_time;
+        double extract_time;
+        double total_time;
+        int threads;
+        unsigned long objects;
+        unsigned long long bytes;
+};
+
+typedef void (*extract_progress_func)(unsigned long objects,
+                                      unsigned long total_objects,
+                                      unsigned long long bytes,
+                                      unsigned long long total_bytes,
+                                      void *data);
+
+struct extract_options
+{
+        extract_progress_func progress;
+        void *progress_data;
+        volatile int *cancel;
+        int pack;               /* store into PACK_FILE instead of files */
+};
+
+#define EXTRACT_CANCELLED -3
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-long extract_chm(const char *, const char *);
+long extract_chm(const char *, const char *, const struct extract_options *, struct extract_stats *);
+long extract_chm_lazy(struct chmFile *, const char *, const char **);
+long extract_object(struct chmFile *, const char *, const char *);
+int chm_make_folder(const char *);
+void chm_normalize_path(char *);
 void chm_fileinfo(struct fileinfo *);
 
 #ifdef __cplusplus
@@ -0,0 +1,545 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Reader of the full-text index Microsoft's compiler puts in archives
+ *
+ * $FIftiMain is a B-tree of words.  Index nodes hold the last word of each
+ * child, leaf nodes hold the words with the offset and size of their
+ * word location codes (WLC): for every topic containing the word, the
+ * topic number delta, the number of locations and the locations, all in
+ * scale and root encoding.  Topic numbers index #TOPICS, which points to
+ * the title in #STRINGS and, through #URLTBL, to the page in #URLSTR.
+ *
+ * Words are stored in the book charset, queries are matched without
+ * regard to ASCII case.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include <chm_lib.h>
+
+#include "csChmfile.h"
+#include "csChmparser.h"
+#include "csChmfts.h"
+
+#define FTS_HEADER_LEN   0x32
+#define TOPICS_ENTRY_LEN 16
+#define URLTBL_ENTRY_LEN 12
+#define STRING_MAX       1024
+#define QUERY_WORDS_MAX  16
+#define TITLE_BOOST      8
+
+struct fts
+{
+        struct chmFile *h;
+        struct chmUnitInfo main, topics, strings, urltbl, urlstr;
+
+        u_int32_t root;
+        u_int16_t depth;
+        u_int32_t node_len;
+        unsigned char doc_s, doc_r;
+        unsigned char count_s, count_r;
+        unsigned char loc_s, loc_r;
+};
+
+struct fts_hit
+{
+        u_int32_t topic;
+        u_int32_t weight;
+};
+
+struct hit_list
+{
+        struct fts_hit *hits;
+        u_int32_t count;
+        u_int32_t capacity;
+};
+
+static u_int16_t get_word(const unsigned char *buf)
+{
+        return buf[0] | (buf[1] << 8);
+}
+
+static u_int32_t get_dword(const unsigned char *buf)
+{
+        return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((u_int32_t)buf[3] << 24);
+}
+
+/* Bit reader for the scale and root encoded numbers, most significant bit first */
+
+struct bits
+{
+        const unsigned char *p;
+        const unsigned char *end;
+        int bit;
+};
+
+static int get_bit(struct bits *b)
+{
+        int value;
+
+        if (b->p >= b->end)
+                return -1;
+
+        value = (*b->p >> b->bit) & 1;
+        if (b->bit-- == 0) {
+                b->bit = 7;
+                b->p++;
+        }
+
+        return value;
+}
+
+static void align_byte(struct bits *b)
+{
+        if (b->bit != 7) {
+                b->bit = 7;
+                b->p++;
+        }
+}
+
+/*
+ * Scale 2, root r: n one bits and a zero, then r bits if n is 0, else
+ * r + n - 1 bits below an implicit leading one.  Returns -1 at the end of
+ * the buffer.
+ */
+static int64_t sr_int(struct bits *b, unsigned char r)
+{
+        int n = 0, bit, nbits, i;
+        u_int64_t value = 0;
+
+        while ((bit = get_bit(b)) == 1)
+                n++;
+        if (bit == -1 || n > 32)
+                return -1;
+
+        nbits = r + (n ? n - 1 : 0);
+        for (i = 0; i < nbits; i++) {
+                if ((bit = get_bit(b)) == -1)
+                        return -1;
+                value = (value << 1) | bit;
+        }
+
+        if (n)
+                value |= (u_int64_t)1 << nbits;
+
+        return value;
+}
+
+/* Variable length integers of the leaf nodes, least significant group first */
+static u_int64_t enc_int(const unsigned char *p, const unsigned char *end, size_t *length)
+{
+        u_int64_t value = 0;
+        int shift = 0;
+
+        *length = 0;
+        while (p < end && shift < 64) {
+                value |= (u_int64_t)(*p & 0x7f) << shift;
+                (*length)++;
+                if (!(*p++ & 0x80))
+                        break;
+                shift += 7;
+        }
+
+        return value;
+}
+
+static int fts_init(struct fts *fts, struct chmFile *h)
+{
+        unsigned char header[FTS_HEADER_LEN];
+
+        memset(fts, 0, sizeof(*fts));
+        fts->h = h;
+
+        if (chm_resolve_object(h, "/$FIftiMain", &fts->main) != CHM_RESOLVE_SUCCESS
+            || chm_resolve_object(h, "/#TOPICS", &fts->topics) != CHM_RESOLVE_SUCCESS
+            || chm_resolve_object(h, "/#STRINGS", &fts->strings) != CHM_RESOLVE_SUCCESS
+            || chm_resolve_object(h, "/#URLTBL", &fts->urltbl) != CHM_RESOLVE_SUCCESS
+            || chm_resolve_object(h, "/#URLSTR", &fts->urlstr) != CHM_RESOLVE_SUCCESS)
+                return -1;
+
+        if (chm_retrieve_object(h, &fts->main, header, 0, FTS_HEADER_LEN) != FTS_HEADER_LEN)
+                return -1;
+
+        fts->root = get_dword(header + 0x14);
+        fts->depth = get_word(header + 0x18);
+        fts->doc_s = header[0x1e];
+        fts->doc_r = header[0x1f];
+        fts->count_s = header[0x20];
+        fts->count_r = header[0x21];
+        fts->loc_s = header[0x22];
+        fts->loc_r = header[0x23];
+        fts->node_len = get_dword(header + 0x2e);
+
+        /* only scale 2 is ever used */
+        if (fts->doc_s != 2 || fts->count_s != 2 || fts->loc_s != 2
+            || fts->node_len < 8 || fts->node_len > 0x10000 || fts->depth == 0)
+                return -1;
+
+        return 0;
+}
+
+int
+fts_available(struct chmFile *h)
+{
+        struct fts fts;
+
+        return fts_init(&fts, h) == 0;
+}
+
+static int read_node(struct fts *fts, u_int32_t offset, unsigned char *buffer)
+{
+        return chm_retrieve_object(fts->h, &fts->main, buffer, offset, fts->node_len) == (LONGINT64)fts->node_len ? 0 : -1;
+}
+
+/*
+ * Walk the index nodes down to the first leaf which may hold word.  Words
+ * are front compressed: each repeats pos bytes of the previous one.
+ */
+static u_int32_t find_leaf(struct fts *fts, const char *word, unsigned char *buffer)
+{
+        u_int32_t offset = fts->root;
+        char current[256];
+        int level;
+
+        for (level = 1; level < fts->depth; level++) {
+                u_int32_t i = 2, end, next = 0;
+                int found = 0;
+
+                if (read_node(fts, offset, buffer) == -1)
+                        return 0;
+
+                end = fts->node_len - get_word(buffer);
+                if (end > fts->node_len)
+                        return 0;
+
+                while (i + 2 <= end) {
+                        unsigned char len = buffer[i], pos = buffer[i + 1];
+
+                        if (len == 0 || pos + len > sizeof(current) || i + len + 7 > end)
+                                break;
+
+                        memcpy(current + pos, buffer + i + 2, len - 1);
+                        current[pos + len - 1] = '\0';
+
+                        next = get_dword(buffer + i + len + 1);
+                        if (strcasecmp(word, current) <= 0) {
+                                found = 1;
+                                break;
+                        }
+
+                        i += len + 7;
+                }
+
+                /* past the last word, there is no leaf for it */
+                if (!found || next == offset)
+                        return 0;
+                offset = next;
+        }
+
+        return offset;
+}
+
+static void hit_add(struct hit_list *list, u_int32_t topic, u_int32_t weight)
+{
+        if (list->count == list->capacity) {
+                list->capacity = list->capacity ? list->capacity * 2 : 256;
+                list->hits = (struct fts_hit *)realloc(list->hits, list->capacity * sizeof(struct fts_hit));
+        }
+
+        list->hits[list->count].topic = topic;
+        list->hits[list->count].weight = weight;
+        list->count++;
+}
+
+/* Decode the location codes of one word, adding a hit per topic */
+static int read_wlc(struct fts *fts, u_int64_t count, u_int32_t offset, u_int32_t size,
+                    int title, struct hit_list *list)
+{
+        unsigned char *buffer;
+        struct bits b;
+        u_int64_t i, j;
+        int64_t topic = 0, value;
+
+        buffer = (unsigned char *)malloc(size ? size : 1);
+        if (chm_retrieve_object(fts->h, &fts->main, buffer, offset, size) != (LONGINT64)size) {
+                free(buffer);
+                return -1;
+        }
+
+        b.p = buffer;
+        b.end = buffer + size;
+        b.bit = 7;
+
+        for (i = 0; i < count; i++) {
+                int64_t locations;
+
+                align_byte(&b);
+
+                if ((value = sr_int(&b, fts->doc_r)) == -1)
+                        break;
+                topic += value;
+
+                if ((locations = sr_int(&b, fts->count_r)) == -1)
+                        break;
+                for (j = 0; j < (u_int64_t)locations; j++)
+                        if (sr_int(&b, fts->loc_r) == -1)
+                                break;
+
+                hit_add(list, (u_int32_t)topic, (u_int32_t)locations * (title ? TITLE_BOOST : 1));
+        }
+
+        free(buffer);
+        return 0;
+}
+
+/*
+ * Collect the topics containing word, or a word starting with it when
+ * partial is set.  Leaves are chained, so a prefix may span several.
+ */
+static void search_word(struct fts *fts, const char *word, int partial, struct hit_list *list)
+{
+        unsigned char *buffer = (unsigned char *)malloc(fts->node_len);
+        size_t word_len = strlen(word);
+        u_int32_t offset;
+        char current[256];
+        int done = 0;
+
+        offset = find_leaf(fts, word, buffer);
+
+        while (offset && !done) {
+                u_int32_t i = 8, end, next;
+
+                if (read_node(fts, offset, buffer) == -1)
+                        break;
+
+                next = get_dword(buffer);
+                end = fts->node_len - get_word(buffer + 6);
+                if (end > fts->node_len)
+                        break;
+
+                while (i + 2 <= end) {
+                        unsigned char len = buffer[i], pos = buffer[i + 1];
+                        u_int64_t wlc_count, wlc_size;
+                        u_int32_t wlc_offset;
+                        size_t n;
+                        int title, cmp;
+
+                        if (len == 0 || pos + len > sizeof(current) || i + 2 + len > end)
+                                break;
+
+                        memcpy(current + pos, buffer + i + 2, len - 1);
+                        current[pos + len - 1] = '\0';
+                        i += 2 + len;
+                        title = buffer[i - 1];
+
+                        wlc_count = enc_int(buffer + i, buffer + end, &n);
+                        i += n;
+                        if (i + 6 > end)
+                                break;
+                        wlc_offset = get_dword(buffer + i);
+                        i += 6;
+                        wlc_size = enc_int(buffer + i, buffer + end, &n);
+                        i += n;
+
+                        cmp = partial ? strncasecmp(current, word, word_len) : strcasecmp(current, word);
+                        if (cmp == 0) {
+                                read_wlc(fts, wlc_count, wlc_offset, (u_int32_t)wlc_size, title, list);
+                                if (!partial) {
+                                        done = 1;
+                                        break;
+                                }
+                        } else if (cmp > 0) {
+                                done = 1;
+                                break;
+                        }
+                }
+
+                offset = (next == offset) ? 0 : next;
+        }
+
+        free(buffer);
+}
+
+static int compare_hit_topic(const void *a, const void *b)
+{
+        const struct fts_hit *ha = (const struct fts_hit *)a;
+        const struct fts_hit *hb = (const struct fts_hit *)b;
+
+        return ha->topic < hb->topic ? -1 : ha->topic > hb->topic;
+}
+
+static int compare_hit_weight(const void *a, const void *b)
+{
+        const struct fts_hit *ha = (const struct fts_hit *)a;
+        const struct fts_hit *hb = (const struct fts_hit *)b;
+
+        if (ha->weight != hb->weight)
+                return ha->weight > hb->weight ? -1 : 1;
+        return ha->topic < hb->topic ? -1 : ha->topic > hb->topic;
+}
+
+/* sort by topic and sum the weights of repeated topics */
+static void hits_normalize(struct hit_list *list)
+{
+        u_int32_t i, n = 0;
+
+        qsort(list->hits, list->count, sizeof(struct fts_hit), compare_hit_topic);
+
+        for (i = 0; i < list->count; i++) {
+                if (n && list->hits[n - 1].topic == list->hits[i].topic)
+                        list->hits[n - 1].weight += list->hits[i].weight;
+                else
+                        list->hits[n++] = list->hits[i];
+        }
+        list->count = n;
+}
+
+/* keep the topics of result also in list, adding up the weights */
+static void hits_intersect(struct hit_list *result, const struct hit_list *list)
+{
+        u_int32_t i = 0, j = 0, n = 0;
+
+        while (i < result->count && j < list->count) {
+                if (result->hits[i].topic < list->hits[j].topic) {
+                        i++;
+                } else if (result->hits[i].topic > list->hits[j].topic) {
+                        j++;
+                } else {
+                        result->hits[n].topic = result->hits[i].topic;
+                        result->hits[n].weight = result->hits[i].weight + list->hits[j].weight;
+                        n++;
+                        i++;
+                        j++;
+                }
+        }
+        result->count = n;
+}
+
+static void read_string(struct fts *fts, struct chmUnitInfo *ui, u_int32_t offset, char *buffer)
+{
+        LONGINT64 len = 0;
+
+        if (offset < ui->length)
+                len = chm_retrieve_object(fts->h, ui, (unsigned char *)buffer, offset, STRING_MAX - 1);
+        buffer[len > 0 ? len : 0] = '\0';
+}
+
+/* Title and page of a topic, returns -1 if the topic has no page */
+static int topic_info(struct fts *fts, u_int32_t topic, char *title, char *url)
+{
+        unsigned char entry[TOPICS_ENTRY_LEN], urlentry[URLTBL_ENTRY_LEN];
+
+        *title = *url = '\0';
+
+        if (chm_retrieve_object(fts->h, &fts->topics, entry, (LONGUINT64)topic * TOPICS_ENTRY_LEN,
+                                TOPICS_ENTRY_LEN) != TOPICS_ENTRY_LEN)
+                return -1;
+
+        if (get_dword(entry + 4) != 0xffffffff)
+                read_string(fts, &fts->strings, get_dword(entry + 4), title);
+
+        if (chm_retrieve_object(fts->h, &fts->urltbl, urlentry, get_dword(entry + 8),
+                                URLTBL_ENTRY_LEN) != URLTBL_ENTRY_LEN)
+                return -1;
+
+        read_string(fts, &fts->urlstr, get_dword(urlentry + 8) + 8, url);
+
+        return *url ? 0 : -1;
+}
+
+/*
+ * Look the words of query up in the built-in index and append the best
+ * limit pages containing all of them to results, a title and a page per
+ * entry.  Returns the number of pages found, -1 if the archive has no
+ * index.
+ */
+int
+fts_search(struct chmFile *h, const char *query, int partial,
+           struct sitemap *results, u_int32_t limit)
+{
+        struct fts fts;
+        struct hit_list result, list;
+        char words[QUERY_WORDS_MAX][256];
+        int count = 0, w;
+        const char *p = query;
+        u_int32_t i, found = 0;
+
+        if (fts_init(&fts, h) == -1)
+                return -1;
+
+        /* words are split at ASCII blanks and punctuation */
+        while (*p && count < QUERY_WORDS_MAX) {
+                size_t len = 0;
+
+                while (*p && (unsigned char)*p < 0x80 && !isalnum((unsigned char)*p) && *p != '_')
+                        p++;
+                while (*p && ((unsigned char)*p >= 0x80 || isalnum((unsigned char)*p) || *p == '_')) {
+                        if (len < sizeof(words[0]) - 1)
+                                words[count][len++] = *p;
+                        p++;
+                }
+                if (len) {
+                        words[count][len] = '\0';
+                        count++;
+                }
+        }
+
+        if (count == 0)
+                return 0;
+
+        memset(&result, 0, sizeof(result));
+        for (w = 0; w < count; w++) {
+                memset(&list, 0, sizeof(list));
+                search_word(&fts, words[w], partial, &list);
+                hits_normalize(&list);
+
+                if (w == 0) {
+                        result = list;
+                } else {
+                        hits_intersect(&result, &list);
+                        free(list.hits);
+                }
+
+                if (result.count == 0)
+                        break;
+        }
+
+        qsort(result.hits, result.count, sizeof(struct fts_hit), compare_hit_weight);
+
+        for (i = 0; i < result.count && found < limit; i++) {
+                char title[STRING_MAX], url[STRING_MAX];
+
+                if (topic_info(&fts, result.hits[i].topic, title, url) == -1)
+                        continue;
+
+                sitemap_append(results, 0, *title ? title : url, url);
+                found++;
+        }
+
+        d(printf("fts_search >>> %s: %u topics, %u pages\n", query, result.count, found));
+
+        free(result.hits);
+        return found;
+}
@@ -0,0 +1,242 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Book fingerprint
+ *
+ * The bookshelf folder of a book is named after a 64-bit FNV-1a hash of
+ * its ITSF header and directory chunks plus the file size.  The directory
+ * lists the offset and length of every object, so it identifies the book
+ * without reading the content sections.  A cache file maps (path, device,
+ * inode, mtime, size) to the fingerprint, so a known book costs one stat
+ * and one small read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "csChmfile.h"
+#include "csChmhash.h"
+#include "csChmstats.h"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME        0x100000001b3ULL
+
+#define ITSF_DIR_OFFSET  0x48
+#define ITSF_DIR_LENGTH  0x50
+#define ITSF_MIN_HEADER  0x58
+
+#define CACHE_LINE_MAX   (4096 + 128)
+
+static u_int64_t get_qword(const unsigned char *buf)
+{
+        u_int64_t result = 0;
+        int i;
+
+        for (i = 7; i >= 0; i--)
+                result = (result << 8) | buf[i];
+
+        return result;
+}
+
+static u_int64_t fnv1a(u_int64_t hash, const unsigned char *buf, size_t len)
+{
+        const unsigned char *end = buf + len;
+
+        while (buf < end) {
+                hash ^= *buf++;
+                hash *= FNV_PRIME;
+        }
+
+        return hash;
+}
+
+static int hash_file(const char *filename, const struct stat *statbuf, char *fingerprint)
+{
+        unsigned char header[ITSF_MIN_HEADER];
+        u_int64_t hash, end, size = statbuf->st_size;
+        void *map;
+        int fd;
+
+        fd = open(filename, O_RDONLY);
+        if (fd == -1)
+                return -1;
+
+        if (read(fd, header, sizeof(header)) != sizeof(header)
+            || memcmp(header, "ITSF", 4) != 0) {
+                fprintf(stderr, "Not a chm file: %s\n", filename);
+                close(fd);
+                return -1;
+        }
+
+        end = get_qword(header + ITSF_DIR_OFFSET) + get_qword(header + ITSF_DIR_LENGTH);
+        if (end > size || end < ITSF_MIN_HEADER)
+                end = size;
+
+        map = mmap(NULL, end, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (map == MAP_FAILED)
+                return -1;
+
+        madvise(map, end, MADV_SEQUENTIAL);
+
+        hash = fnv1a(FNV_OFFSET_BASIS, (const unsigned char *)map, end);
+        hash = fnv1a(hash, (const unsigned char *)&size, sizeof(size));
+
+        munmap(map, end);
+
+        snprintf(fingerprint, CHM_FINGERPRINT_LEN + 1, "%016llx", (unsigned long long)hash);
+        d(printf("hash_file >>> %s: %s, hashed %llu bytes\n", filename, fingerprint, (unsigned long long)end));
+
+        return 0;
+}
+
+/*
+ * The cache is rewritten as a whole, one writer at a time within the
+ * process.  Other processes write through their own temporary.
+ */
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Cache lines look like "<dev> <ino> <mtime> <size> <fingerprint> <path>".
+ * Returns 0 and fills fingerprint if path is cached with the same identity.
+ */
+static int cache_lookup(const char *cache_path, const char *filename,
+                        const struct stat *statbuf, char *fingerprint)
+{
+        char line[CACHE_LINE_MAX];
+        FILE *fp;
+        int found = -1;
+
+        fp = fopen(cache_path, "r");
+        if (fp == NULL)
+                return -1;
+
+        while (fgets(line, sizeof(line), fp)) {
+                unsigned long long dev, ino, size;
+                long long mtime;
+                char hash[CHM_FINGERPRINT_LEN + 1];
+                int pos = 0;
+
+                if (sscanf(line, "%llu %llu %lld %llu %16s %n", &dev, &ino, &mtime, &size, hash, &pos) < 5 || pos == 0)
+                        continue;
+
+                line[strcspn(line, "\n")] = '\0';
+
+                if (strcmp(line + pos, filename) == 0
+                    && dev == (unsigned long long)statbuf->st_dev
+                    && ino == (unsigned long long)statbuf->st_ino
+                    && mtime == (long long)statbuf->st_mtime
+                    && size == (unsigned long long)statbuf->st_size) {
+                        strcpy(fingerprint, hash);
+                        found = 0;
+                        break;
+                }
+        }
+
+        fclose(fp);
+        return found;
+}
+
+/* Rewrite the cache with the entry of filename replaced */
+static void cache_store(const char *cache_path, const char *filename,
+                        const struct stat *statbuf, const char *fingerprint)
+{
+        char line[CACHE_LINE_MAX];
+        char tmp_path[1024];
+        FILE *in, *out;
+        int fd;
+
+        /* a private temporary, chmsee-prepare may be storing at the same time */
+        if (snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", cache_path) >= (int)sizeof(tmp_path))
+                return;
+
+        fd = mkstemp(tmp_path);
+        if (fd == -1)
+                return;
+
+        out = fdopen(fd, "w");
+        if (out == NULL) {
+                close(fd);
+                unlink(tmp_path);
+                return;
+        }
+
+        in = fopen(cache_path, "r");
+        if (in) {
+                while (fgets(line, sizeof(line), in)) {
+                        int pos = 0;
+                        char path[CACHE_LINE_MAX];
+
+                        strcpy(path, line);
+                        path[strcspn(path, "\n")] = '\0';
+                        sscanf(path, "%*u %*u %*d %*u %*s %n", &pos);
+
+                        if (pos == 0 || strcmp(path + pos, filename) != 0)
+                                fputs(line, out);
+                }
+                fclose(in);
+        }
+
+        fprintf(out, "%llu %llu %lld %llu %s %s\n",
+                (unsigned long long)statbuf->st_dev,
+                (unsigned long long)statbuf->st_ino,
+                (long long)statbuf->st_mtime,
+                (unsigned long long)statbuf->st_size,
+                fingerprint, filename);
+
+        if (fclose(out) == 0)
+                rename(tmp_path, cache_path);
+        else
+                unlink(tmp_path);
+}
+
+int
+chm_fingerprint(const char *filename, const char *cache_path, char *fingerprint)
+{
+        struct stat statbuf;
+
+        chm_stats_add(CHM_STAT_STATS, 1);
+        if (stat(filename, &statbuf) == -1)
+                return -1;
+
+        if (cache_path && cache_lookup(cache_path, filename, &statbuf, fingerprint) == 0) {
+                d(printf("chm_fingerprint >>> cached %s: %s\n", filename, fingerprint));
+                return 0;
+        }
+
+        if (hash_file(filename, &statbuf, fingerprint) == -1)
+                return -1;
+
+        if (cache_path) {
+                pthread_mutex_lock(&cache_mutex);
+                cache_store(cache_path, filename, &statbuf, fingerprint);
+                pthread_mutex_unlock(&cache_mutex);
+        }
+
+        return 0;
+}
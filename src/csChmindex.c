@@ -0,0 +1,219 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "csChmfile.h"
+#include "csChmparser.h"
+#include "csChmindex.h"
+
+#define TRI_BITS    16
+#define TRI_BUCKETS (1 << TRI_BITS)
+
+struct sort_item
+{
+        const char *key;
+        u_int32_t entry;
+};
+
+static int compare_sort_item(const void *a, const void *b)
+{
+        const struct sort_item *ia = (const struct sort_item *)a;
+        const struct sort_item *ib = (const struct sort_item *)b;
+        int ret = strcmp(ia->key, ib->key);
+
+        if (ret)
+                return ret;
+
+        return ia->entry < ib->entry ? -1 : ia->entry > ib->entry;
+}
+
+static inline char fold(char c)
+{
+        return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline u_int32_t trigram(const char *s)
+{
+        u_int32_t h = ((unsigned char)s[0] << 16) | ((unsigned char)s[1] << 8) | (unsigned char)s[2];
+
+        return (h * 2654435761u) >> (32 - TRI_BITS);
+}
+
+struct name_index *
+name_index_build(const struct sitemap *map)
+{
+        struct name_index *index;
+        struct sort_item *items;
+        u_int32_t *fill;
+        size_t len = 0, off;
+        u_int32_t i;
+
+        index = (struct name_index *)calloc(1, sizeof(struct name_index));
+        index->count = map->count;
+
+        for (i = 0; i < map->count; i++)
+                if (map->entries[i].name < map->strings_len)
+                        len += strlen(SITEMAP_NAME(map, i));
+        len += map->count;
+
+        index->folded = (char *)malloc(len ? len : 1);
+        index->folded_off = (u_int32_t *)malloc((map->count + 1) * sizeof(u_int32_t));
+        index->sorted = (u_int32_t *)malloc((map->count + 1) * sizeof(u_int32_t));
+        items = (struct sort_item *)malloc((map->count + 1) * sizeof(struct sort_item));
+
+        /* fold in entry order, then sort by the folded names */
+        for (i = 0, off = 0; i < map->count; i++) {
+                const char *name = map->entries[i].name < map->strings_len ? SITEMAP_NAME(map, i) : "";
+
+                items[i].key = index->folded + off;
+                items[i].entry = i;
+                while (*name)
+                        index->folded[off++] = fold(*name++);
+                index->folded[off++] = '\0';
+        }
+
+        qsort(items, map->count, sizeof(struct sort_item), compare_sort_item);
+
+        for (i = 0; i < map->count; i++) {
+                index->sorted[i] = items[i].entry;
+                index->folded_off[i] = items[i].key - index->folded;
+        }
+        free(items);
+
+        /* count, then place, the trigrams of every name in name order */
+        index->tri_start = (u_int32_t *)calloc(TRI_BUCKETS + 1, sizeof(u_int32_t));
+        for (i = 0; i < map->count; i++) {
+                const char *s = index->folded + index->folded_off[i];
+                for (; s[0] && s[1] && s[2]; s++)
+                        index->tri_start[trigram(s) + 1]++;
+        }
+        for (i = 0; i < TRI_BUCKETS; i++)
+                index->tri_start[i + 1] += index->tri_start[i];
+
+        index->tri_ranks = (u_int32_t *)malloc((index->tri_start[TRI_BUCKETS] + 1) * sizeof(u_int32_t));
+        fill = (u_int32_t *)malloc(TRI_BUCKETS * sizeof(u_int32_t));
+        memcpy(fill, index->tri_start, TRI_BUCKETS * sizeof(u_int32_t));
+
+        for (i = 0; i < map->count; i++) {
+                const char *s = index->folded + index->folded_off[i];
+                for (; s[0] && s[1] && s[2]; s++)
+                        index->tri_ranks[fill[trigram(s)]++] = i;
+        }
+        free(fill);
+
+        d(printf("name_index_build >>> %u names, %u trigrams\n", index->count, index->tri_start[TRI_BUCKETS]));
+
+        return index;
+}
+
+/* match the folded text against every name, or only the candidates of its rarest trigram */
+static void run_query(struct name_index *index, const char *text)
+{
+        size_t len = strlen(text);
+        u_int32_t best, last, i;
+        const char *s;
+
+        index->match_count = 0;
+        if (!index->matches)
+                index->matches = (u_int32_t *)malloc((index->count + 1) * sizeof(u_int32_t));
+
+        if (len < 3) {
+                for (i = 0; i < index->count; i++)
+                        if (strstr(index->folded + index->folded_off[i], text))
+                                index->matches[index->match_count++] = i;
+                return;
+        }
+
+        best = trigram(text);
+        for (s = text + 1; s[2]; s++) {
+                u_int32_t b = trigram(s);
+                if (index->tri_start[b + 1] - index->tri_start[b]
+                    < index->tri_start[best + 1] - index->tri_start[best])
+                        best = b;
+        }
+
+        last = (u_int32_t)-1;
+        for (i = index->tri_start[best]; i < index->tri_start[best + 1]; i++) {
+                u_int32_t rank = index->tri_ranks[i];
+                if (rank == last)
+                        continue;
+                last = rank;
+
+                if (strstr(index->folded + index->folded_off[rank], text))
+                        index->matches[index->match_count++] = rank;
+        }
+}
+
+/*
+ * Put the entries of at most limit names containing text, starting with
+ * match number offset, into entries.  Matches are in name order and the
+ * whole result of the last text is kept, so scrolling through it does not
+ * search again.  Returns the total number of matches.
+ */
+u_int32_t
+name_index_filter(struct name_index *index, const char *text,
+                  u_int32_t offset, u_int32_t limit, u_int32_t *entries)
+{
+        u_int32_t total, i;
+        char *folded;
+
+        if (*text == '\0') {
+                total = index->count;
+                for (i = 0; i < limit && offset + i < total; i++)
+                        entries[i] = index->sorted[offset + i];
+                return total;
+        }
+
+        if (!index->last || strcasecmp(index->last, text) != 0) {
+                folded = strdup(text);
+                for (i = 0; folded[i]; i++)
+                        folded[i] = fold(folded[i]);
+
+                run_query(index, folded);
+
+                free(index->last);
+                index->last = folded;
+        }
+
+        total = index->match_count;
+        for (i = 0; i < limit && offset + i < total; i++)
+                entries[i] = index->sorted[index->matches[offset + i]];
+
+        return total;
+}
+
+void
+name_index_free(struct name_index *index)
+{
+        if (!index)
+                return;
+
+        free(index->sorted);
+        free(index->folded_off);
+        free(index->folded);
+        free(index->tri_start);
+        free(index->tri_ranks);
+        free(index->last);
+        free(index->matches);
+        free(index);
+}
@@ -0,0 +1,60 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHMINDEX_H__
+#define __CS_CHMINDEX_H__
+
+#include <sys/types.h>
+
+struct sitemap;
+
+/*
+ * Names of a sitemap sorted case-insensitively, with trigram postings for
+ * substring search.  Only ASCII letters are folded, other bytes are
+ * compared as they are, names are UTF-8 by then.
+ */
+struct name_index
+{
+        u_int32_t count;
+        u_int32_t *sorted;      /* entry numbers in name order */
+        u_int32_t *folded_off;  /* folded name of sorted[i] */
+        char *folded;
+
+        u_int32_t *tri_start;   /* TRI_BUCKETS + 1 offsets into tri_ranks */
+        u_int32_t *tri_ranks;   /* ascending positions in sorted */
+
+        /* result of the last query */
+        char *last;
+        u_int32_t *matches;
+        u_int32_t match_count;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct name_index *name_index_build(const struct sitemap *);
+u_int32_t name_index_filter(struct name_index *, const char *, u_int32_t, u_int32_t, u_int32_t *);
+void name_index_free(struct name_index *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Manifest of a lazily extracted book
+ *
+ * The bookshelf folder of such a book only holds the objects that were
+ * asked for so far.  MANIFEST_FILE lists them, one normalized archive
+ * path per line, and a line is appended only once its object is written
+ * in full, so a half written file left by a crash is extracted again.
+ * The paths are kept in a hash set while the book is open.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "csChmfile.h"
+#include "csChmmanifest.h"
+
+struct manifest
+{
+        int fd;
+        char **slots;
+        u_int32_t mask;
+        u_int32_t count;
+};
+
+static u_int32_t hash_path(const char *path)
+{
+        u_int32_t h = 2166136261u;
+
+        while (*path)
+                h = (h ^ (unsigned char)*path++) * 16777619u;
+
+        return h;
+}
+
+static char **lookup(struct manifest *m, const char *path)
+{
+        u_int32_t i = hash_path(path) & m->mask;
+
+        while (m->slots[i] && strcmp(m->slots[i], path) != 0)
+                i = (i + 1) & m->mask;
+
+        return m->slots + i;
+}
+
+static void insert(struct manifest *m, const char *path)
+{
+        char **slot;
+
+        if ((m->count + 1) * 2 > m->mask + 1) {
+                char **old = m->slots;
+                u_int32_t i, size = m->mask + 1;
+
+                m->mask = size * 2 - 1;
+                m->slots = (char **)calloc(size * 2, sizeof(char *));
+                for (i = 0; i < size; i++)
+                        if (old[i])
+                                *lookup(m, old[i]) = old[i];
+                free(old);
+        }
+
+        slot = lookup(m, path);
+        if (*slot)
+                return;
+
+        *slot = strdup(path);
+        m->count++;
+}
+
+static void load(struct manifest *m)
+{
+        char *data = NULL, *p, *end;
+        size_t len = 0, cap = 0;
+        ssize_t n;
+
+        for (;;) {
+                if (len + 4096 > cap) {
+                        cap = cap ? cap * 2 : 65536;
+                        data = (char *)realloc(data, cap);
+                }
+                n = read(m->fd, data + len, cap - len);
+                if (n <= 0)
+                        break;
+                len += n;
+        }
+
+        for (p = data, end = data + len; p < end; ) {
+                char *nl = (char *)memchr(p, '\n', end - p);
+
+                if (!nl)
+                        break;
+                *nl = '\0';
+                if (*p == '/')
+                        insert(m, p);
+                p = nl + 1;
+        }
+
+        /* a trailing line without newline was cut short, drop it */
+        if (p < end && ftruncate(m->fd, p - data) == -1)
+                fprintf(stderr, "Cannot truncate manifest\n");
+
+        free(data);
+}
+
+/*
+ * Open the manifest of folder, creating it, or emptying it when truncate
+ * is set.  NULL when the folder is not writable.
+ */
+struct manifest *
+manifest_open(const char *folder, int truncate)
+{
+        struct manifest *m;
+        char path[1024];
+
+        if (snprintf(path, sizeof(path), "%s/" MANIFEST_FILE, folder) >= (int)sizeof(path))
+                return NULL;
+
+        m = (struct manifest *)calloc(1, sizeof(struct manifest));
+        m->fd = open(path, O_RDWR | O_CREAT | O_APPEND | (truncate ? O_TRUNC : 0), 0666);
+        if (m->fd == -1) {
+                fprintf(stderr, "Cannot open manifest: %s\n", path);
+                free(m);
+                return NULL;
+        }
+
+        m->mask = 1023;
+        m->slots = (char **)calloc(m->mask + 1, sizeof(char *));
+        load(m);
+
+        d(printf("manifest_open >>> %s, %u objects\n", path, m->count));
+
+        return m;
+}
+
+int
+manifest_has(struct manifest *m, const char *path)
+{
+        return *lookup(m, path) != NULL;
+}
+
+/* Record path as present, returns -1 if the manifest could not be written */
+int
+manifest_add(struct manifest *m, const char *path)
+{
+        size_t len = strlen(path);
+        char *line;
+        int ret = 0;
+
+        if (manifest_has(m, path))
+                return 0;
+
+        /* one write, so concurrent appends never interleave */
+        line = (char *)malloc(len + 1);
+        memcpy(line, path, len);
+        line[len] = '\n';
+        if (write(m->fd, line, len + 1) != (ssize_t)(len + 1))
+                ret = -1;
+        free(line);
+
+        insert(m, path);
+
+        return ret;
+}
+
+void
+manifest_close(struct manifest *m)
+{
+        u_int32_t i;
+
+        if (!m)
+                return;
+
+        for (i = 0; i <= m->mask; i++)
+                free(m->slots[i]);
+        free(m->slots);
+        close(m->fd);
+        free(m);
+}
@@ -0,0 +1,347 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Navigation cache
+ *
+ * The book information, the parsed table of contents and the parsed
+ * index are written to NAV_CACHE_FILE in the bookshelf folder, laid out
+ * so that loading is a mmap and a few bounds checks:
+ *
+ *   header | info strings | toc entries | toc strings
+ *          | index entries | index strings
+ *
+ * Every section starts 4-byte aligned.  Integers are in host byte order,
+ * the cache never leaves the machine.  A version mismatch or a short file
+ * makes nav_load fail, and the caller rebuilds the cache from the archive.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "csChmfile.h"
+#include "csChmarena.h"
+#include "csChmparser.h"
+#include "csChmnav.h"
+#include "csChmstats.h"
+
+#define NAV_MAGIC   "CSNV"
+/* 2: sitemap names are UTF-8 */
+#define NAV_VERSION 2
+#define NAV_NONE    0xffffffff
+
+/* info strings read without a malloc up to this size */
+#define NAV_INFO_BUFFER 2048
+
+#define ALIGN4(x) (((x) + 3) & ~(size_t)3)
+
+struct nav_header
+{
+        char magic[4];
+        u_int32_t version;
+        u_int32_t flags;
+        u_int32_t lcid;
+
+        /* offsets into the info strings, NAV_NONE when missing */
+        u_int32_t chmfile;
+        u_int32_t homepage;
+        u_int32_t bookname;
+        u_int32_t hhc;
+        u_int32_t hhk;
+        u_int32_t info_len;
+
+        u_int32_t toc_count;
+        u_int32_t toc_strings_len;
+        u_int32_t index_count;
+        u_int32_t index_strings_len;
+};
+
+static u_int32_t info_string(char *buffer, size_t *len, const char *str)
+{
+        u_int32_t offset = *len;
+
+        if (!str)
+                return NAV_NONE;
+
+        if (buffer)
+                strcpy(buffer + offset, str);
+        *len += strlen(str) + 1;
+
+        return offset;
+}
+
+static int write_padded(FILE *fp, const void *data, size_t len)
+{
+        static const char zeros[4] = { 0, 0, 0, 0 };
+
+        if (len && fwrite(data, 1, len, fp) != len)
+                return -1;
+        if (ALIGN4(len) != len && fwrite(zeros, 1, ALIGN4(len) - len, fp) != ALIGN4(len) - len)
+                return -1;
+
+        return 0;
+}
+
+int
+nav_save(const char *path, const struct navinfo *info,
+         const struct sitemap *toc, const struct sitemap *index)
+{
+        struct nav_header header;
+        char tmp_path[1024];
+        char *strings;
+        size_t len = 0;
+        FILE *fp;
+        int ret = 0;
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, NAV_MAGIC, 4);
+        header.version = NAV_VERSION;
+        header.flags = info->flags;
+        header.lcid = info->lcid;
+
+        /* first pass sizes the info strings, second pass copies them */
+        info_string(NULL, &len, info->chmfile);
+        info_string(NULL, &len, info->homepage);
+        info_string(NULL, &len, info->bookname);
+        info_string(NULL, &len, info->hhc);
+        info_string(NULL, &len, info->hhk);
+
+        strings = (char *)malloc(len ? len : 1);
+        len = 0;
+        header.chmfile = info_string(strings, &len, info->chmfile);
+        header.homepage = info_string(strings, &len, info->homepage);
+        header.bookname = info_string(strings, &len, info->bookname);
+        header.hhc = info_string(strings, &len, info->hhc);
+        header.hhk = info_string(strings, &len, info->hhk);
+        header.info_len = len;
+
+        if (toc) {
+                header.toc_count = toc->count;
+                header.toc_strings_len = toc->strings_len;
+        }
+        if (index) {
+                header.index_count = index->count;
+                header.index_strings_len = index->strings_len;
+        }
+
+        if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+                free(strings);
+                return -1;
+        }
+
+        fp = fopen(tmp_path, "wb");
+        if (fp == NULL) {
+                fprintf(stderr, "Cannot write navigation cache: %s\n", tmp_path);
+                free(strings);
+                return -1;
+        }
+
+        if (fwrite(&header, sizeof(header), 1, fp) != 1
+            || write_padded(fp, strings, header.info_len) == -1)
+                ret = -1;
+
+        if (ret == 0 && toc
+            && (write_padded(fp, toc->entries, toc->count * sizeof(struct sitemap_entry)) == -1
+                || write_padded(fp, toc->strings, toc->strings_len) == -1))
+                ret = -1;
+
+        if (ret == 0 && index
+            && (write_padded(fp, index->entries, index->count * sizeof(struct sitemap_entry)) == -1
+                || write_padded(fp, index->strings, index->strings_len) == -1))
+                ret = -1;
+
+        free(strings);
+
+        if (fclose(fp) != 0)
+                ret = -1;
+
+        if (ret == 0)
+                ret = rename(tmp_path, path);
+        else
+                unlink(tmp_path);
+
+        d(printf("nav_save >>> %s, return value = %d\n", path, ret));
+
+        return ret;
+}
+
+static const char *info_copy(struct chm_arena *arena, const char *strings, u_int32_t len, u_int32_t offset)
+{
+        if (offset == NAV_NONE || offset >= len)
+                return NULL;
+
+        return chm_arena_intern(arena, strings + offset, strnlen(strings + offset, len - offset));
+}
+
+/*
+ * Point a sitemap into its own mapping of the cache file, the entries
+ * start at offset.  Returns the offset following the section.
+ */
+static size_t map_sitemap(int fd, size_t size, size_t offset,
+                          u_int32_t count, u_int32_t strings_len,
+                          struct sitemap **result)
+{
+        size_t entries_len = (size_t)count * sizeof(struct sitemap_entry);
+        size_t end = offset + ALIGN4(entries_len) + ALIGN4(strings_len);
+        struct sitemap *map;
+        void *mapping;
+        u_int32_t i;
+
+        *result = NULL;
+
+        if (end > size || (count && strings_len == 0))
+                return 0;
+
+        if (count == 0)
+                return end;
+
+        mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+                return 0;
+
+        map = (struct sitemap *)calloc(1, sizeof(struct sitemap));
+        map->mapping = mapping;
+        map->mapping_len = size;
+        map->entries = (struct sitemap_entry *)((char *)mapping + offset);
+        map->count = map->capacity = count;
+        map->strings = (char *)mapping + offset + ALIGN4(entries_len);
+        map->strings_len = map->strings_cap = strings_len;
+
+        /* the arena must be NUL terminated for the string offsets to be safe */
+        if (map->strings[strings_len - 1] != '\0') {
+                sitemap_free(map);
+                return 0;
+        }
+
+        /* one pass of checks here, so readers of the entries need none */
+        for (i = 0; i < count; i++) {
+                const struct sitemap_entry *e = map->entries + i;
+
+                if (e->name >= strings_len || e->local >= strings_len
+                    || e->depth > (i ? map->entries[i - 1].depth + 1 : 0)) {
+                        sitemap_free(map);
+                        return 0;
+                }
+        }
+
+        *result = map;
+        return end;
+}
+
+static int
+nav_read(const char *path, struct navinfo *info,
+         struct sitemap **toc, struct sitemap **index)
+{
+        struct nav_header header;
+        struct stat statbuf;
+        char buffer[NAV_INFO_BUFFER], *strings;
+        size_t size, offset;
+        int fd, own_arena;
+
+        *toc = *index = NULL;
+
+        fd = open(path, O_RDONLY);
+        if (fd == -1)
+                return -1;
+
+        if (fstat(fd, &statbuf) == -1
+            || (size = statbuf.st_size) < sizeof(header)
+            || read(fd, &header, sizeof(header)) != sizeof(header)
+            || memcmp(header.magic, NAV_MAGIC, 4) != 0
+            || header.version != NAV_VERSION
+            || sizeof(header) + ALIGN4(header.info_len) > size) {
+                d(printf("nav_read >>> %s is missing or out of date\n", path));
+                close(fd);
+                return -1;
+        }
+
+        own_arena = info->arena == NULL;
+        if (own_arena && (info->arena = chm_arena_new()) == NULL) {
+                close(fd);
+                return -1;
+        }
+
+        /* a few paths, on the stack unless the header says otherwise */
+        strings = header.info_len < sizeof(buffer) ? buffer : (char *)malloc(header.info_len + 1);
+        if (strings == NULL
+            || pread(fd, strings, header.info_len, sizeof(header)) != (ssize_t)header.info_len) {
+                if (strings != buffer)
+                        free(strings);
+                if (own_arena) {
+                        chm_arena_free(info->arena);
+                        info->arena = NULL;
+                }
+                close(fd);
+                return -1;
+        }
+        strings[header.info_len] = '\0';
+
+        info->chmfile = info_copy(info->arena, strings, header.info_len, header.chmfile);
+        info->homepage = info_copy(info->arena, strings, header.info_len, header.homepage);
+        info->bookname = info_copy(info->arena, strings, header.info_len, header.bookname);
+        info->hhc = info_copy(info->arena, strings, header.info_len, header.hhc);
+        info->hhk = info_copy(info->arena, strings, header.info_len, header.hhk);
+        info->lcid = header.lcid;
+        info->flags = header.flags;
+        if (strings != buffer)
+                free(strings);
+
+        offset = sizeof(header) + ALIGN4(header.info_len);
+        offset = map_sitemap(fd, size, offset, header.toc_count, header.toc_strings_len, toc);
+        if (offset)
+                offset = map_sitemap(fd, size, offset, header.index_count, header.index_strings_len, index);
+
+        close(fd);
+
+        if (!offset) {
+                fprintf(stderr, "Corrupted navigation cache: %s\n", path);
+                sitemap_free(*toc);
+                sitemap_free(*index);
+                *toc = *index = NULL;
+                info->chmfile = info->homepage = info->bookname = NULL;
+                info->hhc = info->hhk = NULL;
+                if (own_arena) {
+                        chm_arena_free(info->arena);
+                        info->arena = NULL;
+                }
+                return -1;
+        }
+
+        d(printf("nav_read >>> %s, toc = %u, index = %u\n", path, header.toc_count, header.index_count));
+
+        return 0;
+}
+
+int
+nav_load(const char *path, struct navinfo *info,
+         struct sitemap **toc, struct sitemap **index)
+{
+        u_int64_t begin = chm_stats_clock();
+        int ret = nav_read(path, info, toc, index);
+
+        chm_stats_add(ret == 0 ? CHM_STAT_NAV_HITS : CHM_STAT_NAV_MISSES, 1);
+        chm_trace_event("nav_load", begin, chm_stats_clock(), path);
+
+        return ret;
+}
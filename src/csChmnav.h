@@ -0,0 +1,64 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHMNAV_H__
+#define __CS_CHMNAV_H__
+
+#include <sys/types.h>
+
+#define NAV_CACHE_FILE "chmsee_nav.bin"
+
+/* the book was fully extracted to its bookshelf folder */
+#define NAV_EXTRACTED 0x1
+/* only the objects listed in its manifest were extracted */
+#define NAV_LAZY      0x2
+/* the objects are in the folder's pack rather than files */
+#define NAV_PACKED    0x4
+
+struct sitemap;
+struct chm_arena;
+
+/*
+ * nav_load() interns the strings in arena, creating it if NULL, and
+ * frees an arena it created when it fails
+ */
+struct navinfo
+{
+        struct chm_arena *arena;
+        const char *chmfile;
+        const char *homepage;
+        const char *bookname;
+        const char *hhc;
+        const char *hhk;
+        u_int32_t lcid;
+        u_int32_t flags;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int nav_save(const char *, const struct navinfo *, const struct sitemap *, const struct sitemap *);
+int nav_load(const char *, struct navinfo *, struct sitemap **, struct sitemap **);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
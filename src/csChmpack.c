@@ -0,0 +1,536 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Pack storage
+ *
+ * An extracted book kept as one file instead of a tree of raw files:
+ *
+ *   header | frame data | frame table | object table | path strings
+ *
+ * Every object is cut into PACK_FRAME_SIZE frames, each deflated on its
+ * own, so a read decompresses at most the frames it touches.  Frames
+ * that do not shrink, images and the like, are stored as they are and
+ * can be served straight from the mapping.  The frames of an object are
+ * consecutive in the frame table, the data itself may interleave with
+ * other objects as the extraction workers append concurrently.  Objects
+ * are sorted by path for binary search.  Integers are in host byte
+ * order like the navigation cache.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "csChmfile.h"
+#include "csChmpack.h"
+
+#define PACK_MAGIC   "CSPK"
+#define PACK_VERSION 1
+
+#define ALIGN8(x) (((x) + 7) & ~(u_int64_t)7)
+
+struct pack_header
+{
+        char magic[4];
+        u_int32_t version;
+        u_int32_t object_count;
+        u_int32_t frame_count;
+        u_int64_t frames_offset;
+        u_int64_t objects_offset;
+        u_int64_t strings_offset;
+        u_int64_t strings_len;
+};
+
+struct pack_frame
+{
+        u_int64_t offset;
+        u_int32_t clen;         /* == ulen when stored */
+        u_int32_t ulen;
+};
+
+struct pack_object
+{
+        u_int32_t path;
+        u_int32_t first_frame;
+        u_int64_t length;
+};
+
+struct pack_writer
+{
+        char *path;
+        char *tmp_path;
+        int fd;
+        u_int64_t offset;
+        int failed;
+
+        pthread_mutex_t mutex;
+
+        struct pack_frame *frames;
+        u_int32_t frame_count;
+        u_int32_t frame_capacity;
+
+        struct pack_object *objects;
+        u_int32_t object_count;
+        u_int32_t object_capacity;
+
+        char *strings;
+        u_int64_t strings_len;
+        u_int64_t strings_cap;
+};
+
+struct pack
+{
+        unsigned char *map;
+        size_t map_len;
+        const struct pack_header *header;
+        const struct pack_frame *frames;
+        const struct pack_object *objects;
+        const char *strings;
+};
+
+struct pack_writer *
+pack_create(const char *path)
+{
+        struct pack_writer *w;
+        struct pack_header header;
+
+        w = (struct pack_writer *)calloc(1, sizeof(struct pack_writer));
+        w->path = strdup(path);
+        w->tmp_path = (char *)malloc(strlen(path) + sizeof(".tmp"));
+        sprintf(w->tmp_path, "%s.tmp", path);
+
+        w->fd = open(w->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (w->fd == -1) {
+                fprintf(stderr, "Cannot create pack: %s\n", w->tmp_path);
+                free(w->tmp_path);
+                free(w->path);
+                free(w);
+                return NULL;
+        }
+
+        /* the header is rewritten by pack_finish */
+        memset(&header, 0, sizeof(header));
+        w->offset = sizeof(header);
+        if (write(w->fd, &header, sizeof(header)) != sizeof(header))
+                w->failed = 1;
+
+        pthread_mutex_init(&w->mutex, NULL);
+
+        return w;
+}
+
+/* Append one compressed frame, returns its data offset */
+static u_int64_t append_frame(struct pack_writer *w, const unsigned char *data, u_int32_t len)
+{
+        u_int64_t offset;
+
+        pthread_mutex_lock(&w->mutex);
+        offset = w->offset;
+        w->offset += len;
+        pthread_mutex_unlock(&w->mutex);
+
+        /* the range is ours, write it without the lock */
+        if (pwrite(w->fd, data, len, offset) != (ssize_t)len)
+                w->failed = 1;
+
+        return offset;
+}
+
+/*
+ * Store the object at path of length bytes, read through read_func.
+ * Safe to call from several threads at once.
+ */
+int
+pack_add(struct pack_writer *w, const char *path, u_int64_t length,
+         pack_read_func read_func, void *data)
+{
+        u_int32_t count = (length + PACK_FRAME_SIZE - 1) / PACK_FRAME_SIZE;
+        struct pack_frame *frames;
+        unsigned char *raw, *packed;
+        uLong bound = compressBound(PACK_FRAME_SIZE);
+        u_int32_t i;
+        size_t path_len = strlen(path) + 1;
+        int ret = 0;
+
+        frames = (struct pack_frame *)malloc((count ? count : 1) * sizeof(struct pack_frame));
+        raw = (unsigned char *)malloc(PACK_FRAME_SIZE);
+        packed = (unsigned char *)malloc(bound);
+
+        for (i = 0; i < count; i++) {
+                u_int64_t offset = (u_int64_t)i * PACK_FRAME_SIZE;
+                long len = length - offset < PACK_FRAME_SIZE ? (long)(length - offset) : PACK_FRAME_SIZE;
+                uLongf clen = bound;
+
+                if (read_func(data, raw, offset, len) != len) {
+                        fprintf(stderr, "incomplete file: %s\n", path);
+                        ret = -1;
+                        break;
+                }
+
+                frames[i].ulen = len;
+                if (compress2(packed, &clen, raw, len, Z_DEFAULT_COMPRESSION) == Z_OK
+                    && clen < (uLongf)len) {
+                        frames[i].clen = clen;
+                        frames[i].offset = append_frame(w, packed, clen);
+                } else {
+                        frames[i].clen = len;
+                        frames[i].offset = append_frame(w, raw, len);
+                }
+        }
+
+        free(raw);
+        free(packed);
+
+        if (ret == -1) {
+                free(frames);
+                return -1;
+        }
+
+        pthread_mutex_lock(&w->mutex);
+
+        if (w->frame_count + count > w->frame_capacity) {
+                while (w->frame_count + count > w->frame_capacity)
+                        w->frame_capacity = w->frame_capacity ? w->frame_capacity * 2 : 1024;
+                w->frames = (struct pack_frame *)realloc(w->frames, w->frame_capacity * sizeof(struct pack_frame));
+        }
+        if (w->object_count == w->object_capacity) {
+                w->object_capacity = w->object_capacity ? w->object_capacity * 2 : 1024;
+                w->objects = (struct pack_object *)realloc(w->objects, w->object_capacity * sizeof(struct pack_object));
+        }
+        if (w->strings_len + path_len > w->strings_cap) {
+                while (w->strings_len + path_len > w->strings_cap)
+                        w->strings_cap = w->strings_cap ? w->strings_cap * 2 : 65536;
+                w->strings = (char *)realloc(w->strings, w->strings_cap);
+        }
+
+        w->objects[w->object_count].path = w->strings_len;
+        w->objects[w->object_count].first_frame = w->frame_count;
+        w->objects[w->object_count].length = length;
+        w->object_count++;
+
+        memcpy(w->frames + w->frame_count, frames, count * sizeof(struct pack_frame));
+        w->frame_count += count;
+
+        memcpy(w->strings + w->strings_len, path, path_len);
+        w->strings_len += path_len;
+
+        pthread_mutex_unlock(&w->mutex);
+
+        free(frames);
+        return 0;
+}
+
+static const char *sort_strings;
+
+static int compare_object(const void *a, const void *b)
+{
+        return strcmp(sort_strings + ((const struct pack_object *)a)->path,
+                      sort_strings + ((const struct pack_object *)b)->path);
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+        return len == 0 || write(fd, data, len) == (ssize_t)len ? 0 : -1;
+}
+
+/*
+ * Write the tables and move the pack in place, or throw it away when
+ * commit is 0.  Frees the writer either way.
+ */
+int
+pack_finish(struct pack_writer *w, int commit)
+{
+        struct pack_header header;
+        int ret = -1;
+
+        if (commit && !w->failed) {
+                /* single threaded by now, the comparator global is fine */
+                sort_strings = w->strings;
+                qsort(w->objects, w->object_count, sizeof(struct pack_object), compare_object);
+
+                memset(&header, 0, sizeof(header));
+                memcpy(header.magic, PACK_MAGIC, 4);
+                header.version = PACK_VERSION;
+                header.object_count = w->object_count;
+                header.frame_count = w->frame_count;
+                header.frames_offset = ALIGN8(w->offset);
+                header.objects_offset = header.frames_offset + w->frame_count * sizeof(struct pack_frame);
+                header.strings_offset = header.objects_offset + w->object_count * sizeof(struct pack_object);
+                header.strings_len = w->strings_len;
+
+                if (lseek(w->fd, header.frames_offset, SEEK_SET) != -1
+                    && write_all(w->fd, w->frames, w->frame_count * sizeof(struct pack_frame)) == 0
+                    && write_all(w->fd, w->objects, w->object_count * sizeof(struct pack_object)) == 0
+                    && write_all(w->fd, w->strings, w->strings_len) == 0
+                    && pwrite(w->fd, &header, sizeof(header), 0) == sizeof(header))
+                        ret = 0;
+        }
+
+        if (close(w->fd) == -1)
+                ret = -1;
+
+        if (ret == 0 && rename(w->tmp_path, w->path) == -1)
+                ret = -1;
+        if (ret == -1)
+                unlink(w->tmp_path);
+
+        d(printf("pack_finish >>> %s: %u objects, %u frames, %llu bytes\n",
+                 w->path, w->object_count, w->frame_count, (unsigned long long)w->offset));
+
+        pthread_mutex_destroy(&w->mutex);
+        free(w->frames);
+        free(w->objects);
+        free(w->strings);
+        free(w->tmp_path);
+        free(w->path);
+        free(w);
+
+        return ret;
+}
+
+/* One pass of bounds checks at open, so reads need none */
+static int tables_valid(const struct pack *pack)
+{
+        const struct pack_header *header = pack->header;
+        u_int32_t i;
+
+        for (i = 0; i < header->frame_count; i++) {
+                const struct pack_frame *f = pack->frames + i;
+
+                if (f->offset + f->clen > header->frames_offset || f->ulen > PACK_FRAME_SIZE)
+                        return 0;
+        }
+
+        for (i = 0; i < header->object_count; i++) {
+                const struct pack_object *o = pack->objects + i;
+                u_int64_t count = (o->length + PACK_FRAME_SIZE - 1) / PACK_FRAME_SIZE;
+                u_int64_t j;
+
+                if (o->path >= header->strings_len
+                    || o->first_frame + count > header->frame_count)
+                        return 0;
+
+                /* every frame but the last is full, the last holds the rest */
+                for (j = 0; j < count; j++) {
+                        u_int64_t want = j + 1 < count ? PACK_FRAME_SIZE : o->length - j * PACK_FRAME_SIZE;
+
+                        if (pack->frames[o->first_frame + j].ulen != want)
+                                return 0;
+                }
+        }
+
+        return 1;
+}
+
+struct pack *
+pack_open(const char *path)
+{
+        const struct pack_header *header;
+        struct stat statbuf;
+        struct pack *pack;
+        void *map;
+        int fd;
+
+        fd = open(path, O_RDONLY);
+        if (fd == -1)
+                return NULL;
+
+        if (fstat(fd, &statbuf) == -1 || statbuf.st_size < (off_t)sizeof(struct pack_header)) {
+                close(fd);
+                return NULL;
+        }
+
+        map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+                return NULL;
+
+        header = (const struct pack_header *)map;
+        if (memcmp(header->magic, PACK_MAGIC, 4) != 0
+            || header->version != PACK_VERSION
+            || header->frames_offset > (u_int64_t)statbuf.st_size
+            || header->objects_offset != header->frames_offset + (u_int64_t)header->frame_count * sizeof(struct pack_frame)
+            || header->strings_offset != header->objects_offset + (u_int64_t)header->object_count * sizeof(struct pack_object)
+            || header->strings_offset + header->strings_len != (u_int64_t)statbuf.st_size
+            || (header->strings_len && ((const char *)map)[statbuf.st_size - 1] != '\0')) {
+                fprintf(stderr, "Corrupted pack: %s\n", path);
+                munmap(map, statbuf.st_size);
+                return NULL;
+        }
+
+        pack = (struct pack *)calloc(1, sizeof(struct pack));
+        pack->map = (unsigned char *)map;
+        pack->map_len = statbuf.st_size;
+        pack->header = header;
+        pack->frames = (const struct pack_frame *)(pack->map + header->frames_offset);
+        pack->objects = (const struct pack_object *)(pack->map + header->objects_offset);
+        pack->strings = (const char *)(pack->map + header->strings_offset);
+
+        if (!tables_valid(pack)) {
+                fprintf(stderr, "Corrupted pack: %s\n", path);
+                pack_close(pack);
+                return NULL;
+        }
+
+        return pack;
+}
+
+/* Index of the object at path, -1 when the pack has none */
+long
+pack_lookup(struct pack *pack, const char *path)
+{
+        long lo = 0, hi = (long)pack->header->object_count - 1;
+
+        while (lo <= hi) {
+                long mid = (lo + hi) / 2;
+                int cmp = strcmp(pack->strings + pack->objects[mid].path, path);
+
+                if (cmp == 0)
+                        return mid;
+                if (cmp < 0)
+                        lo = mid + 1;
+                else
+                        hi = mid - 1;
+        }
+
+        return -1;
+}
+
+u_int64_t
+pack_length(struct pack *pack, long object)
+{
+        return pack->objects[object].length;
+}
+
+/* Make frame the one held by cursor */
+static int load_frame(struct pack *pack, struct pack_cursor *cursor, long frame)
+{
+        const struct pack_frame *f = pack->frames + frame;
+        uLongf len = PACK_FRAME_SIZE;
+
+        if (cursor->frame == frame && cursor->data)
+                return 0;
+
+        if (!cursor->data)
+                cursor->data = (unsigned char *)malloc(PACK_FRAME_SIZE);
+
+        cursor->frame = -1;
+        if (f->clen == f->ulen) {
+                memcpy(cursor->data, pack->map + f->offset, f->ulen);
+        } else if (uncompress(cursor->data, &len, pack->map + f->offset, f->clen) != Z_OK
+                   || len != f->ulen) {
+                return -1;
+        }
+
+        cursor->frame = frame;
+        cursor->length = f->ulen;
+
+        return 0;
+}
+
+/* Like chm_retrieve_object, cursor starts zeroed with frame -1 */
+long
+pack_read(struct pack *pack, long object, struct pack_cursor *cursor,
+          unsigned char *buf, u_int64_t offset, long len)
+{
+        const struct pack_object *o = pack->objects + object;
+        long done = 0;
+
+        if (offset >= o->length)
+                return 0;
+        if (offset + len > o->length)
+                len = o->length - offset;
+
+        while (done < len) {
+                u_int64_t pos = offset + done;
+                long frame = o->first_frame + pos / PACK_FRAME_SIZE;
+                u_int32_t skip = pos % PACK_FRAME_SIZE;
+                const struct pack_frame *f = pack->frames + frame;
+                long n;
+
+                if (f->ulen <= skip)
+                        break;
+
+                n = f->ulen - skip;
+                if (n > len - done)
+                        n = len - done;
+
+                /* stored frames need no cursor */
+                if (f->clen == f->ulen) {
+                        memcpy(buf + done, pack->map + f->offset + skip, n);
+                } else {
+                        if (load_frame(pack, cursor, frame) == -1)
+                                break;
+                        memcpy(buf + done, cursor->data + skip, n);
+                }
+
+                done += n;
+        }
+
+        return done;
+}
+
+/*
+ * Point into the mapping at offset of object if its frame there is
+ * stored, len gets how many bytes of the frame follow.  NULL otherwise.
+ */
+const unsigned char *
+pack_slice(struct pack *pack, long object, u_int64_t offset, long *len)
+{
+        const struct pack_object *o = pack->objects + object;
+        const struct pack_frame *f;
+        u_int32_t skip;
+
+        if (offset >= o->length)
+                return NULL;
+
+        f = pack->frames + o->first_frame + offset / PACK_FRAME_SIZE;
+        skip = offset % PACK_FRAME_SIZE;
+        if (f->clen != f->ulen || f->ulen <= skip)
+                return NULL;
+
+        *len = f->ulen - skip;
+
+        return pack->map + f->offset + skip;
+}
+
+void
+pack_cursor_free(struct pack_cursor *cursor)
+{
+        free(cursor->data);
+        cursor->data = NULL;
+        cursor->frame = -1;
+}
+
+void
+pack_close(struct pack *pack)
+{
+        if (!pack)
+                return;
+
+        munmap(pack->map, pack->map_len);
+        free(pack);
+}
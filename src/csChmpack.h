@@ -0,0 +1,64 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHMPACK_H__
+#define __CS_CHMPACK_H__
+
+#include <sys/types.h>
+
+#define PACK_FILE "chmsee_pack.bin"
+
+/* uncompressed bytes per frame, the unit of random access */
+#define PACK_FRAME_SIZE (64 << 10)
+
+struct pack;
+struct pack_writer;
+
+/* one decompressed frame kept by a reader between reads */
+struct pack_cursor
+{
+        long frame;
+        u_int32_t length;
+        unsigned char *data;
+};
+
+/* fill buf with len bytes of the object at offset, returns the count */
+typedef long (*pack_read_func)(void *, unsigned char *, u_int64_t, long);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct pack_writer *pack_create(const char *);
+int pack_add(struct pack_writer *, const char *, u_int64_t, pack_read_func, void *);
+int pack_finish(struct pack_writer *, int);
+
+struct pack *pack_open(const char *);
+long pack_lookup(struct pack *, const char *);
+u_int64_t pack_length(struct pack *, long);
+long pack_read(struct pack *, long, struct pack_cursor *, unsigned char *, u_int64_t, long);
+const unsigned char *pack_slice(struct pack *, long, u_int64_t, long *);
+void pack_cursor_free(struct pack_cursor *);
+void pack_close(struct pack *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
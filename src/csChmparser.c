@@ -0,0 +1,374 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Sitemap parser
+ *
+ * A single pass SAX style scanner for the hhc/hhk HTML.  Only <ul>,
+ * </ul>, <object>, </object> and <param> matter, everything else is
+ * skipped.  Entries go into one flat array with their <ul> depth, and all
+ * names and locals into one string arena, so a 100k entry index costs
+ * two allocations that grow geometrically.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+
+#include <chm_lib.h>
+
+#include "csChmfile.h"
+#include "csChmparser.h"
+#include "csChmstats.h"
+
+#define PARAM_MAX 4096
+
+struct parse_state
+{
+        struct sitemap *map;
+        int depth;
+        int in_item;
+        u_int32_t name;
+        u_int32_t local;
+};
+
+static u_int32_t arena_add(struct sitemap *map, const char *str, size_t len)
+{
+        u_int32_t offset = map->strings_len;
+
+        if (map->strings_len + len + 1 > map->strings_cap) {
+                while (map->strings_len + len + 1 > map->strings_cap)
+                        map->strings_cap = map->strings_cap ? map->strings_cap * 2 : 4096;
+                map->strings = (char *)realloc(map->strings, map->strings_cap);
+        }
+
+        memcpy(map->strings + offset, str, len);
+        map->strings[offset + len] = '\0';
+        map->strings_len += len + 1;
+
+        return offset;
+}
+
+static void add_entry(struct parse_state *state)
+{
+        struct sitemap *map = state->map;
+        struct sitemap_entry *entry;
+        u_int32_t depth = state->depth > 0 ? state->depth - 1 : 0;
+        u_int32_t max = map->count ? map->entries[map->count - 1].depth + 1 : 0;
+
+        /* <ul>s nested with no entry between them still go one level down */
+        if (depth > max)
+                depth = max;
+
+        if (map->count == map->capacity) {
+                map->capacity = map->capacity ? map->capacity * 2 : 256;
+                map->entries = (struct sitemap_entry *)realloc(map->entries,
+                                                               map->capacity * sizeof(struct sitemap_entry));
+        }
+
+        entry = map->entries + map->count++;
+        entry->depth = depth;
+        entry->name = state->name;
+        entry->local = state->local;
+}
+
+/* Decode the few entities sitemaps use, in place, returns the new length */
+static size_t decode_entities(char *str, size_t len)
+{
+        char *src = str, *dst = str, *end = str + len;
+
+        while (src < end) {
+                if (*src == '&') {
+                        if (end - src >= 5 && strncmp(src, "&amp;", 5) == 0) {
+                                *dst++ = '&';
+                                src += 5;
+                                continue;
+                        } else if (end - src >= 4 && strncmp(src, "&lt;", 4) == 0) {
+                                *dst++ = '<';
+                                src += 4;
+                                continue;
+                        } else if (end - src >= 4 && strncmp(src, "&gt;", 4) == 0) {
+                                *dst++ = '>';
+                                src += 4;
+                                continue;
+                        } else if (end - src >= 6 && strncmp(src, "&quot;", 6) == 0) {
+                                *dst++ = '"';
+                                src += 6;
+                                continue;
+                        } else if (end - src >= 4 && src[1] == '#') {
+                                char *semi = (char *)memchr(src, ';', end - src);
+                                long code = semi ? strtol(src + 2, NULL, 10) : 0;
+
+                                /* only ASCII, the text is still in the book charset */
+                                if (code > 0 && code < 128) {
+                                        *dst++ = (char)code;
+                                        src = semi + 1;
+                                        continue;
+                                }
+                        }
+                }
+                *dst++ = *src++;
+        }
+
+        return dst - str;
+}
+
+/*
+ * Find attribute attr in the tag body [p, end) and copy its value to
+ * value, returns the value length or -1 when missing.
+ */
+static int tag_attribute(const char *p, const char *end, const char *attr, char *value)
+{
+        size_t attr_len = strlen(attr);
+
+        while (p < end) {
+                const char *name, *val;
+                size_t name_len, val_len;
+                char quote = 0;
+
+                while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == '/'))
+                        p++;
+
+                name = p;
+                while (p < end && *p != '=' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+                        p++;
+                name_len = p - name;
+
+                while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+                        p++;
+
+                if (p >= end || *p != '=') {
+                        if (p == name)
+                                p++;
+                        continue;
+                }
+                p++;
+
+                while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+                        p++;
+
+                if (p < end && (*p == '"' || *p == '\''))
+                        quote = *p++;
+
+                val = p;
+                if (quote) {
+                        while (p < end && *p != quote)
+                                p++;
+                } else {
+                        while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+                                p++;
+                }
+                val_len = p - val;
+                if (quote && p < end)
+                        p++;
+
+                if (name_len == attr_len && strncasecmp(name, attr, attr_len) == 0) {
+                        if (val_len >= PARAM_MAX)
+                                val_len = PARAM_MAX - 1;
+                        memcpy(value, val, val_len);
+                        value[val_len] = '\0';
+                        return (int)val_len;
+                }
+        }
+
+        return -1;
+}
+
+static int tag_is(const char *tag, size_t len, const char *name)
+{
+        return strlen(name) == len && strncasecmp(tag, name, len) == 0;
+}
+
+static void handle_tag(struct parse_state *state, const char *p, const char *end)
+{
+        char name[PARAM_MAX], value[PARAM_MAX];
+        const char *tag;
+        int closing = 0;
+        size_t len;
+
+        if (p < end && *p == '/') {
+                closing = 1;
+                p++;
+        }
+
+        tag = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && *p != '/')
+                p++;
+        len = p - tag;
+
+        if (tag_is(tag, len, "ul")) {
+                if (closing) {
+                        if (state->depth > 0)
+                                state->depth--;
+                } else {
+                        state->depth++;
+                }
+        } else if (tag_is(tag, len, "object")) {
+                if (closing) {
+                        if (state->in_item && state->map->strings[state->name] != '\0')
+                                add_entry(state);
+                        state->in_item = 0;
+                } else if (tag_attribute(p, end, "type", value) > 0
+                           && strcasecmp(value, "text/sitemap") == 0) {
+                        state->in_item = 1;
+                        state->name = 0;
+                        state->local = 0;
+                }
+        } else if (!closing && state->in_item && tag_is(tag, len, "param")) {
+                int value_len;
+
+                if (tag_attribute(p, end, "name", name) <= 0)
+                        return;
+
+                value_len = tag_attribute(p, end, "value", value);
+                if (value_len < 0)
+                        return;
+
+                /* keep the first Name (the keyword in an index) and Local */
+                if (strcasecmp(name, "name") == 0 && state->name == 0) {
+                        value_len = decode_entities(value, value_len);
+                        state->name = arena_add(state->map, value, value_len);
+                } else if (strcasecmp(name, "local") == 0 && state->local == 0) {
+                        value_len = decode_entities(value, value_len);
+                        state->local = arena_add(state->map, value, value_len);
+                }
+        }
+}
+
+struct sitemap *
+sitemap_new(void)
+{
+        struct sitemap *map = (struct sitemap *)calloc(1, sizeof(struct sitemap));
+
+        /* offset 0 is the empty string, used for missing values */
+        arena_add(map, "", 0);
+
+        return map;
+}
+
+void
+sitemap_append(struct sitemap *map, u_int32_t depth, const char *name, const char *local)
+{
+        struct parse_state state;
+
+        memset(&state, 0, sizeof(state));
+        state.map = map;
+        state.depth = depth + 1;
+        state.name = arena_add(map, name, strlen(name));
+        state.local = arena_add(map, local, strlen(local));
+
+        add_entry(&state);
+}
+
+struct sitemap *
+sitemap_parse(const char *data, size_t len)
+{
+        struct parse_state state;
+        const char *p = data, *end = data + len;
+        struct sitemap *map;
+
+        map = sitemap_new();
+
+        memset(&state, 0, sizeof(state));
+        state.map = map;
+
+        while (p < end) {
+                const char *lt = (const char *)memchr(p, '<', end - p);
+                const char *gt;
+
+                if (lt == NULL)
+                        break;
+
+                if (end - lt >= 4 && strncmp(lt, "<!--", 4) == 0) {
+                        const char *close = lt + 4;
+
+                        while (close + 3 <= end && strncmp(close, "-->", 3) != 0)
+                                close++;
+                        p = close + 3;
+                        continue;
+                }
+
+                gt = (const char *)memchr(lt, '>', end - lt);
+                if (gt == NULL)
+                        break;
+
+                handle_tag(&state, lt + 1, gt);
+                p = gt + 1;
+        }
+
+        d(printf("sitemap_parse >>> %u entries, %u bytes of strings\n", map->count, map->strings_len));
+
+        return map;
+}
+
+struct sitemap *
+sitemap_parse_object(struct chmFile *h, const char *path)
+{
+        struct chmUnitInfo ui;
+        struct sitemap *map;
+        char objpath[CHM_MAX_PATHLEN + 1];
+        char *buffer;
+        LONGINT64 len;
+        u_int64_t begin;
+
+        if (snprintf(objpath, sizeof(objpath), "%s%s", path[0] == '/' ? "" : "/", path) >= (int)sizeof(objpath))
+                return NULL;
+
+        chm_normalize_path(objpath);
+
+        if (chm_resolve_object(h, objpath, &ui) != CHM_RESOLVE_SUCCESS) {
+                d(printf("sitemap_parse_object >>> %s not found\n", objpath));
+                return NULL;
+        }
+
+        buffer = (char *)malloc((size_t)ui.length + 1);
+        if (buffer == NULL)
+                return NULL;
+
+        len = ui.length ? chm_retrieve_object(h, &ui, (unsigned char *)buffer, 0, ui.length) : 0;
+        if (len < (LONGINT64)ui.length) {
+                fprintf(stderr, "incomplete file: %s\n", objpath);
+                free(buffer);
+                return NULL;
+        }
+
+        begin = chm_stats_clock();
+        map = sitemap_parse(buffer, (size_t)ui.length);
+        chm_trace_event("sitemap_parse", begin, chm_stats_clock(), objpath);
+        free(buffer);
+
+        return map;
+}
+
+void
+sitemap_free(struct sitemap *map)
+{
+        if (!map)
+                return;
+
+        if (map->mapping) {
+                munmap(map->mapping, map->mapping_len);
+        } else {
+                free(map->entries);
+                free(map->strings);
+        }
+        free(map);
+}
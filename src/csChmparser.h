@@ -0,0 +1,71 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHMPARSER_H__
+#define __CS_CHMPARSER_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct chmFile;
+
+/*
+ * A parsed hhc/hhk sitemap: one entry per <object type="text/sitemap">,
+ * name and local are offsets of NUL terminated strings in the arena.
+ */
+struct sitemap_entry
+{
+        u_int32_t depth;
+        u_int32_t name;
+        u_int32_t local;
+};
+
+struct sitemap
+{
+        struct sitemap_entry *entries;
+        u_int32_t count;
+        u_int32_t capacity;
+
+        char *strings;
+        u_int32_t strings_len;
+        u_int32_t strings_cap;
+
+        /* set when entries and strings point into an mmapped nav cache */
+        void *mapping;
+        size_t mapping_len;
+};
+
+#define SITEMAP_NAME(map, i)  ((map)->strings + (map)->entries[i].name)
+#define SITEMAP_LOCAL(map, i) ((map)->strings + (map)->entries[i].local)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sitemap *sitemap_new(void);
+void sitemap_append(struct sitemap *, u_int32_t, const char *, const char *);
+struct sitemap *sitemap_parse(const char *, size_t);
+struct sitemap *sitemap_parse_object(struct chmFile *, const char *);
+void sitemap_free(struct sitemap *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
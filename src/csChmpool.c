@@ -0,0 +1,294 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Process-wide pool of open chm handles.
+ *
+ * Handles are keyed by file identity (device, inode, size, mtime), so
+ * every component opening the same book shares one chmFile and its
+ * directory and decompression caches.  Released handles stay open until
+ * the pool grows past its capacity, then the least recently used idle
+ * ones are closed.  A handle whose file has changed is closed as soon as
+ * it is idle, its mapping must not outlive the file it maps.  Sharing a handle between threads relies on chmlib being built
+ * with CHM_MT.  Each handle comes with a chm_access for cached reads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <chm_lib.h>
+
+#include "csChmfile.h"
+#include "csChmpool.h"
+#include "csChmaccess.h"
+#include "csChmstats.h"
+
+#define CHM_POOL_DEFAULT_CAPACITY 16
+
+struct pool_entry
+{
+        struct pool_entry *next;
+        struct chmFile *handle;
+        struct chm_access *access;
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        time_t mtime;
+        int stale;
+        int refcount;
+        unsigned long last_used;
+};
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pool_entry *pool_head = NULL;
+static int pool_size = 0;
+static int pool_capacity = CHM_POOL_DEFAULT_CAPACITY;
+static unsigned long pool_clock = 0;
+
+/* counters of the handles already closed */
+static struct chm_access_stats pool_retired;
+
+/* Unlink the entry at link and close its handle */
+static void pool_remove(struct pool_entry **link)
+{
+        struct pool_entry *entry = *link;
+        struct chm_access_stats stats;
+
+        *link = entry->next;
+
+        chm_access_get_stats(entry->access, &stats);
+        pool_retired.hits += stats.hits;
+        pool_retired.misses += stats.misses;
+        pool_retired.mapped_reads += stats.mapped_reads;
+
+        d(printf("pool_remove >>> close handle %p\n", (void *)entry->handle));
+        chm_access_close(entry->access);
+        chm_close(entry->handle);
+        free(entry);
+        pool_size--;
+}
+
+/*
+ * Close idle handles of changed files, then idle handles least recently
+ * used first until the pool fits
+ */
+static void pool_shrink(int capacity)
+{
+        struct pool_entry **i;
+
+        for (i = &pool_head; *i; ) {
+                if ((*i)->stale && (*i)->refcount == 0)
+                        pool_remove(i);
+                else
+                        i = &(*i)->next;
+        }
+
+        while (pool_size > capacity) {
+                struct pool_entry **lru = NULL;
+
+                for (i = &pool_head; *i; i = &(*i)->next) {
+                        if ((*i)->refcount == 0 && (!lru || (*i)->last_used < (*lru)->last_used))
+                                lru = i;
+                }
+
+                if (!lru)
+                        break;
+
+                pool_remove(lru);
+        }
+}
+
+/*
+ * The usable entry of the file statbuf describes, marking those of its
+ * earlier versions stale.  Called with the mutex held.
+ */
+static struct pool_entry *pool_find(const struct stat *statbuf)
+{
+        struct pool_entry *entry;
+
+        for (entry = pool_head; entry; entry = entry->next) {
+                if (entry->dev != statbuf->st_dev || entry->ino != statbuf->st_ino)
+                        continue;
+
+                /* rewritten or truncated since it was opened */
+                if (entry->size != statbuf->st_size || entry->mtime != statbuf->st_mtime)
+                        entry->stale = 1;
+                else if (!entry->stale)
+                        return entry;
+        }
+
+        return NULL;
+}
+
+/*
+ * A miss opens the archive without holding the pool, so cold opens of
+ * different books run in parallel.  When two threads open the same book
+ * at once, the one inserting second closes its handle and takes the other.
+ */
+struct chmFile *
+chm_pool_open(const char *filename)
+{
+        struct stat statbuf;
+        struct pool_entry *entry;
+        struct chmFile *handle, *duplicate = NULL;
+        struct chm_access *access;
+
+        chm_stats_add(CHM_STAT_STATS, 1);
+        if (stat(filename, &statbuf) == -1)
+                return NULL;
+
+        pthread_mutex_lock(&pool_mutex);
+        entry = pool_find(&statbuf);
+        if (entry) {
+                entry->refcount++;
+                entry->last_used = ++pool_clock;
+                handle = entry->handle;
+                chm_stats_add(CHM_STAT_POOL_HITS, 1);
+                d(printf("chm_pool_open >>> reuse handle of %s, refcount = %d\n", filename, entry->refcount));
+                pthread_mutex_unlock(&pool_mutex);
+                return handle;
+        }
+        pool_shrink(pool_capacity);
+        pthread_mutex_unlock(&pool_mutex);
+
+        chm_stats_add(CHM_STAT_POOL_MISSES, 1);
+        handle = chm_stats_open(filename);
+        if (!handle)
+                return NULL;
+        access = chm_access_open(handle, filename);
+
+        pthread_mutex_lock(&pool_mutex);
+        entry = pool_find(&statbuf);
+        if (entry) {
+                entry->refcount++;
+                entry->last_used = ++pool_clock;
+                duplicate = handle;
+                handle = entry->handle;
+                d(printf("chm_pool_open >>> %s was opened meanwhile, refcount = %d\n", filename, entry->refcount));
+        } else {
+                entry = (struct pool_entry *)malloc(sizeof(struct pool_entry));
+                entry->handle = handle;
+                entry->access = access;
+                entry->dev = statbuf.st_dev;
+                entry->ino = statbuf.st_ino;
+                entry->size = statbuf.st_size;
+                entry->mtime = statbuf.st_mtime;
+                entry->stale = 0;
+                entry->refcount = 1;
+                entry->last_used = ++pool_clock;
+                entry->next = pool_head;
+                pool_head = entry;
+                pool_size++;
+
+                d(printf("chm_pool_open >>> open handle of %s, pool size = %d\n", filename, pool_size));
+                pool_shrink(pool_capacity);
+        }
+        pthread_mutex_unlock(&pool_mutex);
+
+        if (duplicate) {
+                chm_access_close(access);
+                chm_close(duplicate);
+        }
+
+        return handle;
+}
+
+void
+chm_pool_close(struct chmFile *handle)
+{
+        struct pool_entry *entry;
+
+        if (!handle)
+                return;
+
+        pthread_mutex_lock(&pool_mutex);
+
+        for (entry = pool_head; entry; entry = entry->next) {
+                if (entry->handle == handle) {
+                        entry->refcount--;
+                        break;
+                }
+        }
+
+        if (!entry)
+                fprintf(stderr, "chm_pool_close: unknown handle %p\n", (void *)handle);
+
+        pool_shrink(pool_capacity);
+
+        pthread_mutex_unlock(&pool_mutex);
+}
+
+/* The access layer of a handle returned by chm_pool_open */
+struct chm_access *
+chm_pool_access(struct chmFile *handle)
+{
+        struct pool_entry *entry;
+        struct chm_access *access = NULL;
+
+        pthread_mutex_lock(&pool_mutex);
+        for (entry = pool_head; entry; entry = entry->next) {
+                if (entry->handle == handle) {
+                        access = entry->access;
+                        break;
+                }
+        }
+        pthread_mutex_unlock(&pool_mutex);
+
+        return access;
+}
+
+/* Block cache counters of every archive opened so far */
+void
+chm_pool_get_stats(struct chm_access_stats *stats)
+{
+        struct pool_entry *entry;
+
+        pthread_mutex_lock(&pool_mutex);
+        *stats = pool_retired;
+        for (entry = pool_head; entry; entry = entry->next) {
+                struct chm_access_stats s;
+
+                chm_access_get_stats(entry->access, &s);
+                stats->hits += s.hits;
+                stats->misses += s.misses;
+                stats->mapped_reads += s.mapped_reads;
+        }
+        pthread_mutex_unlock(&pool_mutex);
+}
+
+void
+chm_pool_set_capacity(int capacity)
+{
+        if (capacity < 1)
+                capacity = 1;
+
+        pthread_mutex_lock(&pool_mutex);
+        pool_capacity = capacity;
+        pool_shrink(pool_capacity);
+        pthread_mutex_unlock(&pool_mutex);
+}
+
+int
+chm_pool_get_capacity(void)
+{
+        return pool_capacity;
+}
@@ -0,0 +1,42 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHMPOOL_H__
+#define __CS_CHMPOOL_H__
+
+struct chmFile;
+struct chm_access;
+struct chm_access_stats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct chmFile *chm_pool_open(const char *);
+void chm_pool_close(struct chmFile *);
+struct chm_access *chm_pool_access(struct chmFile *);
+void chm_pool_get_stats(struct chm_access_stats *);
+void chm_pool_set_capacity(int);
+int chm_pool_get_capacity(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
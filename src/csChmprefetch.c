@@ -0,0 +1,520 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Read ahead of the table of contents
+ *
+ * When a toc entry is selected the pages of the entries around it, next
+ * ones first, and the stylesheets, scripts and images those pages link
+ * to are read on a low priority thread.  Reading them through the pooled
+ * handle leaves their LZX blocks decompressed in the block cache of
+ * csChmaccess.c, reading them from the bookshelf brings them into the
+ * page cache, so going to the next or previous topic finds them warm.
+ *
+ * There is one thread for the process.  A new request replaces the one
+ * waiting and makes the one running stop at its next object, only the
+ * latest position is worth reading around.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <chm_lib.h>
+
+#include "csChmfile.h"
+#include "csChmpool.h"
+#include "csChmaccess.h"
+#include "csChmpack.h"
+#include "csChmparser.h"
+#include "csChmstats.h"
+#include "csChmprefetch.h"
+
+struct prefetch_request
+{
+        char *chmfile;
+        char *folder;
+        enum chm_prefetch_source source;
+
+        /* archive paths, the pages first, nearest first */
+        char *paths[CHM_PREFETCH_MAX_OBJECTS];
+        int pages;
+        int count;
+};
+
+struct prefetch_reader
+{
+        const struct prefetch_request *request;
+        struct chmFile *h;
+        struct chm_access *access;
+        struct pack *pack;
+
+        /* blocks of the block cache this request already paid for */
+        u_int64_t block_len;
+        u_int32_t *blocks;
+        u_int32_t block_count;
+};
+
+static pthread_mutex_t prefetch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+static struct prefetch_request *prefetch_pending = NULL;
+static unsigned long prefetch_generation = 0;
+static int prefetch_started = 0;
+
+static void request_free(struct prefetch_request *request)
+{
+        int i;
+
+        if (!request)
+                return;
+
+        for (i = 0; i < request->count; i++)
+                free(request->paths[i]);
+        free(request->chmfile);
+        free(request->folder);
+        free(request);
+}
+
+static int stale(unsigned long generation)
+{
+        return __sync_fetch_and_add(&prefetch_generation, 0) != generation;
+}
+
+/* Add the archive path of a link, len bytes of link, unless already there */
+static void add_path(struct prefetch_request *request, const char *base,
+                     const char *link, size_t len)
+{
+        char path[CHM_MAX_PATHLEN + 1];
+        size_t n = 0, i;
+        int j;
+
+        if (request->count == CHM_PREFETCH_MAX_OBJECTS || len == 0 || link[0] == '#')
+                return;
+
+        /* links to other archives or other schemes */
+        for (i = 0; i < len && link[i] != '/'; i++)
+                if (link[i] == ':')
+                        return;
+
+        if (link[0] != '/') {
+                const char *slash = strrchr(base, '/');
+
+                n = slash ? slash - base + 1 : 0;
+                if (n == 0 || n >= sizeof(path))
+                        return;
+                memcpy(path, base, n);
+        }
+
+        for (i = 0; i < len && link[i] != '?' && link[i] != '#'; i++) {
+                int c = (unsigned char)link[i];
+
+                if (c == '%' && i + 2 < len && isxdigit((unsigned char)link[i + 1])
+                    && isxdigit((unsigned char)link[i + 2])) {
+                        char hex[3] = { link[i + 1], link[i + 2], '\0' };
+
+                        c = (int)strtol(hex, NULL, 16);
+                        i += 2;
+                }
+
+                if (n == sizeof(path) - 1 || c == '\0')
+                        return;
+                path[n++] = (char)c;
+        }
+        path[n] = '\0';
+
+        if (path[0] != '/')
+                return;
+        chm_normalize_path(path);
+
+        for (j = 0; j < request->count; j++)
+                if (strcmp(request->paths[j], path) == 0)
+                        return;
+
+        request->paths[request->count++] = strdup(path);
+}
+
+static int linked_type(const char *link, size_t len)
+{
+        static const char *types[] = {
+                "css", "js", "gif", "png", "jpg", "jpeg", "bmp", "ico", "svg", NULL
+        };
+        size_t end = 0, dot;
+        int i;
+
+        while (end < len && link[end] != '?' && link[end] != '#')
+                end++;
+
+        for (dot = end; dot > 0 && link[dot - 1] != '.' && link[dot - 1] != '/'; dot--)
+                ;
+        if (dot == 0 || link[dot - 1] != '.')
+                return 0;
+
+        for (i = 0; types[i]; i++)
+                if (strlen(types[i]) == end - dot && strncasecmp(types[i], link + dot, end - dot) == 0)
+                        return 1;
+
+        return 0;
+}
+
+/* Queue the stylesheets, scripts and images page links to */
+static void scan_links(struct prefetch_request *request, const char *page,
+                       const char *html, size_t len)
+{
+        size_t i = 0;
+
+        while (i < len) {
+                const char *p = html + i;
+                size_t name, start, end;
+                char quote = 0;
+
+                if (len - i > 5 && strncasecmp(p, "href", 4) == 0)
+                        name = 4;
+                else if (len - i > 4 && strncasecmp(p, "src", 3) == 0)
+                        name = 3;
+                else {
+                        i++;
+                        continue;
+                }
+
+                if (i > 0 && !isspace((unsigned char)html[i - 1])) {
+                        i += name;
+                        continue;
+                }
+
+                start = i + name;
+                while (start < len && isspace((unsigned char)html[start]))
+                        start++;
+                if (start == len || html[start] != '=') {
+                        i = start;
+                        continue;
+                }
+                start++;
+                while (start < len && isspace((unsigned char)html[start]))
+                        start++;
+                if (start < len && (html[start] == '"' || html[start] == '\''))
+                        quote = html[start++];
+
+                for (end = start; end < len; end++) {
+                        if (quote ? html[end] == quote
+                            : (isspace((unsigned char)html[end]) || html[end] == '>'))
+                                break;
+                }
+
+                if (linked_type(html + start, end - start))
+                        add_path(request, page, html + start, end - start);
+
+                i = end;
+        }
+}
+
+static int block_paid(const struct prefetch_reader *reader, u_int32_t block)
+{
+        u_int32_t i;
+
+        for (i = 0; i < reader->block_count; i++)
+                if (reader->blocks[i] == block)
+                        return 1;
+
+        return 0;
+}
+
+/*
+ * What reading ui costs the block cache: the blocks it spans that this
+ * request has not read yet, or its length when it is not read through
+ * the cache.  The blocks are recorded when they fit in budget.
+ */
+static u_int64_t object_cost(struct prefetch_reader *reader, const struct chmUnitInfo *ui,
+                             u_int64_t budget)
+{
+        u_int64_t first, last, block, cost = 0;
+
+        if (ui->space != CHM_COMPRESSED || !reader->blocks || ui->length == 0)
+                return ui->length;
+
+        first = ui->start / reader->block_len;
+        last = (ui->start + ui->length - 1) / reader->block_len;
+        for (block = first; block <= last && cost <= budget; block++)
+                if (!block_paid(reader, (u_int32_t)block))
+                        cost += reader->block_len;
+
+        if (cost <= budget)
+                for (block = first; block <= last; block++)
+                        if (!block_paid(reader, (u_int32_t)block))
+                                reader->blocks[reader->block_count++] = (u_int32_t)block;
+
+        return cost;
+}
+
+/* The whole object at path, NULL if missing or costing more than budget */
+static char *read_object(struct prefetch_reader *reader, const char *path,
+                         u_int64_t budget, u_int64_t *length, u_int64_t *cost)
+{
+        char *buf = NULL;
+        u_int64_t done = 0;
+
+        switch (reader->request->source) {
+        case CHM_PREFETCH_ARCHIVE: {
+                struct chmUnitInfo ui;
+
+                if (!reader->h || chm_resolve_object(reader->h, path, &ui) != CHM_RESOLVE_SUCCESS
+                    || (*cost = object_cost(reader, &ui, budget)) > budget)
+                        return NULL;
+
+                buf = (char *)malloc(ui.length + 1);
+                while (done < ui.length) {
+                        LONGINT64 n = reader->access
+                                ? chm_access_read(reader->access, &ui, (unsigned char *)buf + done,
+                                                  done, ui.length - done)
+                                : chm_retrieve_object(reader->h, &ui, (unsigned char *)buf + done,
+                                                      done, ui.length - done);
+                        if (n <= 0)
+                                break;
+                        done += n;
+                }
+                break;
+        }
+        case CHM_PREFETCH_PACK: {
+                struct pack_cursor cursor;
+                long object;
+
+                if (!reader->pack || (object = pack_lookup(reader->pack, path)) < 0
+                    || pack_length(reader->pack, object) > budget)
+                        return NULL;
+
+                cursor.frame = -1;
+                cursor.length = 0;
+                cursor.data = NULL;
+
+                *length = *cost = pack_length(reader->pack, object);
+                buf = (char *)malloc(*length + 1);
+                while (done < *length) {
+                        long n = pack_read(reader->pack, object, &cursor, (unsigned char *)buf + done,
+                                           done, *length - done);
+                        if (n <= 0)
+                                break;
+                        done += n;
+                }
+                pack_cursor_free(&cursor);
+                break;
+        }
+        case CHM_PREFETCH_FOLDER: {
+                char filename[1024];
+                struct stat st;
+                int fd;
+
+                /* lazily extracted books only have what was asked for */
+                if (snprintf(filename, sizeof(filename), "%s%s", reader->request->folder, path) >= (int)sizeof(filename)
+                    || (fd = open(filename, O_RDONLY)) == -1)
+                        return NULL;
+
+                if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || (u_int64_t)st.st_size > budget) {
+                        close(fd);
+                        return NULL;
+                }
+
+                *cost = st.st_size;
+                buf = (char *)malloc(st.st_size + 1);
+                while (done < (u_int64_t)st.st_size) {
+                        ssize_t n = read(fd, buf + done, st.st_size - done);
+
+                        if (n <= 0)
+                                break;
+                        done += n;
+                }
+                close(fd);
+                break;
+        }
+        }
+
+        buf[done] = '\0';
+        *length = done;
+
+        return buf;
+}
+
+static int is_page(const char *path)
+{
+        const char *dot = strrchr(path, '.');
+
+        return dot && (strcasecmp(dot, ".htm") == 0 || strcasecmp(dot, ".html") == 0);
+}
+
+static void prefetch_run(struct prefetch_request *request, unsigned long generation)
+{
+        struct prefetch_reader reader;
+        u_int64_t begin = chm_stats_clock(), budget = CHM_PREFETCH_BUDGET;
+        int i;
+
+        memset(&reader, 0, sizeof(reader));
+        reader.request = request;
+
+        if (request->source == CHM_PREFETCH_ARCHIVE) {
+                reader.h = chm_pool_open(request->chmfile);
+                reader.access = reader.h ? chm_pool_access(reader.h) : NULL;
+                reader.block_len = reader.access ? chm_access_block_len(reader.access) : 0;
+                if (reader.block_len)
+                        reader.blocks = (u_int32_t *)malloc((budget / reader.block_len + 1) * sizeof(u_int32_t));
+        } else if (request->source == CHM_PREFETCH_PACK) {
+                char filename[1024];
+
+                if (snprintf(filename, sizeof(filename), "%s/" PACK_FILE, request->folder) < (int)sizeof(filename))
+                        reader.pack = pack_open(filename);
+        }
+
+        for (i = 0; i < request->count && budget > 0 && !stale(generation); i++) {
+                u_int64_t length, cost;
+                char *buf = read_object(&reader, request->paths[i], budget, &length, &cost);
+
+                if (!buf)
+                        continue;
+
+                if (i < request->pages && is_page(request->paths[i]))
+                        scan_links(request, request->paths[i], buf, length);
+
+                budget -= cost;
+                chm_stats_add(CHM_STAT_PREFETCH_OBJECTS, 1);
+                chm_stats_add(CHM_STAT_PREFETCH_BYTES, length);
+                free(buf);
+        }
+
+        d(printf("prefetch_run >>> %d of %d objects, %llu bytes of cache, %u blocks\n", i, request->count,
+                 (unsigned long long)(CHM_PREFETCH_BUDGET - budget), reader.block_count));
+
+        if (reader.h)
+                chm_pool_close(reader.h);
+        if (reader.pack)
+                pack_close(reader.pack);
+        free(reader.blocks);
+
+        chm_trace_event("prefetch", begin, chm_stats_clock(), request->count ? request->paths[0] : NULL);
+}
+
+static void *prefetch_worker(void *data)
+{
+#ifdef __linux__
+        /* on linux the nice value and io priority are those of the thread */
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#ifdef SYS_ioprio_set
+        /* IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE */
+        syscall(SYS_ioprio_set, 1, (int)syscall(SYS_gettid), 3 << 13);
+#endif
+#endif
+
+        for (;;) {
+                struct prefetch_request *request;
+                unsigned long generation;
+
+                pthread_mutex_lock(&prefetch_mutex);
+                while (!prefetch_pending)
+                        pthread_cond_wait(&prefetch_cond, &prefetch_mutex);
+                request = prefetch_pending;
+                prefetch_pending = NULL;
+                generation = prefetch_generation;
+                pthread_mutex_unlock(&prefetch_mutex);
+
+                prefetch_run(request, generation);
+                request_free(request);
+        }
+
+        return NULL;
+}
+
+/*
+ * Read ahead the pages of up to pages toc entries on each side of entry,
+ * from the archive chmfile, or from the bookshelf folder it was extracted
+ * or packed to, as source says.  Returns at once.
+ */
+void
+chm_prefetch(const char *chmfile, const char *folder, enum chm_prefetch_source source,
+             struct sitemap *toc, u_int32_t entry, u_int32_t pages)
+{
+        struct prefetch_request *request;
+        const char *local;
+        u_int32_t i;
+        int current;
+
+        if (!toc || entry >= toc->count || pages == 0
+            || (source != CHM_PREFETCH_ARCHIVE && !folder))
+                return;
+        if (pages > CHM_PREFETCH_MAX_PAGES)
+                pages = CHM_PREFETCH_MAX_PAGES;
+
+        request = (struct prefetch_request *)calloc(1, sizeof(struct prefetch_request));
+        request->chmfile = strdup(chmfile);
+        request->folder = folder ? strdup(folder) : NULL;
+        request->source = source;
+
+        /* the selected page itself is being loaded already */
+        local = SITEMAP_LOCAL(toc, entry);
+        add_path(request, "/", local, strlen(local));
+        current = request->count;
+
+        for (i = 1; i <= pages; i++) {
+                if (entry + i < toc->count) {
+                        local = SITEMAP_LOCAL(toc, entry + i);
+                        add_path(request, "/", local, strlen(local));
+                }
+                if (entry >= i) {
+                        local = SITEMAP_LOCAL(toc, entry - i);
+                        add_path(request, "/", local, strlen(local));
+                }
+        }
+
+        if (current) {
+                free(request->paths[0]);
+                request->count--;
+                memmove(request->paths, request->paths + 1, request->count * sizeof(char *));
+        }
+        request->pages = request->count;
+
+        pthread_mutex_lock(&prefetch_mutex);
+        request_free(prefetch_pending);
+        prefetch_pending = request;
+        prefetch_generation++;
+
+        if (!prefetch_started) {
+                pthread_t thread;
+                pthread_attr_t attr;
+
+                pthread_attr_init(&attr);
+                pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+                prefetch_started = pthread_create(&thread, &attr, prefetch_worker, NULL) == 0;
+                pthread_attr_destroy(&attr);
+        }
+
+        if (prefetch_started) {
+                pthread_cond_signal(&prefetch_cond);
+        } else {
+                request_free(prefetch_pending);
+                prefetch_pending = NULL;
+        }
+        pthread_mutex_unlock(&prefetch_mutex);
+}
@@ -0,0 +1,61 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHMPREFETCH_H__
+#define __CS_CHMPREFETCH_H__
+
+#include <sys/types.h>
+
+#include "csChmaccess.h"
+
+/* toc entries read ahead at most on each side of the current one */
+#define CHM_PREFETCH_MAX_PAGES 16
+
+/* objects read per request, the pages and what they link to */
+#define CHM_PREFETCH_MAX_OBJECTS 256
+
+/*
+ * Cache bytes filled per request, so the block cache keeps what is being
+ * read: a compressed object costs the LZX blocks it brings in, not its
+ * length, many small objects in distinct blocks add up to whole blocks.
+ */
+#define CHM_PREFETCH_BUDGET (CHM_BLOCK_CACHE_SIZE / 4)
+
+/* where the pages of a book are read from */
+enum chm_prefetch_source
+{
+        CHM_PREFETCH_ARCHIVE,
+        CHM_PREFETCH_FOLDER,
+        CHM_PREFETCH_PACK
+};
+
+struct sitemap;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void chm_prefetch(const char *, const char *, enum chm_prefetch_source,
+                  struct sitemap *, u_int32_t, u_int32_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
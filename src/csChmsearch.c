@@ -0,0 +1,1138 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Full-text search
+ *
+ * search_build() reads every HTML page of an archive, strips the markup
+ * and splits the text into terms: runs of ASCII letters, digits and
+ * bytes above 0x7f, folded to lower case.  Books in a double-byte charset
+ * (chinese, japanese, korean) have no spaces between words, there every
+ * double-byte character is a term of its own and a query matches its
+ * characters anywhere in the page.
+ *
+ * Postings are (document delta, term frequency) pairs stored as varints.
+ * They are collected in memory, and written out as a sorted segment once
+ * memory_limit is reached.  The segments are merged into SEARCH_INDEX_FILE:
+ *
+ *   header | documents | document strings | terms | term strings | postings
+ *
+ * Queries map the file, look the terms up by binary search and rank the
+ * pages containing all of them by BM25.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <chm_lib.h>
+
+#include "csChmfile.h"
+#include "csChmsearch.h"
+#include "csChmstats.h"
+
+#define SEARCH_MAGIC    "CSFT"
+#define SEARCH_VERSION  1
+#define SEARCH_DBCS     0x1
+
+#define TERM_MAX        64
+#define TITLE_MAX       256
+#define QUERY_TERMS_MAX 32
+#define MEMORY_LIMIT    (32 << 20)
+
+#define BM25_K1 1.2
+#define BM25_B  0.75
+
+struct search_header
+{
+        char magic[4];
+        u_int32_t version;
+        u_int32_t flags;
+        u_int32_t doc_count;
+        u_int32_t term_count;
+        u_int32_t reserved;
+        u_int64_t total_length;
+
+        u_int32_t docs;
+        u_int32_t doc_strings;
+        u_int32_t terms;
+        u_int32_t term_strings;
+        u_int32_t postings;
+        u_int32_t file_length;
+};
+
+struct search_doc
+{
+        u_int32_t path;
+        u_int32_t title;
+        u_int32_t length;
+};
+
+struct search_term
+{
+        u_int32_t text;
+        u_int32_t df;
+        u_int32_t postings;
+        u_int32_t postings_len;
+};
+
+struct search_index
+{
+        void *mapping;
+        size_t length;
+        const struct search_header *header;
+        const struct search_doc *docs;
+        const char *doc_strings;
+        const struct search_term *terms;
+        const char *term_strings;
+        const unsigned char *postings;
+};
+
+/* Tokenizer */
+
+typedef void (*token_func)(const char *, size_t, void *);
+
+static int is_dbcs(u_int32_t lcid)
+{
+        switch (lcid) {
+        case 0x0411:                    /* japanese */
+        case 0x0412:                    /* korean */
+        case 0x0404:                    /* chinese */
+        case 0x0804:
+        case 0x0c04:
+        case 0x1004:
+        case 0x1404:
+                return 1;
+        default:
+                return 0;
+        }
+}
+
+static void tokenize(const char *text, size_t len, int dbcs, token_func func, void *data)
+{
+        char term[TERM_MAX];
+        size_t term_len = 0, i = 0;
+        int skip = 0;
+
+        while (i <= len) {
+                unsigned char c = i < len ? (unsigned char)text[i] : ' ';
+
+                if (dbcs && c >= 0x81 && i + 1 < len) {
+                        if (term_len && !skip)
+                                func(term, term_len, data);
+                        term_len = 0;
+                        skip = 0;
+
+                        func(text + i, 2, data);
+                        i += 2;
+                        continue;
+                }
+
+                if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_' || c >= 0x80) {
+                        if (term_len < TERM_MAX)
+                                term[term_len++] = c;
+                        else
+                                skip = 1;       /* too long to be worth indexing */
+                } else if (c >= 'A' && c <= 'Z') {
+                        if (term_len < TERM_MAX)
+                                term[term_len++] = c + ('a' - 'A');
+                        else
+                                skip = 1;
+                } else {
+                        if (term_len && !skip)
+                                func(term, term_len, data);
+                        term_len = 0;
+                        skip = 0;
+                }
+                i++;
+        }
+}
+
+/* Text of an HTML page */
+
+static const char *find_ci(const char *p, const char *end, const char *str)
+{
+        size_t len = strlen(str);
+
+        for (; p + len <= end; p++)
+                if (strncasecmp(p, str, len) == 0)
+                        return p;
+
+        return NULL;
+}
+
+static int tag_name_is(const char *p, const char *end, const char *name)
+{
+        size_t len = strlen(name);
+
+        return p + len < end
+                && strncasecmp(p, name, len) == 0
+                && (p[len] == '>' || p[len] == ' ' || p[len] == '\t'
+                    || p[len] == '\r' || p[len] == '\n' || p[len] == '/');
+}
+
+/*
+ * Replace the markup of buf by spaces, in place.  Scripts, styles and
+ * comments are dropped.  The text of <title> is copied to title.
+ * Returns the length of the text.
+ */
+static size_t html_text(char *buf, size_t len, char *title, size_t title_size)
+{
+        const char *p = buf, *end = buf + len;
+        char *out = buf;
+
+        *title = '\0';
+
+        while (p < end) {
+                if (*p == '&') {
+                        const char *semi = p + 1;
+
+                        while (semi < end && semi - p < 10 && *semi != ';' && *semi != '<')
+                                semi++;
+                        p = (semi < end && *semi == ';') ? semi + 1 : p + 1;
+                        *out++ = ' ';
+                        continue;
+                }
+
+                if (*p != '<') {
+                        *out++ = *p++;
+                        continue;
+                }
+
+                if (end - p >= 4 && strncmp(p, "<!--", 4) == 0) {
+                        const char *close = find_ci(p + 4, end, "-->");
+                        p = close ? close + 3 : end;
+                } else if (tag_name_is(p + 1, end, "script")) {
+                        const char *close = find_ci(p + 7, end, "</script");
+                        p = close ? close + 8 : end;
+                } else if (tag_name_is(p + 1, end, "style")) {
+                        const char *close = find_ci(p + 6, end, "</style");
+                        p = close ? close + 7 : end;
+                } else {
+                        const char *gt = (const char *)memchr(p, '>', end - p);
+
+                        if (tag_name_is(p + 1, end, "title") && gt && *title == '\0') {
+                                const char *close = find_ci(gt + 1, end, "</title");
+                                size_t n = 0, i;
+
+                                if (close) {
+                                        /* collapse white space */
+                                        for (i = gt + 1 - buf; buf + i < close && n + 1 < title_size; i++) {
+                                                char c = buf[i];
+                                                if (c == '\r' || c == '\n' || c == '\t')
+                                                        c = ' ';
+                                                if (c == ' ' && (n == 0 || title[n - 1] == ' '))
+                                                        continue;
+                                                title[n++] = c;
+                                        }
+                                        while (n && title[n - 1] == ' ')
+                                                n--;
+                                        title[n] = '\0';
+                                }
+                        }
+
+                        p = gt ? gt + 1 : end;
+                }
+
+                *out++ = ' ';
+        }
+
+        return out - buf;
+}
+
+/* Varints */
+
+static size_t varint_put(unsigned char *buf, u_int32_t value)
+{
+        size_t n = 0;
+
+        while (value >= 0x80) {
+                buf[n++] = (value & 0x7f) | 0x80;
+                value >>= 7;
+        }
+        buf[n++] = value;
+
+        return n;
+}
+
+static const unsigned char *varint_get(const unsigned char *p, const unsigned char *end, u_int32_t *value)
+{
+        u_int32_t result = 0;
+        int shift = 0;
+
+        while (p < end && shift < 35) {
+                result |= (u_int32_t)(*p & 0x7f) << shift;
+                if (!(*p++ & 0x80)) {
+                        *value = result;
+                        return p;
+                }
+                shift += 7;
+        }
+
+        return NULL;
+}
+
+/* Building */
+
+struct build_term
+{
+        char *text;
+        size_t len;
+        u_int32_t hash;
+
+        u_int32_t df;
+        int32_t last_doc;       /* document of the pending tf */
+        u_int32_t tf;
+        int32_t written_doc;    /* last document in postings */
+
+        unsigned char *postings;
+        u_int32_t postings_len;
+        u_int32_t postings_cap;
+};
+
+/* where a page is in the archive, its terms and title once it is read */
+struct build_doc
+{
+        u_int64_t start;
+        u_int64_t size;
+        char *path;
+        char *title;
+        u_int32_t length;
+        int space;
+};
+
+struct builder
+{
+        const char *index_path;
+        int dbcs;
+
+        struct build_doc *docs;
+        u_int32_t doc_count;
+        u_int32_t doc_cap;
+        int32_t current;
+        u_int64_t total_length;
+
+        struct build_term **table;
+        u_int32_t table_size;
+        u_int32_t term_count;
+        size_t memory;
+
+        int segments;
+};
+
+static u_int32_t hash_term(const char *text, size_t len)
+{
+        u_int32_t h = 2166136261u;
+        size_t i;
+
+        for (i = 0; i < len; i++) {
+                h ^= (unsigned char)text[i];
+                h *= 16777619u;
+        }
+
+        return h;
+}
+
+static void table_grow(struct builder *b)
+{
+        u_int32_t size = b->table_size ? b->table_size * 2 : 4096;
+        struct build_term **table = (struct build_term **)calloc(size, sizeof(struct build_term *));
+        u_int32_t i;
+
+        for (i = 0; i < b->table_size; i++) {
+                struct build_term *t = b->table[i];
+                u_int32_t j;
+
+                if (!t)
+                        continue;
+                for (j = t->hash & (size - 1); table[j]; j = (j + 1) & (size - 1))
+                        ;
+                table[j] = t;
+        }
+
+        free(b->table);
+        b->table = table;
+        b->table_size = size;
+}
+
+static void postings_put(struct builder *b, struct build_term *t, u_int32_t doc_delta, u_int32_t tf)
+{
+        if (t->postings_len + 10 > t->postings_cap) {
+                u_int32_t cap = t->postings_cap ? t->postings_cap * 2 : 16;
+
+                t->postings = (unsigned char *)realloc(t->postings, cap);
+                b->memory += cap - t->postings_cap;
+                t->postings_cap = cap;
+        }
+
+        t->postings_len += varint_put(t->postings + t->postings_len, doc_delta);
+        t->postings_len += varint_put(t->postings + t->postings_len, tf);
+}
+
+/* the first document of a segment is stored as doc + 1 */
+static void flush_tf(struct builder *b, struct build_term *t)
+{
+        if (t->tf) {
+                postings_put(b, t, t->last_doc - t->written_doc, t->tf);
+                t->written_doc = t->last_doc;
+                t->tf = 0;
+        }
+}
+
+static void add_term(const char *text, size_t len, void *data)
+{
+        struct builder *b = (struct builder *)data;
+        u_int32_t hash = hash_term(text, len);
+        struct build_term *t;
+        u_int32_t i;
+
+        if ((b->term_count + 1) * 10 >= b->table_size * 7)
+                table_grow(b);
+
+        for (i = hash & (b->table_size - 1); (t = b->table[i]); i = (i + 1) & (b->table_size - 1))
+                if (t->hash == hash && t->len == len && memcmp(t->text, text, len) == 0)
+                        break;
+
+        if (!t) {
+                t = (struct build_term *)calloc(1, sizeof(struct build_term));
+                t->text = strndup(text, len);
+                t->len = len;
+                t->hash = hash;
+                t->last_doc = -1;
+                t->written_doc = -1;
+                b->table[i] = t;
+                b->term_count++;
+                b->memory += sizeof(struct build_term) + len + 1 + 2 * sizeof(void *);
+        }
+
+        if (t->last_doc != b->current) {
+                flush_tf(b, t);
+                t->last_doc = b->current;
+                t->df++;
+        }
+        t->tf++;
+
+        b->docs[b->current].length++;
+}
+
+static int compare_term(const void *a, const void *b)
+{
+        const struct build_term *ta = *(const struct build_term **)a;
+        const struct build_term *tb = *(const struct build_term **)b;
+
+        return strcmp(ta->text, tb->text);
+}
+
+static void segment_path(char *buf, size_t size, const char *index_path, int segment)
+{
+        snprintf(buf, size, "%s.seg%d", index_path, segment);
+}
+
+/*
+ * Write the terms in memory, sorted, as a segment:
+ *   u32 count, then per term u16 length, text, u32 df, u32 last document,
+ *   u32 postings length and the postings
+ */
+static int write_segment(struct builder *b)
+{
+        struct build_term **terms;
+        char path[1024];
+        u_int32_t i, n = 0;
+        FILE *fp;
+        int ret = 0;
+
+        terms = (struct build_term **)malloc((b->term_count + 1) * sizeof(struct build_term *));
+        for (i = 0; i < b->table_size; i++)
+                if (b->table[i])
+                        terms[n++] = b->table[i];
+
+        qsort(terms, n, sizeof(struct build_term *), compare_term);
+
+        segment_path(path, sizeof(path), b->index_path, b->segments);
+        fp = fopen(path, "wb");
+        if (fp == NULL) {
+                fprintf(stderr, "Cannot write search segment: %s\n", path);
+                free(terms);
+                return -1;
+        }
+
+        fwrite(&n, sizeof(n), 1, fp);
+        for (i = 0; i < n; i++) {
+                struct build_term *t = terms[i];
+                u_int16_t len = t->len;
+                u_int32_t last = t->last_doc;
+
+                flush_tf(b, t);
+                fwrite(&len, sizeof(len), 1, fp);
+                fwrite(t->text, 1, len, fp);
+                fwrite(&t->df, sizeof(t->df), 1, fp);
+                fwrite(&last, sizeof(last), 1, fp);
+                fwrite(&t->postings_len, sizeof(t->postings_len), 1, fp);
+                fwrite(t->postings, 1, t->postings_len, fp);
+
+                free(t->text);
+                free(t->postings);
+                free(t);
+        }
+
+        if (ferror(fp))
+                ret = -1;
+        if (fclose(fp) != 0)
+                ret = -1;
+
+        d(printf("write_segment >>> %s, %u terms, %lu bytes in memory\n", path, n, (unsigned long)b->memory));
+
+        free(terms);
+        memset(b->table, 0, b->table_size * sizeof(struct build_term *));
+        b->term_count = 0;
+        b->memory = 0;
+        b->segments++;
+
+        return ret;
+}
+
+struct segment_reader
+{
+        FILE *fp;
+        int done;
+        char text[TERM_MAX + 1];
+        u_int32_t df;
+        u_int32_t last_doc;
+        unsigned char *postings;
+        u_int32_t postings_len;
+        u_int32_t postings_cap;
+        u_int32_t left;
+};
+
+static void segment_next(struct segment_reader *r)
+{
+        u_int16_t len;
+
+        if (r->left == 0
+            || fread(&len, sizeof(len), 1, r->fp) != 1
+            || len > TERM_MAX
+            || fread(r->text, 1, len, r->fp) != len
+            || fread(&r->df, sizeof(r->df), 1, r->fp) != 1
+            || fread(&r->last_doc, sizeof(r->last_doc), 1, r->fp) != 1
+            || fread(&r->postings_len, sizeof(r->postings_len), 1, r->fp) != 1) {
+                r->done = 1;
+                return;
+        }
+        r->text[len] = '\0';
+
+        if (r->postings_len > r->postings_cap) {
+                r->postings_cap = r->postings_len;
+                r->postings = (unsigned char *)realloc(r->postings, r->postings_cap);
+        }
+        if (fread(r->postings, 1, r->postings_len, r->fp) != r->postings_len) {
+                r->done = 1;
+                return;
+        }
+
+        r->left--;
+}
+
+static int write_padded(FILE *fp, const void *data, size_t len)
+{
+        static const char zeros[4] = { 0, 0, 0, 0 };
+        size_t pad = (4 - (len & 3)) & 3;
+
+        if (len && fwrite(data, 1, len, fp) != len)
+                return -1;
+        if (pad && fwrite(zeros, 1, pad, fp) != pad)
+                return -1;
+
+        return 0;
+}
+
+static u_int32_t arena_add(char **arena, u_int32_t *len, u_int32_t *cap, const char *str)
+{
+        u_int32_t offset = *len;
+        size_t n = strlen(str) + 1;
+
+        if (*len + n > *cap) {
+                while (*len + n > *cap)
+                        *cap = *cap ? *cap * 2 : 4096;
+                *arena = (char *)realloc(*arena, *cap);
+        }
+
+        memcpy(*arena + offset, str, n);
+        *len += n;
+
+        return offset;
+}
+
+/* merge the segments into the index file */
+static int merge_segments(struct builder *b)
+{
+        struct segment_reader *readers;
+        struct search_header header;
+        struct search_term *terms = NULL;
+        u_int32_t term_count = 0, term_cap = 0;
+        char *term_strings = NULL, *doc_strings = NULL;
+        u_int32_t term_strings_len = 0, term_strings_cap = 0;
+        u_int32_t doc_strings_len = 0, doc_strings_cap = 0;
+        struct search_doc *docs;
+        char path[1024], post_path[1024], tmp_path[1024];
+        unsigned char varint[5];
+        u_int32_t postings_len = 0, i;
+        FILE *post, *fp;
+        int s, ret = 0;
+
+        snprintf(post_path, sizeof(post_path), "%s.post", b->index_path);
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", b->index_path);
+
+        post = fopen(post_path, "w+b");
+        if (post == NULL)
+                return -1;
+
+        readers = (struct segment_reader *)calloc(b->segments, sizeof(struct segment_reader));
+        for (s = 0; s < b->segments; s++) {
+                segment_path(path, sizeof(path), b->index_path, s);
+                readers[s].fp = fopen(path, "rb");
+                if (!readers[s].fp || fread(&readers[s].left, sizeof(u_int32_t), 1, readers[s].fp) != 1)
+                        readers[s].done = 1;
+                else
+                        segment_next(&readers[s]);
+        }
+
+        for (;;) {
+                const char *min = NULL;
+                int32_t last = -1;
+                u_int32_t df = 0, start = postings_len;
+
+                for (s = 0; s < b->segments; s++)
+                        if (!readers[s].done && (!min || strcmp(readers[s].text, min) < 0))
+                                min = readers[s].text;
+                if (!min)
+                        break;
+
+                if (term_count == term_cap) {
+                        term_cap = term_cap ? term_cap * 2 : 4096;
+                        terms = (struct search_term *)realloc(terms, term_cap * sizeof(struct search_term));
+                }
+                terms[term_count].text = arena_add(&term_strings, &term_strings_len, &term_strings_cap, min);
+
+                /* segments are in document order, only the first delta of each needs rebasing */
+                for (s = 0; s < b->segments; s++) {
+                        struct segment_reader *r = readers + s;
+                        const unsigned char *p, *end;
+                        u_int32_t first;
+
+                        if (r->done || strcmp(r->text, terms[term_count].text + term_strings) != 0)
+                                continue;
+
+                        p = r->postings;
+                        end = p + r->postings_len;
+                        p = varint_get(p, end, &first);
+                        if (p) {
+                                u_int32_t doc = first - 1;
+                                size_t n = varint_put(varint, doc - last);
+
+                                fwrite(varint, 1, n, post);
+                                fwrite(p, 1, end - p, post);
+                                postings_len += n + (end - p);
+                        }
+
+                        df += r->df;
+                        last = r->last_doc;
+                        segment_next(r);
+                }
+
+                terms[term_count].df = df;
+                terms[term_count].postings = start;
+                terms[term_count].postings_len = postings_len - start;
+                term_count++;
+        }
+
+        for (s = 0; s < b->segments; s++) {
+                if (readers[s].fp)
+                        fclose(readers[s].fp);
+                free(readers[s].postings);
+                segment_path(path, sizeof(path), b->index_path, s);
+                unlink(path);
+        }
+        free(readers);
+
+        docs = (struct search_doc *)malloc((b->doc_count + 1) * sizeof(struct search_doc));
+        for (i = 0; i < b->doc_count; i++) {
+                docs[i].path = arena_add(&doc_strings, &doc_strings_len, &doc_strings_cap, b->docs[i].path);
+                docs[i].title = arena_add(&doc_strings, &doc_strings_len, &doc_strings_cap,
+                                          b->docs[i].title ? b->docs[i].title : "");
+                docs[i].length = b->docs[i].length;
+        }
+
+#define PAD4(x) (((x) + 3) & ~3u)
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SEARCH_MAGIC, 4);
+        header.version = SEARCH_VERSION;
+        header.flags = b->dbcs ? SEARCH_DBCS : 0;
+        header.doc_count = b->doc_count;
+        header.term_count = term_count;
+        header.total_length = b->total_length;
+        header.docs = sizeof(header);
+        header.doc_strings = header.docs + PAD4(b->doc_count * sizeof(struct search_doc));
+        header.terms = header.doc_strings + PAD4(doc_strings_len);
+        header.term_strings = header.terms + PAD4(term_count * sizeof(struct search_term));
+        header.postings = header.term_strings + PAD4(term_strings_len);
+        header.file_length = header.postings + postings_len;
+#undef PAD4
+
+        fp = ferror(post) ? NULL : fopen(tmp_path, "wb");
+        if (fp == NULL) {
+                fprintf(stderr, "Cannot write search index: %s\n", tmp_path);
+                ret = -1;
+        } else {
+                unsigned char copy[65536];
+                size_t n;
+
+                if (fwrite(&header, sizeof(header), 1, fp) != 1
+                    || write_padded(fp, docs, b->doc_count * sizeof(struct search_doc)) == -1
+                    || write_padded(fp, doc_strings, doc_strings_len) == -1
+                    || write_padded(fp, terms, term_count * sizeof(struct search_term)) == -1
+                    || write_padded(fp, term_strings, term_strings_len) == -1)
+                        ret = -1;
+
+                rewind(post);
+                while (ret == 0 && (n = fread(copy, 1, sizeof(copy), post)) > 0)
+                        if (fwrite(copy, 1, n, fp) != n)
+                                ret = -1;
+
+                if (fclose(fp) != 0)
+                        ret = -1;
+                if (ret == 0)
+                        ret = rename(tmp_path, b->index_path);
+                else
+                        unlink(tmp_path);
+        }
+
+        fclose(post);
+        unlink(post_path);
+
+        free(docs);
+        free(terms);
+        free(term_strings);
+        free(doc_strings);
+
+        d(printf("merge_segments >>> %u documents, %u terms, %u bytes of postings\n",
+                 b->doc_count, term_count, postings_len));
+
+        return ret;
+}
+
+static int is_html(const char *path)
+{
+        const char *ext = strrchr(path, '.');
+
+        return ext && (strcasecmp(ext, ".htm") == 0 || strcasecmp(ext, ".html") == 0);
+}
+
+static int _collect_doc(struct chmFile *h, struct chmUnitInfo *ui, void *context)
+{
+        struct builder *b = (struct builder *)context;
+
+        if (ui->path[0] != '/' || !is_html(ui->path) || ui->length == 0)
+                return CHM_ENUMERATOR_CONTINUE;
+
+        if (b->doc_count == b->doc_cap) {
+                b->doc_cap = b->doc_cap ? b->doc_cap * 2 : 256;
+                b->docs = (struct build_doc *)realloc(b->docs, b->doc_cap * sizeof(struct build_doc));
+        }
+
+        b->docs[b->doc_count].start = ui->start;
+        b->docs[b->doc_count].size = ui->length;
+        b->docs[b->doc_count].space = ui->space;
+        b->docs[b->doc_count].path = strdup(ui->path + 1);
+        b->docs[b->doc_count].title = NULL;
+        b->docs[b->doc_count].length = 0;
+        b->doc_count++;
+
+        return CHM_ENUMERATOR_CONTINUE;
+}
+
+static int compare_doc_offset(const void *a, const void *b)
+{
+        const struct build_doc *da = (const struct build_doc *)a;
+        const struct build_doc *db = (const struct build_doc *)b;
+
+        if (da->space != db->space)
+                return da->space < db->space ? -1 : 1;
+        if (da->start != db->start)
+                return da->start < db->start ? -1 : 1;
+        return 0;
+}
+
+/*
+ * Index the HTML pages of the archive filename into index_path.  Returns
+ * 0 on success, -1 on error and EXTRACT_CANCELLED when options->cancel
+ * was set.
+ */
+int
+search_build(const char *filename, const char *index_path, u_int32_t lcid,
+             const struct search_options *options)
+{
+        struct builder b;
+        struct chmFile *h;
+        unsigned char *buffer = NULL;
+        size_t buffer_size = 0;
+        size_t memory_limit = (options && options->memory_limit) ? options->memory_limit : MEMORY_LIMIT;
+        char title[TITLE_MAX];
+        int s, ret = 0;
+        u_int32_t i;
+        u_int64_t begin = chm_stats_clock();
+
+        h = chm_stats_open(filename);
+        if (h == NULL) {
+                fprintf(stderr, "cannot open chmfile: %s\n", filename);
+                return -1;
+        }
+
+        memset(&b, 0, sizeof(b));
+        b.index_path = index_path;
+        b.dbcs = is_dbcs(lcid);
+
+        chm_enumerate(h, CHM_ENUMERATE_NORMAL | CHM_ENUMERATE_FILES, _collect_doc, &b);
+
+        /* read in archive order, pages sharing a compressed block come together */
+        qsort(b.docs, b.doc_count, sizeof(struct build_doc), compare_doc_offset);
+        table_grow(&b);
+
+        for (i = 0; i < b.doc_count; i++) {
+                struct build_doc *doc = b.docs + i;
+                struct chmUnitInfo ui;
+                size_t len;
+
+                if (options && options->cancel && *options->cancel) {
+                        ret = EXTRACT_CANCELLED;
+                        break;
+                }
+
+                if (doc->size + 1 > buffer_size) {
+                        buffer_size = doc->size + 1;
+                        buffer = (unsigned char *)realloc(buffer, buffer_size);
+                }
+
+                ui.start = doc->start;
+                ui.length = doc->size;
+                ui.space = doc->space;
+                ui.path[0] = '\0';
+
+                /* a page that cannot be read in full stays in the index without terms */
+                if (chm_retrieve_object(h, &ui, buffer, 0, doc->size) == (LONGINT64)doc->size) {
+                        len = html_text((char *)buffer, doc->size, title, sizeof(title));
+                        if (*title)
+                                doc->title = strdup(title);
+
+                        b.current = i;
+                        tokenize((char *)buffer, len, b.dbcs, add_term, &b);
+                        b.total_length += doc->length;
+                } else {
+                        fprintf(stderr, "incomplete page: %s\n", doc->path);
+                }
+
+                if (b.memory > memory_limit && write_segment(&b) == -1) {
+                        ret = -1;
+                        break;
+                }
+
+                if (options && options->progress)
+                        options->progress(i + 1, b.doc_count, options->progress_data);
+        }
+
+        chm_close(h);
+        free(buffer);
+
+        if (ret == 0 && (b.term_count || b.segments == 0))
+                ret = write_segment(&b);
+        if (ret == 0)
+                ret = merge_segments(&b);
+
+        if (ret != 0) {
+                char path[1024];
+
+                for (i = 0; i < b.table_size; i++) {
+                        if (b.table[i]) {
+                                free(b.table[i]->text);
+                                free(b.table[i]->postings);
+                                free(b.table[i]);
+                        }
+                }
+                for (s = 0; s < b.segments; s++) {
+                        segment_path(path, sizeof(path), index_path, s);
+                        unlink(path);
+                }
+        }
+
+        for (i = 0; i < b.doc_count; i++) {
+                free(b.docs[i].path);
+                free(b.docs[i].title);
+        }
+        free(b.docs);
+        free(b.table);
+
+        chm_trace_event("search_build", begin, chm_stats_clock(), filename);
+
+        d(printf("search_build >>> %s, return value = %d\n", index_path, ret));
+
+        return ret;
+}
+
+/* Querying */
+
+struct search_index *
+search_open(const char *path)
+{
+        struct search_index *index;
+        const struct search_header *header;
+        struct stat statbuf;
+        void *mapping;
+        int fd;
+
+        fd = open(path, O_RDONLY);
+        if (fd == -1)
+                return NULL;
+
+        if (fstat(fd, &statbuf) == -1 || (size_t)statbuf.st_size < sizeof(struct search_header)) {
+                close(fd);
+                return NULL;
+        }
+
+        mapping = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+                return NULL;
+
+        header = (const struct search_header *)mapping;
+        if (memcmp(header->magic, SEARCH_MAGIC, 4) != 0
+            || header->version != SEARCH_VERSION
+            || header->file_length != (u_int64_t)statbuf.st_size
+            || header->docs + (u_int64_t)header->doc_count * sizeof(struct search_doc) > header->doc_strings
+            || header->doc_strings > header->terms
+            || header->terms + (u_int64_t)header->term_count * sizeof(struct search_term) > header->term_strings
+            || header->term_strings > header->postings
+            || header->postings > header->file_length) {
+                d(printf("search_open >>> %s is missing or out of date\n", path));
+                munmap(mapping, statbuf.st_size);
+                return NULL;
+        }
+
+        index = (struct search_index *)calloc(1, sizeof(struct search_index));
+        index->mapping = mapping;
+        index->length = statbuf.st_size;
+        index->header = header;
+        index->docs = (const struct search_doc *)((const char *)mapping + header->docs);
+        index->doc_strings = (const char *)mapping + header->doc_strings;
+        index->terms = (const struct search_term *)((const char *)mapping + header->terms);
+        index->term_strings = (const char *)mapping + header->term_strings;
+        index->postings = (const unsigned char *)mapping + header->postings;
+
+        return index;
+}
+
+static const char *index_string(const char *arena, const char *arena_end, u_int32_t offset)
+{
+        const char *str = arena + offset;
+
+        if (str >= arena_end || !memchr(str, '\0', arena_end - str))
+                return "";
+
+        return str;
+}
+
+static const struct search_term *find_term(struct search_index *index, const char *text, size_t len)
+{
+        const char *strings_end = (const char *)index->mapping + index->header->postings;
+        u_int32_t lo = 0, hi = index->header->term_count;
+
+        while (lo < hi) {
+                u_int32_t mid = lo + (hi - lo) / 2;
+                const char *term = index_string(index->term_strings, strings_end, index->terms[mid].text);
+                int cmp = strncmp(term, text, len);
+
+                if (cmp == 0)
+                        cmp = term[len] ? 1 : 0;
+                if (cmp == 0)
+                        return index->terms + mid;
+                if (cmp < 0)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        return NULL;
+}
+
+struct query
+{
+        struct search_index *index;
+        const struct search_term *terms[QUERY_TERMS_MAX];
+        int count;
+        int missing;
+};
+
+static void add_query_term(const char *text, size_t len, void *data)
+{
+        struct query *q = (struct query *)data;
+        const struct search_term *term;
+        int i;
+
+        if (q->count == QUERY_TERMS_MAX)
+                return;
+
+        term = find_term(q->index, text, len);
+        if (!term) {
+                q->missing = 1;
+                return;
+        }
+
+        for (i = 0; i < q->count; i++)
+                if (q->terms[i] == term)
+                        return;
+
+        q->terms[q->count++] = term;
+}
+
+static int compare_term_df(const void *a, const void *b)
+{
+        const struct search_term *ta = *(const struct search_term **)a;
+        const struct search_term *tb = *(const struct search_term **)b;
+
+        return ta->df < tb->df ? -1 : ta->df > tb->df;
+}
+
+/*
+ * Rank the pages containing every term of text, which is in the book
+ * charset.  The best limit of them are put into results, best first.
+ * Returns the number of results.
+ */
+u_int32_t
+search_query(struct search_index *index, const char *text,
+             struct search_result *results, u_int32_t limit)
+{
+        const struct search_header *header = index->header;
+        const unsigned char *postings_end = (const unsigned char *)index->mapping + header->file_length;
+        struct query q;
+        float *scores;
+        unsigned char *hits;
+        double avg_length;
+        u_int32_t count = 0, i;
+        int t;
+
+        memset(&q, 0, sizeof(q));
+        q.index = index;
+        tokenize(text, strlen(text), header->flags & SEARCH_DBCS, add_query_term, &q);
+
+        if (q.missing || q.count == 0 || limit == 0 || header->doc_count == 0)
+                return 0;
+
+        /* rarest term first, later terms only score pages already hit */
+        qsort(q.terms, q.count, sizeof(q.terms[0]), compare_term_df);
+
+        scores = (float *)calloc(header->doc_count, sizeof(float));
+        hits = (unsigned char *)calloc(header->doc_count, 1);
+        avg_length = header->total_length ? (double)header->total_length / header->doc_count : 1.0;
+
+        for (t = 0; t < q.count; t++) {
+                const struct search_term *term = q.terms[t];
+                const unsigned char *p = index->postings + term->postings;
+                const unsigned char *end = p + term->postings_len;
+                double idf = log(1.0 + (header->doc_count - term->df + 0.5) / (term->df + 0.5));
+                u_int32_t doc = (u_int32_t)-1;
+
+                if (end > postings_end)
+                        break;
+
+                while (p && p < end) {
+                        u_int32_t delta, tf;
+
+                        p = varint_get(p, end, &delta);
+                        if (p)
+                                p = varint_get(p, end, &tf);
+                        if (!p)
+                                break;
+
+                        doc += delta;
+                        if (doc >= header->doc_count)
+                                break;
+                        if (hits[doc] != t)
+                                continue;
+
+                        hits[doc]++;
+                        scores[doc] += idf * tf * (BM25_K1 + 1)
+                                / (tf + BM25_K1 * (1 - BM25_B + BM25_B * index->docs[doc].length / avg_length));
+                }
+        }
+
+        /* keep the best limit, sorted by insertion */
+        for (i = 0; i < header->doc_count; i++) {
+                u_int32_t pos;
+
+                if (hits[i] != q.count)
+                        continue;
+                if (count == limit && scores[i] <= results[count - 1].score)
+                        continue;
+
+                pos = count < limit ? count++ : count - 1;
+                while (pos > 0 && results[pos - 1].score < scores[i]) {
+                        results[pos] = results[pos - 1];
+                        pos--;
+                }
+                results[pos].doc = i;
+                results[pos].score = scores[i];
+        }
+
+        free(scores);
+        free(hits);
+
+        return count;
+}
+
+const char *
+search_doc_path(struct search_index *index, u_int32_t doc)
+{
+        if (doc >= index->header->doc_count)
+                return "";
+
+        return index_string(index->doc_strings, (const char *)index->terms, index->docs[doc].path);
+}
+
+const char *
+search_doc_title(struct search_index *index, u_int32_t doc)
+{
+        if (doc >= index->header->doc_count)
+                return "";
+
+        return index_string(index->doc_strings, (const char *)index->terms, index->docs[doc].title);
+}
+
+void
+search_close(struct search_index *index)
+{
+        if (!index)
+                return;
+
+        munmap(index->mapping, index->length);
+        free(index);
+}
@@ -0,0 +1,65 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHMSEARCH_H__
+#define __CS_CHMSEARCH_H__
+
+#include <sys/types.h>
+
+#define SEARCH_INDEX_FILE "chmsee_search.bin"
+
+typedef void (*search_progress_func)(unsigned long docs,
+                                     unsigned long total_docs,
+                                     void *data);
+
+struct search_options
+{
+        search_progress_func progress;
+        void *progress_data;
+        volatile int *cancel;
+
+        /* postings kept in memory before a segment is written out */
+        size_t memory_limit;
+};
+
+struct search_result
+{
+        u_int32_t doc;
+        float score;
+};
+
+struct search_index;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int search_build(const char *, const char *, u_int32_t, const struct search_options *);
+
+struct search_index *search_open(const char *);
+u_int32_t search_query(struct search_index *, const char *, struct search_result *, u_int32_t);
+const char *search_doc_path(struct search_index *, u_int32_t);
+const char *search_doc_title(struct search_index *, u_int32_t);
+void search_close(struct search_index *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
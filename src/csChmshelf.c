@@ -0,0 +1,406 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Bookshelf garbage collection
+ *
+ * Every book has a folder in the bookshelf named by its fingerprint.
+ * Using a book touches its folder, so the folder mtime is the last access.
+ * SHELF_INDEX_FILE remembers the disk usage of each folder and when it was
+ * measured, only folders changed since are walked again.  When the total
+ * goes over the budget the least recently used folders are renamed out of
+ * the way under SHELF_LOCK_FILE, then removed without it.  The index is
+ * replaced by a rename, so it cannot be what is locked.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include "csChmfile.h"
+#include "csChmnav.h"
+#include "csChmmanifest.h"
+#include "csChmshelf.h"
+
+#define TRASH_SUFFIX ".trash"
+
+struct shelf_entry
+{
+        char *name;
+        unsigned long long size;
+        time_t measured;
+        time_t last;
+        int evict;
+};
+
+struct shelf
+{
+        struct shelf_entry *entries;
+        int count;
+        int capacity;
+};
+
+static struct shelf_entry *shelf_add(struct shelf *shelf, const char *name)
+{
+        struct shelf_entry *entry;
+
+        if (shelf->count == shelf->capacity) {
+                shelf->capacity = shelf->capacity ? shelf->capacity * 2 : 64;
+                shelf->entries = (struct shelf_entry *)realloc(shelf->entries,
+                                                               shelf->capacity * sizeof(struct shelf_entry));
+        }
+
+        entry = shelf->entries + shelf->count++;
+        memset(entry, 0, sizeof(*entry));
+        entry->name = strdup(name);
+
+        return entry;
+}
+
+static void shelf_clear(struct shelf *shelf)
+{
+        int i;
+
+        for (i = 0; i < shelf->count; i++)
+                free(shelf->entries[i].name);
+        free(shelf->entries);
+}
+
+static int compare_name(const void *a, const void *b)
+{
+        return strcmp(((const struct shelf_entry *)a)->name, ((const struct shelf_entry *)b)->name);
+}
+
+static int compare_last(const void *a, const void *b)
+{
+        const struct shelf_entry *x = (const struct shelf_entry *)a;
+        const struct shelf_entry *y = (const struct shelf_entry *)b;
+
+        return x->last < y->last ? -1 : x->last > y->last;
+}
+
+/* Index lines are "<name> <size> <measured> <last>" */
+static void read_index(FILE *file, struct shelf *shelf)
+{
+        char name[256];
+        unsigned long long size;
+        long long measured, last;
+
+        while (fscanf(file, "%255s %llu %lld %lld", name, &size, &measured, &last) == 4) {
+                struct shelf_entry *entry = shelf_add(shelf, name);
+
+                entry->size = size;
+                entry->measured = (time_t)measured;
+                entry->last = (time_t)last;
+        }
+
+        qsort(shelf->entries, shelf->count, sizeof(struct shelf_entry), compare_name);
+}
+
+static int write_index(const char *path, const struct shelf *shelf)
+{
+        char tmp[1024];
+        FILE *file;
+        int i;
+
+        if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+                return -1;
+
+        file = fopen(tmp, "w");
+        if (!file)
+                return -1;
+
+        for (i = 0; i < shelf->count; i++) {
+                const struct shelf_entry *entry = shelf->entries + i;
+
+                if (!entry->evict)
+                        fprintf(file, "%s %llu %lld %lld\n", entry->name, entry->size,
+                                (long long)entry->measured, (long long)entry->last);
+        }
+
+        if (fclose(file) != 0 || rename(tmp, path) == -1) {
+                unlink(tmp);
+                return -1;
+        }
+
+        return 0;
+}
+
+/* Disk usage of the tree at name in parent */
+static unsigned long long tree_size(int parent, const char *name)
+{
+        unsigned long long size = 0;
+        struct dirent *dent;
+        struct stat st;
+        DIR *dir;
+        int fd;
+
+        if (fstatat(parent, name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+                return 0;
+
+        size = (unsigned long long)st.st_blocks * 512;
+        if (!S_ISDIR(st.st_mode))
+                return size;
+
+        fd = openat(parent, name, O_RDONLY | O_DIRECTORY);
+        if (fd == -1 || (dir = fdopendir(fd)) == NULL) {
+                if (fd != -1)
+                        close(fd);
+                return size;
+        }
+
+        while ((dent = readdir(dir)) != NULL) {
+                if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+                        continue;
+                size += tree_size(fd, dent->d_name);
+        }
+
+        closedir(dir);
+        return size;
+}
+
+static void remove_tree(int parent, const char *name)
+{
+        struct dirent *dent;
+        DIR *dir;
+        int fd;
+
+        if (unlinkat(parent, name, 0) == 0)
+                return;
+
+        fd = openat(parent, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if (fd == -1 || (dir = fdopendir(fd)) == NULL) {
+                if (fd != -1)
+                        close(fd);
+                return;
+        }
+
+        while ((dent = readdir(dir)) != NULL) {
+                if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+                        continue;
+                remove_tree(fd, dent->d_name);
+        }
+
+        closedir(dir);
+
+        if (unlinkat(parent, name, AT_REMOVEDIR) == -1)
+                fprintf(stderr, "Cannot remove bookshelf folder: %s\n", name);
+}
+
+static int has_suffix(const char *name, const char *suffix)
+{
+        size_t len = strlen(name), suffix_len = strlen(suffix);
+
+        return len > suffix_len && strcmp(name + len - suffix_len, suffix) == 0;
+}
+
+/*
+ * Only folders chmsee made are collected, the ones holding a navigation
+ * cache or named by a fingerprint, anything else in the bookshelf
+ * directory is left alone.
+ */
+static int is_book_folder(int dirfd, const char *name)
+{
+        char path[512];
+        const char *p;
+
+        if (snprintf(path, sizeof(path), "%s/" NAV_CACHE_FILE, name) < (int)sizeof(path)
+            && faccessat(dirfd, path, F_OK, 0) == 0)
+                return 1;
+
+        for (p = name; *p; p++)
+                if (!isxdigit((unsigned char)*p))
+                        return 0;
+
+        return p - name >= 16;
+}
+
+static int is_kept(const char *name, const char * const *keep, int nkeep)
+{
+        int i;
+
+        for (i = 0; i < nkeep; i++) {
+                const char *slash = strrchr(keep[i], '/');
+
+                if (strcmp(slash ? slash + 1 : keep[i], name) == 0)
+                        return 1;
+        }
+
+        return 0;
+}
+
+/* Record folder as used now */
+int
+shelf_touch(const char *folder)
+{
+        return utimes(folder, NULL);
+}
+
+/*
+ * Bring the bookshelf under budget bytes, never evicting the folders in
+ * keep.  Returns 0, 1 when another process is collecting, -1 on error.
+ */
+int
+shelf_collect(const char *bookshelf, unsigned long long budget,
+              const char * const *keep, int nkeep, struct shelf_stats *stats)
+{
+        struct shelf index, current;
+        struct dirent *dent;
+        char path[1024];
+        FILE *file;
+        DIR *dir;
+        time_t now = time(NULL);
+        unsigned long long total = 0;
+        int fd, i;
+
+        memset(&index, 0, sizeof(index));
+        memset(&current, 0, sizeof(current));
+        if (stats)
+                memset(stats, 0, sizeof(*stats));
+
+        if (snprintf(path, sizeof(path), "%s/" SHELF_LOCK_FILE, bookshelf) >= (int)sizeof(path))
+                return -1;
+
+        fd = open(path, O_RDONLY | O_CREAT, 0666);
+        if (fd == -1)
+                return -1;
+
+        if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+                close(fd);
+                return 1;
+        }
+
+        dir = opendir(bookshelf);
+        if (!dir) {
+                close(fd);
+                return -1;
+        }
+
+        if (snprintf(path, sizeof(path), "%s/" SHELF_INDEX_FILE, bookshelf) < (int)sizeof(path)
+            && (file = fopen(path, "r")) != NULL) {
+                read_index(file, &index);
+                fclose(file);
+        }
+
+        while ((dent = readdir(dir)) != NULL) {
+                struct shelf_entry key, *old, *entry;
+                struct stat st;
+                time_t changed;
+
+                if (dent->d_name[0] == '.')
+                        continue;
+                if (fstatat(dirfd(dir), dent->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1
+                    || !S_ISDIR(st.st_mode))
+                        continue;
+
+                /* left over by a collection that was interrupted */
+                if (has_suffix(dent->d_name, TRASH_SUFFIX)) {
+                        remove_tree(dirfd(dir), dent->d_name);
+                        continue;
+                }
+
+                if (!is_book_folder(dirfd(dir), dent->d_name))
+                        continue;
+
+                entry = shelf_add(&current, dent->d_name);
+                entry->last = st.st_mtime;
+
+                /* a lazily extracted book grows through its manifest */
+                changed = st.st_mtime;
+                if (snprintf(path, sizeof(path), "%s/" MANIFEST_FILE, dent->d_name) < (int)sizeof(path)
+                    && fstatat(dirfd(dir), path, &st, 0) == 0 && st.st_mtime > changed)
+                        changed = st.st_mtime;
+
+                key.name = dent->d_name;
+                old = (struct shelf_entry *)bsearch(&key, index.entries, index.count,
+                                                    sizeof(struct shelf_entry), compare_name);
+                if (old && old->measured > changed) {
+                        entry->size = old->size;
+                        entry->measured = old->measured;
+                } else {
+                        entry->size = tree_size(dirfd(dir), dent->d_name);
+                        entry->measured = now;
+                        d(printf("shelf_collect >>> measured %s: %llu bytes\n", entry->name, entry->size));
+                }
+
+                total += entry->size;
+        }
+
+        if (stats) {
+                stats->books = current.count;
+                stats->bytes = total;
+        }
+
+        if (budget && total > budget) {
+                qsort(current.entries, current.count, sizeof(struct shelf_entry), compare_last);
+
+                for (i = 0; i < current.count && total > budget; i++) {
+                        struct shelf_entry *entry = current.entries + i;
+
+                        if (entry->last > now - SHELF_GRACE_SECONDS || is_kept(entry->name, keep, nkeep))
+                                continue;
+
+                        snprintf(path, sizeof(path), "%s" TRASH_SUFFIX, entry->name);
+                        if (renameat(dirfd(dir), entry->name, dirfd(dir), path) == -1)
+                                continue;
+
+                        entry->evict = 1;
+                        total -= entry->size;
+                        if (stats) {
+                                stats->evicted++;
+                                stats->evicted_bytes += entry->size;
+                        }
+                }
+        }
+
+        if (snprintf(path, sizeof(path), "%s/" SHELF_INDEX_FILE, bookshelf) >= (int)sizeof(path)
+            || write_index(path, &current) == -1)
+                fprintf(stderr, "Cannot write bookshelf index: %s\n", path);
+
+        /* the folders are out of the way, remove them without the lock */
+        flock(fd, LOCK_UN);
+        close(fd);
+
+        for (i = 0; i < current.count; i++) {
+                if (current.entries[i].evict) {
+                        snprintf(path, sizeof(path), "%s" TRASH_SUFFIX, current.entries[i].name);
+                        remove_tree(dirfd(dir), path);
+                }
+        }
+
+        d(printf("shelf_collect >>> %d books, %llu bytes, evicted %d\n",
+                 current.count, total, stats ? (int)stats->evicted : 0));
+
+        closedir(dir);
+        shelf_clear(&index);
+        shelf_clear(&current);
+
+        return 0;
+}
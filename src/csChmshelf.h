@@ -0,0 +1,49 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHMSHELF_H__
+#define __CS_CHMSHELF_H__
+
+#define SHELF_INDEX_FILE "chmsee_shelf"
+/* locked while collecting, never replaced unlike the index */
+#define SHELF_LOCK_FILE "chmsee_shelf.lock"
+
+/* books used this recently are never evicted, another process may have them open */
+#define SHELF_GRACE_SECONDS 3600
+
+struct shelf_stats
+{
+        unsigned long books;
+        unsigned long long bytes;
+        unsigned long evicted;
+        unsigned long long evicted_bytes;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int shelf_touch(const char *);
+int shelf_collect(const char *, unsigned long long, const char * const *, int, struct shelf_stats *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
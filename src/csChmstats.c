@@ -0,0 +1,273 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Counters and timers of the native layer
+ *
+ * The counters are process wide and always on: an update is one atomic
+ * add, a timer two reads of the monotonic clock around the work.  They
+ * are kept per phase or per object, never per byte.  Trace events, one
+ * per open, parse or extraction chunk, are only recorded once tracing is
+ * enabled through csIChm.tracing or CHM_TRACE_ENV, and are written in
+ * the Chrome trace event format that chrome://tracing and Perfetto load.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+
+#include <chm_lib.h>
+
+#include "csChmfile.h"
+#include "csChmstats.h"
+
+static const char *stat_names[CHM_STAT_COUNT] = {
+        "opens",
+        "open_ns",
+        "enumerate_ns",
+        "decompress_ns",
+        "write_ns",
+        "objects",
+        "bytes",
+        "kernel_bytes",
+        "mkdirs",
+        "stats",
+        "cache_hits",
+        "cache_misses",
+        "pool_hits",
+        "pool_misses",
+        "nav_hits",
+        "nav_misses",
+        "prefetch_objects",
+        "prefetch_bytes",
+        "arena_chunks",
+        "arena_bytes",
+        "intern_hits",
+};
+
+static u_int64_t stat_values[CHM_STAT_COUNT];
+
+struct trace_event
+{
+        const char *name;       /* static strings only */
+        char *detail;
+        u_int64_t begin;
+        u_int64_t end;
+        long tid;
+};
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_event *trace_events;
+static u_int32_t trace_count;
+static u_int32_t trace_capacity;
+static u_int64_t trace_dropped;
+
+/* -1 until the environment has been looked at */
+static volatile int trace_on = -1;
+
+u_int64_t
+chm_stats_clock(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+chm_stats_add(enum chm_stat stat, u_int64_t n)
+{
+        __sync_fetch_and_add(&stat_values[stat], n);
+}
+
+/* Copy of the CHM_STAT_COUNT counters */
+void
+chm_stats_get(u_int64_t *values)
+{
+        int i;
+
+        for (i = 0; i < CHM_STAT_COUNT; i++)
+                values[i] = __sync_fetch_and_add(&stat_values[i], 0);
+}
+
+/* The counters as a JSON object, to be freed */
+char *
+chm_stats_json(void)
+{
+        u_int64_t values[CHM_STAT_COUNT];
+        char *json = (char *)malloc(CHM_STAT_COUNT * 48 + 64);
+        int i, len = 0;
+
+        chm_stats_get(values);
+
+        len += sprintf(json + len, "{");
+        for (i = 0; i < CHM_STAT_COUNT; i++)
+                len += sprintf(json + len, "%s\"%s\": %llu", i ? ", " : "",
+                               stat_names[i], (unsigned long long)values[i]);
+        sprintf(json + len, "}");
+
+        return json;
+}
+
+/* chm_open, counted and traced */
+struct chmFile *
+chm_stats_open(const char *filename)
+{
+        u_int64_t begin = chm_stats_clock(), end;
+        struct chmFile *h = chm_open(filename);
+
+        end = chm_stats_clock();
+        chm_stats_add(CHM_STAT_OPENS, 1);
+        chm_stats_add(CHM_STAT_OPEN_NS, end - begin);
+        chm_trace_event("chm_open", begin, end, filename);
+
+        return h;
+}
+
+static void write_at_exit(void)
+{
+        const char *path = getenv(CHM_TRACE_ENV);
+
+        if (path && chm_trace_write(path) == -1)
+                fprintf(stderr, "Writing trace failed: %s\n", path);
+}
+
+int
+chm_trace_enabled(void)
+{
+        if (trace_on == -1) {
+                const char *path = getenv(CHM_TRACE_ENV);
+
+                pthread_mutex_lock(&trace_mutex);
+                if (trace_on == -1) {
+                        trace_on = path && path[0];
+                        if (trace_on)
+                                atexit(write_at_exit);
+                }
+                pthread_mutex_unlock(&trace_mutex);
+        }
+
+        return trace_on;
+}
+
+void
+chm_trace_enable(int on)
+{
+        chm_trace_enabled();
+        trace_on = on != 0;
+}
+
+/* Record a complete event of name from begin to end, detail may be NULL */
+void
+chm_trace_event(const char *name, u_int64_t begin, u_int64_t end, const char *detail)
+{
+        struct trace_event *event;
+
+        if (!chm_trace_enabled())
+                return;
+
+        pthread_mutex_lock(&trace_mutex);
+
+        if (trace_count == CHM_TRACE_MAX_EVENTS) {
+                trace_dropped++;
+                pthread_mutex_unlock(&trace_mutex);
+                return;
+        }
+
+        if (trace_count == trace_capacity) {
+                trace_capacity = trace_capacity ? trace_capacity * 2 : 1024;
+                trace_events = (struct trace_event *)realloc(trace_events, trace_capacity * sizeof(struct trace_event));
+        }
+
+        event = trace_events + trace_count++;
+        event->name = name;
+        event->detail = detail ? strdup(detail) : NULL;
+        event->begin = begin;
+        event->end = end;
+        event->tid = syscall(SYS_gettid);
+
+        pthread_mutex_unlock(&trace_mutex);
+}
+
+static void write_string(FILE *fp, const char *s)
+{
+        fputc('"', fp);
+        for (; *s; s++) {
+                if (*s == '"' || *s == '\\')
+                        fprintf(fp, "\\%c", *s);
+                else if ((unsigned char)*s < 0x20)
+                        fprintf(fp, "\\u%04x", *s);
+                else
+                        fputc(*s, fp);
+        }
+        fputc('"', fp);
+}
+
+/* Write the events recorded so far and the counters to path */
+int
+chm_trace_write(const char *path)
+{
+        FILE *fp;
+        char *stats;
+        u_int32_t i;
+        int pid = getpid(), ret;
+
+        fp = fopen(path, "w");
+        if (!fp)
+                return -1;
+
+        pthread_mutex_lock(&trace_mutex);
+
+        fprintf(fp, "{\"traceEvents\": [");
+        for (i = 0; i < trace_count; i++) {
+                struct trace_event *event = trace_events + i;
+
+                fprintf(fp, "%s\n{\"name\": \"%s\", \"cat\": \"chm\", \"ph\": \"X\", \"pid\": %d, \"tid\": %ld, "
+                        "\"ts\": %.3f, \"dur\": %.3f", i ? "," : "", event->name, pid, event->tid,
+                        event->begin / 1000.0, (event->end - event->begin) / 1000.0);
+                if (event->detail) {
+                        fprintf(fp, ", \"args\": {\"detail\": ");
+                        write_string(fp, event->detail);
+                        fputc('}', fp);
+                }
+                fputc('}', fp);
+        }
+
+        stats = chm_stats_json();
+        fprintf(fp, "\n], \"displayTimeUnit\": \"ms\", \"droppedEvents\": %llu, \"otherData\": %s}\n",
+                (unsigned long long)trace_dropped, stats);
+        free(stats);
+
+        pthread_mutex_unlock(&trace_mutex);
+
+        ret = ferror(fp) ? -1 : 0;
+        if (fclose(fp) != 0)
+                ret = -1;
+
+        d(printf("chm_trace_write >>> %u events to %s\n", trace_count, path));
+
+        return ret;
+}
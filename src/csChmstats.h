@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHMSTATS_H__
+#define __CS_CHMSTATS_H__
+
+#include <sys/types.h>
+
+/* trace events are written there at exit when this is set */
+#define CHM_TRACE_ENV "CHMSEE_TRACE"
+
+/* events kept at most, later ones are only counted */
+#define CHM_TRACE_MAX_EVENTS (1 << 20)
+
+enum chm_stat
+{
+        CHM_STAT_OPENS,                 /* chm_open calls */
+        CHM_STAT_OPEN_NS,
+        CHM_STAT_ENUMERATE_NS,
+        CHM_STAT_DECOMPRESS_NS,         /* retrieving objects to extract */
+        CHM_STAT_WRITE_NS,              /* writing them out */
+        CHM_STAT_OBJECTS,               /* objects and bytes extracted */
+        CHM_STAT_BYTES,
+        CHM_STAT_KERNEL_BYTES,          /* of them copied by the kernel */
+        CHM_STAT_MKDIRS,                /* mkdir and stat system calls */
+        CHM_STAT_STATS,
+        CHM_STAT_CACHE_HITS,            /* decompressed block cache */
+        CHM_STAT_CACHE_MISSES,
+        CHM_STAT_POOL_HITS,             /* handle pool */
+        CHM_STAT_POOL_MISSES,
+        CHM_STAT_NAV_HITS,              /* navigation cache */
+        CHM_STAT_NAV_MISSES,
+        CHM_STAT_PREFETCH_OBJECTS,      /* read ahead of the toc */
+        CHM_STAT_PREFETCH_BYTES,
+        CHM_STAT_ARENA_CHUNKS,          /* string arena mallocs and bytes */
+        CHM_STAT_ARENA_BYTES,
+        CHM_STAT_INTERN_HITS,           /* strings found already interned */
+        CHM_STAT_COUNT
+};
+
+struct chmFile;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+u_int64_t chm_stats_clock(void);
+void chm_stats_add(enum chm_stat, u_int64_t);
+void chm_stats_get(u_int64_t *);
+char *chm_stats_json(void);
+
+struct chmFile *chm_stats_open(const char *);
+
+void chm_trace_enable(int);
+int chm_trace_enabled(void);
+void chm_trace_event(const char *, u_int64_t, u_int64_t, const char *);
+int chm_trace_write(const char *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Tree of a sitemap
+ *
+ * Only the visible rows are kept, as entry numbers with their level.  The
+ * children of an entry are the entries up to the end of its subtree, the
+ * first entry after it that is not deeper, each child skipping over its
+ * own subtree.  A row is open when the row after it is deeper, so no state
+ * is kept per entry: a 30k entry toc costs its top level rows to show, and
+ * opening an entry walks its subtree once.
+ *
+ * Rows are given in range, csChmTreeView checks them.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "csChmtree.h"
+#include "csChmparser.h"
+
+#define ROWS_MIN 256
+
+/* The first entry after entry that is not deeper than it */
+static u_int32_t subtree_end(const struct sitemap *map, u_int32_t entry)
+{
+        u_int32_t depth = map->entries[entry].depth;
+        u_int32_t i;
+
+        for (i = entry + 1; i < map->count && map->entries[i].depth > depth; i++)
+                ;
+
+        return i;
+}
+
+/*
+ * Insert the children of entry, at level, before row; entry -1 stands for
+ * the top of the tree.  Returns how many, -1 when out of memory.
+ */
+static int32_t insert_children(struct tree_rows *tree, u_int32_t row, int32_t entry, u_int32_t level)
+{
+        const struct sitemap *map = tree->map;
+        u_int32_t start = entry + 1;
+        u_int32_t end = entry < 0 ? map->count : subtree_end(map, entry);
+        u_int32_t count = 0, child;
+
+        for (child = start; child < end; child = subtree_end(map, child))
+                count++;
+
+        if (tree->count + count > tree->capacity) {
+                u_int32_t capacity = tree->capacity ? tree->capacity : ROWS_MIN;
+                struct tree_row *rows;
+
+                while (tree->count + count > capacity)
+                        capacity *= 2;
+
+                rows = (struct tree_row *)realloc(tree->rows, capacity * sizeof(struct tree_row));
+                if (!rows)
+                        return -1;
+                tree->rows = rows;
+                tree->capacity = capacity;
+        }
+
+        memmove(tree->rows + row + count, tree->rows + row, (tree->count - row) * sizeof(struct tree_row));
+        for (child = start; child < end; child = subtree_end(map, child)) {
+                tree->rows[row].entry = child;
+                tree->rows[row].level = level;
+                row++;
+        }
+        tree->count += count;
+
+        return count;
+}
+
+/* Show the top level of map, -1 when out of memory */
+int
+tree_rows_init(struct tree_rows *tree, const struct sitemap *map)
+{
+        tree->map = map;
+        tree->rows = NULL;
+        tree->count = 0;
+        tree->capacity = 0;
+
+        return insert_children(tree, 0, -1, 0) == -1 ? -1 : 0;
+}
+
+void
+tree_rows_free(struct tree_rows *tree)
+{
+        free(tree->rows);
+        tree->rows = NULL;
+        tree->count = tree->capacity = 0;
+}
+
+int
+tree_rows_is_container(const struct tree_rows *tree, u_int32_t row)
+{
+        const struct sitemap *map = tree->map;
+        u_int32_t entry = tree->rows[row].entry;
+
+        return entry + 1 < map->count && map->entries[entry + 1].depth > map->entries[entry].depth;
+}
+
+int
+tree_rows_is_open(const struct tree_rows *tree, u_int32_t row)
+{
+        return row + 1 < tree->count && tree->rows[row + 1].level > tree->rows[row].level;
+}
+
+/* The row of the parent of row, -1 at the top level */
+int32_t
+tree_rows_parent(const struct tree_rows *tree, u_int32_t row)
+{
+        u_int32_t level = tree->rows[row].level;
+        int32_t i;
+
+        for (i = (int32_t)row - 1; i >= 0 && tree->rows[i].level >= level; i--)
+                ;
+
+        return i;
+}
+
+/* Whether a sibling of row follows after, the siblings of a visible row are visible too */
+int
+tree_rows_has_next_sibling(const struct tree_rows *tree, u_int32_t row, u_int32_t after)
+{
+        u_int32_t level = tree->rows[row].level;
+        u_int32_t i = (after > row ? after : row) + 1;
+
+        while (i < tree->count && tree->rows[i].level > level)
+                i++;
+
+        return i < tree->count && tree->rows[i].level == level;
+}
+
+/*
+ * Open or close row, changed is set to the rows inserted after it, or
+ * removed when negative.  -1 when out of memory.
+ */
+int
+tree_rows_toggle(struct tree_rows *tree, u_int32_t row, int32_t *changed)
+{
+        u_int32_t end;
+        int32_t inserted;
+
+        *changed = 0;
+        if (!tree_rows_is_container(tree, row))
+                return 0;
+
+        if (tree_rows_is_open(tree, row)) {
+                for (end = row + 1; end < tree->count && tree->rows[end].level > tree->rows[row].level; end++)
+                        ;
+
+                memmove(tree->rows + row + 1, tree->rows + end, (tree->count - end) * sizeof(struct tree_row));
+                *changed = -(int32_t)(end - row - 1);
+                tree->count -= end - row - 1;
+        } else {
+                inserted = insert_children(tree, row + 1, tree->rows[row].entry, tree->rows[row].level + 1);
+                if (inserted == -1)
+                        return -1;
+                *changed = inserted;
+        }
+
+        return 0;
+}
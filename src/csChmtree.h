@@ -0,0 +1,59 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __CS_CHMTREE_H__
+#define __CS_CHMTREE_H__
+
+#include <sys/types.h>
+
+struct sitemap;
+
+/* a visible row: the sitemap entry and how deep it is in the tree */
+struct tree_row
+{
+        u_int32_t entry;
+        u_int32_t level;
+};
+
+/* The visible rows of a sitemap shown as a tree, the top level at first */
+struct tree_rows
+{
+        const struct sitemap *map;
+        struct tree_row *rows;
+        u_int32_t count;
+        u_int32_t capacity;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int tree_rows_init(struct tree_rows *, const struct sitemap *);
+void tree_rows_free(struct tree_rows *);
+int tree_rows_is_container(const struct tree_rows *, u_int32_t);
+int tree_rows_is_open(const struct tree_rows *, u_int32_t);
+int32_t tree_rows_parent(const struct tree_rows *, u_int32_t);
+int tree_rows_has_next_sibling(const struct tree_rows *, u_int32_t, u_int32_t);
+int tree_rows_toggle(struct tree_rows *, u_int32_t, int32_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Lazily open a book into a folder that does not exist yet.
+ *
+ *   test/lazy-test book.chm workdir
+ *
+ * workdir/lazy-test/book is removed first, extract_chm_lazy() has to
+ * create it and its parent before it starts the manifest.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "csChmfile.h"
+#include "csChmarena.h"
+#include "csChmmanifest.h"
+#include "csChmpool.h"
+
+static int failures;
+
+#define CHECK(cond) do {                                                \
+                if (!(cond)) {                                          \
+                        fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+                        failures++;                                     \
+                }                                                       \
+        } while (0)
+
+static int exists(const char *folder, const char *path)
+{
+        char buffer[1024];
+        struct stat statbuf;
+
+        snprintf(buffer, sizeof(buffer), "%s/%s", folder, path[0] == '/' ? path + 1 : path);
+        return stat(buffer, &statbuf) == 0;
+}
+
+int main(int argc, char **argv)
+{
+        struct fileinfo info;
+        struct manifest *manifest;
+        const char *paths[4];
+        char parent[1000], folder[1024], command[1024];
+        int n = 0;
+
+        if (argc != 3) {
+                fprintf(stderr, "usage: %s book.chm workdir\n", argv[0]);
+                return 2;
+        }
+
+        if (snprintf(parent, sizeof(parent), "%s/lazy-test", argv[2]) >= (int)sizeof(parent))
+                return 2;
+
+        snprintf(folder, sizeof(folder), "%s/book", parent);
+        snprintf(command, sizeof(command), "rm -rf '%s'", parent);
+        if (system(command) != 0)
+                return 2;
+
+        memset(&info, 0, sizeof(info));
+        info.lcid = 0x0409;
+        info.chmfile = chm_pool_open(argv[1]);
+        if (!info.chmfile) {
+                fprintf(stderr, "cannot open %s\n", argv[1]);
+                return 2;
+        }
+
+        chm_fileinfo(&info);
+        CHECK(info.hhc != NULL);
+
+        if (info.homepage)
+                paths[n++] = info.homepage;
+        if (info.hhc)
+                paths[n++] = info.hhc;
+        if (info.hhk)
+                paths[n++] = info.hhk;
+        paths[n] = NULL;
+
+        CHECK(access(parent, F_OK) == -1);
+        CHECK(extract_chm_lazy(info.chmfile, folder, paths) == 0);
+        CHECK(exists(folder, MANIFEST_FILE));
+        CHECK(exists(folder, "#SYSTEM"));
+        if (info.hhc) {
+                CHECK(exists(folder, info.hhc));
+
+                manifest = manifest_open(folder, 0);
+                CHECK(manifest != NULL);
+                if (manifest) {
+                        CHECK(manifest_has(manifest, "/#SYSTEM"));
+                        manifest_close(manifest);
+                }
+        }
+
+        /* a second open finds everything in place */
+        CHECK(extract_chm_lazy(info.chmfile, folder, paths) == 0);
+
+        chm_pool_close(info.chmfile);
+        chm_arena_free(info.arena);
+
+        printf("lazy-test: %s\n", failures ? "FAIL" : "PASS");
+        return failures ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+/*
+ *  Copyright (C) 2011 Ji YongGang <jungleji@gmail.com>
+ *
+ *  ChmSee is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+
+ *  ChmSee is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+
+ *  You should have received a copy of the GNU General Public License
+ *  along with ChmSee; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Open and close rows of the tree behind csChmTreeView.
+ *
+ *   test/tree-test [rounds]
+ *
+ * Random sitemaps, depths jumping down by more than one level too, are
+ * toggled at random rows.  After each toggle the rows have to be what a
+ * walk of the open entries gives, and every row has to agree with it on
+ * being a container, being open, its parent and its next sibling.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "csChmparser.h"
+#include "csChmtree.h"
+
+static int failures;
+
+#define CHECK(cond) do {                                                \
+                if (!(cond)) {                                          \
+                        fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+                        failures++;                                     \
+                }                                                       \
+        } while (0)
+
+#define MAX_ENTRIES 64
+
+static u_int32_t depth(const struct sitemap *map, u_int32_t entry)
+{
+        return map->entries[entry].depth;
+}
+
+/* The parent of each entry is the last one before it that is less deep */
+static void find_parents(const struct sitemap *map, int32_t *parents)
+{
+        int32_t i, j;
+
+        for (i = 0; i < (int32_t)map->count; i++) {
+                for (j = i - 1; j >= 0 && depth(map, j) >= depth(map, i); j--)
+                        ;
+                parents[i] = j;
+        }
+}
+
+/* Append the rows of the children of entry, -1 for the top, to rows */
+static u_int32_t walk(const struct sitemap *map, const int32_t *parents, const char *opened,
+                      int32_t entry, u_int32_t level, struct tree_row *rows, u_int32_t count)
+{
+        u_int32_t i;
+
+        for (i = 0; i < map->count; i++) {
+                if (parents[i] != entry)
+                        continue;
+
+                rows[count].entry = i;
+                rows[count].level = level;
+                count++;
+                if (opened[i])
+                        count = walk(map, parents, opened, i, level + 1, rows, count);
+        }
+
+        return count;
+}
+
+static void check_rows(const struct tree_rows *tree, const char *opened)
+{
+        struct tree_row expected[MAX_ENTRIES];
+        int32_t parents[MAX_ENTRIES];
+        u_int32_t count;
+        u_int32_t row, i;
+
+        find_parents(tree->map, parents);
+        count = walk(tree->map, parents, opened, -1, 0, expected, 0);
+
+        CHECK(tree->count == count);
+        if (tree->count != count)
+                return;
+
+        for (row = 0; row < count; row++) {
+                u_int32_t entry = tree->rows[row].entry;
+                int32_t parent;
+                int sibling = 0;
+
+                CHECK(entry == expected[row].entry && tree->rows[row].level == expected[row].level);
+
+                CHECK(tree_rows_is_container(tree, row)
+                      == (entry + 1 < tree->map->count && depth(tree->map, entry + 1) > depth(tree->map, entry)));
+                CHECK(tree_rows_is_open(tree, row) == (opened[entry] && tree_rows_is_container(tree, row)));
+
+                for (parent = row - 1; parent >= 0 && expected[parent].level >= expected[row].level; parent--)
+                        ;
+                CHECK(tree_rows_parent(tree, row) == parent);
+
+                for (i = row + 1; i < count && expected[i].level >= expected[row].level; i++) {
+                        if (expected[i].level == expected[row].level) {
+                                sibling = 1;
+                                break;
+                        }
+                }
+                CHECK(tree_rows_has_next_sibling(tree, row, row) == sibling);
+        }
+}
+
+static void run(unsigned int seed)
+{
+        struct sitemap *map = sitemap_new();
+        struct tree_rows tree;
+        char opened[MAX_ENTRIES];
+        u_int32_t d = 0, i, n, round;
+
+        srand(seed);
+        n = 1 + rand() % (MAX_ENTRIES - 1);
+        for (i = 0; i < n; i++) {
+                sitemap_append(map, d, "name", "local.htm");
+                d = rand() % (d + 2);
+        }
+
+        memset(opened, 0, sizeof(opened));
+        CHECK(tree_rows_init(&tree, map) == 0);
+        check_rows(&tree, opened);
+
+        for (round = 0; round < 100 && !failures; round++) {
+                u_int32_t row = rand() % tree.count;
+                u_int32_t entry = tree.rows[row].entry;
+                u_int32_t before = tree.count;
+                int32_t changed;
+
+                CHECK(tree_rows_toggle(&tree, row, &changed) == 0);
+                CHECK(tree.count == before + changed);
+
+                if (tree_rows_is_container(&tree, row)) {
+                        /* closing forgets what was open below */
+                        if (opened[entry]) {
+                                u_int32_t j;
+                                for (j = entry + 1; j < map->count && depth(map, j) > depth(map, entry); j++)
+                                        opened[j] = 0;
+                        }
+                        opened[entry] = !opened[entry];
+                } else {
+                        CHECK(changed == 0);
+                }
+
+                check_rows(&tree, opened);
+        }
+
+        if (failures)
+                fprintf(stderr, "seed %u, %u entries\n", seed, n);
+
+        tree_rows_free(&tree);
+        sitemap_free(map);
+}
+
+int main(int argc, char **argv)
+{
+        unsigned int rounds = argc > 1 ? (unsigned int)atoi(argv[1]) : 1000;
+        unsigned int seed;
+
+        for (seed = 1; seed <= rounds && !failures; seed++)
+                run(seed);
+
+        printf("tree-test: %s\n", failures ? "FAIL" : "PASS");
+        return failures ? 1 : 0;
+}